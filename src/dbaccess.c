@@ -189,7 +189,19 @@ const char *schema_cmds[] = {
     "CompressedContentLength INTEGER,"
     "Crc32 INTEGER,"
     "ArchiveId INTEGER,"
-    "LastCollectionId INTEGER)",
+    "LastCollectionId INTEGER,"
+    "HashAlgorithm INTEGER DEFAULT 0,"
+    "Codec INTEGER DEFAULT 0,"
+    "BlockId INTEGER DEFAULT 0,"
+    "BlockOffset INTEGER DEFAULT 0,"
+    "ChunkCount INTEGER DEFAULT 0,"
+    "DeltaBaseId INTEGER DEFAULT 0,"
+    "DeltaDepth INTEGER DEFAULT 0)",
+    "CREATE TABLE TblChunkList ("
+    "ContentsId INTEGER,"
+    "ChunkIndex INTEGER,"
+    "ChunkContentsId INTEGER,"
+    "PRIMARY KEY (ContentsId, ChunkIndex))",
     "CREATE TABLE TblArchives ("
     "RowId INTEGER PRIMARY KEY AUTOINCREMENT,"
     "ArchiveId INTEGER,"
@@ -217,7 +229,7 @@ const char *schema_cmds[] = {
     "PropertyName TEXT PRIMARY KEY,"
     "PropertyVal)",
     "INSERT INTO TblProperties "
-    "VALUES ('SchemaVersion', 1)",
+    "VALUES ('SchemaVersion', 8)",
     "CREATE TABLE TblFilesList ("
     "FilesListId INTEGER PRIMARY KEY AUTOINCREMENT,"
 #ifdef __linux__
@@ -229,11 +241,17 @@ const char *schema_cmds[] = {
     "ContentsId INTEGER,"
     "LastWriteTime INTEGER,"
     "Status INTEGER,"
-    "Flags TEXT)",
+    "Flags TEXT,"
+    "Device INTEGER DEFAULT 0,"
+    "Inode INTEGER DEFAULT 0,"
+    "ModTimeNs INTEGER DEFAULT 0,"
+    "Sparse INTEGER DEFAULT 0)",
     "CREATE UNIQUE INDEX IxTblFilesListPath "
     "ON TblFilesList(Path)",
     "CREATE INDEX IxTblContentsListHash "
     "ON TblContentsList(ContentsHash1)",
+    "CREATE INDEX IxTblChunkListChunk "
+    "ON TblChunkList(ChunkContentsId)",
     "CREATE INDEX IxTblKnownVaultArchivesDescription "
     "ON TblKnownVaultArchives(CloudPath)",
 
@@ -510,8 +528,9 @@ check_result svdb_filesbypath(
     svdb_db *self, const bstring path, sv_file_row *out)
 {
     self->qrystrings[svdb_qid_filesbypath] =
-        "SELECT FilesListId, ContentLength, ContentsId, LastWriteTime, Status "
-        "FROM TblFilesList WHERE Path=? LIMIT 1";
+        "SELECT FilesListId, ContentLength, ContentsId, LastWriteTime, Status, "
+        "Device, Inode, ModTimeNs, Sparse FROM TblFilesList WHERE Path=? "
+        "LIMIT 1";
 
     sv_result currenterr = {};
     memset(out, 0, sizeof(*out));
@@ -527,6 +546,12 @@ check_result svdb_filesbypath(
         svdb_qry_get_uint64(&qry, self, 3, &out->contents_id);
         svdb_qry_get_uint64(&qry, self, 4, &out->last_write_time);
         svdb_qry_get_uint64(&qry, self, 5, &status);
+        svdb_qry_get_uint64(&qry, self, 6, &out->identity.device);
+        svdb_qry_get_uint64(&qry, self, 7, &out->identity.inode);
+        svdb_qry_get_uint64(&qry, self, 8, &out->identity.modtime_ns);
+        uint32_t sparse = 0;
+        svdb_qry_get_uint(&qry, self, 9, &sparse);
+        out->sparse = sparse != 0;
         out->e_status = sv_getstatus(status);
         out->most_recent_collection = sv_collectionidfromstatus(status);
     }
@@ -594,7 +619,9 @@ check_result svdb_contentsbyhash(svdb_db *self, const hash256 *hash,
 {
     self->qrystrings[svdb_qid_contentsbyhash] =
         "SELECT ContentsId, LastCollectionId, CompressedContentLength, "
-        "Crc32, ArchiveId FROM TblContentsList WHERE ContentsHash1=? "
+        "Crc32, ArchiveId, HashAlgorithm, Codec, BlockId, BlockOffset, "
+        "ChunkCount, DeltaBaseId, DeltaDepth FROM TblContentsList "
+        "WHERE ContentsHash1=? "
         "AND ContentsHash2=? AND ContentsHash3=? AND ContentsHash4=? "
         "AND ContentLength=? LIMIT 1";
 
@@ -616,6 +643,13 @@ check_result svdb_contentsbyhash(svdb_db *self, const hash256 *hash,
         svdb_qry_get_uint64(&qry, self, 3, &row->compressed_contents_length);
         svdb_qry_get_uint(&qry, self, 4, &row->crc32);
         svdb_qry_get_uint64(&qry, self, 5, &archiveid);
+        svdb_qry_get_uint(&qry, self, 6, &row->hashalgorithm);
+        svdb_qry_get_uint(&qry, self, 7, &row->codec);
+        svdb_qry_get_uint64(&qry, self, 8, &row->blockid);
+        svdb_qry_get_uint64(&qry, self, 9, &row->blockoffset);
+        svdb_qry_get_uint(&qry, self, 10, &row->chunkcount);
+        svdb_qry_get_uint64(&qry, self, 11, &row->deltabaseid);
+        svdb_qry_get_uint(&qry, self, 12, &row->deltadepth);
         row->original_collection = upper32(archiveid);
         row->archivenumber = lower32(archiveid);
         row->hash = *hash;
@@ -639,7 +673,9 @@ check_result svdb_contentsbyid(
     self->qrystrings[svdb_qid_contentsbyid] =
         "SELECT ContentsHash1, ContentsHash2, ContentsHash3, ContentsHash4, "
         "ContentLength, LastCollectionId, CompressedContentLength, Crc32, "
-        "ArchiveId FROM TblContentsList WHERE ContentsId=? LIMIT 1";
+        "ArchiveId, HashAlgorithm, Codec, BlockId, BlockOffset, ChunkCount, "
+        "DeltaBaseId, DeltaDepth FROM TblContentsList WHERE ContentsId=? "
+        "LIMIT 1";
 
     sv_result currenterr = {};
     int rc = 0;
@@ -660,6 +696,13 @@ check_result svdb_contentsbyid(
         svdb_qry_get_uint64(&qry, self, 7, &row->compressed_contents_length);
         svdb_qry_get_uint(&qry, self, 8, &row->crc32);
         svdb_qry_get_uint64(&qry, self, 9, &archiveid);
+        svdb_qry_get_uint(&qry, self, 10, &row->hashalgorithm);
+        svdb_qry_get_uint(&qry, self, 11, &row->codec);
+        svdb_qry_get_uint64(&qry, self, 12, &row->blockid);
+        svdb_qry_get_uint64(&qry, self, 13, &row->blockoffset);
+        svdb_qry_get_uint(&qry, self, 14, &row->chunkcount);
+        svdb_qry_get_uint64(&qry, self, 15, &row->deltabaseid);
+        svdb_qry_get_uint(&qry, self, 16, &row->deltadepth);
         row->original_collection = upper32(archiveid);
         row->archivenumber = lower32(archiveid);
         row->id = contentsid;
@@ -700,8 +743,9 @@ check_result svdb_contentsupdate(svdb_db *db, const sv_content_row *row)
     db->qrystrings[svdb_qid_contentsupdate] =
         "UPDATE TblContentsList SET ContentsHash1=?, ContentsHash2=?, "
         "ContentsHash3=?, ContentsHash4=?, ContentLength=?, "
-        "CompressedContentLength=?, Crc32=?, ArchiveId=?, LastCollectionId=? "
-        "WHERE ContentsId = ?";
+        "CompressedContentLength=?, Crc32=?, ArchiveId=?, LastCollectionId=?, "
+        "HashAlgorithm=?, Codec=?, BlockId=?, BlockOffset=?, ChunkCount=?, "
+        "DeltaBaseId=?, DeltaDepth=? WHERE ContentsId = ?";
 
     sv_result currenterr = {};
     svdb_qry qry = svdb_qry_open(svdb_qid_contentsupdate, db);
@@ -718,7 +762,14 @@ check_result svdb_contentsupdate(svdb_db *db, const sv_content_row *row)
             cast64u32u(row->archivenumber))));
 
     check(svdb_qry_bind_uint64(&qry, db, 9, row->most_recent_collection));
-    check(svdb_qry_bind_uint64(&qry, db, 10, row->id));
+    check(svdb_qry_bind_uint(&qry, db, 10, row->hashalgorithm));
+    check(svdb_qry_bind_uint(&qry, db, 11, row->codec));
+    check(svdb_qry_bind_uint64(&qry, db, 12, row->blockid));
+    check(svdb_qry_bind_uint64(&qry, db, 13, row->blockoffset));
+    check(svdb_qry_bind_uint(&qry, db, 14, row->chunkcount));
+    check(svdb_qry_bind_uint64(&qry, db, 15, row->deltabaseid));
+    check(svdb_qry_bind_uint(&qry, db, 16, row->deltadepth));
+    check(svdb_qry_bind_uint64(&qry, db, 17, row->id));
     check(svdb_qry_run(&qry, db, expectchanges, NULL));
     check(svdb_qry_disconnect(&qry, db));
 
@@ -762,8 +813,16 @@ cleanup:
 check_result svdb_contents_bulk_delete(
     svdb_db *self, const sv_array *arr, int batchsize)
 {
-    return svdb_bulk_delete_helper(self, arr,
-        "DELETE FROM TblContentsList WHERE ", "ContentsId", batchsize);
+    /* a chunked file's list of chunks goes with it. the chunks themselves
+    are contents rows that expire on their own. */
+    sv_result currenterr = {};
+    check(svdb_bulk_delete_helper(self, arr, "DELETE FROM TblChunkList WHERE ",
+        "ContentsId", batchsize));
+    check(svdb_bulk_delete_helper(self, arr,
+        "DELETE FROM TblContentsList WHERE ", "ContentsId", batchsize));
+
+cleanup:
+    return currenterr;
 }
 
 check_result svdb_contentsiter(
@@ -772,7 +831,9 @@ check_result svdb_contentsiter(
     self->qrystrings[svdb_qid_contentsiter] =
         "SELECT ContentsHash1, ContentsHash2, ContentsHash3, ContentsHash4, "
         "ContentLength, ContentsId, LastCollectionId, "
-        "CompressedContentLength, Crc32, ArchiveId FROM TblContentsList";
+        "CompressedContentLength, Crc32, ArchiveId, HashAlgorithm, Codec, "
+        "BlockId, BlockOffset, ChunkCount, DeltaBaseId, DeltaDepth "
+        "FROM TblContentsList";
 
     sv_result currenterr = {};
     int rc = 0;
@@ -792,6 +853,13 @@ check_result svdb_contentsiter(
         svdb_qry_get_uint64(&qry, self, 8, &row.compressed_contents_length);
         svdb_qry_get_uint(&qry, self, 9, &row.crc32);
         svdb_qry_get_uint64(&qry, self, 10, &archiveid);
+        svdb_qry_get_uint(&qry, self, 11, &row.hashalgorithm);
+        svdb_qry_get_uint(&qry, self, 12, &row.codec);
+        svdb_qry_get_uint64(&qry, self, 13, &row.blockid);
+        svdb_qry_get_uint64(&qry, self, 14, &row.blockoffset);
+        svdb_qry_get_uint(&qry, self, 15, &row.chunkcount);
+        svdb_qry_get_uint64(&qry, self, 16, &row.deltabaseid);
+        svdb_qry_get_uint(&qry, self, 17, &row.deltadepth);
         row.original_collection = upper32(archiveid);
         row.archivenumber = lower32(archiveid);
         if (row.id)
@@ -840,7 +908,8 @@ check_result svdb_filesupdate(
 {
     self->qrystrings[svdb_qid_filesupdate] =
         "UPDATE TblFilesList SET ContentLength=?, ContentsId=?, "
-        "LastWriteTime=?, Status=?, Flags=? WHERE FilesListId=?";
+        "LastWriteTime=?, Status=?, Flags=?, Device=?, Inode=?, ModTimeNs=?, "
+        "Sparse=? WHERE FilesListId=?";
 
     sv_result currenterr = {};
     svdb_qry qry = svdb_qry_open(svdb_qid_filesupdate, self);
@@ -861,7 +930,11 @@ check_result svdb_filesupdate(
         check(svdb_qry_bindstr(&qry, self, 5, "", 0, true));
     }
 
-    check(svdb_qry_bind_uint64(&qry, self, 6, row->id));
+    check(svdb_qry_bind_uint64(&qry, self, 6, row->identity.device));
+    check(svdb_qry_bind_uint64(&qry, self, 7, row->identity.inode));
+    check(svdb_qry_bind_uint64(&qry, self, 8, row->identity.modtime_ns));
+    check(svdb_qry_bind_uint(&qry, self, 9, row->sparse ? 1 : 0));
+    check(svdb_qry_bind_uint64(&qry, self, 10, row->id));
     check(svdb_qry_run(&qry, self, expectchanges, NULL));
     check(svdb_qry_disconnect(&qry, self));
 
@@ -875,7 +948,8 @@ check_result svdb_files_iter(
 {
     self->qrystrings[svdb_qid_fileslessthan] =
         "SELECT FilesListId, Path, ContentLength, ContentsId, LastWriteTime, "
-        "Flags, Status FROM TblFilesList WHERE Status < ?";
+        "Flags, Status, Device, Inode, ModTimeNs, Sparse FROM TblFilesList "
+        "WHERE Status < ?";
 
     sv_result currenterr = {};
     int rc = 0;
@@ -896,6 +970,12 @@ check_result svdb_files_iter(
         svdb_qry_get_str(&qry, self, 6, permissions);
         uint64_t statusgot = 0;
         svdb_qry_get_uint64(&qry, self, 7, &statusgot);
+        svdb_qry_get_uint64(&qry, self, 8, &row.identity.device);
+        svdb_qry_get_uint64(&qry, self, 9, &row.identity.inode);
+        svdb_qry_get_uint64(&qry, self, 10, &row.identity.modtime_ns);
+        uint32_t sparse = 0;
+        svdb_qry_get_uint(&qry, self, 11, &sparse);
+        row.sparse = sparse != 0;
         row.e_status = sv_getstatus(statusgot);
         row.most_recent_collection = sv_collectionidfromstatus(statusgot);
         if (row.id)
@@ -914,6 +994,275 @@ cleanup:
     return currenterr;
 }
 
+svdb_files_catalog svdb_files_catalog_open(void)
+{
+    svdb_files_catalog self = {};
+    self.entries = sv_array_open(sizeof32u(svdb_files_catalog_entry), 0);
+    self.paths = sv_array_open(1, 0);
+    self.slots = sv_array_open(sizeof32u(uint32_t), 0);
+    self.identityslots = sv_array_open(sizeof32u(uint32_t), 0);
+    return self;
+}
+
+static uint64_t svdb_files_catalog_hash(const char *path, uint32_t length)
+{
+    uint64_t hash1 = 0, hash2 = 0, hash3 = 0, hash4 = 0;
+    spooky_shorthash(path, length, &hash1, &hash2, &hash3, &hash4);
+    return hash1;
+}
+
+static uint64_t svdb_files_catalog_identityhash(
+    const os_file_identity *identity)
+{
+    uint64_t hash1 = 0, hash2 = 0, hash3 = 0, hash4 = 0;
+    spooky_shorthash(identity, sizeof32u(*identity), &hash1, &hash2, &hash3,
+        &hash4);
+    return hash1;
+}
+
+/* open addressing with linear probing. a slot holds an index into entries,
+plus one, so that zero means empty. */
+static void svdb_files_catalog_place(
+    sv_array *slotsarray, uint64_t hash, uint32_t index)
+{
+    uint32_t *slots = (uint32_t *)slotsarray->buffer;
+    uint64_t mask = slotsarray->length - 1;
+    uint64_t slot = hash & mask;
+    while (slots[slot])
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    slots[slot] = index + 1;
+}
+
+/* files with a known identity are also indexed by it. an entry whose
+identity changes keeps its old slot, which lookups skip, so the index is
+rebuilt once it fills up with those. */
+static void svdb_files_catalog_reindex(svdb_files_catalog *self)
+{
+    sv_array_truncatelength(&self->identityslots, 0);
+    sv_array_appendzeros(&self->identityslots, self->slots.length * 2);
+    self->identitiesplaced = 0;
+    for (uint32_t i = 0; i < self->entries.length; i++)
+    {
+        const svdb_files_catalog_entry *entry =
+            (const svdb_files_catalog_entry *)sv_array_atconst(
+                &self->entries, i);
+        if (entry->row.identity.inode)
+        {
+            svdb_files_catalog_place(&self->identityslots,
+                svdb_files_catalog_identityhash(&entry->row.identity), i);
+            self->identitiesplaced++;
+        }
+    }
+}
+
+static void svdb_files_catalog_placeidentity(
+    svdb_files_catalog *self, uint32_t index)
+{
+    if (self->identitiesplaced * 2 >= self->identityslots.length)
+    {
+        svdb_files_catalog_reindex(self);
+    }
+    else
+    {
+        const svdb_files_catalog_entry *entry =
+            (const svdb_files_catalog_entry *)sv_array_atconst(
+                &self->entries, index);
+        svdb_files_catalog_place(&self->identityslots,
+            svdb_files_catalog_identityhash(&entry->row.identity), index);
+        self->identitiesplaced++;
+    }
+}
+
+static void svdb_files_catalog_rehash(svdb_files_catalog *self)
+{
+    /* keep the table at most half full */
+    uint32_t newlength = 1024;
+    while (newlength < self->entries.length * 2)
+    {
+        newlength *= 2;
+    }
+
+    if (newlength > self->slots.length)
+    {
+        sv_array_truncatelength(&self->slots, 0);
+        sv_array_appendzeros(&self->slots, newlength);
+        for (uint32_t i = 0; i < self->entries.length; i++)
+        {
+            const svdb_files_catalog_entry *entry =
+                (const svdb_files_catalog_entry *)sv_array_atconst(
+                    &self->entries, i);
+            svdb_files_catalog_place(&self->slots, entry->pathhash, i);
+        }
+
+        svdb_files_catalog_reindex(self);
+    }
+}
+
+/* the permissions are kept after the path, followed by a zero */
+static void svdb_files_catalog_append(svdb_files_catalog *self,
+    const bstring path, const sv_file_row *row, const bstring permissions)
+{
+    svdb_files_catalog_entry entry = {};
+    entry.row = *row;
+    entry.pathlength = cast32s32u(blength(path));
+    entry.pathhash = svdb_files_catalog_hash(cstr(path), entry.pathlength);
+    entry.pathoffset = self->paths.length;
+    sv_array_append(&self->paths, path->data, entry.pathlength);
+    if (permissions)
+    {
+        sv_array_append(&self->paths, permissions->data,
+            cast32s32u(blength(permissions)));
+    }
+
+    sv_array_appendzeros(&self->paths, 1);
+    sv_array_append(&self->entries, &entry, 1);
+}
+
+static sv_result svdb_files_catalog_load_cb(void *context,
+    const sv_file_row *row, const bstring path, const bstring permissions)
+{
+    svdb_files_catalog *self = (svdb_files_catalog *)context;
+    svdb_files_catalog_append(self, path, row, permissions);
+    return OK;
+}
+
+check_result svdb_files_catalog_load(
+    svdb_db *self, svdb_files_catalog *catalog)
+{
+    sv_result currenterr = {};
+    sv_array_truncatelength(&catalog->entries, 0);
+    sv_array_truncatelength(&catalog->paths, 0);
+    sv_array_truncatelength(&catalog->slots, 0);
+    sv_array_truncatelength(&catalog->identityslots, 0);
+    check(svdb_files_iter(
+        self, svdb_all_files, catalog, &svdb_files_catalog_load_cb));
+    svdb_files_catalog_rehash(catalog);
+    catalog->loaded = true;
+
+cleanup:
+    return currenterr;
+}
+
+sv_file_row *svdb_files_catalog_find(
+    svdb_files_catalog *self, const bstring path)
+{
+    if (!self->slots.length)
+    {
+        return NULL;
+    }
+
+    uint32_t length = cast32s32u(blength(path));
+    uint64_t hash = svdb_files_catalog_hash(cstr(path), length);
+    const uint32_t *slots = (const uint32_t *)self->slots.buffer;
+    uint64_t mask = self->slots.length - 1;
+    for (uint64_t slot = hash & mask; slots[slot]; slot = (slot + 1) & mask)
+    {
+        svdb_files_catalog_entry *entry =
+            (svdb_files_catalog_entry *)sv_array_at(
+                &self->entries, slots[slot] - 1);
+        if (entry->pathhash == hash && entry->pathlength == length &&
+            memcmp(sv_array_atconst(&self->paths, entry->pathoffset),
+                path->data, length) == 0)
+        {
+            return &entry->row;
+        }
+    }
+
+    return NULL;
+}
+
+const char *svdb_files_catalog_permissions(
+    const svdb_files_catalog *self, const sv_file_row *row)
+{
+    /* row was returned by svdb_files_catalog_find */
+    const svdb_files_catalog_entry *entry =
+        (const svdb_files_catalog_entry *)row;
+    return (const char *)sv_array_atconst(
+        &self->paths, entry->pathoffset + entry->pathlength);
+}
+
+void svdb_files_catalog_add(
+    svdb_files_catalog *self, const bstring path, const sv_file_row *row)
+{
+    svdb_files_catalog_append(self, path, row, NULL);
+    svdb_files_catalog_entry *entry = (svdb_files_catalog_entry *)sv_array_at(
+        &self->entries, self->entries.length - 1);
+    if (self->entries.length * 2 > self->slots.length)
+    {
+        svdb_files_catalog_rehash(self);
+    }
+    else
+    {
+        svdb_files_catalog_place(
+            &self->slots, entry->pathhash, self->entries.length - 1);
+        if (entry->row.identity.inode)
+        {
+            svdb_files_catalog_placeidentity(self, self->entries.length - 1);
+        }
+    }
+}
+
+/* hard links share an identity, so several rows can match. a complete row
+is preferred, since its contents are known. */
+sv_file_row *svdb_files_catalog_findidentity(svdb_files_catalog *self,
+    const os_file_identity *identity, const sv_file_row *except)
+{
+    if (!self->identityslots.length || !identity->inode)
+    {
+        return NULL;
+    }
+
+    sv_file_row *found = NULL;
+    uint64_t hash = svdb_files_catalog_identityhash(identity);
+    const uint32_t *slots = (const uint32_t *)self->identityslots.buffer;
+    uint64_t mask = self->identityslots.length - 1;
+    for (uint64_t slot = hash & mask; slots[slot]; slot = (slot + 1) & mask)
+    {
+        svdb_files_catalog_entry *entry =
+            (svdb_files_catalog_entry *)sv_array_at(
+                &self->entries, slots[slot] - 1);
+        if (&entry->row != except &&
+            memcmp(&entry->row.identity, identity, sizeof(*identity)) == 0 &&
+            (!found || entry->row.e_status == sv_filerowstatus_complete))
+        {
+            found = &entry->row;
+        }
+    }
+
+    return found;
+}
+
+void svdb_files_catalog_update(
+    svdb_files_catalog *self, sv_file_row *cataloged, const sv_file_row *row)
+{
+    /* cataloged was returned by svdb_files_catalog_find */
+    svdb_files_catalog_entry *entry = (svdb_files_catalog_entry *)cataloged;
+    os_file_identity previous = cataloged->identity;
+    *cataloged = *row;
+    if (row->identity.inode && self->identityslots.length &&
+        memcmp(&previous, &row->identity, sizeof(previous)) != 0)
+    {
+        svdb_files_catalog_placeidentity(self,
+            cast64u32u((uint64_t)(entry -
+                (svdb_files_catalog_entry *)self->entries.buffer)));
+    }
+}
+
+void svdb_files_catalog_close(svdb_files_catalog *self)
+{
+    if (self)
+    {
+        sv_array_close(&self->entries);
+        sv_array_close(&self->paths);
+        sv_array_close(&self->slots);
+        sv_array_close(&self->identityslots);
+        set_self_zero();
+    }
+}
+
 check_result svdb_collectioninsert(
     svdb_db *self, uint64_t timestarted, uint64_t *rowid)
 {
@@ -962,7 +1311,8 @@ check_result svdb_contents_setlastreferenced(
     svdb_db *self, uint64_t contentsid, uint64_t collectionid)
 {
     self->qrystrings[svdb_qid_contents_setlastreferenced] =
-        "UPDATE TblContentsList SET LastCollectionId=? WHERE ContentsId=?";
+        "UPDATE TblContentsList SET LastCollectionId=MAX(LastCollectionId, ?) "
+        "WHERE ContentsId=?";
 
     sv_result currenterr = {};
     svdb_qry qry = svdb_qry_open(svdb_qid_contents_setlastreferenced, self);
@@ -978,12 +1328,226 @@ cleanup:
     return currenterr;
 }
 
+/* a backup doesn't touch the rows of files that haven't changed, so contents
+still in use by a file only have an old LastCollectionId. bring them up to
+date in one statement, before looking at which contents have expired. then
+give each delta's chain of bases, and after that each chunk, the newest
+LastCollectionId of the contents that are built from it. */
+check_result svdb_contents_setreferencedbyfiles(
+    svdb_db *self, uint64_t collectionid)
+{
+    self->qrystrings[svdb_qid_contents_setreferencedbyfiles] =
+        "UPDATE TblContentsList SET LastCollectionId=? "
+        "WHERE LastCollectionId < ? AND ContentsId IN "
+        "(SELECT ContentsId FROM TblFilesList)";
+    self->qrystrings[svdb_qid_contents_setreferencedbychunks] =
+        "UPDATE TblContentsList SET LastCollectionId=MAX(LastCollectionId, "
+        "(SELECT MAX(Parent.LastCollectionId) FROM TblChunkList "
+        "JOIN TblContentsList AS Parent "
+        "ON Parent.ContentsId=TblChunkList.ContentsId "
+        "WHERE TblChunkList.ChunkContentsId=TblContentsList.ContentsId)) "
+        "WHERE ContentsId IN (SELECT ChunkContentsId FROM TblChunkList)";
+    self->qrystrings[svdb_qid_contents_setreferencedbydeltas] =
+        "WITH RECURSIVE Chain(BaseId, LastId) AS ("
+        "SELECT DeltaBaseId, LastCollectionId FROM TblContentsList "
+        "WHERE DeltaBaseId != 0 UNION "
+        "SELECT Base.DeltaBaseId, Chain.LastId FROM TblContentsList AS Base "
+        "JOIN Chain ON Base.ContentsId=Chain.BaseId "
+        "WHERE Base.DeltaBaseId != 0) "
+        "UPDATE TblContentsList SET LastCollectionId=MAX(LastCollectionId, "
+        "(SELECT MAX(LastId) FROM Chain "
+        "WHERE Chain.BaseId=TblContentsList.ContentsId)) "
+        "WHERE ContentsId IN (SELECT BaseId FROM Chain)";
+
+    sv_result currenterr = {};
+    svdb_qry qry =
+        svdb_qry_open(svdb_qid_contents_setreferencedbyfiles, self);
+    svdb_qry qrydeltas =
+        svdb_qry_open(svdb_qid_contents_setreferencedbydeltas, self);
+    svdb_qry qrychunks =
+        svdb_qry_open(svdb_qid_contents_setreferencedbychunks, self);
+    check(svdb_qry_bind_uint64(&qry, self, 1, collectionid));
+    check(svdb_qry_bind_uint64(&qry, self, 2, collectionid));
+    check(svdb_qry_run(&qry, self, expectchangesunknown, NULL));
+    check(svdb_qry_disconnect(&qry, self));
+    check(svdb_qry_run(&qrydeltas, self, expectchangesunknown, NULL));
+    check(svdb_qry_disconnect(&qrydeltas, self));
+    check(svdb_qry_run(&qrychunks, self, expectchangesunknown, NULL));
+    check(svdb_qry_disconnect(&qrychunks, self));
+
+cleanup:
+    svdb_qry_close(&qry, self);
+    svdb_qry_close(&qrydeltas, self);
+    svdb_qry_close(&qrychunks, self);
+    return currenterr;
+}
+
+/* an interrupted backup has committed the rows of each archive it sealed.
+it may also have committed contents rows that were inserted but never filled
+in, which have no archive; remove those. then get the number of the last
+archive that the collection sealed, or 0 if there isn't one. */
+check_result svdb_contents_resume(
+    svdb_db *self, uint64_t collectionid, uint32_t *lastarchive)
+{
+    self->qrystrings[svdb_qid_contents_lastarchive] =
+        "SELECT MAX(ArchiveId) FROM TblContentsList "
+        "WHERE ArchiveId > ? AND ArchiveId < ?";
+
+    sv_result currenterr = {};
+    int rc = 0;
+    uint64_t archiveid = 0;
+    svdb_qry qry = svdb_qry_open(svdb_qid_contents_lastarchive, self);
+    check(svdb_runsql(self,
+        s_and_len("DELETE FROM TblChunkList WHERE ContentsId IN "
+                  "(SELECT ContentsId FROM TblContentsList WHERE ArchiveId=0)"),
+        expectchangesunknown));
+    check(svdb_runsql(self,
+        s_and_len("DELETE FROM TblContentsList WHERE ArchiveId=0"),
+        expectchangesunknown));
+    check(svdb_qry_bind_uint64(
+        &qry, self, 1, make_u64(cast64u32u(collectionid), 0)));
+    check(svdb_qry_bind_uint64(
+        &qry, self, 2, make_u64(cast64u32u(collectionid + 1), 0)));
+    check(svdb_qry_run(&qry, self, expectchangesunknown, &rc));
+    if (rc == SQLITE_ROW)
+    {
+        svdb_qry_get_uint64(&qry, self, 1, &archiveid);
+    }
+
+    *lastarchive = lower32(archiveid);
+    check(svdb_qry_disconnect(&qry, self));
+
+cleanup:
+    svdb_qry_close(&qry, self);
+    return currenterr;
+}
+
+check_result svdb_chunksinsert(svdb_db *self, uint64_t contentsid,
+    uint32_t chunkindex, uint64_t chunkcontentsid)
+{
+    self->qrystrings[svdb_qid_chunksinsert] =
+        "INSERT INTO TblChunkList (ContentsId, ChunkIndex, ChunkContentsId) "
+        "VALUES (?, ?, ?)";
+
+    sv_result currenterr = {};
+    svdb_qry qry = svdb_qry_open(svdb_qid_chunksinsert, self);
+    check_b(contentsid != 0 && chunkcontentsid != 0,
+        "contentsid should not be 0.");
+    check(svdb_qry_bind_uint64(&qry, self, 1, contentsid));
+    check(svdb_qry_bind_uint(&qry, self, 2, chunkindex));
+    check(svdb_qry_bind_uint64(&qry, self, 3, chunkcontentsid));
+    check(svdb_qry_run(&qry, self, expectchanges, NULL));
+    check(svdb_qry_disconnect(&qry, self));
+
+cleanup:
+    svdb_qry_close(&qry, self);
+    return currenterr;
+}
+
+check_result svdb_chunksget(
+    svdb_db *self, uint64_t contentsid, sv_array *chunkcontentsids)
+{
+    self->qrystrings[svdb_qid_chunksget] =
+        "SELECT ChunkContentsId FROM TblChunkList WHERE ContentsId=? "
+        "ORDER BY ChunkIndex";
+
+    sv_result currenterr = {};
+    int rc = 0;
+    svdb_qry qry = svdb_qry_open(svdb_qid_chunksget, self);
+    sv_array_truncatelength(chunkcontentsids, 0);
+    check(svdb_qry_bind_uint64(&qry, self, 1, contentsid));
+    check(svdb_qry_run(&qry, self, expectchangesunknown, &rc));
+    while (rc == SQLITE_ROW)
+    {
+        uint64_t chunkcontentsid = 0;
+        svdb_qry_get_uint64(&qry, self, 1, &chunkcontentsid);
+        sv_array_add64u(chunkcontentsids, chunkcontentsid);
+        check(svdb_qry_run(&qry, self, expectchangesunknown, &rc));
+    }
+
+    check(svdb_qry_disconnect(&qry, self));
+
+cleanup:
+    svdb_qry_close(&qry, self);
+    return currenterr;
+}
+
 check_result svdb_files_delete(svdb_db *db, const sv_array *arr, int batchsize)
 {
     return svdb_bulk_delete_helper(
         db, arr, "DELETE FROM TblFilesList WHERE ", "FilesListId", batchsize);
 }
 
+/* each entry upgrades from the version before it, unused slots are NULL.
+version 2 records which algorithm computed each contents hash; rows from
+version 1 were all hashed with spooky, which is algorithm 0. version 3 records
+which codec compressed each contents row; rows from before then were all xz,
+which is codec 0. version 4 records the solid block, if any, that holds each
+contents row; rows from before then were all archived individually.
+version 5 lists the chunks of files that were split into chunks; rows from
+before then were never split. version 6 records the base of contents stored
+as a delta; rows from before then were all stored in full. version 7 records
+the identity of each file, so that a file that was moved can be recognized;
+rows from before then have none until the next backup sees them. version 8
+records whether each file had holes, so that only those are restored sparse;
+rows from before then are restored dense until the next backup sees them. */
+const char *schema_migrate_cmds[][4] = {
+    {"ALTER TABLE TblContentsList ADD COLUMN HashAlgorithm INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=2 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblContentsList ADD COLUMN Codec INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=3 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblContentsList ADD COLUMN BlockId INTEGER DEFAULT 0",
+        "ALTER TABLE TblContentsList ADD COLUMN BlockOffset INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=4 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblContentsList ADD COLUMN ChunkCount INTEGER DEFAULT 0",
+        "CREATE TABLE TblChunkList (ContentsId INTEGER, ChunkIndex INTEGER, "
+        "ChunkContentsId INTEGER, PRIMARY KEY (ContentsId, ChunkIndex))",
+        "CREATE INDEX IxTblChunkListChunk ON TblChunkList(ChunkContentsId)",
+        "UPDATE TblProperties SET PropertyVal=5 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblContentsList ADD COLUMN DeltaBaseId INTEGER DEFAULT 0",
+        "ALTER TABLE TblContentsList ADD COLUMN DeltaDepth INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=6 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblFilesList ADD COLUMN Device INTEGER DEFAULT 0",
+        "ALTER TABLE TblFilesList ADD COLUMN Inode INTEGER DEFAULT 0",
+        "ALTER TABLE TblFilesList ADD COLUMN ModTimeNs INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=7 WHERE "
+        "PropertyName='SchemaVersion'"},
+    {"ALTER TABLE TblFilesList ADD COLUMN Sparse INTEGER DEFAULT 0",
+        "UPDATE TblProperties SET PropertyVal=8 WHERE "
+        "PropertyName='SchemaVersion'"},
+};
+
+check_result svdb_migrateschema(
+    svdb_db *self, const char *path, uint32_t fromversion)
+{
+    sv_result currenterr = {};
+    svdb_txn txn = {};
+    sv_log_fmt("migrating schema of %s from version %u", path, fromversion);
+    check(svdb_txn_open(&txn, self));
+    for (uint32_t i = fromversion - 1; i < countof32u(schema_migrate_cmds);
+         i++)
+    {
+        for (uint32_t j = 0; j < countof32u(schema_migrate_cmds[i]) &&
+             schema_migrate_cmds[i][j];
+             j++)
+        {
+            check(svdb_runsql(self, schema_migrate_cmds[i][j],
+                strlen32s(schema_migrate_cmds[i][j]), expectchangesunknown));
+        }
+    }
+
+    check(svdb_txn_commit(&txn, self));
+
+cleanup:
+    svdb_txn_close(&txn, self);
+    return currenterr;
+}
+
 check_result svdb_confirmschemaversion(svdb_db *self, const char *path)
 {
     uint32_t version = 0;
@@ -1004,7 +1568,13 @@ check_result svdb_confirmschemaversion(svdb_db *self, const char *path)
     }
 
     check(svdb_getint(self, s_and_len("SchemaVersion"), &version));
-    check_b(version == 1,
+    if (version >= 1 && version < 8)
+    {
+        check(svdb_migrateschema(self, path, version));
+        check(svdb_getint(self, s_and_len("SchemaVersion"), &version));
+    }
+
+    check_b(version == 8,
         "database %s could not be loaded, it might be "
         "from a future version. %d.",
         path, version);
@@ -1163,6 +1733,8 @@ check_result svdb_clear_database_content(svdb_db *self)
         self, s_and_len("DELETE FROM TblFilesList"), expectchangesunknown));
     check(svdb_runsql(
         self, s_and_len("DELETE FROM TblContentsList"), expectchangesunknown));
+    check(svdb_runsql(
+        self, s_and_len("DELETE FROM TblChunkList"), expectchangesunknown));
     check(svdb_runsql(
         self, s_and_len("DELETE FROM TblArchives"), expectchangesunknown));
     check(svdb_runsql(
@@ -1265,6 +1837,32 @@ void svdb_contents_row_string(const sv_content_row *row, bstring s)
         castull(row->compressed_contents_length),
         castull(row->most_recent_collection), row->original_collection,
         row->archivenumber, castull(row->id));
+    if (row->hashalgorithm)
+    {
+        bformata(s, ", hashalgorithm=%u", row->hashalgorithm);
+    }
+
+    if (row->codec)
+    {
+        bformata(s, ", codec=%u", row->codec);
+    }
+
+    if (row->blockid)
+    {
+        bformata(s, ", block=%llu+%llu", castull(row->blockid),
+            castull(row->blockoffset));
+    }
+
+    if (row->chunkcount)
+    {
+        bformata(s, ", chunks=%u", row->chunkcount);
+    }
+
+    if (row->deltabaseid)
+    {
+        bformata(s, ", delta=%llu/%u", castull(row->deltabaseid),
+            row->deltadepth);
+    }
 }
 
 check_result svdb_knownvaults_get(svdb_db *self, bstrlist *regions,
@@ -45,6 +45,12 @@ typedef enum svdb_qid
     svdb_qid_contentsiter,
     svdb_qid_contentscount,
     svdb_qid_contents_setlastreferenced,
+    svdb_qid_contents_setreferencedbyfiles,
+    svdb_qid_contents_setreferencedbychunks,
+    svdb_qid_contents_setreferencedbydeltas,
+    svdb_qid_contents_lastarchive,
+    svdb_qid_chunksinsert,
+    svdb_qid_chunksget,
     svdb_qid_vault_get,
     svdb_qid_vault_insert,
     svdb_qid_vaultarchives_bypath,
@@ -84,8 +90,30 @@ typedef struct sv_file_row
     uint64_t last_write_time;
     uint64_t most_recent_collection;
     sv_filerowstatus e_status;
+    os_file_identity identity;
+    bool sparse;
 } sv_file_row;
 
+/* every row of TblFilesList, read in one pass, so that a backup can look up
+the files it sees without running a query per file. */
+typedef struct svdb_files_catalog_entry
+{
+    sv_file_row row;
+    uint64_t pathhash;
+    uint32_t pathoffset;
+    uint32_t pathlength;
+} svdb_files_catalog_entry;
+
+typedef struct svdb_files_catalog
+{
+    sv_array entries;
+    sv_array paths;
+    sv_array slots;
+    sv_array identityslots;
+    uint32_t identitiesplaced;
+    bool loaded;
+} svdb_files_catalog;
+
 typedef struct sv_collection_row
 {
     uint64_t id;
@@ -106,6 +134,13 @@ typedef struct sv_content_row
     uint32_t archivenumber;
     hash256 hash;
     uint32_t crc32;
+    uint32_t hashalgorithm;
+    uint32_t codec;
+    uint64_t blockid;
+    uint64_t blockoffset;
+    uint32_t chunkcount;
+    uint64_t deltabaseid;
+    uint32_t deltadepth;
 } sv_content_row;
 
 /* Combine status and last-seen-collection id into one int.
@@ -177,6 +212,20 @@ check_result svdb_files_iter(
     svdb_db *self, uint64_t status, void *context, fn_iterate_rows callback);
 check_result svdb_files_delete(
     svdb_db *self, const sv_array *arr, int batchsize);
+svdb_files_catalog svdb_files_catalog_open(void);
+check_result svdb_files_catalog_load(
+    svdb_db *self, svdb_files_catalog *catalog);
+sv_file_row *svdb_files_catalog_find(
+    svdb_files_catalog *self, const bstring path);
+const char *svdb_files_catalog_permissions(
+    const svdb_files_catalog *self, const sv_file_row *row);
+void svdb_files_catalog_add(
+    svdb_files_catalog *self, const bstring path, const sv_file_row *row);
+sv_file_row *svdb_files_catalog_findidentity(svdb_files_catalog *self,
+    const os_file_identity *identity, const sv_file_row *except);
+void svdb_files_catalog_update(
+    svdb_files_catalog *self, sv_file_row *cataloged, const sv_file_row *row);
+void svdb_files_catalog_close(svdb_files_catalog *self);
 
 void svdb_collectiontostring(
     const sv_collection_row *row, bool verbose, bool every, bstring s);
@@ -198,6 +247,14 @@ check_result svdb_contentsiter(
 check_result svdb_contentscount(svdb_db *self, uint64_t *val);
 check_result svdb_contents_setlastreferenced(
     svdb_db *self, uint64_t contentsid, uint64_t collectionid);
+check_result svdb_contents_setreferencedbyfiles(
+    svdb_db *self, uint64_t collectionid);
+check_result svdb_contents_resume(
+    svdb_db *self, uint64_t collectionid, uint32_t *lastarchive);
+check_result svdb_chunksinsert(svdb_db *self, uint64_t contentsid,
+    uint32_t chunkindex, uint64_t chunkcontentsid);
+check_result svdb_chunksget(
+    svdb_db *self, uint64_t contentsid, sv_array *chunkcontentsids);
 check_result svdb_contentsbyid(
     svdb_db *self, uint64_t contentsid, sv_content_row *row);
 check_result svdb_contentsbyhash(svdb_db *self, const hash256 *hash,
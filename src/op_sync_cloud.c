@@ -636,6 +636,8 @@ check_result sv_sync_main(const sv_app *app, const sv_group *grp, svdb_db *db,
     sv_result currenterr = {};
     ar_manager ar = {};
     sv_sync_finddirtyfiles finder = {};
+    sv_perf perf = {};
+    sv_perf_open(&perf, "sync");
     bstring awscli = bstring_open();
     check(sv_sync_findcheckawscli(awscli));
     if (!blength(awscli))
@@ -675,6 +677,7 @@ check_result sv_sync_main(const sv_app *app, const sv_group *grp, svdb_db *db,
         (double)finder.totalsizedirty / (1024.0 * 1024.0));
     if (ask_user("Upload the files now?"))
     {
+        sv_perf_span span = sv_perf_begin();
         for (int i = 0; i < finder.sizes_and_files->qty; i++)
         {
             check(sv_sync_uploadone(db, cstr(awscli), i,
@@ -682,11 +685,17 @@ check_result sv_sync_main(const sv_app *app, const sv_group *grp, svdb_db *db,
                 cstr(finder.groupname), blist_view(finder.sizes_and_files, i),
                 vault, knownvaultid));
         }
+
+        sv_perf_end(&perf, sv_perf_upload, &span, finder.totalsizedirty, 0,
+            cast32s32u(finder.sizes_and_files->qty));
     }
 
     alert("Sync complete.");
 
 cleanup:
+    sv_perf_write(&perf, cstr(app->path_app_data), cstr(grp->grpname),
+        currenterr.code == 0);
+    sv_perf_close(&perf);
     ar_manager_close(&ar);
     sv_sync_finddirtyfiles_close(&finder);
     bdestroy(awscli);
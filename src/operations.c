@@ -64,48 +64,82 @@ check_result sv_backup(
 {
     sv_result currenterr = {};
     sv_backup_state op = {};
-    svdb_txn txn = {};
     bstring dbpath = bstring_open();
     uint64_t timestarted = (uint64_t)time(NULL);
+    uint32_t resume_after = 0;
 
     /* 1) initialize */
     op.app = app;
     op.grp = grp;
     op.test_context = test_context;
+    os_throttle_init(&op.throttle, grp->io_limit_bytes_per_second);
+    os_throttle_register_active(&op.throttle);
+    sv_perf_open(&op.perf, "backup");
+    if (grp->backup_window_minutes)
+    {
+        time_t now = time(NULL);
+        check(hook_get_time(test_context, &now));
+        op.deadline = now + (time_t)grp->backup_window_minutes * 60;
+    }
+
     op.messages = bstrlist_open();
     op.rows_to_delete = sv_array_open_u64();
     op.prev_percent_shown = UINT64_MAX;
     op.tmp_result = bstring_open();
+    op.enc = ar_encoder_open();
+    op.catalog = svdb_files_catalog_open();
+    op.exclusions = fnmatch_compiled_open(grp->exclusion_patterns);
+    op.chunkbuf = sv_array_open(sizeof32u(byte), 0);
+    sv_compress_classifier_init(&op.classifier);
     os_clr_console();
     sv_app_groupdbpathfromname(app, cstr(grp->grpname), dbpath);
     check(svdb_disconnect(db));
     check(svdb_connect(&op.db, cstr(dbpath)));
-    check(svdb_txn_open(&txn, &op.db));
-    check(svdb_collectioninsert(&op.db, timestarted, &op.collectionid));
+    check(svdb_txn_open(&op.txn, &op.db));
+    check(sv_backup_opencollection(&op, timestarted, &resume_after));
+    check(sv_backup_load_classifier(&op));
     check(ar_manager_open(&op.archiver, cstr(op.app->path_app_data),
         cstr(op.grp->grpname), cast64u32u(op.collectionid),
         op.grp->approx_archive_size_bytes));
-    check(checkbinarypaths(&op.archiver.ar, op.grp->separate_metadata,
-        cstr(op.archiver.path_working)));
+    op.archiver.resume_after = resume_after;
+    op.archiver.sealed_callback = &sv_backup_checkpoint;
+    op.archiver.sealed_context = &op;
+    op.archiver.codec = op.grp->codec;
+    op.archiver.codec_level = op.grp->codec_level;
+    op.archiver.solid_threshold = op.grp->solid_threshold_bytes;
+    check(checkbinarypaths(&op.archiver.ar));
 
     /* 2) add files to queue */
+    sv_perf_span span = sv_perf_begin();
     check(sv_backup_addtoqueue(&op));
     check(sv_backup_fromtextfile(
         &op, cstr(op.app->path_app_data), cstr(op.grp->grpname)));
+    sv_perf_end(&op.perf, sv_perf_enumerate, &span, 0, 0,
+        op.count.approx_items_in_queue);
     check(hook_call_before_process_queue(op.test_context, &op.db));
     check(sv_backup_show_user(&op, true));
 
     /* 3) process files in queue */
     check(ar_manager_begin(&op.archiver));
-    check(svdb_files_iter(&op.db,
-        sv_makestatus(op.collectionid, sv_filerowstatus_complete), &op,
-        sv_backup_processqueue_cb));
+    check(sv_backup_pool_start(&op));
+    span = sv_perf_begin();
+    check(sv_backup_processqueue(&op));
+    check(sv_backup_pool_drain(&op));
+    sv_perf_end(&op.perf, sv_perf_queue, &span, op.count.count_new_bytes, 0,
+        op.count.count_new_path);
+    sv_backup_pool_close(&op.pool);
+    svdb_files_catalog_close(&op.catalog);
     check(sv_backup_show_user(&op, false));
     check(svdb_files_delete(&op.db, &op.rows_to_delete, 0));
     check(sv_backup_recordcollectionstats(&op));
+    check(sv_backup_save_classifier(&op));
+    span = sv_perf_begin();
     check(ar_manager_finish(&op.archiver));
+    sv_perf_end(&op.perf, sv_perf_tar, &span, 0, 0, 0);
     check(sv_backup_record_data_checksums(&op));
-    check(svdb_txn_commit(&txn, &op.db));
+    span = sv_perf_begin();
+    check(svdb_txn_commit(&op.txn, &op.db));
+    sv_perf_end(&op.perf, sv_perf_db_commit, &span, 0, 0, 0);
     check(svdb_disconnect(&op.db));
     check(sv_backup_makecopyofdb(&op, grp, cstr(app->path_app_data)));
 
@@ -113,7 +147,9 @@ check_result sv_backup(
     check(sv_backup_show_results(&op));
 
 cleanup:
-    svdb_txn_close(&txn, &op.db);
+    sv_perf_write(&op.perf, cstr(app->path_app_data), cstr(grp->grpname),
+        currenterr.code == 0);
+    svdb_txn_close(&op.txn, &op.db);
     svdb_close(&op.db);
     sv_backup_state_close(&op);
     bdestroy(dbpath);
@@ -128,6 +164,8 @@ check_result sv_restore(
     /* 1) initialize */
     sv_restore_state op = {};
     svdb_txn txn = {};
+    sv_perf perf = {};
+    sv_perf_open(&perf, "restore");
     op.working_dir_archived = bstrcpy(app->path_temp_archived);
     op.working_dir_unarchived = bstrcpy(app->path_temp_unarchived);
     op.separate_metadata = grp->separate_metadata;
@@ -144,7 +182,10 @@ check_result sv_restore(
     if (!op.user_canceled)
     {
         /* 3) run restore */
+        sv_perf_span span = sv_perf_begin();
         check(svdb_files_iter(op.db, svdb_all_files, &op, &sv_restore_cb));
+        sv_perf_end(&perf, sv_perf_extract, &span, 0, op.countbytescomplete,
+            op.countfilescomplete);
         sv_restore_show_messages(latestversion, grp, &op);
         check(svdb_txn_rollback(&txn, op.db));
         check(svdb_disconnect(op.db));
@@ -154,6 +195,13 @@ check_result sv_restore(
     }
 
 cleanup:
+    if (!op.user_canceled)
+    {
+        sv_perf_write(&perf, cstr(app->path_app_data), cstr(grp->grpname),
+            currenterr.code == 0);
+    }
+
+    sv_perf_close(&perf);
     svdb_txn_close(&txn, op.db);
     sv_restore_state_close(&op);
     return currenterr;
@@ -166,6 +214,8 @@ check_result sv_compact(const sv_app *app, const sv_group *grp, svdb_db *db)
     /* 1) initialize */
     svdb_txn txn = {};
     sv_compact_state op = {};
+    sv_perf perf = {};
+    sv_perf_open(&perf, "compact");
     op.working_dir_archived = bstrcpy(app->path_temp_archived);
     op.working_dir_unarchived = bstrcpy(app->path_temp_unarchived);
     op.archive_stats = sv_2darray_open(sizeof32u(sv_archive_stats));
@@ -178,23 +228,114 @@ check_result sv_compact(const sv_app *app, const sv_group *grp, svdb_db *db)
     if (op.expiration_cutoff && !op.user_canceled)
     {
         /* 3) if "thorough" mode enabled, look in each .tar for old data. */
+        uint64_t latestcollection = 0;
+        sv_perf_span span = sv_perf_begin();
+        check(svdb_collectiongetlast(db, &latestcollection));
+        check(svdb_contents_setreferencedbyfiles(db, latestcollection));
         check(svdb_contentsiter(db, &op, &sv_compact_getarchivestats));
         sv_compact_see_what_to_remove(&op, grp->compact_threshold_bytes);
+        sv_perf_end(&perf, sv_perf_enumerate, &span, 0, 0, 0);
         sv_compact_archivestats_to_string(&op, false, msg);
         sv_log_write(cstr(msg));
+        span = sv_perf_begin();
         check(svdb_txn_commit(&txn, db));
+        sv_perf_end(&perf, sv_perf_db_commit, &span, 0, 0, 0);
 
         /* 4) run compaction */
+        span = sv_perf_begin();
         check(sv_compact_impl(grp, app, db, &op));
+        sv_perf_end(&perf, sv_perf_tar, &span, 0, 0,
+            op.archives_to_remove.length + op.archives_to_strip.length);
     }
 
 cleanup:
+    if (!op.user_canceled)
+    {
+        sv_perf_write(&perf, cstr(app->path_app_data), cstr(grp->grpname),
+            currenterr.code == 0);
+    }
+
+    sv_perf_close(&perf);
     bdestroy(msg);
     svdb_txn_close(&txn, db);
     sv_compact_state_close(&op);
     return currenterr;
 }
 
+/* the collection only gets its completion time at the very end, so if the
+latest one doesn't have it, a backup was interrupted or its backup window
+closed. carry on with it: the archives it sealed were committed along with
+their rows, so their files are seen as unchanged and aren't read again. */
+check_result sv_backup_opencollection(
+    sv_backup_state *op, uint64_t timestarted, uint32_t *resume_after)
+{
+    sv_result currenterr = {};
+    sv_array rows = sv_array_open(sizeof32u(sv_collection_row), 0);
+    *resume_after = 0;
+    check(svdb_collectionsget(&op->db, &rows, false));
+    const sv_collection_row *latest = rows.length
+        ? (const sv_collection_row *)sv_array_at(&rows, 0)
+        : NULL;
+    if (latest && !latest->time_finished)
+    {
+        op->collectionid = latest->id;
+        check(svdb_contents_resume(&op->db, op->collectionid, resume_after));
+        sv_log_fmt("resuming collection %llu after archive %u",
+            castull(op->collectionid), *resume_after);
+        if (!op->test_context)
+        {
+            printf("Resuming the backup that was interrupted or ran out of "
+                   "time.\n");
+        }
+    }
+    else
+    {
+        check(svdb_collectioninsert(&op->db, timestarted, &op->collectionid));
+    }
+
+cleanup:
+    sv_array_close(&rows);
+    return currenterr;
+}
+
+/* each archive is committed as soon as it's sealed, so that an interrupted
+backup loses at most the archive it was writing. the rows that point into
+the next archive are only committed once it's sealed in turn. */
+check_result sv_backup_checkpoint(void *context, uint32_t archivenumber)
+{
+    sv_result currenterr = {};
+    sv_backup_state *op = (sv_backup_state *)context;
+    sv_log_fmt("checkpoint collection %llu archive %u",
+        castull(op->collectionid), archivenumber);
+    sv_perf_span span = sv_perf_begin();
+    check(svdb_txn_commit(&op->txn, &op->db));
+    sv_perf_end(&op->perf, sv_perf_db_commit, &span, 0, 0, 0);
+    check(svdb_txn_open(&op->txn, &op->db));
+    check(hook_call_after_checkpoint(op->test_context, archivenumber));
+
+cleanup:
+    return currenterr;
+}
+
+/* don't list directories where every file would be excluded anyway */
+static bool sv_backup_addtoqueue_skipdir(void *context, const bstring dirpath)
+{
+    sv_backup_state *op = (sv_backup_state *)context;
+    return fnmatch_compiled_anyunder(&op->exclusions, cstr(dirpath));
+}
+
+/* the contents of a file seen at another path under the same identity, e.g.
+a hard link, or a file that was moved. */
+static uint64_t sv_backup_samecontents(
+    const sv_file_row *same, uint64_t contents_length, uint64_t last_write_time)
+{
+    return same && same->e_status == sv_filerowstatus_complete &&
+            same->contents_length == contents_length &&
+            same->last_write_time == last_write_time
+        ? same->contents_id
+        : 0;
+}
+
 check_result sv_backup_addtoqueue_cb(void *context, const bstring path,
     uint64_t actual_lmt, uint64_t actual_size, const bstring perms)
 {
@@ -202,50 +343,144 @@ check_result sv_backup_addtoqueue_cb(void *context, const bstring path,
     sv_file_row row = {0};
     sv_backup_state *op = (sv_backup_state *)context;
     uint64_t size = actual_size;
+    uint64_t samecontentsid = 0;
+    const sv_file_row *same = NULL;
+    os_file_identity identity = op->scanidentity;
+    memset(&op->scanidentity, 0, sizeof(op->scanidentity));
     show_status_update_queue(op);
 
     check_b(path, "invalid path");
     if (os_recurse_is_dir(actual_lmt, size) ||
-        !sv_grp_isincluded(op->grp, cstr(path), op->messages))
+        fnmatch_compiled_any(&op->exclusions, cstr(path)))
     {
         /* case 1: it's a directory, or it's excluded by user */
         goto cleanup;
     }
 
-    check(svdb_filesbypath(&op->db, path, &row));
+    sv_file_row *cataloged = NULL;
+    if (op->catalog.loaded)
+    {
+        cataloged = svdb_files_catalog_find(&op->catalog, path);
+        row = cataloged ? *cataloged : row;
+    }
+    else
+    {
+        check(svdb_filesbypath(&op->db, path, &row));
+    }
+
     adjustfilesize_if_audio_file(op->grp->separate_metadata,
         get_file_extension_info(cstr(path), blength(path)), size, &size);
+    if (op->catalog.loaded)
+    {
+        same =
+            svdb_files_catalog_findidentity(&op->catalog, &identity, cataloged);
+        samecontentsid = sv_backup_samecontents(same, size, actual_lmt);
+    }
 
     if (row.id != 0 && row.contents_length == size &&
         row.last_write_time == actual_lmt &&
-        row.most_recent_collection == op->collectionid - 1 &&
+        row.e_status == sv_filerowstatus_complete && cataloged)
+    {
+        /* case 2: the file hasn't been changed. only mark it as seen in
+        memory, the row keeps the collection in which it last changed. */
+        sv_log_fmt("queue-same %s %llx", cstr(path), castull(row.id));
+        bool updaterow = false;
+        if (!s_equal(svdb_files_catalog_permissions(&op->catalog, cataloged),
+                perms ? cstr(perms) : ""))
+        {
+            row.most_recent_collection = op->collectionid;
+            updaterow = true;
+        }
+
+        if (identity.inode &&
+            memcmp(&identity, &row.identity, sizeof(identity)) != 0)
+        {
+            /* record it, so that the file is recognized if it moves */
+            row.identity = identity;
+            updaterow = true;
+        }
+
+        if (updaterow)
+        {
+            check(svdb_filesupdate(&op->db, &row, perms));
+        }
+
+        row.most_recent_collection = op->collectionid;
+        svdb_files_catalog_update(&op->catalog, cataloged, &row);
+    }
+    else if (row.id != 0 && row.contents_length == size &&
+        row.last_write_time == actual_lmt &&
         row.e_status == sv_filerowstatus_complete)
     {
         /* case 2: the file hasn't been changed. */
         sv_log_fmt("queue-same %s %llx", cstr(path), castull(row.id));
         row.most_recent_collection = op->collectionid;
-        row.e_status = sv_filerowstatus_complete;
+        row.identity = identity.inode ? identity : row.identity;
         check(svdb_filesupdate(&op->db, &row, perms));
         check(svdb_contents_setlastreferenced(
             &op->db, row.contents_id, op->collectionid));
     }
+    else if (samecontentsid)
+    {
+        /* case 3: the file was seen at another path, it was moved or is a
+        hard link. use the contents stored for it without reading it. */
+        sv_log_fmt("queue-moved %s %llx", cstr(path), castull(samecontentsid));
+        if (row.id == 0)
+        {
+            check(svdb_filesinsert(&op->db, path, op->collectionid,
+                sv_filerowstatus_complete, &row.id));
+        }
+
+        row.contents_length = size;
+        row.contents_id = samecontentsid;
+        row.last_write_time = actual_lmt;
+        row.most_recent_collection = op->collectionid;
+        row.e_status = sv_filerowstatus_complete;
+        row.identity = identity;
+        row.sparse = same->sparse;
+        check(svdb_filesupdate(&op->db, &row, perms));
+        check(svdb_contents_setlastreferenced(
+            &op->db, samecontentsid, op->collectionid));
+        if (cataloged)
+        {
+            svdb_files_catalog_update(&op->catalog, cataloged, &row);
+        }
+        else
+        {
+            svdb_files_catalog_add(&op->catalog, path, &row);
+        }
+    }
     else if (row.id != 0)
     {
-        /* case 3: the file has been changed, add to queue. a file is added
+        /* case 4: the file has been changed, add to queue. a file is added
         to the queue by setting a flag on a row in the fileslist table. */
         sv_log_fmt("queue-changed %s %llx", cstr(path), castull(row.id));
         op->count.approx_items_in_queue += 1;
         row.most_recent_collection = op->collectionid;
         row.e_status = sv_filerowstatus_queued;
+
+        /* a queued row gets its identity once its job is submitted, see
+        sv_backup_job_findsame */
+        memset(&row.identity, 0, sizeof(row.identity));
         check(svdb_filesupdate(&op->db, &row, perms));
+        if (cataloged)
+        {
+            svdb_files_catalog_update(&op->catalog, cataloged, &row);
+        }
     }
     else
     {
-        /* case 4: it's a new file, add to queue. */
+        /* case 5: it's a new file, add to queue. */
         sv_log_writes("queue-new", cstr(path));
         op->count.approx_items_in_queue += 1;
         check(svdb_filesinsert(&op->db, path, row.most_recent_collection,
-            sv_filerowstatus_queued, NULL));
+            sv_filerowstatus_queued, &row.id));
+        if (op->catalog.loaded)
+        {
+            /* the path might be seen again, e.g. in the manual file list */
+            row.e_status = sv_filerowstatus_queued;
+            svdb_files_catalog_add(&op->catalog, path, &row);
+        }
     }
 
 cleanup:
@@ -256,6 +491,7 @@ check_result sv_backup_addtoqueue(sv_backup_state *op)
 {
     sv_result currenterr = {};
     bstring tmp = bstring_open();
+    sv_array roots = sv_array_open(sizeof32u(os_recurse_params), 0);
     if (!op->test_context && op->grp->root_directories->qty == 0)
     {
         alert("\nThere are currently no directories to "
@@ -264,8 +500,15 @@ check_result sv_backup_addtoqueue(sv_backup_state *op)
         goto cleanup;
     }
 
+    /* read the whole files table once, rather than query it per file */
+    check(svdb_files_catalog_load(&op->db, &op->catalog));
+    sv_log_fmt("sv_backup_addtoqueue collection=%llu, %u known files",
+        op->collectionid, op->catalog.entries.length);
     check(hook_provide_file_list(op->test_context, op));
-    sv_log_fmt("sv_backup_addtoqueue collection=%llu", op->collectionid);
+
+    /* every root is walked at the same time, but the callback still sees
+    each root in turn, in a stable order. */
+    uint32_t threads = sv_backup_pool_threadcount(op->grp);
     for (int i = 0; i < op->grp->root_directories->qty; i++)
     {
         const char *dir = blist_view(op->grp->root_directories, i);
@@ -273,9 +516,10 @@ check_result sv_backup_addtoqueue(sv_backup_state *op)
         {
             sv_log_writes("sv_backup_addtoqueue", dir);
             printf("Searching %s...\n", dir);
-            os_recurse_params params = {
-                op, dir, &sv_backup_addtoqueue_cb, PATH_MAX, op->messages};
-            check(os_recurse(&params));
+            os_recurse_params params = {op, dir, &sv_backup_addtoqueue_cb,
+                PATH_MAX, op->messages, threads > 1 ? threads : 0,
+                &sv_backup_addtoqueue_skipdir, &op->scanidentity};
+            sv_array_append(&roots, &params, 1);
         }
         else
         {
@@ -287,7 +531,14 @@ check_result sv_backup_addtoqueue(sv_backup_state *op)
         }
     }
 
+    if (roots.length)
+    {
+        check(os_recurse_many(
+            (os_recurse_params *)sv_array_at(&roots, 0), roots.length));
+    }
+
 cleanup:
+    sv_array_close(&roots);
     bdestroy(tmp);
     return currenterr;
 }
@@ -331,6 +582,7 @@ check_result sv_backup_fromtextfile(
                 uint64_t lmt_from_disk = 0, actual_size_from_disk = 0;
                 check(os_lockedfilehandle_stat(&handle, &actual_size_from_disk,
                     &lmt_from_disk, permissions));
+                check(os_lockedfilehandle_identity(&handle, &op->scanidentity));
                 check(sv_backup_addtoqueue_cb(op, split.currentline,
                     lmt_from_disk, actual_size_from_disk, permissions));
             }
@@ -356,8 +608,17 @@ void sv_backup_state_close(sv_backup_state *self)
         bstrlist_close(self->messages);
         bdestroy(self->tmp_result);
         bdestroy(self->count.summary_current_dir);
+        sv_backup_pool_close(&self->pool);
+        os_throttle_register_active(NULL);
+        os_throttle_close(&self->throttle);
+        sv_perf_close(&self->perf);
+        svdb_files_catalog_close(&self->catalog);
+        sv_compress_classifier_close(&self->classifier);
+        fnmatch_compiled_close(&self->exclusions);
+        ar_encoder_close(&self->enc);
         ar_manager_close(&self->archiver);
         sv_array_close(&self->rows_to_delete);
+        sv_array_close(&self->chunkbuf);
         svdb_close(&self->db);
         set_self_zero();
     }
@@ -405,38 +666,449 @@ void show_status_update(sv_backup_state *op, unused_ptr(const char))
     }
 }
 
-check_result sv_backup_addfile(sv_backup_state *op, os_lockedfilehandle *handle,
-    const bstring path, uint64_t rowid)
+void sv_backup_job_close(sv_backup_job *self)
+{
+    if (self)
+    {
+        if (self->has_compressed)
+        {
+            log_b(os_tryuntil_remove(cstr(self->compressedpath)),
+                "couldn't delete %s", cstr(self->compressedpath));
+        }
+
+        if (self->dropcache)
+        {
+            os_lockedfilehandle_dropcache(&self->handle);
+        }
+
+        os_lockedfilehandle_close(&self->handle);
+        sv_array_close(&self->chunks);
+        bdestroy(self->path);
+        bdestroy(self->permissions);
+        bdestroy(self->compressedpath);
+        sv_result_close(&self->result);
+        set_self_zero();
+    }
+}
+
+/* a hard link to a file that is still in the queue wasn't recognized while
+adding files to the queue, since its contents weren't known yet. jobs are
+written in the order they were submitted, so if another path of the file was
+submitted first, its contents are known by the time this job is written. */
+static const sv_file_row *sv_backup_job_findsame(
+    sv_backup_state *op, const sv_backup_job *job, bool submitting)
+{
+    sv_file_row *cataloged = op->catalog.loaded && job->identity.inode
+        ? svdb_files_catalog_find(&op->catalog, job->path)
+        : NULL;
+    if (!cataloged)
+    {
+        return NULL;
+    }
+
+    const sv_file_row *same = svdb_files_catalog_findidentity(
+        &op->catalog, &job->identity, cataloged);
+    if (submitting)
+    {
+        sv_file_row submitted = *cataloged;
+        submitted.identity = job->identity;
+        svdb_files_catalog_update(&op->catalog, cataloged, &submitted);
+    }
+
+    return same;
+}
+
+check_result sv_backup_job_open(sv_backup_state *op, sv_backup_job *job,
+    os_lockedfilehandle *handle, const bstring path, uint64_t rowid,
+    uint64_t basecontentsid)
+{
+    sv_result currenterr = {};
+    check_b(path, "invalid path");
+
+    /* the job takes ownership of the handle */
+    job->handle = *handle;
+    memset(handle, 0, sizeof(*handle));
+    job->rowid = rowid;
+    job->path = bstrcpy(path);
+    job->permissions = bstring_open();
+    job->ext = get_file_extension_info(cstr(path), blength(path));
+    job->hashalgorithm = op->grp->hash_algorithm;
+    job->readengine = op->grp->read_engine;
+    job->codec = op->grp->codec;
+    job->codec_level = op->grp->codec_level;
+    job->solid_threshold = op->archiver.solid_threshold;
+    job->chunk_threshold = op->grp->chunk_threshold_bytes;
+    job->dropcache = op->grp->background_priority != 0;
+    job->perf = &op->perf;
+    job->chunks = sv_array_open(sizeof32u(sv_chunk), 0);
+    job->classifier = &op->classifier;
+    job->basecontentsid = op->grp->delta_chain_length &&
+            job->ext == filetype_none && ar_codec_in_process(job->codec)
+        ? basecontentsid
+        : 0;
+    check(os_lockedfilehandle_stat(&job->handle, &job->rawcontentslength,
+        &job->modtimeondisk, job->permissions));
+    check(hook_get_file_info(op->test_context, &job->handle,
+        &job->rawcontentslength, &job->modtimeondisk, job->permissions));
+    adjustfilesize_if_audio_file(op->grp->separate_metadata, job->ext,
+        job->rawcontentslength, &job->contentslength);
+    check(os_lockedfilehandle_identity(&job->handle, &job->identity));
+    job->sparse = os_lockedfilehandle_sparse(&job->handle);
+    const sv_file_row *same = sv_backup_job_findsame(op, job, true);
+    job->samecontentsid = sv_backup_samecontents(
+        same, job->contentslength, job->modtimeondisk);
+    job->samepending = !job->samecontentsid && same &&
+        same->e_status == sv_filerowstatus_queued;
+    if (job->samecontentsid || job->samepending)
+    {
+        /* see sv_backup_job_write */
+        job->basecontentsid = 0;
+    }
+    else if (job->basecontentsid)
+    {
+        /* if the file grew, the worker checks whether its start is still
+        the same as the contents it had before */
+        sv_content_row baserow = {};
+        check(svdb_contentsbyid(&op->db, job->basecontentsid, &baserow));
+        if (baserow.id && baserow.hashalgorithm == job->hashalgorithm &&
+            baserow.deltadepth < op->grp->delta_chain_length &&
+            baserow.contents_length > 0 &&
+            baserow.contents_length < job->rawcontentslength &&
+            job->rawcontentslength - baserow.contents_length <=
+                ar_delta_maxsize)
+        {
+            job->prefixlength = baserow.contents_length;
+            job->prefixhash = baserow.hash;
+        }
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result sv_backup_job_run(
+    sv_backup_job *job, uint32_t separate_metadata, ar_encoder *enc)
+{
+    sv_result currenterr = {};
+    sv_perf_span span = sv_perf_begin();
+    sv_perf_phase phase = sv_perf_hash;
+    uint64_t compressedsize = 0;
+    if (job->samecontentsid || job->samepending)
+    {
+        /* the contents are known from another path of the same file */
+        goto cleanup;
+    }
+    else if (job->ext == filetype_none && job->classifier)
+    {
+        /* don't spend time compressing data that's already compressed */
+        check(sv_compress_classifier_run(job->classifier, cstr(job->path),
+            job->handle.fd, job->rawcontentslength, &job->incompressible));
+    }
+
+    /* split a large file into chunks, so that a small change to it only
+    adds the chunks around the change. the writer thread reads back the
+    chunks that aren't already in an archive. */
+    if (job->chunk_threshold && job->ext == filetype_none &&
+        !job->incompressible && ar_codec_in_process(job->codec) &&
+        job->rawcontentslength >= job->chunk_threshold)
+    {
+        check(hash_of_file_and_chunks(&job->handle, job->hashalgorithm,
+            job->readengine, MIN(SvChunkAvgSize, job->chunk_threshold / 4),
+            &job->hash, &job->crc32, &job->chunks));
+        goto cleanup;
+    }
+
+    /* compress before knowing whether the contents are new, so that the
+    file is read only once. the writer thread throws the output away if the
+    hash is already in the database, or if a changed file is stored as a
+    delta, so that a delta that's too big doesn't leave the writer thread to
+    compress the whole file. small files are left for the writer thread to
+    pack into a shared block instead. */
+    bool compress = enc && job->compressedpath && job->ext == filetype_none &&
+        !job->incompressible && ar_codec_in_process(job->codec) &&
+        job->rawcontentslength >= job->solid_threshold;
+
+    /* a log or mailbox usually only has data appended to it, see
+    sv_backup_write_tail. if its start changed after all, it's read again
+    to be compressed. */
+    if (job->prefixlength)
+    {
+        hash256 prefixhash = {};
+        check(hash_of_file_and_prefix(&job->handle, job->hashalgorithm,
+            job->readengine, job->prefixlength, &prefixhash, &job->hash,
+            &job->crc32, &job->tailcrc32));
+        job->isappend =
+            memcmp(&prefixhash, &job->prefixhash, sizeof(prefixhash)) == 0;
+        if (job->isappend || !compress)
+        {
+            goto cleanup;
+        }
+    }
+
+    if (compress)
+    {
+        phase = sv_perf_compress;
+        job->has_compressed = true;
+        check(hash_of_file_and_compress(&job->handle, enc, job->codec,
+            job->codec_level, cstr(job->compressedpath), job->hashalgorithm,
+            job->readengine, &job->hash, &job->crc32, &compressedsize));
+        goto cleanup;
+    }
+
+    check(hash_of_file(&job->handle, separate_metadata, job->ext,
+        job->hashalgorithm, job->readengine, &job->hash, &job->crc32));
+
+cleanup:
+    if (!currenterr.code && !job->samecontentsid && !job->samepending)
+    {
+        sv_perf_end(job->perf, phase, &span, job->rawcontentslength,
+            compressedsize, 1);
+    }
+
+    return currenterr;
+}
+
+static check_result sv_backup_read_chunk(
+    sv_backup_state *op, sv_backup_job *job, const sv_chunk *chunk)
+{
+    sv_result currenterr = {};
+    uint32_t length = cast64u32u(chunk->length);
+    sv_array_truncatelength(&op->chunkbuf, 0);
+    sv_array_reserve(&op->chunkbuf, length);
+#if __linux__
+    int64_t pos = lseek64(job->handle.fd, cast64u64s(chunk->offset), SEEK_SET);
+#else
+    int64_t pos =
+        _lseeki64(job->handle.fd, cast64u64s(chunk->offset), SEEK_SET);
+#endif
+    check_b(pos == cast64u64s(chunk->offset), "couldn't seek %s to %llu",
+        cstr(job->path), castull(chunk->offset));
+    while (op->chunkbuf.length < length)
+    {
+        int bytes = 0;
+        log_errno_to(bytes,
+            cast64s32s(read(job->handle.fd,
+                op->chunkbuf.buffer + op->chunkbuf.length,
+                length - op->chunkbuf.length)),
+            cstr(job->path));
+        check_b(bytes > 0, "couldn't read %s at %llu", cstr(job->path),
+            castull(chunk->offset + op->chunkbuf.length));
+        op->chunkbuf.length += cast32s32u(bytes);
+    }
+
+    uint32_t crc32 = sv_crc32(0, op->chunkbuf.buffer, length);
+    check_b(crc32 == chunk->crc32, "%s changed while it was being backed up",
+        cstr(job->path));
+
+cleanup:
+    return currenterr;
+}
+
+/* add the chunks of a large file that aren't already in an archive, and
+list all of its chunks in order. the file's own row holds no data; it goes
+with the archive of its first chunk, so that compaction sees it there. */
+static check_result sv_backup_write_chunks(sv_backup_state *op,
+    sv_backup_job *job, sv_content_row *parent, uint64_t *written)
+{
+    sv_result currenterr = {};
+    bstring displayname = bstring_open();
+    for (uint32_t i = 0; i < job->chunks.length; i++)
+    {
+        const sv_chunk *chunk =
+            (const sv_chunk *)sv_array_at(&job->chunks, i);
+        sv_content_row row = {};
+        check(svdb_contentsbyhash(&op->db, &chunk->hash, chunk->length, &row));
+        if (row.id && !row.chunkcount)
+        {
+            check(svdb_contents_setlastreferenced(
+                &op->db, row.id, op->collectionid));
+        }
+        else
+        {
+            memset(&row, 0, sizeof(row));
+            check(svdb_contentsinsert(&op->db, &row.id));
+            check(sv_backup_read_chunk(op, job, chunk));
+            bsetfmt(displayname, "%s (chunk %u)", cstr(job->path), i);
+            check(ar_manager_add_buffer(&op->archiver, op->chunkbuf.buffer,
+                op->chunkbuf.length, cstr(displayname), row.id,
+                &row.archivenumber, &row.compressed_contents_length));
+            *written += row.compressed_contents_length;
+            row.hash = chunk->hash;
+            row.hashalgorithm = job->hashalgorithm;
+            row.codec = job->codec;
+            row.crc32 = chunk->crc32;
+            row.contents_length = chunk->length;
+            row.original_collection = cast64u32u(op->collectionid);
+            row.most_recent_collection = op->collectionid;
+            check(svdb_contentsupdate(&op->db, &row));
+        }
+
+        if (i == 0)
+        {
+            parent->original_collection = row.original_collection;
+            parent->archivenumber = row.archivenumber;
+        }
+
+        check(svdb_chunksinsert(&op->db, parent->id, i, row.id));
+    }
+
+    parent->compressed_contents_length = 0;
+    parent->chunkcount = job->chunks.length;
+
+cleanup:
+    bdestroy(displayname);
+    return currenterr;
+}
+
+/* store a changed file as a delta against its previous contents, if the
+delta is much smaller than the file. restoring it restores the previous
+contents first, so chains of deltas are capped at delta_chain_length. when
+the delta isn't used, the file the worker thread compressed is stored. */
+static check_result sv_backup_write_delta(sv_backup_state *op,
+    sv_backup_job *job, sv_content_row *row, bool *isdelta)
+{
+    sv_result currenterr = {};
+    sv_result result_restorebase = {};
+    sv_content_row baserow = {};
+    sv_chunk whole = {};
+    sv_array base = sv_array_open(1, 0);
+    sv_array delta = sv_array_open(1, 0);
+    sv_array applied = sv_array_open(1, 0);
+    bstring basepath = bformat("%s%s%08llx.base",
+        cstr(op->app->path_temp_archived), pathsep,
+        castull(job->basecontentsid));
+    bstring displayname = bformat("%s (delta)", cstr(job->path));
+    *isdelta = false;
+    check(svdb_contentsbyid(&op->db, job->basecontentsid, &baserow));
+    if (!baserow.id || baserow.chunkcount ||
+        baserow.deltadepth >= op->grp->delta_chain_length ||
+        baserow.contents_length > ar_delta_maxsize ||
+        job->rawcontentslength > ar_delta_maxsize)
+    {
+        goto cleanup;
+    }
+
+    /* if the base can't be restored, for example because its archive was
+    moved elsewhere, store the whole file */
+    result_restorebase = sv_contents_restore(&op->archiver, &op->db,
+        cstr(op->app->path_temp_archived), &baserow, false, cstr(basepath));
+    if (result_restorebase.code)
+    {
+        sv_log_fmt("delta base %08llx unavailable, %s",
+            castull(baserow.id), cstr(result_restorebase.msg));
+        goto cleanup;
+    }
+
+    whole.length = job->rawcontentslength;
+    whole.crc32 = job->crc32;
+    check(ar_util_readall(cstr(basepath), &base));
+    check(sv_backup_read_chunk(op, job, &whole));
+    ar_delta_encode(base.buffer, base.length, op->chunkbuf.buffer,
+        op->chunkbuf.length, &delta);
+    if (delta.length >= op->chunkbuf.length / 2)
+    {
+        goto cleanup;
+    }
+
+    check(ar_delta_apply(
+        base.buffer, base.length, delta.buffer, delta.length, &applied));
+    check_b(applied.length == op->chunkbuf.length &&
+            memcmp(applied.buffer, op->chunkbuf.buffer, applied.length) == 0,
+        "delta for %s did not rebuild the file", cstr(job->path));
+    check(ar_manager_add_buffer(&op->archiver, delta.buffer, delta.length,
+        cstr(displayname), row->id, &row->archivenumber,
+        &row->compressed_contents_length));
+    row->deltabaseid = baserow.id;
+    row->deltadepth = baserow.deltadepth + 1;
+    *isdelta = true;
+
+cleanup:
+    log_b(os_tryuntil_remove(cstr(basepath)), "couldn't delete %s",
+        cstr(basepath));
+    sv_result_close(&result_restorebase);
+    sv_array_close(&base);
+    sv_array_close(&delta);
+    sv_array_close(&applied);
+    bdestroy(basepath);
+    bdestroy(displayname);
+    return currenterr;
+}
+
+/* a file whose start matched its previous contents while it was hashed
+only needs the data that was appended to it. it's stored as a delta that
+copies all of the previous contents, so the previous contents don't need
+to be restored or even read here. */
+static check_result sv_backup_write_tail(sv_backup_state *op,
+    sv_backup_job *job, sv_content_row *row, bool *isdelta)
+{
+    sv_result currenterr = {};
+    sv_content_row baserow = {};
+    sv_array delta = sv_array_open(1, 0);
+    bstring displayname = bformat("%s (appended)", cstr(job->path));
+    sv_chunk tail = {};
+    tail.offset = job->prefixlength;
+    tail.length = job->rawcontentslength - job->prefixlength;
+    tail.crc32 = job->tailcrc32;
+    check(svdb_contentsbyid(&op->db, job->basecontentsid, &baserow));
+    check_b(baserow.id && baserow.contents_length == job->prefixlength,
+        "base of %s changed while it was being backed up", cstr(job->path));
+    check(sv_backup_read_chunk(op, job, &tail));
+    ar_delta_encode_append(job->prefixlength, op->chunkbuf.buffer,
+        op->chunkbuf.length, &delta);
+    check(ar_manager_add_buffer(&op->archiver, delta.buffer, delta.length,
+        cstr(displayname), row->id, &row->archivenumber,
+        &row->compressed_contents_length));
+    row->deltabaseid = baserow.id;
+    row->deltadepth = baserow.deltadepth + 1;
+    *isdelta = true;
+
+cleanup:
+    sv_array_close(&delta);
+    bdestroy(displayname);
+    return currenterr;
+}
+
+check_result sv_backup_job_write(sv_backup_state *op, sv_backup_job *job)
 {
     sv_result currenterr = {};
     sv_file_row newfilesrow = {};
     sv_content_row contentsrow = {};
+    newfilesrow.last_write_time = job->modtimeondisk;
+    newfilesrow.contents_length = job->contentslength;
+    newfilesrow.identity = job->identity;
+    newfilesrow.sparse = job->sparse;
+    if (job->samepending)
+    {
+        job->samecontentsid =
+            sv_backup_samecontents(sv_backup_job_findsame(op, job, false),
+                job->contentslength, job->modtimeondisk);
+    }
 
-    bstring permissions = bstring_open();
-    uint64_t contentslength = 0, rawcontentslength = 0, modtimeondisk = 0;
-    hash256 hash = {};
-    uint32_t crc32 = 0;
-    check_b(path, "invalid path");
-    efiletype ext = get_file_extension_info(cstr(path), blength(path));
-    check(os_lockedfilehandle_stat(
-        handle, &rawcontentslength, &modtimeondisk, permissions));
-    check(hook_get_file_info(op->test_context, handle, &rawcontentslength,
-        &modtimeondisk, permissions));
-    adjustfilesize_if_audio_file(
-        op->grp->separate_metadata, ext, rawcontentslength, &contentslength);
-    check(hash_of_file(handle, op->grp->separate_metadata, ext,
-        cstr(op->archiver.ar.audiotag_binary), &hash, &crc32));
-    newfilesrow.last_write_time = modtimeondisk;
-    newfilesrow.contents_length = contentslength;
-
-    check(svdb_contentsbyhash(
-        &op->db, &hash, newfilesrow.contents_length, &contentsrow));
+    if (job->samecontentsid)
+    {
+        check(svdb_contentsbyid(&op->db, job->samecontentsid, &contentsrow));
+    }
+
+    if (!contentsrow.id && (job->samecontentsid || job->samepending))
+    {
+        /* the other path couldn't be stored, read this one after all */
+        sv_log_fmt("addfile notsame %s", cstr(job->path));
+        job->samecontentsid = 0;
+        job->samepending = false;
+        check(sv_backup_job_run(job, op->grp->separate_metadata, NULL));
+    }
+
+    if (!contentsrow.id)
+    {
+        check(svdb_contentsbyhash(
+            &op->db, &job->hash, newfilesrow.contents_length, &contentsrow));
+    }
 
     if (contentsrow.id)
     {
         /* contents are already in an archive */
-        sv_log_fmt("addfile seen %s fid=%llx cid=%llx", cstr(path),
-            castull(rowid), castull(contentsrow.id));
+        sv_log_fmt("addfile seen %s fid=%llx cid=%llx", cstr(job->path),
+            castull(job->rowid), castull(contentsrow.id));
         check(svdb_contents_setlastreferenced(
             &op->db, contentsrow.id, op->collectionid));
         newfilesrow.contents_id = contentsrow.id;
@@ -448,42 +1120,329 @@ check_result sv_backup_addfile(sv_backup_state *op, os_lockedfilehandle *handle,
         check(svdb_contentsinsert(&op->db, &newcontentsrow.id));
 
         /* add to an archive on disk */
-        bool iscompressed = ext != filetype_none;
-        sv_log_fmt("addfile new %s fid=%llx cid=%llx", cstr(path),
-            castull(rowid), castull(newcontentsrow.id));
-        check(ar_manager_add(&op->archiver, cstr(path), iscompressed,
-            newcontentsrow.id, &newcontentsrow.archivenumber,
-            &newcontentsrow.compressed_contents_length));
+        bool iscompressed = job->ext != filetype_none || job->incompressible;
+        bool isdelta = false;
+        uint64_t written = 0;
+        sv_perf_span span = sv_perf_begin();
+        sv_log_fmt("addfile new %s fid=%llx cid=%llx", cstr(job->path),
+            castull(job->rowid), castull(newcontentsrow.id));
+        if (!job->chunks.length && job->isappend)
+        {
+            check(sv_backup_write_tail(op, job, &newcontentsrow, &isdelta));
+        }
+        else if (!job->chunks.length && job->basecontentsid)
+        {
+            check(sv_backup_write_delta(op, job, &newcontentsrow, &isdelta));
+        }
+
+        if (job->chunks.length || isdelta)
+        {
+            /* see sv_backup_write_chunks and sv_backup_write_delta */
+        }
+        else if (job->has_compressed)
+        {
+            check(ar_manager_add_compressedfile(&op->archiver, cstr(job->path),
+                cstr(job->compressedpath), newcontentsrow.id,
+                &newcontentsrow.archivenumber,
+                &newcontentsrow.compressed_contents_length));
+            job->has_compressed = false;
+        }
+        else if (ar_manager_packs(
+                     &op->archiver, iscompressed, job->rawcontentslength))
+        {
+            /* read from the handle that was hashed, so that what goes into
+            the block is what the row's hash and crc32 describe */
+            sv_chunk whole = {};
+            whole.length = job->rawcontentslength;
+            whole.crc32 = job->crc32;
+            check(sv_backup_read_chunk(op, job, &whole));
+            check(ar_manager_add_buffer_to_block(&op->archiver,
+                op->chunkbuf.buffer, op->chunkbuf.length, cstr(job->path),
+                newcontentsrow.id, &newcontentsrow.archivenumber,
+                &newcontentsrow.blockid, &newcontentsrow.blockoffset));
+        }
+        else
+        {
+            check(ar_manager_add(&op->archiver, cstr(job->path), iscompressed,
+                newcontentsrow.id, &newcontentsrow.archivenumber,
+                &newcontentsrow.compressed_contents_length,
+                &newcontentsrow.blockid, &newcontentsrow.blockoffset));
+        }
 
         /* add to the database */
-        newcontentsrow.hash = hash;
-        newcontentsrow.crc32 = crc32;
+        newcontentsrow.hash = job->hash;
+        newcontentsrow.hashalgorithm = job->hashalgorithm;
+        newcontentsrow.codec = job->codec;
+        newcontentsrow.crc32 = job->crc32;
         newcontentsrow.contents_length = newfilesrow.contents_length;
         newcontentsrow.original_collection = cast64u32u(op->collectionid);
         newcontentsrow.most_recent_collection = op->collectionid;
+        if (job->chunks.length)
+        {
+            check(sv_backup_write_chunks(op, job, &newcontentsrow, &written));
+        }
+
+        written += newcontentsrow.compressed_contents_length;
+        sv_perf_end(&op->perf, sv_perf_tar, &span, job->rawcontentslength,
+            written, 1);
+
         check(svdb_contentsupdate(&op->db, &newcontentsrow));
         newfilesrow.contents_id = newcontentsrow.id;
         op->count.count_new_files += 1;
-        op->count.count_new_bytes += rawcontentslength;
+        op->count.count_new_bytes += job->rawcontentslength;
     }
 
     /* update the fileslist row */
-    newfilesrow.id = rowid;
+    newfilesrow.id = job->rowid;
     newfilesrow.most_recent_collection = op->collectionid;
     newfilesrow.e_status = sv_filerowstatus_complete;
-    check(svdb_filesupdate(&op->db, &newfilesrow, permissions));
+    check(svdb_filesupdate(&op->db, &newfilesrow, job->permissions));
+    sv_file_row *cataloged = op->catalog.loaded
+        ? svdb_files_catalog_find(&op->catalog, job->path)
+        : NULL;
+    if (cataloged)
+    {
+        /* lets other paths of the same file find these contents */
+        svdb_files_catalog_update(&op->catalog, cataloged, &newfilesrow);
+    }
 
 cleanup:
-    bdestroy(permissions);
     return currenterr;
 }
 
+check_result sv_backup_addfile(sv_backup_state *op, os_lockedfilehandle *handle,
+    const bstring path, uint64_t rowid, uint64_t basecontentsid)
+{
+    sv_result currenterr = {};
+    sv_backup_job job = {};
+    check(sv_backup_job_open(op, &job, handle, path, rowid, basecontentsid));
+    job.compressedpath = bformat("%s%sjob.%s",
+        cstr(op->archiver.path_working), pathsep, ar_codec_suffix(job.codec));
+    check(sv_backup_job_run(&job, op->grp->separate_metadata, &op->enc));
+    check(sv_backup_job_write(op, &job));
+
+cleanup:
+    sv_backup_job_close(&job);
+    return currenterr;
+}
+
+uint32_t sv_backup_pool_threadcount(const sv_group *grp)
+{
+    /* by default, don't use more than 4 threads: each encoder can use
+    around 100Mb, and past that the disk is usually the bottleneck. */
+    return grp->worker_threads ? grp->worker_threads
+                               : MIN(4, os_cpu_count());
+}
+
+static void sv_backup_pool_worker(void *context)
+{
+    sv_backup_pool *pool = (sv_backup_pool *)context;
+    ar_encoder enc = ar_encoder_open();
+    if (pool->background)
+    {
+        os_thread_set_background();
+    }
+
+    os_mutex_lock(&pool->mutex);
+    while (true)
+    {
+        /* take the oldest job that no other thread has started */
+        sv_backup_job *job = NULL;
+        for (uint32_t i = 0; i < pool->pending && !job; i++)
+        {
+            sv_backup_job *candidate =
+                &pool->jobs[(pool->first + i) % pool->jobcount];
+            job = candidate->state == sv_backup_job_queued ? candidate : NULL;
+        }
+
+        if (!job && pool->stopping)
+        {
+            break;
+        }
+        else if (!job)
+        {
+            os_cond_wait(&pool->cond_queued, &pool->mutex);
+            continue;
+        }
+
+        job->state = sv_backup_job_working;
+        os_mutex_unlock(&pool->mutex);
+        sv_result result =
+            sv_backup_job_run(job, pool->separate_metadata, &enc);
+        os_mutex_lock(&pool->mutex);
+        job->result = result;
+        job->state = sv_backup_job_done;
+        os_cond_broadcast(&pool->cond_done);
+    }
+
+    os_mutex_unlock(&pool->mutex);
+    ar_encoder_close(&enc);
+}
+
+check_result sv_backup_pool_start(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    sv_backup_pool *pool = &op->pool;
+    uint32_t threadcount = sv_backup_pool_threadcount(op->grp);
+    if (threadcount <= 1)
+    {
+        /* process files on this thread, see sv_backup_addfile */
+        goto cleanup;
+    }
+
+    /* queue a few jobs per thread, so that one large file doesn't leave the
+    other threads idle while the writer waits for it. */
+    sv_log_fmt("starting %u worker threads", threadcount);
+    pool->separate_metadata = op->grp->separate_metadata;
+    pool->background = op->grp->background_priority != 0;
+    pool->jobcount = 4 * threadcount;
+    pool->jobs = (sv_backup_job *)sv_calloc(
+        pool->jobcount, sizeof32u(sv_backup_job));
+    pool->threads = (os_thread *)sv_calloc(threadcount, sizeof32u(os_thread));
+    os_mutex_init(&pool->mutex);
+    os_cond_init(&pool->cond_queued);
+    os_cond_init(&pool->cond_done);
+    pool->threadcount = threadcount;
+    for (uint32_t i = 0; i < threadcount; i++)
+    {
+        check(os_thread_start(
+            &pool->threads[i], &sv_backup_pool_worker, pool));
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result sv_backup_pool_submit(sv_backup_state *op,
+    os_lockedfilehandle *handle, const bstring path, uint64_t rowid,
+    uint64_t basecontentsid)
+{
+    sv_result currenterr = {};
+    sv_backup_pool *pool = &op->pool;
+    sv_backup_job *job = NULL;
+    if (pool->pending == pool->jobcount)
+    {
+        check(sv_backup_pool_write_first(op));
+    }
+
+    /* workers only look at slots within pending, so it's safe to fill this
+    one in without holding the lock. */
+    uint32_t slot = (pool->first + pool->pending) % pool->jobcount;
+    job = &pool->jobs[slot];
+    check(sv_backup_job_open(op, job, handle, path, rowid, basecontentsid));
+    job->compressedpath = bformat("%s%sjob%03u.%s",
+        cstr(op->archiver.path_working), pathsep, slot,
+        ar_codec_suffix(job->codec));
+
+    os_mutex_lock(&pool->mutex);
+    job->state = sv_backup_job_queued;
+    pool->pending++;
+    os_cond_broadcast(&pool->cond_queued);
+    os_mutex_unlock(&pool->mutex);
+
+cleanup:
+    if (currenterr.code)
+    {
+        sv_backup_job_close(job);
+    }
+
+    return currenterr;
+}
+
+check_result sv_backup_pool_write_first(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    sv_backup_pool *pool = &op->pool;
+    sv_backup_job *job = &pool->jobs[pool->first];
+    os_mutex_lock(&pool->mutex);
+    while (job->state != sv_backup_job_done)
+    {
+        os_cond_wait(&pool->cond_done, &pool->mutex);
+    }
+
+    pool->first = (pool->first + 1) % pool->jobcount;
+    pool->pending--;
+    os_mutex_unlock(&pool->mutex);
+
+    /* the job's result now belongs to us */
+    sv_result result = job->result;
+    memset(&job->result, 0, sizeof(job->result));
+    check(result);
+    check(sv_backup_job_write(op, job));
+
+cleanup:
+    sv_backup_job_close(job);
+    return currenterr;
+}
+
+check_result sv_backup_pool_drain(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    while (op->pool.pending)
+    {
+        check(sv_backup_pool_write_first(op));
+    }
+
+cleanup:
+    return currenterr;
+}
+
+void sv_backup_pool_close(sv_backup_pool *self)
+{
+    if (self && self->threadcount)
+    {
+        os_mutex_lock(&self->mutex);
+        self->stopping = true;
+        os_cond_broadcast(&self->cond_queued);
+        os_mutex_unlock(&self->mutex);
+        for (uint32_t i = 0; i < self->threadcount; i++)
+        {
+            os_thread_join(&self->threads[i]);
+        }
+
+        for (uint32_t i = 0; i < self->jobcount; i++)
+        {
+            sv_backup_job_close(&self->jobs[i]);
+        }
+
+        os_cond_close(&self->cond_queued);
+        os_cond_close(&self->cond_done);
+        os_mutex_close(&self->mutex);
+        sv_freenull(self->jobs);
+        sv_freenull(self->threads);
+        set_self_zero();
+    }
+}
+
+/* files that were seen unchanged are only marked in the catalog, their rows
+still have the collection in which they last changed. */
+static bool sv_backup_seen_unchanged(sv_backup_state *op, const bstring path)
+{
+    const sv_file_row *cataloged = op->catalog.loaded
+        ? svdb_files_catalog_find(&op->catalog, path)
+        : NULL;
+    return cataloged && cataloged->e_status == sv_filerowstatus_complete &&
+        cataloged->most_recent_collection == op->collectionid;
+}
+
 check_result sv_backup_processqueue_cb(void *context,
     const sv_file_row *in_files_row, const bstring path, unused(const bstring))
 {
     sv_result currenterr = {};
     os_lockedfilehandle handle = {};
     sv_backup_state *op = (sv_backup_state *)context;
+    if (sv_backup_seen_unchanged(op, path))
+    {
+        return OK;
+    }
+    else if (in_files_row->contents_id && op->collectionid > 1)
+    {
+        /* the file is about to change or be removed, so its old contents
+        were last referenced in the previous collection. */
+        check(svdb_contents_setlastreferenced(
+            &op->db, in_files_row->contents_id, op->collectionid - 1));
+    }
+
     pause_if_requested(op);
     show_status_update(op, cstr(path));
     bool filenotfound = false;
@@ -519,7 +1478,17 @@ check_result sv_backup_processqueue_cb(void *context,
     else
     {
         /* case 4: can access file, store its contents */
-        check(sv_backup_addfile(op, &handle, path, in_files_row->id));
+        if (op->pool.threadcount)
+        {
+            check(sv_backup_pool_submit(op, &handle, path, in_files_row->id,
+                in_files_row->contents_id));
+        }
+        else
+        {
+            check(sv_backup_addfile(op, &handle, path, in_files_row->id,
+                in_files_row->contents_id));
+        }
+
         op->count.count_new_path++;
     }
 
@@ -529,6 +1498,107 @@ cleanup:
     return currenterr;
 }
 
+static check_result sv_backup_collectqueue_cb(void *context,
+    const sv_file_row *in_files_row, const bstring path, unused(const bstring))
+{
+    sv_backup_queue *queue = (sv_backup_queue *)context;
+    if (!sv_backup_seen_unchanged(queue->op, path))
+    {
+        sv_backup_queued entry = {};
+        entry.row = *in_files_row;
+        entry.size = os_getfilesize(cstr(path));
+        uint64_t modtime = os_getmodifiedtime(cstr(path));
+        entry.recent = modtime + 24 * 60 * 60 >= cast64s64u(queue->now);
+        entry.pathindex = queue->paths->qty;
+        bstrlist_append(queue->paths, path);
+        sv_array_append(&queue->entries, &entry, 1);
+    }
+
+    return OK;
+}
+
+/* files changed in the last day first, then smaller files before larger */
+static int sv_backup_queued_cmp(const void *p1, const void *p2)
+{
+    const sv_backup_queued *a = (const sv_backup_queued *)p1;
+    const sv_backup_queued *b = (const sv_backup_queued *)p2;
+    if (a->recent != b->recent)
+    {
+        return a->recent ? -1 : 1;
+    }
+    else if (a->size != b->size)
+    {
+        return a->size < b->size ? -1 : 1;
+    }
+    else
+    {
+        return a->row.id < b->row.id ? -1 : (a->row.id > b->row.id ? 1 : 0);
+    }
+}
+
+check_result sv_backup_processqueue(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    sv_backup_queue queue = {};
+    uint64_t status =
+        sv_makestatus(op->collectionid, sv_filerowstatus_complete);
+    if (!op->deadline)
+    {
+        check(svdb_files_iter(&op->db, status, op, sv_backup_processqueue_cb));
+        goto cleanup;
+    }
+
+    /* with a backup window, read the whole queue first so that the files
+    that matter most are started before the window closes. files not started
+    in time stay queued, and the collection is left unfinished so that the
+    next run carries on with it. */
+    queue.op = op;
+    queue.entries = sv_array_open(sizeof32u(sv_backup_queued), 0);
+    queue.paths = bstrlist_open();
+    queue.now = time(NULL);
+    check(svdb_files_iter(&op->db, status, &queue, sv_backup_collectqueue_cb));
+    if (queue.entries.length)
+    {
+        qsort(sv_array_at(&queue.entries, 0), queue.entries.length,
+            sizeof(sv_backup_queued), &sv_backup_queued_cmp);
+    }
+
+    bool windowclosed = false;
+    for (uint32_t i = 0; i < queue.entries.length; i++)
+    {
+        const sv_backup_queued *entry =
+            (const sv_backup_queued *)sv_array_at(&queue.entries, i);
+        if (!windowclosed)
+        {
+            time_t now = time(NULL);
+            check(hook_get_time(op->test_context, &now));
+            windowclosed = now >= op->deadline;
+        }
+
+        if (windowclosed)
+        {
+            op->count.count_deferred++;
+            op->count.count_deferred_bytes += entry->size;
+            continue;
+        }
+
+        check(sv_backup_processqueue_cb(
+            op, &entry->row, queue.paths->entry[entry->pathindex], NULL));
+    }
+
+    if (op->count.count_deferred)
+    {
+        sv_log_fmt("backup window closed, %llu files (%llu bytes) left",
+            castull(op->count.count_deferred),
+            castull(op->count.count_deferred_bytes));
+    }
+
+cleanup:
+    sv_array_close(&queue.entries);
+    bstrlist_close(queue.paths);
+    return currenterr;
+}
+
 check_result sv_backup_show_user(sv_backup_state *op, bool before)
 {
     if (before && !op->test_context)
@@ -542,13 +1612,25 @@ check_result sv_backup_show_user(sv_backup_state *op, bool before)
     }
     else if (!op->test_context)
     {
-        printf("100%% complete...");
+        printf(op->count.count_deferred ? "Backup window closed..."
+                                        : "100%% complete...");
         printf("\n%llu new file%s (%0.3f Mb) archived.\n ",
             castull(op->count.count_new_files),
             op->count.count_new_files == 1 ? "" : "s",
             (double)op->count.count_new_bytes / (1024.0 * 1024));
     }
 
+    if (!before && op->count.count_deferred)
+    {
+        bsetfmt(op->tmp_result,
+            "The backup window closed with %llu file%s (%0.3f Mb) still to "
+            "be backed up. They will be backed up the next time backups run.",
+            castull(op->count.count_deferred),
+            op->count.count_deferred == 1 ? "" : "s",
+            (double)op->count.count_deferred_bytes / (1024.0 * 1024));
+        bstrlist_append(op->messages, op->tmp_result);
+    }
+
     return OK;
 }
 
@@ -586,8 +1668,11 @@ check_result sv_backup_makecopyofdb(
 
     /* make a copy of it to the upload dir */
     sv_log_fmt("copy %s to %s", cstr(src), cstr(dest));
+    sv_perf_span span = sv_perf_begin();
     os_sleep(op->test_context ? 1 : 250);
     log_b(os_tryuntil_copy(cstr(src), cstr(dest), true), "couldn't copy db.");
+    uint64_t size = os_getfilesize(cstr(dest));
+    sv_perf_end(&op->perf, sv_perf_makecopyofdb, &span, size, size, 1);
     bdestroy(src);
     bdestroy(dest);
     return OK;
@@ -626,6 +1711,10 @@ check_result sv_backup_compute_preview_cb(void *context,
     sv_backup_state *op = (sv_backup_state *)context;
     bool filenotfound = false;
     check_b(path, "invalid path");
+    if (sv_backup_seen_unchanged(op, path))
+    {
+        return OK;
+    }
     sv_result result_handle =
         os_lockedfilehandle_open(&handle, cstr(path), true, &filenotfound);
 
@@ -644,7 +1733,7 @@ check_result sv_backup_compute_preview_cb(void *context,
         if (!file_is_new)
         {
             check(hash_of_file(&handle, op->grp->separate_metadata, ext,
-                cstr(op->archiver.ar.audiotag_binary), &hash, &crc32));
+                op->grp->hash_algorithm, op->grp->read_engine, &hash, &crc32));
 
             sv_content_row found = {};
             check(svdb_contentsbyhash(&op->db, &hash, contentlength, &found));
@@ -692,6 +1781,8 @@ check_result sv_backup_record_data_checksums(sv_backup_state *op)
     bstring filenamestartswith = bformat("%05llx_", castull(op->collectionid));
     const char *dir_readytoupload = cstr(op->archiver.path_readytoupload);
     bstrlist *files = bstrlist_open();
+    sv_perf_span span = sv_perf_begin();
+    uint64_t bytesread = 0, count = 0;
     check(os_listfiles(dir_readytoupload, files, true));
     for (int i = 0; i < files->qty; i++)
     {
@@ -702,10 +1793,14 @@ check_result sv_backup_record_data_checksums(sv_backup_state *op)
         {
             check(write_archive_checksum(
                 &op->db, blist_view(files, i), 0, true /* still needed */));
+            bytesread += os_getfilesize(blist_view(files, i));
+            count++;
             fputs(".", stdout);
         }
     }
 
+    sv_perf_end(&op->perf, sv_perf_checksum, &span, bytesread, 0, count);
+
 cleanup:
     bdestroy(filename);
     bdestroy(filenamestartswith);
@@ -717,11 +1812,20 @@ check_result sv_backup_recordcollectionstats(sv_backup_state *op)
     sv_result currenterr = {};
     time_t timecompleted = time(NULL);
     sv_collection_row updatedrow = {0};
-    updatedrow.id = op->collectionid;
-    updatedrow.time_finished = cast64s64u(timecompleted);
+    sv_array rows = sv_array_open(sizeof32u(sv_collection_row), 0);
+    check(svdb_collectionsget(&op->db, &rows, false));
+    check_b(rows.length, "no collection to update");
+
+    /* a collection that's carried on over several runs adds up their counts.
+    it's only finished once nothing is left in the queue. */
+    updatedrow = *(const sv_collection_row *)sv_array_at(&rows, 0);
+    check_b(updatedrow.id == op->collectionid, "not the latest collection");
+    updatedrow.time = 0;
+    updatedrow.time_finished =
+        op->count.count_deferred ? 0 : cast64s64u(timecompleted);
     check(svdb_filescount(&op->db, &updatedrow.count_total_files));
-    updatedrow.count_new_contents = op->count.count_new_files;
-    updatedrow.count_new_contents_bytes = op->count.count_new_bytes;
+    updatedrow.count_new_contents += op->count.count_new_files;
+    updatedrow.count_new_contents_bytes += op->count.count_new_bytes;
     check(svdb_collectionupdate(&op->db, &updatedrow));
     svdb_collectiontostring(&updatedrow, true, true, op->tmp_result);
     sv_log_writes("Writing collection stats", cstr(op->tmp_result));
@@ -732,6 +1836,34 @@ check_result sv_backup_recordcollectionstats(sv_backup_state *op)
     }
 
 cleanup:
+    sv_array_close(&rows);
+    return currenterr;
+}
+
+/* what earlier backups learned about which extensions are worth compressing */
+check_result sv_backup_load_classifier(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    bstrlist *saved = bstrlist_open();
+    check(svdb_getlist(&op->db, s_and_len("compress_by_extension"), saved));
+    sv_compress_classifier_load(&op->classifier, saved);
+
+cleanup:
+    bstrlist_close(saved);
+    return currenterr;
+}
+
+check_result sv_backup_save_classifier(sv_backup_state *op)
+{
+    sv_result currenterr = {};
+    bstrlist *saved = bstrlist_open();
+    sv_log_fmt("compressibility: sampled %llu files, routed %llu by extension",
+        castull(op->classifier.sampled), castull(op->classifier.routed));
+    sv_compress_classifier_save(&op->classifier, saved);
+    check(svdb_setlist(&op->db, s_and_len("compress_by_extension"), saved));
+
+cleanup:
+    bstrlist_close(saved);
     return currenterr;
 }
 
@@ -744,7 +1876,15 @@ check_result sv_compact_getcutoff(svdb_db *db, const sv_group *grp,
     sv_array collectionrows = sv_array_open(sizeof32u(sv_collection_row), 0);
     check(svdb_collectionsget(db, &collectionrows, true));
     *collectionid_to_expire = 0;
-    if (collectionrows.length == 0 || collectionrows.length == 1)
+    if (collectionrows.length &&
+        !((sv_collection_row *)sv_array_at(&collectionrows, 0))->time_finished)
+    {
+        /* the files of an interrupted backup aren't all referenced yet */
+        sv_log_write("Not compacting, the latest backup was interrupted.");
+        printf("The latest backup was interrupted. Run backup again to "
+               "finish it before compacting.\n");
+    }
+    else if (collectionrows.length == 0 || collectionrows.length == 1)
     {
         sv_log_write("Nothing to compact, there is no old data.");
         printf("Nothing to compact, there is no old data.\n");
@@ -794,6 +1934,17 @@ check_result sv_compact_getarchivestats(void *context, const sv_content_row *row
         /* this data is still needed */
         stats->count_new += 1;
         stats->size_new += row->compressed_contents_length;
+
+        if (op->is_thorough && row->blockid)
+        {
+            /* its block has to stay, even if other files in it are old */
+            if (!stats->live_blocks.buffer)
+            {
+                stats->live_blocks = sv_array_open_u64();
+            }
+
+            sv_array_add64u(&stats->live_blocks, row->blockid);
+        }
     }
     else
     {
@@ -806,9 +1957,16 @@ check_result sv_compact_getarchivestats(void *context, const sv_content_row *row
             if (!stats->old_individual_files.buffer)
             {
                 stats->old_individual_files = sv_array_open_u64();
+                stats->old_members = sv_array_open_u64();
             }
 
+            /* a chunked file's row has no member of its own */
             sv_array_add64u(&stats->old_individual_files, row->id);
+            if (!row->chunkcount)
+            {
+                sv_array_add64u(
+                    &stats->old_members, row->blockid ? row->blockid : row->id);
+            }
         }
     }
 
@@ -847,6 +2005,8 @@ check_result sv_compact_see_what_to_remove_cb(
     {
         /* free memory */
         sv_array_close(&archive->old_individual_files);
+        sv_array_close(&archive->old_members);
+        sv_array_close(&archive->live_blocks);
     }
 
     return OK;
@@ -864,6 +2024,30 @@ void sv_compact_see_what_to_remove(
         "", continue_on_err);
 }
 
+void sv_compact_keep_live_blocks(sv_archive_stats *archive)
+{
+    /* a packed block can only be removed from the tar once every file in it
+    is old, so drop blocks that still hold a needed file. */
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < archive->old_members.length; i++)
+    {
+        uint64_t id = sv_array_at64u(&archive->old_members, i);
+        bool live = false;
+        for (uint32_t j = 0; j < archive->live_blocks.length && !live; j++)
+        {
+            live = sv_array_at64u(&archive->live_blocks, j) == id;
+        }
+
+        if (!live)
+        {
+            memcpy(sv_array_at(&archive->old_members, kept++), &id,
+                sizeof(id));
+        }
+    }
+
+    sv_array_truncatelength(&archive->old_members, kept);
+}
+
 check_result sv_strip_archive_removing_old_files(sv_compact_state *op,
     const sv_app *app, const sv_group *grp, svdb_db *db, bstrlist *msgs)
 {
@@ -877,7 +2061,7 @@ check_result sv_strip_archive_removing_old_files(sv_compact_state *op,
     /* delete rows from db before modifying tars, for transactional integrity.
     if exception occurs, we'll be left with unneeded data in the .tar,
     which is better than being left with db pointing to non-existing data */
-    check(checkbinarypaths(&ar, false, NULL));
+    check(checkbinarypaths(&ar));
     check(svdb_txn_open(&txn, db));
     for (uint32_t i = 0; i < op->archives_to_strip.length; i++)
     {
@@ -913,9 +2097,10 @@ check_result sv_strip_archive_removing_old_files(sv_compact_state *op,
 
         if (os_file_exists(cstr(tar)))
         {
+            sv_compact_keep_live_blocks(o);
             sv_result result =
                 ar_util_delete(&ar, cstr(tar), cstr(op->working_dir_archived),
-                    cstr(op->working_dir_unarchived), &o->old_individual_files);
+                    cstr(op->working_dir_unarchived), &o->old_members);
 
             if (result.code)
             {
@@ -1046,6 +2231,8 @@ void sv_compact_state_close(sv_compact_state *self)
             sv_archive_stats *o =
                 (sv_archive_stats *)sv_array_at(&self->archives_to_strip, i);
             sv_array_close(&o->old_individual_files);
+            sv_array_close(&o->old_members);
+            sv_array_close(&o->live_blocks);
         }
 
         for (uint32_t i = 0; i < self->archives_to_remove.length; i++)
@@ -1053,6 +2240,8 @@ void sv_compact_state_close(sv_compact_state *self)
             sv_archive_stats *o =
                 (sv_archive_stats *)sv_array_at(&self->archives_to_remove, i);
             sv_array_close(&o->old_individual_files);
+            sv_array_close(&o->old_members);
+            sv_array_close(&o->live_blocks);
         }
 
         sv_2darray_close(&self->archive_stats);
@@ -1199,13 +2388,147 @@ cleanup:
     return currenterr;
 }
 
+static check_result sv_restore_append(const char *src, FILE *out,
+    const char *outpath, bool sparse, uint64_t *offset)
+{
+    sv_result currenterr = {};
+    sv_file in = {};
+    const uint32_t buflen = 64 * 1024;
+    byte *buf = sv_calloc(buflen, 1);
+    check(sv_file_open(&in, src, "rb"));
+    while (true)
+    {
+        size_t amtread = fread(buf, 1, buflen, in.file);
+        check_b(!ferror(in.file), "couldn't read %s", src);
+        if (amtread == 0)
+        {
+            break;
+        }
+
+        if (sparse)
+        {
+            check(ar_util_write_sparse(out, outpath, buf, amtread, offset));
+        }
+        else
+        {
+            check_b(fwrite(buf, amtread, 1, out) == 1, "couldn't write to %s",
+                outpath);
+            *offset += amtread;
+        }
+    }
+
+cleanup:
+    sv_file_close(&in);
+    sv_freenull(buf);
+    return currenterr;
+}
+
+/* restore each chunk of a large file, which can be in any archive, and join
+them in order before moving the result to its destination. */
+static check_result sv_restore_chunks(ar_manager *archiver, svdb_db *db,
+    const char *workingdir, const sv_content_row *contentsrow, bool sparse,
+    const char *dest)
+{
+    sv_result currenterr = {};
+    sv_file out = {};
+    uint64_t written = 0;
+    sv_content_row chunkrow = {};
+    sv_array chunkids = sv_array_open_u64();
+    bstring chunkpath = bformat(
+        "%s%s%08llx.chunk", workingdir, pathsep, castull(contentsrow->id));
+    bstring joinedpath = bformat(
+        "%s%s%08llx.joined", workingdir, pathsep, castull(contentsrow->id));
+    check(svdb_chunksget(db, contentsrow->id, &chunkids));
+    check_b(chunkids.length == contentsrow->chunkcount,
+        "restoring %08llx expected %u chunks but got %u",
+        castull(contentsrow->id), contentsrow->chunkcount, chunkids.length);
+    check(sv_file_open(&out, cstr(joinedpath), "wb"));
+    for (uint32_t i = 0; i < chunkids.length; i++)
+    {
+        uint64_t chunkid = sv_array_at64u(&chunkids, i);
+        memset(&chunkrow, 0, sizeof(chunkrow));
+        check(svdb_contentsbyid(db, chunkid, &chunkrow));
+        check_b(chunkrow.id != 0 && chunkrow.chunkcount == 0,
+            "did not get correct row for chunk %08llx of %08llx",
+            castull(chunkid), castull(contentsrow->id));
+        check(sv_contents_restore(
+            archiver, db, workingdir, &chunkrow, false, cstr(chunkpath)));
+        check(sv_restore_append(
+            cstr(chunkpath), out.file, cstr(joinedpath), sparse, &written));
+    }
+
+    check(ar_util_write_sparse_end(out.file, cstr(joinedpath), written));
+    sv_file_close(&out);
+    check(ar_manager_move_restored(cstr(joinedpath), dest));
+
+cleanup:
+    sv_file_close(&out);
+    log_b(os_tryuntil_remove(cstr(chunkpath)), "couldn't delete %s",
+        cstr(chunkpath));
+    log_b(os_tryuntil_remove(cstr(joinedpath)), "couldn't delete %s",
+        cstr(joinedpath));
+    sv_array_close(&chunkids);
+    bdestroy(chunkpath);
+    bdestroy(joinedpath);
+    return currenterr;
+}
+
+/* restore one contents row to dest, whether it was stored whole, in chunks,
+or as a delta. a delta's base is restored into the working directory first,
+which in turn can be a delta, up to the group's delta_chain_length. if sparse,
+dest gets a hole wherever an aligned block of it is all zeros. */
+check_result sv_contents_restore(ar_manager *archiver, svdb_db *db,
+    const char *workingdir, const sv_content_row *row, bool sparse,
+    const char *dest)
+{
+    sv_result currenterr = {};
+    sv_content_row baserow = {};
+    bstring basepath = bstring_open();
+    bstring archivepath = bformat("%s%s%05x_%05x.tar",
+        cstr(archiver->path_readytoupload), pathsep, row->original_collection,
+        row->archivenumber);
+    if (row->chunkcount)
+    {
+        check(sv_restore_chunks(archiver, db, workingdir, row, sparse, dest));
+    }
+    else if (row->deltabaseid)
+    {
+        check(svdb_contentsbyid(db, row->deltabaseid, &baserow));
+        check_b(baserow.id != 0, "did not get base %08llx of delta %08llx",
+            castull(row->deltabaseid), castull(row->id));
+        bsetfmt(basepath, "%s%s%08llx.base", workingdir, pathsep,
+            castull(baserow.id));
+        check(sv_contents_restore(
+            archiver, db, workingdir, &baserow, false, cstr(basepath)));
+        check(ar_manager_restore(archiver, cstr(archivepath), row->id,
+            row->codec, row->blockid, row->blockoffset, row->contents_length,
+            cstr(basepath), sparse, workingdir, dest));
+    }
+    else
+    {
+        check(ar_manager_restore(archiver, cstr(archivepath), row->id,
+            row->codec, row->blockid, row->blockoffset, row->contents_length,
+            NULL, sparse, workingdir, dest));
+    }
+
+cleanup:
+    if (blength(basepath))
+    {
+        log_b(os_tryuntil_remove(cstr(basepath)), "couldn't delete %s",
+            cstr(basepath));
+    }
+
+    bdestroy(basepath);
+    bdestroy(archivepath);
+    return currenterr;
+}
+
 check_result sv_restore_file(sv_restore_state *op,
     const sv_file_row *in_files_row, const bstring path, const bstring perms)
 {
     sv_result currenterr = {};
     sv_content_row contentsrow = {};
     os_lockedfilehandle handle = {};
-    bstring archivepath = bstring_open();
     bstring hashexpected = bstring_open();
     bstring hashgot = bstring_open();
     hash256 hash = {};
@@ -1213,11 +2536,6 @@ check_result sv_restore_file(sv_restore_state *op,
     check(svdb_contentsbyid(op->db, in_files_row->contents_id, &contentsrow));
     check_b(contentsrow.id != 0, "did not get correct contents row.");
 
-    /* get src path */
-    bsetfmt(archivepath, "%s%s%05x_%05x.tar",
-        cstr(op->archiver.path_readytoupload), pathsep,
-        contentsrow.original_collection, contentsrow.archivenumber);
-
     /* get dest path */
     check_b(blength(path) >= 4, "path length is too short %s", cstr(path));
     const char *pathwithoutroot = cstr(path) + (islinux ? 1 : 3);
@@ -1228,8 +2546,9 @@ check_result sv_restore_file(sv_restore_state *op,
         "choose a shorter destination directory.");
     check(hook_call_when_restoring_file(
         op->test_context, cstr(path), op->destfullpath));
-    check(ar_manager_restore(&op->archiver, cstr(archivepath), contentsrow.id,
-        cstr(op->working_dir_archived), cstr(op->destfullpath)));
+    check(sv_contents_restore(&op->archiver, op->db,
+        cstr(op->working_dir_archived), &contentsrow, in_files_row->sparse,
+        cstr(op->destfullpath)));
 
     /* apply lmt */
     log_b(os_setmodifiedtime_nearestsecond(
@@ -1253,8 +2572,11 @@ check_result sv_restore_file(sv_restore_state *op,
             castull(os_getfilesize(cstr(op->destfullpath))));
     }
 
-    /* confirm hash */
-    if (!is_separate_audio || blength(op->archiver.ar.audiotag_binary))
+    /* confirm hash. audio hashes from older versions were computed by
+    ffmpeg, have zeros in the upper half, and can't be checked here. */
+    bool legacy_audio_hash = is_separate_audio &&
+        contentsrow.hash.data[2] == 0 && contentsrow.hash.data[3] == 0;
+    if (!legacy_audio_hash)
     {
         /* set file readable, e.g. if we're restoring from other user */
         log_b(os_try_set_readable(cstr(op->destfullpath), true), "%s",
@@ -1262,7 +2584,7 @@ check_result sv_restore_file(sv_restore_state *op,
         check(os_lockedfilehandle_open(
             &handle, cstr(op->destfullpath), true, NULL));
         check(hash_of_file(&handle, cast64u32u(op->separate_metadata), ext,
-            cstr(op->archiver.ar.audiotag_binary), &hash, &crc));
+            contentsrow.hashalgorithm, sv_readengine_read, &hash, &crc));
 
         /* compare 256bit hashes and not the crc */
         hash256tostr(&contentsrow.hash, hashexpected);
@@ -1286,7 +2608,6 @@ check_result sv_restore_file(sv_restore_state *op,
 
 cleanup:
     os_lockedfilehandle_close(&handle);
-    bdestroy(archivepath);
     bdestroy(hashexpected);
     bdestroy(hashgot);
     return currenterr;
@@ -1300,8 +2621,9 @@ check_result sv_restore_cb(void *context, const sv_file_row *in_files_row,
     {
         op->countfilesmatch++;
         op->countfilescomplete++;
+        /* a row keeps the collection in which the file last changed */
         log_b(in_files_row->e_status == sv_filerowstatus_complete &&
-                in_files_row->most_recent_collection == op->collectionidwanted,
+                in_files_row->most_recent_collection <= op->collectionidwanted,
             "%s, at the original time the backup was taken this file was "
             "not available, so we will recover a valid but previous version. "
             "%d %llu %llu",
@@ -1317,6 +2639,10 @@ check_result sv_restore_cb(void *context, const sv_file_row *in_files_row,
             sv_result_close(&res);
             op->countfilescomplete--;
         }
+        else
+        {
+            op->countbytescomplete += in_files_row->contents_length;
+        }
     }
 
     return OK;
@@ -1328,24 +2654,7 @@ check_result sv_restore_checkbinarypaths(
     sv_result currenterr = {};
     check(ar_manager_open(&op->archiver, cstr(app->path_app_data),
         cstr(grp->grpname), 0, grp->approx_archive_size_bytes));
-    sv_result result = checkbinarypaths(&op->archiver.ar, grp->separate_metadata,
-        cstr(op->archiver.path_working));
-    if (result.code)
-    {
-        if (grp->separate_metadata && s_contains(cstr(result.msg), "ffmpeg") &&
-            ask_user(
-                "We were not able to find ffmpeg. Please try to install "
-                "ffmpeg first.\nShould we continue without installing ffmpeg "
-                "(files can be restored successfully, but file content "
-                "verification will be skipped)? y/n"))
-        {
-            sv_result_close(&result);
-            check(checkbinarypaths(&op->archiver.ar, false, NULL));
-            bstr_assignstatic(op->archiver.ar.audiotag_binary, "");
-        }
-
-        check(result);
-    }
+    check(checkbinarypaths(&op->archiver.ar));
 
 cleanup:
     return currenterr;
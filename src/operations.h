@@ -32,6 +32,17 @@ typedef enum sv_enum_ops
     sv_set_compact_threshold_bytes,
     sv_set_separate_metadata_enabled,
     sv_set_pause_duration,
+    sv_set_worker_threads,
+    sv_set_hash_algorithm,
+    sv_set_read_engine,
+    sv_set_codec,
+    sv_set_codec_level,
+    sv_set_solid_threshold_bytes,
+    sv_set_chunk_threshold_bytes,
+    sv_set_delta_chain_length,
+    sv_set_backup_window_minutes,
+    sv_set_io_limit_bytes_per_second,
+    sv_set_background_priority,
 } sv_enum_ops;
 
 typedef struct sv_backup_count
@@ -41,15 +52,85 @@ typedef struct sv_backup_count
     uint64_t count_new_bytes;
     uint64_t count_new_path;
     uint64_t count_moved_path;
+    uint64_t count_deferred;
+    uint64_t count_deferred_bytes;
     bstring summary_current_dir;
     uint64_t summary_current_dir_size;
 } sv_backup_count;
 
+typedef enum sv_backup_job_state
+{
+    sv_backup_job_empty = 0,
+    sv_backup_job_queued,
+    sv_backup_job_working,
+    sv_backup_job_done,
+} sv_backup_job_state;
+
+/* one file to be archived. the writer thread opens and stats the file, a
+worker thread hashes and compresses it, then the writer thread looks up the
+hash and adds it to the database and archive. */
+typedef struct sv_backup_job
+{
+    uint64_t rowid;
+    bstring path;
+    bstring permissions;
+    os_lockedfilehandle handle;
+    efiletype ext;
+    uint64_t rawcontentslength;
+    uint64_t contentslength;
+    uint64_t modtimeondisk;
+    hash256 hash;
+    uint32_t hashalgorithm;
+    uint32_t readengine;
+    uint32_t crc32;
+    sv_compress_classifier *classifier;
+    bool incompressible;
+    uint32_t codec;
+    uint32_t codec_level;
+    uint64_t solid_threshold;
+    uint64_t chunk_threshold;
+    sv_array chunks;
+    uint64_t basecontentsid;
+    uint64_t prefixlength;
+    hash256 prefixhash;
+    uint32_t tailcrc32;
+    bool isappend;
+    os_file_identity identity;
+    bool sparse;
+    uint64_t samecontentsid;
+    bool samepending;
+    bstring compressedpath;
+    bool has_compressed;
+    bool dropcache;
+    sv_perf *perf;
+    sv_result result;
+    sv_backup_job_state state;
+} sv_backup_job;
+
+/* jobs are a ring buffer, written in the order they were queued, so that the
+database and archives come out the same regardless of thread timing. */
+typedef struct sv_backup_pool
+{
+    os_mutex mutex;
+    os_cond cond_queued;
+    os_cond cond_done;
+    os_thread *threads;
+    uint32_t threadcount;
+    sv_backup_job *jobs;
+    uint32_t jobcount;
+    uint32_t first;
+    uint32_t pending;
+    bool stopping;
+    uint32_t separate_metadata;
+    bool background;
+} sv_backup_pool;
+
 typedef struct sv_backup_state
 {
     const sv_app *app;
     const sv_group *grp;
     svdb_db db;
+    svdb_txn txn;
     uint64_t collectionid;
     ar_manager archiver;
     sv_array rows_to_delete;
@@ -58,9 +139,37 @@ typedef struct sv_backup_state
     time_t time_since_showing_update;
     uint64_t prev_percent_shown;
     sv_backup_count count;
+    sv_backup_pool pool;
+    ar_encoder enc;
+    sv_compress_classifier classifier;
+    svdb_files_catalog catalog;
+    os_file_identity scanidentity;
+    fnmatch_compiled exclusions;
+    sv_array chunkbuf;
+    os_throttle throttle;
+    sv_perf perf;
+    time_t deadline;
     void *test_context;
 } sv_backup_state;
 
+/* a queued file, when there's a backup window and the queue is put in order
+of priority before any file is started */
+typedef struct sv_backup_queued
+{
+    sv_file_row row;
+    uint64_t size;
+    int pathindex;
+    bool recent;
+} sv_backup_queued;
+
+typedef struct sv_backup_queue
+{
+    sv_backup_state *op;
+    sv_array entries;
+    bstrlist *paths;
+    time_t now;
+} sv_backup_queue;
+
 typedef struct sv_restore_state
 {
     bstring working_dir_archived;
@@ -75,6 +184,7 @@ typedef struct sv_restore_state
     svdb_db *db;
     uint64_t countfilesmatch;
     uint64_t countfilescomplete;
+    uint64_t countbytescomplete;
     uint64_t separate_metadata;
     bool restore_owners;
     bool user_canceled;
@@ -104,6 +214,8 @@ typedef struct sv_archive_stats
     uint32_t original_collection;
     uint32_t archive_number;
     sv_array old_individual_files;
+    sv_array old_members;
+    sv_array live_blocks;
 } sv_archive_stats;
 
 check_result sv_backup(
@@ -115,12 +227,17 @@ void show_status_update_queue(sv_backup_state *op);
 check_result sv_application_run(sv_app *app, int optype);
 check_result hook_provide_file_list(void *phook, void *context);
 check_result hook_call_before_process_queue(void *phook, svdb_db *db);
+check_result hook_call_after_checkpoint(void *phook, uint32_t archivenumber);
+check_result hook_get_time(void *phook, time_t *now);
 check_result hook_get_file_info(void *phook, os_lockedfilehandle *self,
     uint64_t *, uint64_t *modtime, bstring permissions);
 check_result hook_call_when_restoring_file(
     void *phook, const char *originalpath, bstring destpath);
 
 void sv_restore_state_close(sv_restore_state *self);
+check_result sv_contents_restore(ar_manager *archiver, svdb_db *db,
+    const char *workingdir, const sv_content_row *row, bool sparse,
+    const char *dest);
 check_result sv_restore_file(sv_restore_state *op,
     const sv_file_row *in_files_row, const bstring path,
     const bstring permissions);
@@ -164,15 +281,36 @@ void show_status_update(sv_backup_state *op, unused_ptr(const char));
 void sv_backup_compute_preview(sv_backup_state *op);
 check_result sv_backup_record_data_checksums(sv_backup_state *op);
 check_result sv_backup_recordcollectionstats(sv_backup_state *op);
+check_result sv_backup_opencollection(
+    sv_backup_state *op, uint64_t timestarted, uint32_t *resume_after);
+check_result sv_backup_checkpoint(void *context, uint32_t archivenumber);
+check_result sv_backup_load_classifier(sv_backup_state *op);
+check_result sv_backup_save_classifier(sv_backup_state *op);
 check_result sv_backup_addtoqueue_cb(void *context, const bstring filepath,
     uint64_t lmt_from_disk, uint64_t actual_size_from_disk,
     const bstring permissions);
 check_result sv_backup_fromtextfile(
     sv_backup_state *op, const char *appdir, const char *grpname);
 check_result sv_backup_addfile(sv_backup_state *op, os_lockedfilehandle *handle,
-    const bstring path, uint64_t rowid);
+    const bstring path, uint64_t rowid, uint64_t basecontentsid);
 check_result sv_backup_processqueue_cb(void *context,
     const sv_file_row *in_files_row, const bstring path, unused(const bstring));
+check_result sv_backup_processqueue(sv_backup_state *op);
+void sv_backup_job_close(sv_backup_job *self);
+check_result sv_backup_job_open(sv_backup_state *op, sv_backup_job *job,
+    os_lockedfilehandle *handle, const bstring path, uint64_t rowid,
+    uint64_t basecontentsid);
+check_result sv_backup_job_run(
+    sv_backup_job *job, uint32_t separate_metadata, ar_encoder *enc);
+check_result sv_backup_job_write(sv_backup_state *op, sv_backup_job *job);
+uint32_t sv_backup_pool_threadcount(const sv_group *grp);
+check_result sv_backup_pool_start(sv_backup_state *op);
+check_result sv_backup_pool_submit(sv_backup_state *op,
+    os_lockedfilehandle *handle, const bstring path, uint64_t rowid,
+    uint64_t basecontentsid);
+check_result sv_backup_pool_write_first(sv_backup_state *op);
+check_result sv_backup_pool_drain(sv_backup_state *op);
+void sv_backup_pool_close(sv_backup_pool *self);
 check_result sv_backup_makecopyofdb(
     sv_backup_state *op, const sv_group *grp, const char *appdir);
 void sv_backup_compute_preview_on_new_file(
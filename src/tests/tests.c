@@ -30,6 +30,7 @@ void run_all_tests(void)
     tests_open_db_connection(tempdir);
     tests_path_handling(tempdir);
     tests_aligned_malloc(tempdir);
+    tests_throttle(tempdir);
     tests_write_text_file(tempdir);
     tests_file_operations(tempdir);
     tests_bypattern(tempdir);
@@ -53,7 +54,6 @@ void run_all_tests(void)
     tests_tar(tempdir);
     tests_xz(tempdir);
     whole_tests_archive_filenames(tempdir);
-    tests_read_md5_string(tempdir);
     tests_get_version(tempdir);
     tests_hash_audio(tempdir);
     tests_sync_cloud_standalone(tempdir);
@@ -189,6 +189,9 @@ typedef struct sv_test_hook
     const char *expectcontentrows;
     const char *expectfilerows;
     bool messwithfiles;
+    uint32_t interruptafterarchive;
+    uint32_t secondspertick;
+    time_t faketime;
 } sv_test_hook;
 
 sv_test_hook sv_test_hook_open(const char *dir);
@@ -212,6 +215,7 @@ void tests_2d_array(const char *tempdir);
 void tests_open_db_connection(const char *tempdir);
 void tests_path_handling(const char *tempdir);
 void tests_aligned_malloc(const char *tempdir);
+void tests_throttle(const char *tempdir);
 void tests_write_text_file(const char *tempdir);
 void tests_file_operations(const char *tempdir);
 void tests_bypattern(const char *tempdir);
@@ -235,7 +239,6 @@ void tests_widestrings(const char *tempdir);
 void tests_tar(const char *tempdir);
 void tests_xz(const char *tempdir);
 void whole_tests_archive_filenames(const char *tempdir);
-void tests_read_md5_string(const char *tempdir);
 void tests_get_version(const char *tempdir);
 void tests_hash_audio(const char *tempdir);
 void tests_sync_cloud_standalone(const char *tempdir);
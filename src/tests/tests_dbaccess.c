@@ -16,9 +16,161 @@ GNU General Public License for more details.
 
 check_result svdb_connection_openhandle(svdb_db *self);
 
+/* the columns that each schema version added, so that the migration
+tests start from the same database an older build would have created. */
+static const struct
+{
+    uint32_t version;
+    const char *contentscolumns;
+    const char *filescolumns;
+} tests_schema_history[] = {
+    {2, ",HashAlgorithm INTEGER DEFAULT 0", ""},
+    {3, ",Codec INTEGER DEFAULT 0", ""},
+    {4, ",BlockId INTEGER DEFAULT 0,BlockOffset INTEGER DEFAULT 0", ""},
+    {5, ",ChunkCount INTEGER DEFAULT 0", ""},
+    {6, ",DeltaBaseId INTEGER DEFAULT 0,DeltaDepth INTEGER DEFAULT 0", ""},
+    {7, "",
+        ",Device INTEGER DEFAULT 0,Inode INTEGER DEFAULT 0,"
+        "ModTimeNs INTEGER DEFAULT 0"},
+    {8, "", ",Sparse INTEGER DEFAULT 0"},
+};
+
+static const char *tests_schema_unversioned[] = {
+    "CREATE TABLE TblCollections ("
+    "CollectionId INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "Time INTEGER,"
+    "TimeCompleted INTEGER,"
+    "CountTotalFiles INTEGER,"
+    "CountNewContents INTEGER,"
+    "CountNewContentsBytes INTEGER)",
+    "CREATE TABLE TblArchives ("
+    "RowId INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "ArchiveId INTEGER,"
+    "ModifiedTime INTEGER,"
+    "CompactionRemovedDataBeforeThisCollection INTEGER,"
+    "ChecksumString TEXT)",
+    "CREATE TABLE TblKnownVaults ("
+    "KnownVaultsId INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "Name TEXT UNIQUE,"
+    "AwsRegion TEXT,"
+    "AwsVaultName TEXT,"
+    "AwsVaultARN TEXT)",
+    "CREATE TABLE TblKnownVaultArchives ("
+    "KnownArchiveId INTEGER PRIMARY KEY AUTOINCREMENT,"
+    "KnownVaultsId INTEGER,"
+    "CloudPath TEXT,"
+    "AwsArchiveId TEXT,"
+    "AwsDescription TEXT,"
+    "AwsCreationDate TEXT,"
+    "Size INTEGER,"
+    "Crc32 INTEGER,"
+    "ModifiedTime INTEGER, "
+    "UNIQUE(CloudPath, KnownVaultsId))",
+    "CREATE TABLE TblProperties ("
+    "PropertyName TEXT PRIMARY KEY,"
+    "PropertyVal)",
+    "CREATE INDEX IxTblKnownVaultArchivesDescription "
+    "ON TblKnownVaultArchives(CloudPath)",
+};
+
+/* create the full schema as of the given version, with one row in
+TblContentsList and TblFilesList that uses only the original columns. */
+static check_result tests_create_historical_schema(
+    svdb_db *db, uint32_t version)
+{
+    sv_result currenterr = {};
+    bstring contentscolumns = bstring_open();
+    bstring filescolumns = bstring_open();
+    bstring sql = bstring_open();
+    for (uint32_t i = 0; i < countof32u(tests_schema_history); i++)
+    {
+        if (tests_schema_history[i].version <= version)
+        {
+            bcatcstr(contentscolumns, tests_schema_history[i].contentscolumns);
+            bcatcstr(filescolumns, tests_schema_history[i].filescolumns);
+        }
+    }
+
+    for (uint32_t i = 0; i < countof32u(tests_schema_unversioned); i++)
+    {
+        check(svdb_runsql(db, tests_schema_unversioned[i],
+            strlen32s(tests_schema_unversioned[i]), expectchangesunknown));
+    }
+
+    bsetfmt(sql,
+        "CREATE TABLE TblContentsList ("
+        "ContentsId INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "ContentsHash1 INTEGER,"
+        "ContentsHash2 INTEGER,"
+        "ContentsHash3 INTEGER,"
+        "ContentsHash4 INTEGER,"
+        "ContentLength INTEGER,"
+        "CompressedContentLength INTEGER,"
+        "Crc32 INTEGER,"
+        "ArchiveId INTEGER,"
+        "LastCollectionId INTEGER%s)",
+        cstr(contentscolumns));
+    check(svdb_runsql(db, cstr(sql), blength(sql), expectchangesunknown));
+    bsetfmt(sql,
+        "CREATE TABLE TblFilesList ("
+        "FilesListId INTEGER PRIMARY KEY AUTOINCREMENT,"
+        "Path TEXT COLLATE BINARY,"
+        "ContentLength INTEGER,"
+        "ContentsId INTEGER,"
+        "LastWriteTime INTEGER,"
+        "Status INTEGER,"
+        "Flags TEXT%s)",
+        cstr(filescolumns));
+    check(svdb_runsql(db, cstr(sql), blength(sql), expectchangesunknown));
+    check(svdb_runsql(db,
+        s_and_len("CREATE UNIQUE INDEX IxTblFilesListPath "
+                  "ON TblFilesList(Path)"),
+        expectchangesunknown));
+    check(svdb_runsql(db,
+        s_and_len("CREATE INDEX IxTblContentsListHash "
+                  "ON TblContentsList(ContentsHash1)"),
+        expectchangesunknown));
+    if (version >= 5)
+    {
+        check(svdb_runsql(db,
+            s_and_len("CREATE TABLE TblChunkList ("
+                      "ContentsId INTEGER,"
+                      "ChunkIndex INTEGER,"
+                      "ChunkContentsId INTEGER,"
+                      "PRIMARY KEY (ContentsId, ChunkIndex))"),
+            expectchangesunknown));
+        check(svdb_runsql(db,
+            s_and_len("CREATE INDEX IxTblChunkListChunk "
+                      "ON TblChunkList(ChunkContentsId)"),
+            expectchangesunknown));
+    }
+
+    bsetfmt(sql, "INSERT INTO TblProperties VALUES ('SchemaVersion', %u)",
+        version);
+    check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+    bsetfmt(sql,
+        "INSERT INTO TblContentsList (ContentsHash1, ContentsHash2, "
+        "ContentsHash3, ContentsHash4, ContentLength, "
+        "CompressedContentLength, Crc32, ArchiveId, LastCollectionId) "
+        "VALUES (1234, 3, 4, 5, 6, 7, 8, %llu, 3)",
+        castull(make_u64(2, 9)));
+    check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+    bsetfmt(sql,
+        "INSERT INTO TblFilesList (Path, ContentLength, ContentsId, "
+        "LastWriteTime, Status, Flags) VALUES ('/a', 6, 1, 10, %llu, '')",
+        castull(sv_makestatus(3, sv_filerowstatus_complete)));
+    check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+
+cleanup:
+    bdestroy(contentscolumns);
+    bdestroy(filescolumns);
+    bdestroy(sql);
+    return currenterr;
+}
+
 SV_BEGIN_TEST_SUITE(tests_open_db_connection)
 {
-    SV_TEST("schema version should be set to 1")
+    SV_TEST("schema version should be set to 8")
     {
         uint32_t version = 0;
         TEST_OPEN_EX(svdb_db, db, {});
@@ -27,7 +179,7 @@ SV_BEGIN_TEST_SUITE(tests_open_db_connection)
         check(svdb_connect(&db, cstr(path)));
         check(svdb_getint(&db, s_and_len("SchemaVersion"), &version));
         check(svdb_disconnect(&db));
-        TestEqn(1, version);
+        TestEqn(8, version);
     }
 
     SV_TEST("reject an unsupported schema version")
@@ -36,12 +188,89 @@ SV_BEGIN_TEST_SUITE(tests_open_db_connection)
         TEST_OPEN_EX(
             bstring, path, bformat("%s%s\xED\x95\x9C.db", tempdir, pathsep));
         check(svdb_connect(&db, cstr(path)));
-        check(svdb_setint(&db, s_and_len("SchemaVersion"), 2));
+        check(svdb_setint(&db, s_and_len("SchemaVersion"), 9));
         check(svdb_disconnect(&db));
         expect_err_with_message(svdb_connect(&db, cstr(path)), "future version");
         check(svdb_disconnect(&db));
     }
 
+    SV_TEST("migrate every earlier schema version")
+    {
+        /* rows from before each migration were hashed with spooky,
+        compressed with xz, archived individually, stored whole, and have
+        no identity and no holes, so the added columns should all read back
+        as 0. */
+        for (uint32_t version = 1; version < 8; version++)
+        {
+            uint32_t gotversion = 0;
+            sv_content_row contentsrow = {};
+            sv_file_row filesrow = {};
+            sv_array chunkids = sv_array_open_u64();
+            TEST_OPEN_EX(svdb_db, db, {});
+            TEST_OPEN_EX(bstring, filepath, bfromcstr("/a"));
+            TEST_OPEN_EX(bstring, path,
+                bformat("%s%sv%u.db", tempdir, pathsep, version));
+            db.path = bstrcpy(path);
+            check(svdb_connection_openhandle(&db));
+            check(tests_create_historical_schema(&db, version));
+            check(svdb_disconnect(&db));
+
+            check(svdb_connect(&db, cstr(path)));
+            check(svdb_getint(&db, s_and_len("SchemaVersion"), &gotversion));
+            TestEqn(8, gotversion);
+            check(svdb_contentsbyid(&db, 1, &contentsrow));
+            TestEqn(1234, contentsrow.hash.data[0]);
+            TestEqn(5, contentsrow.hash.data[3]);
+            TestEqn(6, contentsrow.contents_length);
+            TestEqn(7, contentsrow.compressed_contents_length);
+            TestEqn(8, contentsrow.crc32);
+            TestEqn(9, contentsrow.archivenumber);
+            TestEqn(2, contentsrow.original_collection);
+            TestEqn(3, contentsrow.most_recent_collection);
+            TestEqn(0, contentsrow.hashalgorithm);
+            TestEqn(0, contentsrow.codec);
+            TestEqn(0, contentsrow.blockid);
+            TestEqn(0, contentsrow.blockoffset);
+            TestEqn(0, contentsrow.chunkcount);
+            TestEqn(0, contentsrow.deltabaseid);
+            TestEqn(0, contentsrow.deltadepth);
+            check(svdb_chunksget(&db, 1, &chunkids));
+            TestEqn(0, chunkids.length);
+            check(svdb_filesbypath(&db, filepath, &filesrow));
+            TestEqn(1, filesrow.id);
+            TestEqn(6, filesrow.contents_length);
+            TestEqn(1, filesrow.contents_id);
+            TestEqn(10, filesrow.last_write_time);
+            TestEqn(3, filesrow.most_recent_collection);
+            TestEqn(sv_filerowstatus_complete, filesrow.e_status);
+            TestEqn(0, filesrow.identity.device);
+            TestEqn(0, filesrow.identity.inode);
+            TestEqn(0, filesrow.identity.modtime_ns);
+            TestTrue(!filesrow.sparse);
+
+            /* the current code can write every column to the old rows */
+            contentsrow.id = 1;
+            contentsrow.codec = 2;
+            contentsrow.blockid = 3;
+            contentsrow.deltadepth = 4;
+            check(svdb_contentsupdate(&db, &contentsrow));
+            filesrow.identity.inode = 5;
+            filesrow.sparse = true;
+            check(svdb_filesupdate(&db, &filesrow, NULL));
+            memset(&contentsrow, 0, sizeof(contentsrow));
+            memset(&filesrow, 0, sizeof(filesrow));
+            check(svdb_contentsbyid(&db, 1, &contentsrow));
+            TestEqn(2, contentsrow.codec);
+            TestEqn(3, contentsrow.blockid);
+            TestEqn(4, contentsrow.deltadepth);
+            check(svdb_filesbypath(&db, filepath, &filesrow));
+            TestEqn(5, filesrow.identity.inode);
+            TestTrue(filesrow.sparse);
+            check(svdb_disconnect(&db));
+            sv_array_close(&chunkids);
+        }
+    }
+
     SV_TEST("reject missing schema version")
     {
         TEST_OPEN_EX(svdb_db, db, {});
@@ -67,7 +296,7 @@ SV_BEGIN_TEST_SUITE(tests_open_db_connection)
         quiet_warnings(false);
         check(svdb_getint(&db, s_and_len("SchemaVersion"), &version));
         check(svdb_disconnect(&db));
-        TestEqn(1, version);
+        TestEqn(8, version);
     }
 
     SV_TEST("recover from valid db with no schema")
@@ -84,7 +313,7 @@ SV_BEGIN_TEST_SUITE(tests_open_db_connection)
         quiet_warnings(false);
         check(svdb_getint(&db, s_and_len("SchemaVersion"), &version));
         check(svdb_disconnect(&db));
-        TestEqn(1, version);
+        TestEqn(8, version);
     }
 
     SV_TEST("add rows, read from rows")
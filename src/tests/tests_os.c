@@ -291,6 +291,54 @@ SV_BEGIN_TEST_SUITE(tests_aligned_malloc)
 }
 SV_END_TEST_SUITE()
 
+SV_BEGIN_TEST_SUITE(tests_throttle)
+{
+    SV_TEST("no limit never waits")
+    {
+        os_throttle throttle = {};
+        os_throttle_init(&throttle, 0);
+        uint64_t start = os_clock_monotonic_ms();
+        os_throttle_take(&throttle, 1024ULL * 1024 * 1024);
+        os_throttle_take(&throttle, 1024ULL * 1024 * 1024);
+        TestTrue(os_clock_monotonic_ms() - start < 100);
+        os_throttle_close(&throttle);
+    }
+
+    SV_TEST("waits once a second's worth has been used")
+    {
+        os_throttle throttle = {};
+        os_throttle_init(&throttle, 1024 * 1024);
+        uint64_t start = os_clock_monotonic_ms();
+        os_throttle_take(&throttle, 1024 * 1024);
+        TestTrue(os_clock_monotonic_ms() - start < 100);
+        os_throttle_take(&throttle, 512 * 1024);
+        uint64_t elapsed = os_clock_monotonic_ms() - start;
+        TestTrue(elapsed >= 450 && elapsed < 2000);
+        os_throttle_close(&throttle);
+    }
+
+    SV_TEST("charges bigger than the rate don't build up debt")
+    {
+        os_throttle throttle = {};
+        os_throttle_init(&throttle, 1024 * 1024);
+        uint64_t start = os_clock_monotonic_ms();
+        for (int i = 0; i < 3; i++)
+        {
+            /* each call should wait about 1.5 seconds, except the first,
+            which starts with a full second's worth */
+            uint64_t callstart = os_clock_monotonic_ms();
+            os_throttle_take(&throttle, 1536 * 1024);
+            uint64_t callelapsed = os_clock_monotonic_ms() - callstart;
+            TestTrue(callelapsed < 1800);
+        }
+
+        uint64_t elapsed = os_clock_monotonic_ms() - start;
+        TestTrue(elapsed >= 3400 && elapsed < 4500);
+        os_throttle_close(&throttle);
+    }
+}
+SV_END_TEST_SUITE()
+
 check_result writetextfilehelper(
     const char *dir, const char *leaf, const char *contents, bstring outgetpath)
 {
@@ -771,6 +819,21 @@ static check_result add_file_to_list_callback(void *context,
     return OK;
 }
 
+static bool skip_d3_callback(unused_ptr(void), const bstring dirpath)
+{
+    return s_endwith(cstr(dirpath), pathsep "d3" pathsep);
+}
+
+static check_result fail_at_once_callback(unused_ptr(void),
+    const bstring filepath, unused(uint64_t), unused(uint64_t),
+    unused(const bstring))
+{
+    sv_result currenterr = {};
+    check_b(0, "stopping at %s", cstr(filepath));
+cleanup:
+    return currenterr;
+}
+
 SV_BEGIN_TEST_SUITE(tests_bypattern)
 {
     SV_TEST("delete matches no files")
@@ -1517,6 +1580,76 @@ SV_BEGIN_TEST_SUITE(tests_recurse_dir)
             list);
     }
 
+    SV_TEST("recurse on several threads, same order as one thread")
+    {
+        TEST_OPEN_EX(bstrlist *, expected, bstrlist_open());
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(bstrlist *, msg, bstrlist_open());
+        os_recurse_params params = {
+            expected, tempdir, &add_file_to_list_callback, INT_MAX};
+        check(os_recurse(&params));
+        os_recurse_params paramsthreaded[] = {
+            {list, cstr(d2), &add_file_to_list_callback, INT_MAX, msg, 4},
+            {list, tempdir, &add_file_to_list_callback, INT_MAX, msg, 3},
+        };
+        check(os_recurse_many(paramsthreaded, countof(paramsthreaded)));
+        TestEqn(0, msg->qty);
+        TestEqn(expected->qty + 1, list->qty);
+        TestEqs("f3.txt:3", blist_view(list, 0));
+        for (int i = 0; i < expected->qty; i++)
+        {
+            TestEqs(blist_view(expected, i), blist_view(list, i + 1));
+        }
+    }
+
+    SV_TEST("recurse on several threads, callback fails")
+    {
+        /* the subdirectories are still queued or being listed on the
+        workers when the callback fails on the first entry */
+        TEST_OPEN_EX(bstrlist *, msg, bstrlist_open());
+        TEST_OPEN_EX(bstring, wide, bformat("%s%swide", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, sub, bstring_open());
+        for (int i = 0; i < 64; i++)
+        {
+            bsetfmt(sub, "%s%s%02d%sinner", cstr(wide), pathsep, i,
+                pathsep);
+            check_b(os_create_dirs(cstr(sub)), "");
+        }
+
+        for (uint32_t threads = 1; threads <= 4; threads++)
+        {
+            os_recurse_params params = {NULL, cstr(wide),
+                &fail_at_once_callback, INT_MAX, msg, threads};
+            expect_err_with_message(os_recurse(&params), "stopping at");
+        }
+
+        TestEqn(0, msg->qty);
+        for (int i = 0; i < 64; i++)
+        {
+            bsetfmt(sub, "%s%s%02d%sinner", cstr(wide), pathsep, i,
+                pathsep);
+            check_b(os_remove(cstr(sub)), "");
+            bsetfmt(sub, "%s%s%02d", cstr(wide), pathsep, i);
+            check_b(os_remove(cstr(sub)), "");
+        }
+
+        check_b(os_remove(cstr(wide)), "");
+    }
+
+    SV_TEST("recurse files and dirs, skipping a subtree")
+    {
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(bstrlist *, msg, bstrlist_open());
+        os_recurse_params params = {list, tempdir, &add_file_to_list_callback,
+            INT_MAX, msg, 2, &skip_d3_callback};
+        check(os_recurse(&params));
+        bstrlist_sort(list);
+        TestEqList("d1 \xED\x95\x9C:ffffffffffffffff|"
+                   "d2 \xED\x95\x9C:ffffffffffffffff|"
+                   "d3:ffffffffffffffff|f1.txt:1|f2.txt:2|f3.txt:3",
+            list);
+    }
+
     SV_TEST("recurse files and dirs, hit recursion limit")
     {
         TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
@@ -1647,5 +1780,51 @@ SV_BEGIN_TEST_SUITE(tests_logging)
         sv_log_close(&testlogger);
         TestTrue(os_file_exists(cstr(logpathsecond)));
     }
+
+    SV_TEST("write a performance report")
+    {
+        TEST_OPEN_EX(bstring, jsonpath,
+            bformat("%s%sperf%sgrp_backup.json", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstring, prompath,
+            bformat("%s%sperf%sglacial_backup_grp_backup.prom", tempdir,
+                pathsep, pathsep));
+        TEST_OPEN(bstring, s);
+        sv_perf perf = {};
+        sv_perf_open(&perf, "backup");
+        sv_perf_span span = sv_perf_begin();
+        sv_perf_end(&perf, sv_perf_hash, &span, 100, 0, 1);
+        sv_perf_end(&perf, sv_perf_hash, &span, 200, 0, 1);
+        sv_perf_end(&perf, sv_perf_tar, &span, 300, 40, 2);
+        sv_perf_end(NULL, sv_perf_tar, &span, 300, 40, 2);
+        TestEqn(2, perf.phases[sv_perf_hash].calls);
+        TestEqn(300, perf.phases[sv_perf_hash].bytes_read);
+        TestEqn(2, perf.phases[sv_perf_hash].files);
+        TestEqn(0, perf.phases[sv_perf_compress].calls);
+        sv_perf_write(&perf, tempdir, "grp", true);
+        sv_perf_close(&perf);
+
+        check(sv_file_readfile(cstr(jsonpath), s));
+        TestTrue(s_contains(cstr(s), "\"operation\": \"backup\""));
+        TestTrue(s_contains(cstr(s), "\"success\": true"));
+        TestTrue(s_contains(cstr(s),
+            "{\"phase\": \"tar\", \"calls\": 1, "));
+        TestTrue(s_contains(cstr(s),
+            "\"read_bytes\": 300, \"written_bytes\": 40, \"files\": 2, "));
+        check(sv_file_readfile(cstr(prompath), s));
+        TestTrue(s_contains(cstr(s),
+            "# TYPE glacial_backup_phase_read_bytes gauge\n"));
+        TestTrue(s_contains(cstr(s),
+            "glacial_backup_phase_read_bytes{group=\"grp\","
+            "operation=\"backup\",phase=\"hash\"} 300\n"));
+        TestTrue(s_contains(cstr(s),
+            "glacial_backup_phase_files{group=\"grp\","
+            "operation=\"backup\",phase=\"upload\"} 0\n"));
+        TestTrue(s_contains(cstr(s),
+            "glacial_backup_run_success{group=\"grp\","
+            "operation=\"backup\"} 1\n"));
+        os_get_parent(cstr(jsonpath), s);
+        check(os_tryuntil_deletefiles(cstr(s), "*"));
+        check_b(os_remove(cstr(s)), "");
+    }
 }
 SV_END_TEST_SUITE()
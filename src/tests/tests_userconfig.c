@@ -215,6 +215,17 @@ SV_BEGIN_TEST_SUITE(tests_persist_user_configs)
         grp.root_directories = bstrlist_open();
         grp.separate_metadata = 555;
         grp.pause_duration_seconds = 666;
+        grp.worker_threads = 777;
+        grp.hash_algorithm = 888;
+        grp.read_engine = 999;
+        grp.codec = 1111;
+        grp.codec_level = 2222;
+        grp.solid_threshold_bytes = 3333;
+        grp.chunk_threshold_bytes = 4444;
+        grp.delta_chain_length = 5555;
+        grp.backup_window_minutes = 6666;
+        grp.io_limit_bytes_per_second = 7777;
+        grp.background_priority = 8888;
         grp.grpname = bfromcstr("name");
         bstrlist_splitcstr(grp.exclusion_patterns, "*.aaa|*.bbb|*.ccc", '|');
         bstrlist_splitcstr(grp.root_directories, "/path/1|/path/2", '|');
@@ -230,6 +241,17 @@ SV_BEGIN_TEST_SUITE(tests_persist_user_configs)
         TestEqList("/path/1|/path/2", groupgot.root_directories);
         TestEqn(555, groupgot.separate_metadata);
         TestEqn(666, groupgot.pause_duration_seconds);
+        TestEqn(777, groupgot.worker_threads);
+        TestEqn(888, groupgot.hash_algorithm);
+        TestEqn(999, groupgot.read_engine);
+        TestEqn(1111, groupgot.codec);
+        TestEqn(2222, groupgot.codec_level);
+        TestEqn(3333, groupgot.solid_threshold_bytes);
+        TestEqn(4444, groupgot.chunk_threshold_bytes);
+        TestEqn(5555, groupgot.delta_chain_length);
+        TestEqn(6666, groupgot.backup_window_minutes);
+        TestEqn(7777, groupgot.io_limit_bytes_per_second);
+        TestEqn(8888, groupgot.background_priority);
         TestEqs("name", cstr(groupgot.grpname));
     }
 }
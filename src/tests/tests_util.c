@@ -370,6 +370,60 @@ SV_BEGIN_TEST_SUITE(tests_fnmatch)
         fnmatch_isvalid("ab\x81", msg);
         TestTrue(blength(msg) != 0);
     }
+
+    SV_TEST("compiled patterns give the same results as fnmatch_simple")
+    {
+        const char *patterns[] = {"*.tmp", "*.VC.db", "*.", "/a/b*", "/a/c",
+            "", "?x*", "*/node_modules/*", "*~", "a\\*.o", "*d?r/*.txt"};
+        const char *paths[] = {"", "/", "a.tmp", "/d/a.tmp", "/d.tmp/a",
+            "a.tmp.b", "x.VC.db", "x.db", "/d/a.", "/a/b", "/a/bcd/e", "/a/c",
+            "/a/cd", "/a", "ax", "/x/y", "/n/node_modules/a/b",
+            "/n/node_modules", "file~", "a\\b.o", "/dir/a.txt", "/dr/a.txt",
+            "/d/dxr/b/c.txt"};
+        for (uint32_t mask = 0; mask < (1U << countof(patterns)); mask += 7)
+        {
+            bstrlist *list = bstrlist_open();
+            for (uint32_t i = 0; i < countof(patterns); i++)
+            {
+                if (mask & (1U << i))
+                {
+                    bstrlist_appendcstr(list, patterns[i]);
+                }
+            }
+
+            fnmatch_compiled compiled = fnmatch_compiled_open(list);
+            for (uint32_t i = 0; i < countof(paths); i++)
+            {
+                bool expected = false;
+                for (int j = 0; j < list->qty; j++)
+                {
+                    expected |= fnmatch_simple(blist_view(list, j), paths[i]);
+                }
+
+                TestEqn(expected, fnmatch_compiled_any(&compiled, paths[i]));
+            }
+
+            fnmatch_compiled_close(&compiled);
+            bstrlist_close(list);
+        }
+    }
+
+    SV_TEST("compiled patterns, skip only dirs where every file matches")
+    {
+        bstrlist *list = bstrlist_open();
+        bstrlist_splitcstr(list, "*.tmp|/a/b*|*/node_modules/*|/c/", '|');
+        fnmatch_compiled compiled = fnmatch_compiled_open(list);
+        TestTrue(fnmatch_compiled_anyunder(&compiled, "/a/b/"));
+        TestTrue(fnmatch_compiled_anyunder(&compiled, "/a/bc/"));
+        TestTrue(fnmatch_compiled_anyunder(&compiled, "/x/node_modules/"));
+        TestTrue(fnmatch_compiled_anyunder(&compiled, "/x/node_modules/y/"));
+        TestTrue(!fnmatch_compiled_anyunder(&compiled, "/a/"));
+        TestTrue(!fnmatch_compiled_anyunder(&compiled, "/c/"));
+        TestTrue(!fnmatch_compiled_anyunder(&compiled, "/x.tmp/"));
+        TestTrue(!fnmatch_compiled_anyunder(&compiled, "/x/node_module/"));
+        fnmatch_compiled_close(&compiled);
+        bstrlist_close(list);
+    }
 }
 SV_END_TEST_SUITE()
 
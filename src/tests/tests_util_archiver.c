@@ -20,6 +20,8 @@ check_result create_test_tar(
     const char *tar, const char *tempdir, ar_util *ar, int nfiles);
 check_result create_test_xz(
     const char *xz, const char *tempdir, ar_util *ar, bool large);
+check_result open_test_ar_manager(ar_manager *mgr, const char *tempdir,
+    uint32_t maxsize, uint32_t codec, uint32_t level);
 
 SV_BEGIN_TEST_SUITE(tests_tar)
 {
@@ -82,7 +84,7 @@ SV_BEGIN_TEST_SUITE(tests_tar)
         TEST_OPEN_EX(
             bstring, path, bformat("%s%snot-exist.txt", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(
             ar_util_add(&ar, cstr(tar), cstr(path), "namewithin", 0),
             "Cannot stat: No such file");
@@ -150,7 +152,7 @@ SV_BEGIN_TEST_SUITE(tests_tar)
         TEST_OPEN_EX(sv_array, sizes, sv_array_open_u64());
         TEST_OPEN(ar_util, ar);
         sv_array_add64u(&sizes, 0x1);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(
             tests_tar_list(&ar, cstr(tar), list), "Cannot open: No such");
         expect_err_with_message(ar_util_verify(&ar, cstr(tar), list, &sizes),
@@ -168,7 +170,7 @@ SV_BEGIN_TEST_SUITE(tests_tar)
         TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
         TEST_OPEN_EX(sv_array, arrsizes, sv_array_open_u64());
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(path), "file-a-contents", "wb"));
         check(ar_util_add(&ar, cstr(tar), cstr(path), "0000007b.file",
             os_getfilesize(cstr(path))));
@@ -213,6 +215,62 @@ SV_BEGIN_TEST_SUITE(tests_tar)
             "0000007b.file|000001c8.file|00000315.file|00000316.file", list);
     }
 
+    SV_TEST("tar written in-process can be listed and extracted")
+    {
+        TEST_OPEN_EX(bstring, tar,
+            bformat("%s%s%s.tar", tempdir, pathsep, currentcontext));
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path1, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path2, bformat("%s%s2.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path3, bformat("%s%s3.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(sv_array, arrsizes, sv_array_open_u64());
+        TEST_OPEN3(bstring, restored_to, contents, large);
+        TEST_OPEN(ar_util, ar);
+        ar_tar_writer writer = {};
+        uint64_t sizewritten = 0;
+        bstr_fill(large, 'a', 1000);
+        check(checkbinarypaths(&ar));
+        check(tests_cleardir(cstr(tempsubdir)));
+        check(sv_file_writefile(cstr(path1), "file-contents1", "wb"));
+        check(sv_file_writefile(cstr(path2), "", "wb"));
+        check(sv_file_writefile(cstr(path3), cstr(large), "wb"));
+        check(ar_tar_writer_open(&writer, cstr(tar)));
+        check(ar_tar_writer_add(&writer, cstr(path1), "0000007b.file", NULL));
+        check(ar_tar_writer_add(&writer, cstr(path2), "000001c8.file", NULL));
+        TestEqn(3 * 512, writer.offset);
+
+        /* a failed add leaves the archive as it was */
+        if (islinux)
+        {
+            /* a directory can be opened, but fails on read */
+            expect_err_with_message(
+                ar_tar_writer_add(
+                    &writer, cstr(tempsubdir), "00000315.file", NULL),
+                "couldn't read");
+            TestEqn(3 * 512, writer.offset);
+        }
+
+        check(ar_tar_writer_add(
+            &writer, cstr(path3), "00000316.file", &sizewritten));
+        TestEqn(1000, sizewritten);
+        TestEqn(6 * 512, writer.offset);
+        check(ar_tar_writer_finish(&writer));
+        ar_tar_writer_close(&writer);
+        TestEqn(10240, os_getfilesize(cstr(tar)));
+
+        check(tests_tar_list(&ar, cstr(tar), list));
+        TestEqList("0000007b.file|000001c8.file|00000316.file", list);
+        sv_array_add64u(&arrsizes, strlen("file-contents1"));
+        sv_array_add64u(&arrsizes, 0);
+        sv_array_add64u(&arrsizes, 1000);
+        check(ar_util_verify(&ar, cstr(tar), list, &arrsizes));
+        check(ar_util_extract_overwrite(
+            &ar, cstr(tar), "00000316.file", cstr(tempsubdir), restored_to));
+        check(sv_file_readfile(cstr(restored_to), contents));
+        TestEqs(cstr(large), cstr(contents));
+    }
+
     SV_TEST("validation should fail if incorrect filename given")
     {
         TEST_OPEN_EX(bstring, tar,
@@ -334,7 +392,7 @@ SV_BEGIN_TEST_SUITE(tests_tar)
             bstring, tar, bformat("%s%snotexist.tar", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
         TEST_OPEN(bstring, restored_to);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(
             ar_util_extract_overwrite(&ar, cstr(tar), "*", tempdir, restored_to),
             "Cannot open: No such");
@@ -447,7 +505,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(path), "abcdef", "wb"));
         check(ar_util_xz_add(&ar, cstr(path), cstr(xz)));
         check(ar_util_xz_verify(&ar, cstr(xz)));
@@ -471,7 +529,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(xz), "existing file", "wb"));
         check(sv_file_writefile(cstr(path), "abcdef", "wb"));
         check(ar_util_xz_add(&ar, cstr(path), cstr(xz)));
@@ -495,12 +553,696 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TestEqs("file-contents1", cstr(contents));
     }
 
+#if SV_USE_LIBLZMA
+    SV_TEST("compress into tar in-process")
+    {
+        TEST_OPEN_EX(bstring, tar,
+            bformat("%s%s%s.tar", tempdir, pathsep, currentcontext));
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path1, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path2, bformat("%s%s2.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, xzpath,
+            bformat("%s%s00000316.xz", cstr(tempsubdir), pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(sv_array, arrsizes, sv_array_open_u64());
+        TEST_OPEN4(bstring, restored_to, contents, large, decompressed);
+        TEST_OPEN(ar_util, ar);
+        ar_tar_writer writer = {};
+        os_lockedfilehandle handle = {};
+        uint64_t size1 = 0, size2 = 0;
+        bstr_fill(large, 'a', 250 * 1024);
+        check(checkbinarypaths(&ar));
+        check(tests_cleardir(cstr(tempsubdir)));
+        check(sv_file_writefile(cstr(path1), "", "wb"));
+        check(sv_file_writefile(cstr(path2), cstr(large), "wb"));
+        check(ar_tar_writer_open(&writer, cstr(tar)));
+        check(os_lockedfilehandle_open(&handle, cstr(path1), true, NULL));
+        check(ar_tar_writer_add_compressed(
+            &writer, &handle, "0000007b.xz", ar_codec_xz, 0, &size1));
+        os_lockedfilehandle_close(&handle);
+        check(os_lockedfilehandle_open(&handle, cstr(path2), true, NULL));
+        check(ar_tar_writer_add_compressed(
+            &writer, &handle, "00000316.xz", ar_codec_xz, 0, &size2));
+        os_lockedfilehandle_close(&handle);
+        check(ar_tar_writer_finish(&writer));
+        ar_tar_writer_close(&writer);
+        TestTrue(size1 > 0 && size2 > 0 && size2 < 1024);
+
+        /* tar sees the final compressed sizes */
+        check(tests_tar_list(&ar, cstr(tar), list));
+        TestEqList("0000007b.xz|00000316.xz", list);
+        sv_array_add64u(&arrsizes, size1);
+        sv_array_add64u(&arrsizes, size2);
+        check(ar_util_verify(&ar, cstr(tar), list, &arrsizes));
+
+        /* the xz binary can read what was written */
+        check(ar_util_extract_overwrite(
+            &ar, cstr(tar), "00000316.xz", cstr(tempsubdir), restored_to));
+        check(ar_util_xz_verify(&ar, cstr(xzpath)));
+        bsetfmt(decompressed, "%s%sout.txt", cstr(tempsubdir), pathsep);
+        check(ar_util_xz_extract_overwrite(
+            &ar, cstr(xzpath), cstr(decompressed)));
+        check(sv_file_readfile(cstr(decompressed), contents));
+        TestEqs(cstr(large), cstr(contents));
+    }
+
+    SV_TEST("hash and compress in a single pass")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, xzpath, bformat("%s%s1.xz", tempdir, pathsep));
+        TEST_OPEN3(bstring, large, contents, decompressed);
+        TEST_OPEN(ar_util, ar);
+        ar_encoder enc = ar_encoder_open();
+        os_lockedfilehandle handle = {};
+        hash256 hashexpected = {}, hashgot = {};
+        uint32_t crcexpected = 0, crcgot = 0;
+        uint64_t compressedsize = 0;
+        /* large enough to be mapped by sv_readengine_mmap */
+        for (int i = 0; i < 200 * 1000; i++)
+        {
+            bformata(large, "%d,", i);
+        }
+
+        check(checkbinarypaths(&ar));
+        bsetfmt(decompressed, "%s%sout.txt", tempdir, pathsep);
+        const char *inputs[] = {cstr(large), ""};
+        for (uint32_t i = 0; i < 4 * countof32u(inputs); i++)
+        {
+            /* same hash and crc as reading the file separately */
+            const char *input = inputs[i % countof32u(inputs)];
+            uint32_t algorithm = (i / countof32u(inputs)) % 2
+                ? sv_hashalgorithm_spookytree
+                : sv_hashalgorithm_spooky;
+            uint32_t readengine = i < 2 * countof32u(inputs)
+                ? sv_readengine_read
+                : sv_readengine_mmap;
+            check(sv_file_writefile(cstr(path), input, "wb"));
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, 0, filetype_none, algorithm,
+                sv_readengine_read, &hashexpected, &crcexpected));
+            check(hash_of_file_and_compress(&handle, &enc, ar_codec_xz, 0,
+                cstr(xzpath), algorithm, readengine, &hashgot, &crcgot,
+                &compressedsize));
+            os_lockedfilehandle_close(&handle);
+            TestTrue(memcmp(&hashexpected, &hashgot, sizeof(hashgot)) == 0);
+            TestEqn(crcexpected, crcgot);
+            TestEqn(os_getfilesize(cstr(xzpath)), compressedsize);
+
+            /* the xz binary can read what was written */
+            check(ar_util_xz_verify(&ar, cstr(xzpath)));
+            check(ar_util_xz_extract_overwrite(
+                &ar, cstr(xzpath), cstr(decompressed)));
+            check(sv_file_readfile(cstr(decompressed), contents));
+            TestEqs(input, cstr(contents));
+        }
+
+        ar_encoder_close(&enc);
+    }
+#endif
+
+#if SV_USE_LIBZSTD
+    SV_TEST("archive with zstd, then restore and delete")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path1, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path2, bformat("%s%s2.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%s2.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(sv_array, ids, sv_array_open_u64());
+        TEST_OPEN3(bstring, large, contents, tar);
+        ar_manager mgr = {};
+        uint32_t archivenumber = 0;
+        uint64_t size1 = 0, size2 = 0, blockid = 0, blockoffset = 0;
+        for (int i = 0; i < 100 * 1000; i++)
+        {
+            bformata(large, "%d,", i);
+        }
+
+        check(sv_file_writefile(cstr(path1), "small", "wb"));
+        check(sv_file_writefile(cstr(path2), cstr(large), "wb"));
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, ar_codec_zstd, 19));
+        check(ar_manager_begin(&mgr));
+        check(ar_manager_add(&mgr, cstr(path1), false, 0x7b, &archivenumber,
+            &size1, &blockid, &blockoffset));
+        check(ar_manager_add(&mgr, cstr(path2), false, 0x316, &archivenumber,
+            &size2, &blockid, &blockoffset));
+        check(ar_manager_finish(&mgr));
+        TestTrue(size1 > 0 && size2 > 0);
+        TestTrue(size2 < cast32s32u(blength(large)) / 4);
+        bsetfmt(tar, "%s%s00001_00001.tar", cstr(mgr.path_readytoupload),
+            pathsep);
+        check(tests_tar_list(&mgr.ar, cstr(tar), list));
+        TestEqList("0000007b.zst|00000316.zst|filenames.txt", list);
+
+        /* the contents row says which codec to decompress with */
+        check(tests_cleardir(cstr(tempsubdir)));
+        check(ar_manager_restore(&mgr, cstr(tar), 0x316, ar_codec_zstd, 0, 0,
+            0, NULL, false, cstr(tempsubdir), cstr(restoreto)));
+        check(sv_file_readfile(cstr(restoreto), contents));
+        TestEqs(cstr(large), cstr(contents));
+        expect_err_with_message(ar_manager_restore(&mgr, cstr(tar), 0x316,
+                                    ar_codec_xz, 0, 0, 0, NULL, false,
+                                    cstr(tempsubdir), cstr(restoreto)),
+            "nothing found");
+
+        /* delete removes .zst members too */
+        sv_array_add64u(&ids, 0x316);
+        check(ar_util_delete(
+            &mgr.ar, cstr(tar), tempdir, cstr(tempsubdir), &ids));
+        check(tests_tar_list(&mgr.ar, cstr(tar), list));
+        TestEqList("0000007b.zst|filenames.txt", list);
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("pack small files into solid blocks, then restore and delete")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN_EX(sv_array, ids, sv_array_open_u64());
+        TEST_OPEN4(bstring, large, contents, tar, path);
+        ar_manager mgr = {};
+        uint32_t archivenumber = 0;
+        uint64_t sizes[4] = {0}, blockids[4] = {0}, offsets[4] = {0};
+        for (int i = 0; i < 100 * 1000; i++)
+        {
+            bformata(large, "%d,", i);
+        }
+
+        /* a fits in the first block, b doesn't, so it starts a second. the
+        large file is compressed on its own. */
+        const char *inputs[] = {"int a = 1;", cstr(large), "int b = 2;", ""};
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, ar_codec_zstd, 3));
+        mgr.solid_threshold = 1024;
+        mgr.solid_blocksize = 16;
+        check(ar_manager_begin(&mgr));
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            bsetfmt(path, "%s%s%u.txt", tempdir, pathsep, i);
+            check(sv_file_writefile(cstr(path), inputs[i], "wb"));
+            check(ar_manager_add(&mgr, cstr(path), false, 0x10 + i,
+                &archivenumber, &sizes[i], &blockids[i], &offsets[i]));
+            TestEqn(1, archivenumber);
+        }
+
+        check(ar_manager_finish(&mgr));
+        TestEqn(0x10, blockids[0]);
+        TestEqn(0, blockids[1]);
+        TestEqn(0x12, blockids[2]);
+        TestEqn(0x12, blockids[3]);
+        TestEqn(0, offsets[0]);
+        TestEqn(0, offsets[2]);
+        TestEqn(strlen(inputs[2]), offsets[3]);
+        TestEqn(0, sizes[0]);
+        TestTrue(sizes[1] > 0);
+        bsetfmt(tar, "%s%s00001_00001.tar", cstr(mgr.path_readytoupload),
+            pathsep);
+        check(tests_tar_list(&mgr.ar, cstr(tar), list));
+        TestEqList(
+            "00000011.zst|00000010.blk.zst|00000012.blk.zst|filenames.txt",
+            list);
+
+        /* restore decompresses the block and takes the file's range */
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            check(tests_cleardir(cstr(tempsubdir)));
+            check(ar_manager_restore(&mgr, cstr(tar), 0x10 + i, ar_codec_zstd,
+                blockids[i], offsets[i], strlen(inputs[i]), NULL, false,
+                cstr(tempsubdir), cstr(restoreto)));
+            check(sv_file_readfile(cstr(restoreto), contents));
+            TestEqs(inputs[i], cstr(contents));
+        }
+
+        check(tests_cleardir(cstr(tempsubdir)));
+        expect_err_with_message(
+            ar_manager_restore(&mgr, cstr(tar), 0x13, ar_codec_zstd, 0x12, 8,
+                100, NULL, false, cstr(tempsubdir), cstr(restoreto)),
+            "too short");
+
+        /* a block is deleted by its id */
+        sv_array_add64u(&ids, 0x10);
+        check(ar_util_delete(
+            &mgr.ar, cstr(tar), tempdir, cstr(tempsubdir), &ids));
+        check(tests_tar_list(&mgr.ar, cstr(tar), list));
+        TestEqList("00000011.zst|00000012.blk.zst|filenames.txt", list);
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("pack a block that holds only an empty file")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstring, path, bformat("%s%s0.txt", tempdir, pathsep));
+        TEST_OPEN2(bstring, contents, tar);
+        ar_manager mgr = {};
+        uint32_t archivenumber = 0;
+        uint64_t size = 0, blockid = 0, blockoffset = 0;
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, ar_codec_zstd, 3));
+        mgr.solid_threshold = 1024;
+        check(ar_manager_begin(&mgr));
+        check(sv_file_writefile(cstr(path), "", "wb"));
+        check(ar_manager_add(&mgr, cstr(path), false, 0x18, &archivenumber,
+            &size, &blockid, &blockoffset));
+        check(ar_manager_add_buffer_to_block(&mgr, NULL, 0, "empty", 0x19,
+            &archivenumber, &blockid, &blockoffset));
+        check(ar_manager_finish(&mgr));
+        TestEqn(0x18, blockid);
+        TestEqn(0, blockoffset);
+        bsetfmt(tar, "%s%s00001_00001.tar", cstr(mgr.path_readytoupload),
+            pathsep);
+        check(ar_manager_restore(&mgr, cstr(tar), 0x19, ar_codec_zstd,
+            blockid, blockoffset, 0, NULL, false, cstr(tempsubdir),
+            cstr(restoreto)));
+        check(sv_file_readfile(cstr(restoreto), contents));
+        TestEqs("", cstr(contents));
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("add chunks from memory, then restore them")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN2(bstring, contents, tar);
+        ar_manager mgr = {};
+        uint32_t archivenumbers[2] = {0};
+        uint64_t sizes[2] = {0};
+
+        /* the archive is full after the first chunk, so the second one is
+        moved to the next archive */
+        const char *inputs[] = {"first chunk of data", "second chunk of data"};
+        check(open_test_ar_manager(&mgr, tempdir, 1, ar_codec_zstd, 3));
+        check(ar_manager_begin(&mgr));
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            check(ar_manager_add_buffer(&mgr, (const byte *)inputs[i],
+                strlen32u(inputs[i]), "big.img (chunk)", 0x20 + i,
+                &archivenumbers[i], &sizes[i]));
+            TestTrue(sizes[i] > 0);
+        }
+
+        check(ar_manager_finish(&mgr));
+        TestEqn(1, archivenumbers[0]);
+        TestEqn(2, archivenumbers[1]);
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            bsetfmt(tar, "%s%s00001_%05x.tar", cstr(mgr.path_readytoupload),
+                pathsep, archivenumbers[i]);
+            check(tests_tar_list(&mgr.ar, cstr(tar), list));
+            bsetfmt(contents, "%08x.zst|filenames.txt", 0x20 + i);
+            TestEqList(cstr(contents), list);
+            check(tests_cleardir(cstr(tempsubdir)));
+            check(ar_manager_restore(&mgr, cstr(tar), 0x20 + i, ar_codec_zstd,
+                0, 0, strlen(inputs[i]), NULL, false, cstr(tempsubdir),
+                cstr(restoreto)));
+            check(sv_file_readfile(cstr(restoreto), contents));
+            TestEqs(inputs[i], cstr(contents));
+        }
+
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("a file that doesn't fit is moved to the next archive")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(bstrlist *, list, bstrlist_open());
+        TEST_OPEN4(bstring, path, contents, tar, moved);
+        ar_manager mgr = {};
+        uint32_t archivenumbers[3] = {0};
+        uint64_t sizes[3] = {0}, blockid = 0, blockoffset = 0;
+        const char *inputs[] = {"int a = 1;", "int b = 2;", "int c = 3;"};
+        check(open_test_ar_manager(&mgr, tempdir, 1, ar_codec_zstd, 3));
+        check(ar_manager_begin(&mgr));
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            bsetfmt(path, "%s%s%u.txt", tempdir, pathsep, i);
+            check(sv_file_writefile(cstr(path), inputs[i], "wb"));
+            check(ar_manager_add(&mgr, cstr(path), false, 0x60 + i,
+                &archivenumbers[i], &sizes[i], &blockid, &blockoffset));
+            TestTrue(sizes[i] > 0);
+            TestEqn(0, blockid);
+            TestEqn(i + 1, archivenumbers[i]);
+        }
+
+        /* the bytes moved through the working directory are cleaned up */
+        bsetfmt(moved, "%s%s%08x.zst", cstr(mgr.path_working), pathsep, 0x61);
+        TestTrue(!os_file_exists(cstr(moved)));
+        check(ar_manager_finish(&mgr));
+        for (uint32_t i = 0; i < countof32u(inputs); i++)
+        {
+            bsetfmt(tar, "%s%s00001_%05x.tar", cstr(mgr.path_readytoupload),
+                pathsep, archivenumbers[i]);
+            check(tests_tar_list(&mgr.ar, cstr(tar), list));
+            bsetfmt(contents, "%08x.zst|filenames.txt", 0x60 + i);
+            TestEqList(cstr(contents), list);
+            check(tests_cleardir(cstr(tempsubdir)));
+            check(ar_manager_restore(&mgr, cstr(tar), 0x60 + i, ar_codec_zstd,
+                0, 0, 0, NULL, false, cstr(tempsubdir), cstr(restoreto)));
+            check(sv_file_readfile(cstr(restoreto), contents));
+            TestEqs(inputs[i], cstr(contents));
+        }
+
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("delta encode and apply")
+    {
+        TEST_OPEN_EX(sv_array, base, sv_array_open(1, 0));
+        TEST_OPEN_EX(sv_array, target, sv_array_open(1, 0));
+        TEST_OPEN_EX(sv_array, delta, sv_array_open(1, 0));
+        TEST_OPEN_EX(sv_array, applied, sv_array_open(1, 0));
+        uint32_t seed = 1234;
+        for (uint32_t i = 0; i < 200 * 1000; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            byte b = (byte)('a' + (seed >> 16) % 26);
+            sv_array_append(&base, &b, 1);
+        }
+
+        /* prepend, insert, overwrite and cut off the tail */
+        sv_array_append(&target, "new header", 10);
+        sv_array_append(&target, base.buffer, 50000);
+        sv_array_append(&target, "inserted text", 13);
+        sv_array_append(&target, base.buffer + 50000, 100000);
+        memcpy(target.buffer + 90000, "overwritten", 11);
+        ar_delta_encode(
+            base.buffer, base.length, target.buffer, target.length, &delta);
+        TestTrue(delta.length < 200);
+        check(ar_delta_apply(
+            base.buffer, base.length, delta.buffer, delta.length, &applied));
+        TestEqn(target.length, applied.length);
+        TestTrue(memcmp(target.buffer, applied.buffer, target.length) == 0);
+
+        /* unrelated and empty inputs become literals */
+        ar_delta_encode(base.buffer, 0, target.buffer, target.length, &delta);
+        check(ar_delta_apply(
+            base.buffer, 0, delta.buffer, delta.length, &applied));
+        TestTrue(memcmp(target.buffer, applied.buffer, target.length) == 0);
+        ar_delta_encode(base.buffer, base.length, target.buffer, 0, &delta);
+        check(ar_delta_apply(
+            base.buffer, base.length, delta.buffer, delta.length, &applied));
+        TestEqn(0, applied.length);
+
+        /* malformed deltas are rejected. the first instruction follows the
+        4-byte magic and two 3-byte lengths. */
+        ar_delta_encode(
+            base.buffer, base.length, target.buffer, target.length, &delta);
+        expect_err_with_message(ar_delta_apply(base.buffer, base.length - 1,
+                                    delta.buffer, delta.length, &applied),
+            "expects a base");
+        expect_err_with_message(ar_delta_apply(base.buffer, base.length,
+                                    delta.buffer, delta.length - 1, &applied),
+            "out of range");
+        expect_err_with_message(ar_delta_apply(base.buffer, base.length,
+                                    target.buffer, target.length, &applied),
+            "not a delta");
+        delta.buffer[10] = 'Z';
+        expect_err_with_message(ar_delta_apply(base.buffer, base.length,
+                                    delta.buffer, delta.length, &applied),
+            "unknown delta instruction");
+    }
+
+    SV_TEST("restore a delta against its base")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, basepath, bformat("%s%sbase", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(sv_array, delta, sv_array_open(1, 0));
+        TEST_OPEN3(bstring, base, target, contents);
+        TEST_OPEN(bstring, tar);
+        ar_manager mgr = {};
+        uint32_t archivenumber = 0;
+        uint64_t size = 0;
+        for (uint32_t i = 0; i < 1000; i++)
+        {
+            bformata(base, "line %u of the file\n", i);
+            bformata(target, "line %u of the file%s\n", i,
+                i % 100 == 0 ? ", edited" : "");
+        }
+
+        ar_delta_encode((const byte *)cstr(base), cast32s32u(blength(base)),
+            (const byte *)cstr(target), cast32s32u(blength(target)), &delta);
+        TestTrue(delta.length < cast32s32u(blength(target)) / 10);
+        check(sv_file_writefile(cstr(basepath), cstr(base), "wb"));
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, ar_codec_zstd, 3));
+        check(ar_manager_begin(&mgr));
+        check(ar_manager_add_buffer(&mgr, delta.buffer, delta.length,
+            "file.txt (delta)", 0x30, &archivenumber, &size));
+        check(ar_manager_finish(&mgr));
+        bsetfmt(tar, "%s%s00001_%05x.tar", cstr(mgr.path_readytoupload),
+            pathsep, archivenumber);
+
+        /* the delta is applied to the base during restore */
+        check(tests_cleardir(cstr(tempsubdir)));
+        check(ar_manager_restore(&mgr, cstr(tar), 0x30, ar_codec_zstd, 0, 0,
+            0, cstr(basepath), false, cstr(tempsubdir), cstr(restoreto)));
+        check(sv_file_readfile(cstr(restoreto), contents));
+        TestEqs(cstr(target), cstr(contents));
+
+        /* applying to the wrong base fails */
+        bcatcstr(base, "x");
+        check(sv_file_writefile(cstr(basepath), cstr(base), "wb"));
+        check(tests_cleardir(cstr(tempsubdir)));
+        expect_err_with_message(
+            ar_manager_restore(&mgr, cstr(tar), 0x30, ar_codec_zstd, 0, 0, 0,
+                cstr(basepath), false, cstr(tempsubdir), cstr(restoreto)),
+            "expects a base");
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("restore a file that was appended to")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, basepath, bformat("%s%sbase", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%sout.txt", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(sv_array, delta, sv_array_open(1, 0));
+        TEST_OPEN_EX(sv_array, applied, sv_array_open(1, 0));
+        TEST_OPEN4(bstring, base, tail, contents, tar);
+        ar_manager mgr = {};
+        uint32_t archivenumber = 0;
+        uint64_t size = 0;
+        for (uint32_t i = 0; i < 1000; i++)
+        {
+            bformata(i < 900 ? base : tail, "message %u\n", i);
+        }
+
+        /* the delta holds the tail and one copy of the whole base */
+        ar_delta_encode_append(cast32s32u(blength(base)),
+            (const byte *)cstr(tail), cast32s32u(blength(tail)), &delta);
+        TestTrue(delta.length < cast32s32u(blength(tail)) + 20);
+        check(ar_delta_apply((const byte *)cstr(base),
+            cast32s32u(blength(base)), delta.buffer, delta.length, &applied));
+        bsetfmt(contents, "%s%s", cstr(base), cstr(tail));
+        TestEqn(blength(contents), applied.length);
+        TestTrue(memcmp(cstr(contents), applied.buffer, applied.length) == 0);
+
+        check(sv_file_writefile(cstr(basepath), cstr(base), "wb"));
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, ar_codec_zstd, 3));
+        check(ar_manager_begin(&mgr));
+        check(ar_manager_add_buffer(&mgr, delta.buffer, delta.length,
+            "file.log (appended)", 0x40, &archivenumber, &size));
+        check(ar_manager_finish(&mgr));
+        bsetfmt(tar, "%s%s00001_%05x.tar", cstr(mgr.path_readytoupload),
+            pathsep, archivenumber);
+        check(tests_cleardir(cstr(tempsubdir)));
+        check(ar_manager_restore(&mgr, cstr(tar), 0x40, ar_codec_zstd, 0, 0,
+            0, cstr(basepath), false, cstr(tempsubdir), cstr(restoreto)));
+        check(sv_file_readfile(cstr(restoreto), contents));
+        bconcat(base, tail);
+        TestEqs(cstr(base), cstr(contents));
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST_LIN("hash and restore a sparse file")
+    {
+        TEST_OPEN_EX(bstring, tempsubdir, bformat("%s%ssub", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, path, bformat("%s%ssparse", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, dense, bformat("%s%sdense", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, restoreto,
+            bformat("%s%srestored%ssparse", tempdir, pathsep, pathsep));
+        TEST_OPEN_EX(sv_array, expected, sv_array_open(1, 0));
+        TEST_OPEN_EX(sv_array, got, sv_array_open(1, 0));
+        TEST_OPEN(bstring, tar);
+        ar_manager mgr = {};
+        sv_file file = {};
+        os_lockedfilehandle handle = {};
+        struct stat64 st = {};
+        hash256 hashexpected = {}, hashgot = {};
+        uint32_t crcexpected = 0, crcgot = 0, archivenumber = 0;
+        uint64_t size = 0, blockid = 0, blockoffset = 0;
+        const uint64_t filesize = 8 * 1024 * 1024;
+
+        /* a hole, a little data, then a longer hole */
+        check(sv_file_open(&file, cstr(path), "wb"));
+        TestEqn(0, fseeko(file.file, 3 * 1024 * 1024 + 100, SEEK_SET));
+        TestEqn(1, fwrite("data", 4, 1, file.file));
+        TestEqn(0, fflush(file.file));
+        TestEqn(0, ftruncate(fileno(file.file), cast64u64s(filesize)));
+        sv_file_close(&file);
+        TestEqn(0, stat64(cstr(path), &st));
+        TestTrue(cast64s64u(st.st_blocks) * 512 < filesize / 2);
+        check(ar_util_readall(cstr(path), &expected));
+        TestEqn(filesize, expected.length);
+        check(sv_file_open(&file, cstr(dense), "wb"));
+        TestEqn(1, fwrite(expected.buffer, expected.length, 1, file.file));
+        sv_file_close(&file);
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        TestTrue(os_lockedfilehandle_sparse(&handle));
+        os_lockedfilehandle_close(&handle);
+        check(os_lockedfilehandle_open(&handle, cstr(dense), true, NULL));
+        TestTrue(!os_lockedfilehandle_sparse(&handle));
+        os_lockedfilehandle_close(&handle);
+
+        /* holes hash the same as the zeros stored densely */
+        for (uint32_t i = 0; i < 3; i++)
+        {
+            uint32_t algorithm =
+                i == 2 ? sv_hashalgorithm_spookytree : sv_hashalgorithm_spooky;
+            uint32_t readengine =
+                i == 1 ? sv_readengine_mmap : sv_readengine_read;
+            check(os_lockedfilehandle_open(
+                &handle, cstr(dense), true, NULL));
+            check(hash_of_file(&handle, 0, filetype_none, algorithm,
+                sv_readengine_read, &hashexpected, &crcexpected));
+            os_lockedfilehandle_close(&handle);
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, 0, filetype_none, algorithm,
+                readengine, &hashgot, &crcgot));
+            os_lockedfilehandle_close(&handle);
+            TestTrue(memcmp(&hashexpected, &hashgot, sizeof(hashgot)) == 0);
+            TestEqn(crcexpected, crcgot);
+        }
+
+        /* the restored file has its holes back, whichever the codec, and a
+        file that was dense stays dense even though it's mostly zeros */
+        const uint32_t codecs[] = {ar_codec_zstd, ar_codec_xz};
+        check(open_test_ar_manager(
+            &mgr, tempdir, 64 * 1024 * 1024, codecs[0], 0));
+        for (uint32_t i = 0; i < countof32u(codecs); i++)
+        {
+            mgr.codec = codecs[i];
+            check(ar_manager_begin(&mgr));
+            check(ar_manager_add(&mgr, cstr(path), false, 0x50, &archivenumber,
+                &size, &blockid, &blockoffset));
+            check(ar_manager_finish(&mgr));
+            TestTrue(size > 0 && size < 64 * 1024);
+            bsetfmt(tar, "%s%s00001_%05x.tar", cstr(mgr.path_readytoupload),
+                pathsep, archivenumber);
+            for (uint32_t sparse = 0; sparse < 2; sparse++)
+            {
+                check(tests_cleardir(cstr(tempsubdir)));
+                check(ar_manager_restore(&mgr, cstr(tar), 0x50, codecs[i], 0,
+                    0, 0, NULL, sparse != 0, cstr(tempsubdir),
+                    cstr(restoreto)));
+                check(ar_util_readall(cstr(restoreto), &got));
+                TestEqn(expected.length, got.length);
+                TestTrue(memcmp(expected.buffer, got.buffer, got.length) == 0);
+                TestEqn(0, stat64(cstr(restoreto), &st));
+                TestEqn(sparse != 0,
+                    cast64s64u(st.st_blocks) * 512 < filesize / 2);
+            }
+        }
+
+        ar_manager_close(&mgr);
+    }
+
+    SV_TEST("hash and compress with zstd at several levels")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, zstpath, bformat("%s%s1.zst", tempdir, pathsep));
+        TEST_OPEN3(bstring, large, contents, decompressed);
+        TEST_OPEN(ar_util, ar);
+        ar_encoder enc = ar_encoder_open();
+        os_lockedfilehandle handle = {};
+        hash256 hashexpected = {}, hashgot = {};
+        uint32_t crcexpected = 0, crcgot = 0;
+        uint64_t sizes[3] = {0};
+        for (int i = 0; i < 200 * 1000; i++)
+        {
+            bformata(large, "%d,", i % 5000);
+        }
+
+        bsetfmt(decompressed, "%s%sout.txt", tempdir, pathsep);
+        const uint32_t levels[] = {1, 19, 19};
+        const char *inputs[] = {cstr(large), cstr(large), ""};
+        for (uint32_t i = 0; i < countof32u(levels); i++)
+        {
+            check(sv_file_writefile(cstr(path), inputs[i], "wb"));
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, 0, filetype_none,
+                sv_hashalgorithm_spooky, sv_readengine_read, &hashexpected,
+                &crcexpected));
+            check(hash_of_file_and_compress(&handle, &enc, ar_codec_zstd,
+                levels[i], cstr(zstpath), sv_hashalgorithm_spooky,
+                sv_readengine_read, &hashgot, &crcgot, &sizes[i]));
+            os_lockedfilehandle_close(&handle);
+            TestTrue(memcmp(&hashexpected, &hashgot, sizeof(hashgot)) == 0);
+            TestEqn(crcexpected, crcgot);
+            TestEqn(os_getfilesize(cstr(zstpath)), sizes[i]);
+            check(ar_util_zstd_extract_overwrite(
+                &ar, cstr(zstpath), cstr(decompressed), false));
+            check(sv_file_readfile(cstr(decompressed), contents));
+            TestEqs(inputs[i], cstr(contents));
+        }
+
+        /* the input repeats every ~25k, which long-distance matching finds */
+        TestTrue(sizes[1] <= sizes[0]);
+        TestTrue(sizes[0] < cast32s32u(blength(large)) / 20);
+        TestTrue(sizes[2] > 0);
+        ar_encoder_close(&enc);
+    }
+
+    SV_TEST_LIN("zstd extract should fail on truncated file")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%s1.txt", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, zstpath, bformat("%s%s1.zst", tempdir, pathsep));
+        TEST_OPEN2(bstring, large, decompressed);
+        TEST_OPEN(ar_util, ar);
+        ar_encoder enc = ar_encoder_open();
+        os_lockedfilehandle handle = {};
+        hash256 hash = {};
+        uint32_t crc = 0;
+        uint64_t size = 0;
+        for (int i = 0; i < 100 * 1000; i++)
+        {
+            bformata(large, "%d,", i);
+        }
+
+        bsetfmt(decompressed, "%s%sout.txt", tempdir, pathsep);
+        check(sv_file_writefile(cstr(path), cstr(large), "wb"));
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        check(hash_of_file_and_compress(&handle, &enc, ar_codec_zstd, 3,
+            cstr(zstpath), sv_hashalgorithm_spooky, sv_readengine_read, &hash,
+            &crc, &size));
+        os_lockedfilehandle_close(&handle);
+        TestEqn(0, truncate(cstr(zstpath), cast64u64s(size / 2)));
+        expect_err_with_message(
+            ar_util_zstd_extract_overwrite(
+                &ar, cstr(zstpath), cstr(decompressed), false),
+            "truncated");
+        ar_encoder_close(&enc);
+    }
+#endif
+
     SV_TEST("validate should fail on corrupt file with no header")
     {
         TEST_OPEN_EX(
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(xz), "not-a-valid-xz-file", "wb"));
         expect_err_with_message(
             ar_util_xz_verify(&ar, cstr(xz)), "File format not recognized");
@@ -564,7 +1306,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TEST_OPEN_EX(
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(xz), "", "wb"));
         expect_err_with_message(ar_util_xz_verify(&ar, cstr(xz)), "0 bytes");
     }
@@ -574,7 +1316,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TEST_OPEN_EX(
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(ar_util_xz_verify(&ar, cstr(xz)),
             islinux ? "see short path" : "get short path");
     }
@@ -599,7 +1341,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TEST_OPEN_EX(
             bstring, path, bformat("%s%snot-exist.txt", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(ar_util_xz_add(&ar, cstr(path), cstr(xz)),
             islinux ? "see short path" : "get short path");
     }
@@ -611,7 +1353,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         TEST_OPEN_EX(os_lockedfilehandle, handle, {});
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(path), "abcdef", "wb"));
         check(tests_lockfile(true, cstr(path), &handle));
         expect_err_with_message(
@@ -626,7 +1368,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         TEST_OPEN_EX(os_lockedfilehandle, handle, {});
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         check(sv_file_writefile(cstr(path), "abcdef", "wb"));
         check(sv_file_writefile(cstr(xz), "", "wb"));
         check(tests_lockfile(true, cstr(xz), &handle));
@@ -674,7 +1416,7 @@ SV_BEGIN_TEST_SUITE(tests_xz)
             bstring, xz, bformat("%s%s%s.xz", tempdir, pathsep, currentcontext));
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         TEST_OPEN(ar_util, ar);
-        check(checkbinarypaths(&ar, false, tempdir));
+        check(checkbinarypaths(&ar));
         expect_err_with_message(
             ar_util_xz_extract_overwrite(&ar, cstr(xz), cstr(path)),
             islinux ? "see short path" : "get short path");
@@ -705,7 +1447,7 @@ SV_BEGIN_TEST_SUITE(whole_tests_archive_filenames)
     TEST_OPEN_EX(bstring, file_name3,
         bformat("%s%s%s", dir, pathsep, "-beginswithdash and has spaces"));
     bstr_fill(large, 'a', 250 * 1024);
-    check(checkbinarypaths(&ar, false, NULL));
+    check(checkbinarypaths(&ar));
     check(tests_cleardir(cstr(restoreto)));
     check(sv_file_writefile(cstr(file_normal), cstr(file_normal), "wb"));
     check(sv_file_writefile(cstr(file_large), cstr(large), "wb"));
@@ -871,7 +1613,7 @@ check_result create_test_xz(
 {
     sv_result currenterr = {};
     bstring path = bformat("%s%sinput.txt", tempdir, pathsep);
-    check(checkbinarypaths(ar, false, tempdir));
+    check(checkbinarypaths(ar));
     if (large)
     {
         sv_file file = {};
@@ -906,7 +1648,7 @@ check_result create_test_tar(
     bstring path2 = bformat("%s%sb.txt", tempdir, pathsep);
     bstring path3 = bformat("%s%sc.txt", tempdir, pathsep);
     bstring path4 = bformat("%s%sd.txt", tempdir, pathsep);
-    check(checkbinarypaths(ar, false, tempdir));
+    check(checkbinarypaths(ar));
     check(sv_file_writefile(cstr(path1), "file-contents1", "wb"));
     check(sv_file_writefile(cstr(path2), "file-contents11", "wb"));
     check(sv_file_writefile(cstr(path3), "file-contents111", "wb"));
@@ -931,3 +1673,21 @@ cleanup:
     bdestroy(path4);
     return currenterr;
 }
+
+/* an archiver that keeps its directories under tempdir, ready to begin */
+check_result open_test_ar_manager(ar_manager *mgr, const char *tempdir,
+    uint32_t maxsize, uint32_t codec, uint32_t level)
+{
+    sv_result currenterr = {};
+    check(ar_manager_open(mgr, tempdir, "grp", 1, maxsize));
+    check(checkbinarypaths(&mgr->ar));
+    bsetfmt(mgr->path_working, "%s%sworking", tempdir, pathsep);
+    bsetfmt(mgr->path_staging, "%s%sstaging", tempdir, pathsep);
+    bsetfmt(mgr->path_readytoupload, "%s%sready", tempdir, pathsep);
+    mgr->codec = codec;
+    mgr->codec_level = level;
+    TestTrue(os_create_dirs(cstr(mgr->path_readytoupload)));
+
+cleanup:
+    return currenterr;
+}
@@ -15,124 +15,190 @@ GNU General Public License for more details.
 #include "tests.h"
 #include <math.h>
 
-SV_BEGIN_TEST_SUITE(tests_read_md5_string)
+void get_tar_version_from_string(bstring s, double *outversion);
+
+void get_hash(const char *path, bool sepmetadata, hash256 *h, uint32_t *crc)
 {
-    SV_TEST("assign zeros")
-    {
-        hash256 h = {};
-        memset(&h, 1, sizeof(h));
-        h = hash256zeros;
-        TestEqn(0, h.data[0]);
-        TestEqn(0, h.data[1]);
-        TestEqn(0, h.data[2]);
-        TestEqn(0, h.data[3]);
-    }
+    *h = hash256zeros;
+    *crc = UINT32_MAX;
+    os_lockedfilehandle handle = {};
+    check_warn(
+        os_lockedfilehandle_open(&handle, path, true, NULL), "", exit_on_err);
 
-    SV_TEST("read")
-    {
-        hash256 h = {};
-        TestTrue(readhash("abc\nPress [q] to stop, [?] for "
-                          "help\nMD5=1122334455667788a1a2a3a4a5a6a7a8",
-            &h));
-        TestEqn(0x8877665544332211ULL, h.data[0]);
-        TestEqn(0xa8a7a6a5a4a3a2a1ULL, h.data[1]);
-        TestEqn(0, h.data[2]);
-        TestEqn(0, h.data[3]);
-    }
+    check_warn(hash_of_file(&handle, sepmetadata ? 1 : 0,
+                   sepmetadata ? filetype_mp3 : filetype_binary,
+                   sv_hashalgorithm_spooky, sv_readengine_read, h, crc),
+        "", exit_on_err);
 
-    SV_TEST("read, windows newlines")
-    {
-        hash256 h = {};
-        TestTrue(readhash("abc\r\nPress [q] to stop, [?] for "
-                          "help\r\nMD5=1122334455667788a1a2a3a4a5a6a7a8",
-            &h));
-        TestEqn(0x8877665544332211ULL, h.data[0]);
-        TestEqn(0xa8a7a6a5a4a3a2a1ULL, h.data[1]);
-        TestEqn(0, h.data[2]);
-        TestEqn(0, h.data[3]);
-    }
+    os_lockedfilehandle_close(&handle);
+}
 
-    SV_TEST("read, intervening message")
-    {
-        hash256 h = {};
-        TestTrue(
-            readhash("abc\nPress [q] to stop, [?] for "
-                     "help\nNo more output streams to write to, finishing.\n"
-                     "MD5=1122334455667788a1a2a3a4a5a6a7a8\n0",
-                &h));
-        TestEqn(0x8877665544332211ULL, h.data[0]);
-        TestEqn(0xa8a7a6a5a4a3a2a1ULL, h.data[1]);
-        TestEqn(0, h.data[2]);
-        TestEqn(0, h.data[3]);
-    }
+bool get_incompressible(sv_compress_classifier *classifier, const char *path,
+    const byte *data, uint32_t len)
+{
+    bool incompressible = false;
+    sv_file f = {};
+    os_lockedfilehandle handle = {};
+    check_warn(sv_file_open(&f, path, "wb"), "", exit_on_err);
+    check_fatal(fwrite(data, 1, len, f.file) == len, "couldn't write");
+    sv_file_close(&f);
+    check_warn(
+        os_lockedfilehandle_open(&handle, path, true, NULL), "", exit_on_err);
+    check_warn(sv_compress_classifier_run(
+                   classifier, path, handle.fd, len, &incompressible),
+        "", exit_on_err);
+    os_lockedfilehandle_close(&handle);
+    return incompressible;
+}
+
+void write_test_bytes(const char *path, bstring contents)
+{
+    sv_file f = {};
+    uint32_t len = cast32s32u(contents->slen);
+    check_warn(sv_file_open(&f, path, "wb"), "", exit_on_err);
+    check_fatal(
+        fwrite(contents->data, 1, len, f.file) == len, "couldn't write");
+    sv_file_close(&f);
+}
+
+/* separateaudio on, with the hash of the whole file as the fallback */
+void get_audio_hash(const char *path, efiletype ext, hash256 *h)
+{
+    uint32_t crc = 0;
+    *h = hash256zeros;
+    os_lockedfilehandle handle = {};
+    check_warn(
+        os_lockedfilehandle_open(&handle, path, true, NULL), "", exit_on_err);
+
+    quiet_warnings(true);
+    check_warn(hash_of_file(&handle, 1, ext, sv_hashalgorithm_spooky,
+                   sv_readengine_read, h, &crc),
+        "", exit_on_err);
+
+    quiet_warnings(false);
+    os_lockedfilehandle_close(&handle);
+}
+
+bool audio_hash_matches_whole_file(const char *path, efiletype ext)
+{
+    hash256 audio = {}, whole = {};
+    uint32_t crc = 0;
+    get_audio_hash(path, ext, &audio);
+    get_hash(path, false, &whole, &crc);
+    return memcmp(&audio, &whole, sizeof(audio)) == 0;
+}
+
+bool audio_hashes_match(
+    const char *path, efiletype ext, bstring contents1, bstring contents2)
+{
+    hash256 h1 = {}, h2 = {};
+    write_test_bytes(path, contents1);
+    get_audio_hash(path, ext, &h1);
+    write_test_bytes(path, contents2);
+    get_audio_hash(path, ext, &h2);
+    return memcmp(&h1, &h2, sizeof(h1)) == 0;
+}
 
-    SV_TEST("reading should skip over other text")
+/* a streaminfo block, a vorbis comment block holding the tag, then frames */
+bstring make_test_flac(const char *tag, byte payload)
+{
+    bstring s = bstring_open();
+    byte streaminfo[4 + 34] = {0x00, 0x00, 0x00, 34};
+    byte comment[4] = {0x84, 0x00, 0x00, (byte)strlen(tag)};
+    byte frames[64] = {0xff, 0xf8};
+    for (uint32_t i = 2; i < countof(frames); i++)
     {
-        hash256 h = {};
-        TestTrue(readhash("\nPress [q] to stop"
-                          "\nMMD5=0000004455667788a1a2a3a4a5a6a7a8"
-                          "\nPress [q] to stop, [?] for "
-                          "help\nMD5=1122334455667788a1a2a3a4a5a6a7a8"
-                          "other text",
-            &h));
-        TestEqn(0x8877665544332211ULL, h.data[0]);
-        TestEqn(0xa8a7a6a5a4a3a2a1ULL, h.data[1]);
-        TestEqn(0, h.data[2]);
-        TestEqn(0, h.data[3]);
+        frames[i] = (byte)(payload + i);
     }
 
-    SV_TEST("reading empty string should return false")
+    bcatblk(s, "fLaC", 4);
+    bcatblk(s, streaminfo, sizeof32s(streaminfo));
+    bcatblk(s, comment, sizeof32s(comment));
+    bcatblk(s, tag, cast64u32s(strlen(tag)));
+    bcatblk(s, frames, sizeof32s(frames));
+    return s;
+}
+
+/* a page holding one packet, or the start of one if it doesn't end here */
+void append_ogg_page(bstring s, byte flags, uint32_t seq, const byte *data,
+    uint32_t len, bool ends)
+{
+    byte header[27 + 255] = {'O', 'g', 'g', 'S', 0x00, flags};
+    header[14] = 0x5a;
+    header[18] = (byte)seq;
+    uint32_t segments = len / 255;
+    memset(header + 27, 255, segments);
+    if (ends)
     {
-        hash256 h = {};
-        TestTrue(!readhash("", &h));
+        header[27 + segments++] = (byte)(len % 255);
     }
 
-    SV_TEST("reading string with non hex chars should return false")
+    header[26] = (byte)segments;
+    bcatblk(s, header, cast32u32s(27 + segments));
+    bcatblk(s, data, cast32u32s(len));
+}
+
+/* identification, comment, and audio packets. a comment packet too long
+for one page continues onto a second page. */
+bstring make_test_ogg(const char *tag, byte payload)
+{
+    bstring s = bstring_open();
+    bstring comment = bfromcstr("\x03vorbis");
+    bcatcstr(comment, tag);
+    byte ident[30] = "\x01vorbis";
+    byte audio[400] = {0};
+    for (uint32_t i = 0; i < countof(audio); i++)
     {
-        hash256 h = {};
-        TestTrue(!readhash("\nPress [q] to stop, [?] for "
-                           "help\nMD5=1122334455667788a1a2a3a4a5a6a7x",
-            &h));
+        audio[i] = (byte)(payload + i);
     }
 
-    SV_TEST("reading string that is too short should return false")
+    uint32_t seq = 0;
+    uint32_t commentlen = cast32s32u(comment->slen);
+    append_ogg_page(s, 0x02, seq++, ident, sizeof32u(ident), true);
+    if (commentlen > 255)
     {
-        hash256 h = {};
-        TestTrue(!readhash("\nPress [q] to stop, [?] for "
-                           "help\nMD5=\nother text",
-            &h));
+        append_ogg_page(s, 0x00, seq++, comment->data, 255, false);
+        append_ogg_page(
+            s, 0x01, seq++, comment->data + 255, commentlen - 255, true);
     }
-
-    SV_TEST("reading string that is too short should return false")
+    else
     {
-        hash256 h = {};
-        TestTrue(!readhash("\nPress [q] to stop, [?] for "
-                           "help\nMD5=1122334455667788a1a2a3a4a5a6a7a",
-            &h));
+        append_ogg_page(s, 0x00, seq++, comment->data, commentlen, true);
     }
-}
-SV_END_TEST_SUITE()
 
-void get_tar_version_from_string(bstring s, double *outversion);
+    append_ogg_page(s, 0x00, seq++, audio, 100, true);
+    append_ogg_page(s, 0x04, seq++, audio + 100, 300, true);
+    bdestroy(comment);
+    return s;
+}
 
-void get_hash(const char *path, const char *tempdir, bool sepmetadata,
-    hash256 *h, uint32_t *crc)
+void append_mp4_atom(
+    bstring s, const char *type, const void *data, uint32_t len)
 {
-    *h = hash256zeros;
-    *crc = UINT32_MAX;
-    ar_util ar = ar_util_open();
-    os_lockedfilehandle handle = {};
-    check_warn(
-        os_lockedfilehandle_open(&handle, path, true, NULL), "", exit_on_err);
+    byte header[8] = {(byte)((len + 8) >> 24), (byte)((len + 8) >> 16),
+        (byte)((len + 8) >> 8), (byte)(len + 8)};
+    memcpy(header + 4, type, 4);
+    bcatblk(s, header, sizeof32s(header));
+    bcatblk(s, data, cast32u32s(len));
+}
 
-    check_warn(checkbinarypaths(&ar, !!sepmetadata, tempdir), "", exit_on_err);
-    check_warn(hash_of_file(&handle, sepmetadata ? 1 : 0,
-                   sepmetadata ? filetype_mp3 : filetype_binary,
-                   sepmetadata ? cstr(ar.audiotag_binary) : "", h, crc),
-        "", exit_on_err);
+/* the tag is kept in moov/udta, before the mdat */
+bstring make_test_mp4(const char *tag, byte payload)
+{
+    bstring s = bstring_open();
+    bstring moov = bstring_open();
+    byte mdat[200] = {0};
+    for (uint32_t i = 0; i < countof(mdat); i++)
+    {
+        mdat[i] = (byte)(payload + i);
+    }
 
-    os_lockedfilehandle_close(&handle);
-    ar_util_close(&ar);
+    append_mp4_atom(moov, "udta", tag, cast64u32u(strlen(tag)));
+    append_mp4_atom(s, "ftyp", "M4A \0\0\0\0", 8);
+    append_mp4_atom(s, "moov", moov->data, cast32s32u(moov->slen));
+    append_mp4_atom(s, "mdat", mdat, sizeof32u(mdat));
+    bdestroy(moov);
+    return s;
 }
 
 SV_BEGIN_TEST_SUITE(tests_get_version)
@@ -245,13 +311,65 @@ SV_END_TEST_SUITE()
 
 SV_BEGIN_TEST_SUITE(tests_hash_audio)
 {
+    SV_TEST("crc32 of check string, every kernel")
+    {
+        for (int k = 0; k < sv_crc32_kernel_count; k++)
+        {
+            if (sv_crc32_kernel_supported((sv_crc32_kernel)k))
+            {
+                TestEqn(0xcbf43926,
+                    sv_crc32_kernel_run((sv_crc32_kernel)k, 0, "123456789", 9));
+            }
+        }
+
+        TestEqn(0xcbf43926, sv_crc32(0, "123456789", 9));
+        TestEqn(0, sv_crc32(0, "", 0));
+    }
+
+    SV_TEST("crc32 kernels agree for any length and alignment")
+    {
+        byte buf[1100] = {};
+        uint32_t state = 12345;
+        for (uint32_t i = 0; i < countof(buf); i++)
+        {
+            state = state * 1103515245 + 12345;
+            buf[i] = (byte)(state >> 16);
+        }
+
+        const uint64_t lengths[] = {
+            0, 1, 7, 15, 16, 17, 63, 64, 65, 127, 128, 200, 1024, 1083};
+        for (uint32_t offset = 0; offset < 17; offset++)
+        {
+            for (uint32_t i = 0; i < countof(lengths); i++)
+            {
+                uint32_t expected = sv_crc32_kernel_run(
+                    sv_crc32_kernel_bytewise, 0, buf + offset, lengths[i]);
+                for (int k = 0; k < sv_crc32_kernel_count; k++)
+                {
+                    if (sv_crc32_kernel_supported((sv_crc32_kernel)k))
+                    {
+                        TestEqn(expected,
+                            sv_crc32_kernel_run((sv_crc32_kernel)k, 0,
+                                buf + offset, lengths[i]));
+                    }
+                }
+
+                /* computing in two parts gives the same result */
+                uint64_t half = lengths[i] / 2;
+                TestEqn(expected,
+                    sv_crc32(sv_crc32(0, buf + offset, half),
+                        buf + offset + half, lengths[i] - half));
+            }
+        }
+    }
+
     SV_TEST("hash of text file")
     {
         hash256 h = {};
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         check(sv_file_writefile(cstr(path), "abcde", "wb"));
-        get_hash(cstr(path), tempdir, false, &h, &crc32);
+        get_hash(cstr(path), false, &h, &crc32);
         TestTrue(0x4d36bf2cf609ea58ULL == h.data[0] &&
             0x19b91b8a95e63aadULL == h.data[1]);
         TestTrue(0x1f1242b808bf0428ULL == h.data[2] &&
@@ -259,13 +377,423 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         TestEqn(0x8587d865, crc32);
     }
 
+    SV_TEST("crc32 of two parts can be combined")
+    {
+        const char *s = "the quick brown fox jumps over the lazy dog";
+        for (uint32_t split = 0; split <= strlen32u(s); split++)
+        {
+            uint32_t first = sv_crc32(0, s, split);
+            uint32_t second = sv_crc32(0, s + split, strlen32u(s) - split);
+            TestEqn(sv_crc32(0, s, strlen32u(s)),
+                sv_crc32_combine(first, second, strlen32u(s) - split));
+        }
+    }
+
+    SV_TEST("tree hash of text file")
+    {
+        hash256 h = {};
+        uint32_t crc32 = 0;
+        os_lockedfilehandle handle = {};
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
+        check(sv_file_writefile(cstr(path), "abcde", "wb"));
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        check(hash_of_file(&handle, false, filetype_binary,
+            sv_hashalgorithm_spookytree, sv_readengine_read, &h, &crc32));
+        os_lockedfilehandle_close(&handle);
+        TestTrue(0x4679fa9bd643d5ddULL == h.data[0] &&
+            0x20f60ca488bac733ULL == h.data[1]);
+        TestTrue(0xcc7ec70597718098ULL == h.data[2] &&
+            0xa4bd7dc505c23670ULL == h.data[3]);
+        TestEqn(0x8587d865, crc32);
+    }
+
+    SV_TEST("tree hash is the same however the input is split")
+    {
+        hash256 expected = {}, got = {};
+        uint32_t crcgot = 0;
+        uint32_t len = cast64u32u(9 * SvTreeHashLeafSize + 12345);
+        byte *buf = sv_calloc(len, 1);
+        uint32_t state = 12345;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            state = state * 1103515245 + 12345;
+            buf[i] = (byte)(state >> 16);
+        }
+
+        TEST_OPEN_EX(bstring, path, bformat("%s%sbig.bin", tempdir, pathsep));
+        sv_file f = {};
+        check(sv_file_open(&f, cstr(path), "wb"));
+        TestEqn(len, fwrite(buf, 1, len, f.file));
+        sv_file_close(&f);
+
+        sv_contenthash tree = {};
+        sv_contenthash_init(&tree, sv_hashalgorithm_spookytree);
+        sv_contenthash_update(&tree, buf, len);
+        sv_contenthash_final(&tree, &expected);
+
+        /* in pieces that don't line up with the leaves */
+        const uint32_t piecesizes[] = {7, 4097, 1024 * 1024 + 3};
+        for (uint32_t i = 0; i < countof(piecesizes); i++)
+        {
+            sv_contenthash_init(&tree, sv_hashalgorithm_spookytree);
+            for (uint32_t pos = 0; pos < len; pos += piecesizes[i])
+            {
+                sv_contenthash_update(
+                    &tree, buf + pos, MIN(piecesizes[i], len - pos));
+            }
+
+            sv_contenthash_final(&tree, &got);
+            TestTrue(memcmp(&expected, &got, sizeof(got)) == 0);
+        }
+
+        /* on any number of threads */
+        os_lockedfilehandle handle = {};
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        sv_hasher hasher = sv_hasher_open(
+            cstr(path), sv_hashalgorithm_spookytree, sv_readengine_read);
+        const uint32_t threadcounts[] = {1, 2, 3, 8, 64};
+        for (uint32_t i = 0; i < countof(threadcounts); i++)
+        {
+            check(sv_hasher_tree_parallel(
+                &hasher, handle.fd, len, threadcounts[i], &got, &crcgot));
+            TestTrue(memcmp(&expected, &got, sizeof(got)) == 0);
+            TestEqn(sv_crc32(0, buf, len), crcgot);
+        }
+
+        for (uint32_t engine = 0; engine < sv_readengine_count; engine++)
+        {
+            check(hash_of_file(&handle, false, filetype_binary,
+                sv_hashalgorithm_spookytree, engine, &got, &crcgot));
+            TestTrue(memcmp(&expected, &got, sizeof(got)) == 0);
+            TestEqn(sv_crc32(0, buf, len), crcgot);
+        }
+
+        /* and different from the sequential hash */
+        check(hash_of_file(&handle, false, filetype_binary,
+            sv_hashalgorithm_spooky, sv_readengine_read, &got, &crcgot));
+        TestTrue(memcmp(&expected, &got, sizeof(got)) != 0);
+        sv_hasher_close(&hasher);
+        os_lockedfilehandle_close(&handle);
+        sv_freenull(buf);
+    }
+
+    SV_TEST("tree hash threads are charged against the throttle")
+    {
+        const uint32_t len = 6 * 1024 * 1024;
+        byte *buf = sv_calloc(len, 1);
+        memset(buf, 'a', len);
+        TEST_OPEN_EX(bstring, path, bformat("%s%stree.bin", tempdir, pathsep));
+        sv_file f = {};
+        check(sv_file_open(&f, cstr(path), "wb"));
+        TestEqn(len, fwrite(buf, 1, len, f.file));
+        sv_file_close(&f);
+
+        /* a second's worth is free, the other 4Mb take about 2 seconds */
+        os_throttle throttle = {};
+        os_throttle_init(&throttle, 2 * 1024 * 1024);
+        os_throttle_register_active(&throttle);
+        os_lockedfilehandle handle = {};
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        sv_hasher hasher = sv_hasher_open(
+            cstr(path), sv_hashalgorithm_spookytree, sv_readengine_read);
+        hash256 got = {};
+        uint64_t start = os_clock_monotonic_ms();
+        check(sv_hasher_tree_parallel(&hasher, handle.fd, len, 4, &got, NULL));
+        TestTrue(os_clock_monotonic_ms() - start >= 1000);
+        os_throttle_register_active(NULL);
+        os_throttle_close(&throttle);
+        sv_hasher_close(&hasher);
+        os_lockedfilehandle_close(&handle);
+        sv_freenull(buf);
+    }
+
+    SV_TEST("read engines give the same hash and crc")
+    {
+        /* on either side of where the mmap engine starts mapping, and across
+        more than one mapped window */
+        const uint32_t sizes[] = {0, 1024 * 1024 - 1, 1024 * 1024,
+            2 * 16 * 1024 * 1024 + 777};
+        uint32_t len = sizes[countof(sizes) - 1];
+        byte *buf = sv_calloc(len, 1);
+        uint32_t state = 54321;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            state = state * 1103515245 + 12345;
+            buf[i] = (byte)(state >> 16);
+        }
+
+        TEST_OPEN_EX(bstring, path, bformat("%s%sbig.bin", tempdir, pathsep));
+        for (uint32_t i = 0; i < countof(sizes); i++)
+        {
+            hash256 expected = {}, got = {};
+            uint32_t crcgot = 0;
+            sv_contenthash hash = {};
+            sv_contenthash_init(&hash, sv_hashalgorithm_spooky);
+            sv_contenthash_update(&hash, buf, sizes[i]);
+            sv_contenthash_final(&hash, &expected);
+
+            sv_file f = {};
+            check(sv_file_open(&f, cstr(path), "wb"));
+            TestEqn(sizes[i], fwrite(buf, 1, sizes[i], f.file));
+            sv_file_close(&f);
+            os_lockedfilehandle handle = {};
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            for (uint32_t engine = 0; engine < sv_readengine_count; engine++)
+            {
+                check(hash_of_file(&handle, false, filetype_binary,
+                    sv_hashalgorithm_spooky, engine, &got, &crcgot));
+                TestTrue(memcmp(&expected, &got, sizeof(got)) == 0);
+                TestEqn(sv_crc32(0, buf, sizes[i]), crcgot);
+
+                /* a hasher can be reused, and can compute only the crc */
+                sv_hasher hasher = sv_hasher_open(
+                    cstr(path), sv_hashalgorithm_spooky, engine);
+                check(sv_hasher_wholefile(&hasher, handle.fd, &got, &crcgot));
+                check(sv_hasher_wholefile(&hasher, handle.fd, NULL, &crcgot));
+                TestTrue(memcmp(&expected, &got, sizeof(got)) == 0);
+                TestEqn(sv_crc32(0, buf, sizes[i]), crcgot);
+                sv_hasher_close(&hasher);
+            }
+
+            os_lockedfilehandle_close(&handle);
+        }
+
+        sv_freenull(buf);
+    }
+
+    SV_TEST("content-defined chunks survive an insertion")
+    {
+        const uint32_t len = 1024 * 1024, avg = 16 * 1024;
+        byte *buf = sv_calloc(len + 100, 1);
+        uint32_t state = 12345;
+        for (uint32_t i = 0; i < len + 100; i++)
+        {
+            state = state * 1103515245 + 12345;
+            buf[i] = (byte)(state >> 16);
+        }
+
+        TEST_OPEN_EX(bstring, path, bformat("%s%schunk.bin", tempdir, pathsep));
+        TEST_OPEN_EX(sv_array, before, sv_array_open(sizeof32u(sv_chunk), 0));
+        TEST_OPEN_EX(sv_array, after, sv_array_open(sizeof32u(sv_chunk), 0));
+        TEST_OPEN_EX(sv_array, pieces, sv_array_open(sizeof32u(sv_chunk), 0));
+        for (uint32_t pass = 0; pass < 2; pass++)
+        {
+            /* the second pass inserts 100 bytes at 300000 */
+            hash256 wholehash = {}, expected = {};
+            uint32_t crc = 0, expectedcrc = 0;
+            sv_array *chunks = pass ? &after : &before;
+            sv_file f = {};
+            check(sv_file_open(&f, cstr(path), "wb"));
+            TestEqn(300000, fwrite(buf, 1, 300000, f.file));
+            TestEqn(100 * pass, fwrite(buf + len, 1, 100 * pass, f.file));
+            TestEqn(
+                len - 300000, fwrite(buf + 300000, 1, len - 300000, f.file));
+            sv_file_close(&f);
+            os_lockedfilehandle handle = {};
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, false, filetype_binary,
+                sv_hashalgorithm_spookytree, sv_readengine_read, &expected,
+                &expectedcrc));
+            check(hash_of_file_and_chunks(&handle, sv_hashalgorithm_spookytree,
+                sv_readengine_read, avg, &wholehash, &crc, chunks));
+            os_lockedfilehandle_close(&handle);
+            TestTrue(memcmp(&expected, &wholehash, sizeof(expected)) == 0);
+            TestEqn(expectedcrc, crc);
+
+            /* chunks cover the file in order, within the size limits */
+            uint64_t offset = 0;
+            for (uint32_t i = 0; i < chunks->length; i++)
+            {
+                const sv_chunk *chunk =
+                    (const sv_chunk *)sv_array_at(chunks, i);
+                TestEqn(offset, chunk->offset);
+                TestTrue(chunk->length <= avg * 8);
+                TestTrue(chunk->length >= avg / 4 || i == chunks->length - 1);
+                offset += chunk->length;
+            }
+
+            TestEqn(len + 100 * pass, offset);
+            TestTrue(chunks->length > 20 && chunks->length < 200);
+        }
+
+        /* only the chunks near the insertion are different */
+        uint32_t same = 0;
+        for (uint32_t i = 0; i < after.length; i++)
+        {
+            const sv_chunk *a = (const sv_chunk *)sv_array_at(&after, i);
+            for (uint32_t j = 0; j < before.length; j++)
+            {
+                const sv_chunk *b = (const sv_chunk *)sv_array_at(&before, j);
+                same += a->length == b->length &&
+                    memcmp(&a->hash, &b->hash, sizeof(a->hash)) == 0;
+            }
+        }
+
+        TestTrue(same + 3 >= before.length);
+
+        /* boundaries don't depend on how the input was split up */
+        sv_chunker chunker = {};
+        sv_chunker_init(&chunker, sv_hashalgorithm_spooky, avg, &pieces);
+        for (uint32_t i = 0; i < len; i += 1000)
+        {
+            sv_chunker_update(&chunker, buf + i, MIN(1000, len - i));
+        }
+
+        sv_chunker_final(&chunker);
+        TestEqn(before.length, pieces.length);
+        for (uint32_t i = 0; i < pieces.length; i++)
+        {
+            const sv_chunk *a = (const sv_chunk *)sv_array_at(&pieces, i);
+            const sv_chunk *b = (const sv_chunk *)sv_array_at(&before, i);
+            TestEqn(b->offset, a->offset);
+            TestEqn(b->length, a->length);
+            TestEqn(sv_crc32(0, buf + a->offset, a->length), a->crc32);
+        }
+
+        sv_freenull(buf);
+    }
+
+    SV_TEST("hash a grown file and the prefix of its old length")
+    {
+        /* the old length isn't a multiple of the tree's leaf size */
+        const uint32_t oldlen = 1536 * 1024 + 7, newlen = oldlen + 5000;
+        byte *buf = sv_calloc(newlen, 1);
+        for (uint32_t i = 0; i < newlen; i++)
+        {
+            buf[i] = (byte)(i * 31 + (i >> 9));
+        }
+
+        TEST_OPEN_EX(bstring, path, bformat("%s%sgrow.bin", tempdir, pathsep));
+        const uint32_t algorithms[] = {
+            sv_hashalgorithm_spooky, sv_hashalgorithm_spookytree};
+        for (uint32_t i = 0; i < countof32u(algorithms); i++)
+        {
+            hash256 oldhash = {}, newhash = {}, prefixhash = {}, hash = {};
+            uint32_t crc = 0, newcrc = 0, tailcrc = 0;
+            os_lockedfilehandle handle = {};
+            sv_file f = {};
+            check(sv_file_open(&f, cstr(path), "wb"));
+            TestEqn(oldlen, fwrite(buf, 1, oldlen, f.file));
+            sv_file_close(&f);
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, false, filetype_binary, algorithms[i],
+                sv_readengine_read, &oldhash, &crc));
+            os_lockedfilehandle_close(&handle);
+
+            check(sv_file_open(&f, cstr(path), "ab"));
+            TestEqn(newlen - oldlen, fwrite(buf + oldlen, 1, newlen - oldlen,
+                                         f.file));
+            sv_file_close(&f);
+            check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+            check(hash_of_file(&handle, false, filetype_binary, algorithms[i],
+                sv_readengine_read, &newhash, &newcrc));
+            check(hash_of_file_and_prefix(&handle, algorithms[i],
+                sv_readengine_read, oldlen, &prefixhash, &hash, &crc,
+                &tailcrc));
+            TestTrue(memcmp(&oldhash, &prefixhash, sizeof(hash)) == 0);
+            TestTrue(memcmp(&newhash, &hash, sizeof(hash)) == 0);
+            TestEqn(newcrc, crc);
+            TestEqn(sv_crc32(0, buf + oldlen, newlen - oldlen), tailcrc);
+
+            /* a prefix past the end of the file is never matched */
+            check(hash_of_file_and_prefix(&handle, algorithms[i],
+                sv_readengine_read, newlen + 1, &prefixhash, &hash, &crc,
+                &tailcrc));
+            TestTrue(memcmp(&hash256zeros, &prefixhash, sizeof(hash)) == 0);
+            TestTrue(memcmp(&newhash, &hash, sizeof(hash)) == 0);
+            os_lockedfilehandle_close(&handle);
+        }
+
+        sv_freenull(buf);
+    }
+
+    SV_TEST("sample files to see whether they're worth compressing")
+    {
+        const uint32_t len = 200 * 1024;
+        byte *random = sv_calloc(len, 1);
+        byte *counting = sv_calloc(len, 1);
+        byte *zstd = sv_calloc(len, 1);
+        uint32_t state = 12345;
+        for (uint32_t i = 0; i < len; i++)
+        {
+            state = state * 1103515245 + 12345;
+            random[i] = (byte)(state >> 16);
+            counting[i] = (byte)i;
+        }
+
+        TEST_OPEN(bstring, text);
+        for (uint32_t i = 0; blength(text) < (int)len; i++)
+        {
+            bformata(text, "line %u of a text file\n", i);
+        }
+
+        memcpy(zstd, "\x28\xb5\x2f\xfd", 4);
+        sv_compress_classifier classifier = {};
+        sv_compress_classifier_init(&classifier);
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.dat", tempdir, pathsep));
+        TestTrue(!get_incompressible(
+            &classifier, cstr(path), (const byte *)cstr(text), len));
+        TestTrue(get_incompressible(&classifier, cstr(path), random, len));
+        TestTrue(get_incompressible(&classifier, cstr(path), zstd, len));
+
+        /* every byte value appears equally often, but it compresses well */
+        TestTrue(!get_incompressible(&classifier, cstr(path), counting, len));
+
+        /* small files aren't sampled */
+        TestTrue(!get_incompressible(&classifier, cstr(path), random, 1024));
+        TestEqn(4, classifier.sampled);
+        TestEqn(0, classifier.routed);
+
+        /* files without an extension are always sampled */
+        bsetfmt(path, "%s%snoextension", tempdir, pathsep);
+        for (uint32_t i = 0; i < 5; i++)
+        {
+            TestTrue(get_incompressible(&classifier, cstr(path), random, len));
+        }
+
+        TestEqn(9, classifier.sampled);
+        TestEqn(0, classifier.routed);
+
+        /* once enough files with an extension agree, the rest are routed
+        without sampling, even this one that would compress */
+        bsetfmt(path, "%s%sa.enc", tempdir, pathsep);
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            TestTrue(get_incompressible(&classifier, cstr(path), random, len));
+        }
+
+        TestTrue(get_incompressible(&classifier, cstr(path), counting, len));
+        TestEqn(13, classifier.sampled);
+        TestEqn(1, classifier.routed);
+
+        /* .dat files disagreed, so they will keep being sampled */
+        TEST_OPEN_EX(bstrlist *, saved, bstrlist_open());
+        sv_compress_classifier_save(&classifier, saved);
+        TestEqList("00646174 2 2|00656e63 0 4", saved);
+        sv_compress_classifier_close(&classifier);
+
+        /* decisions carry over to the next backup */
+        bstrlist_clear(saved);
+        bstrlist_appendcstr(saved, "00656e63 0 4");
+        bstrlist_appendcstr(saved, "not valid");
+        sv_compress_classifier_init(&classifier);
+        sv_compress_classifier_load(&classifier, saved);
+        TestTrue(get_incompressible(&classifier, cstr(path), counting, len));
+        TestEqn(0, classifier.sampled);
+        TestEqn(1, classifier.routed);
+        sv_compress_classifier_close(&classifier);
+        sv_freenull(random);
+        sv_freenull(counting);
+        sv_freenull(zstd);
+    }
+
     SV_TEST("hash of 0-byte file")
     {
         hash256 h = {};
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, path, bformat("%s%sa.txt", tempdir, pathsep));
         check(sv_file_writefile(cstr(path), "", "wb"));
-        get_hash(cstr(path), tempdir, false, &h, &crc32);
+        get_hash(cstr(path), false, &h, &crc32);
         TestTrue(0x232706fc6bf50919ULL == h.data[0] &&
             0x8b72ee65b4e851c7ULL == h.data[1]);
         TestTrue(0x88d8e9628fb694aeULL == h.data[2] &&
@@ -273,19 +801,23 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         TestEqn(0x00000000, crc32);
     }
 
-    SV_TEST("hash of missing file")
+    SV_TEST("hash of audio reads from the handle, not the path")
     {
         hash256 h = {};
         uint32_t crc32 = 0;
         os_lockedfilehandle handle = {};
         TEST_OPEN_EX(
-            bstring, path, bformat("%s%sdoes-exist.txt", tempdir, pathsep));
-        check(sv_file_writefile(cstr(path), "", "wb"));
+            bstring, path, bformat("%s%sdoes-exist.mp3", tempdir, pathsep));
+        check(writevalidmp3(cstr(path), false, false, false));
         check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
         bsetfmt(handle.loggingcontext, "%s%snot-exist.mp3", tempdir, pathsep);
-        expect_err_with_message(
-            hash_of_file(&handle, true, filetype_mp3, "", &h, &crc32),
-            "not found");
+        check(hash_of_file(&handle, true, filetype_mp3,
+            sv_hashalgorithm_spooky, sv_readengine_read, &h, &crc32));
+        TestTrue(0xf949debca46ad00aULL == h.data[0] &&
+            0x319ae6a8df67e9e4ULL == h.data[1]);
+        TestTrue(0x490b5e78f7f8c752ULL == h.data[2] &&
+            0xf777666849904b82ULL == h.data[3]);
+        TestEqn(0xb6a3e71a, crc32);
         os_lockedfilehandle_close(&handle);
     }
 
@@ -297,7 +829,8 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         bsetfmt(handle.loggingcontext, "%s%sdoes-exist.txt", tempdir, pathsep);
         check(sv_file_writefile(cstr(handle.loggingcontext), "", "wb"));
         expect_err_with_message(
-            hash_of_file(&handle, true, filetype_binary, "", &h, &crc32),
+            hash_of_file(&handle, true, filetype_binary,
+                sv_hashalgorithm_spooky, sv_readengine_read, &h, &crc32),
             "bad file handle");
         os_lockedfilehandle_close(&handle);
     }
@@ -310,7 +843,8 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         bsetfmt(handle.loggingcontext, "%s%sdoes-exist.txt", tempdir, pathsep);
         check(sv_file_writefile(cstr(handle.loggingcontext), "", "wb"));
         expect_err_with_message(
-            hash_of_file(&handle, false, filetype_binary, "", &h, &crc32),
+            hash_of_file(&handle, false, filetype_binary,
+                sv_hashalgorithm_spooky, sv_readengine_read, &h, &crc32),
             "bad file handle");
         os_lockedfilehandle_close(&handle);
     }
@@ -322,7 +856,7 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         TEST_OPEN_EX(
             bstring, invalidmp3, bformat("%s%si.mp3", tempdir, pathsep));
         check(sv_file_writefile(cstr(invalidmp3), "not-a-valid-mp3", "wb"));
-        get_hash(cstr(invalidmp3), tempdir, false, &h, &crc32);
+        get_hash(cstr(invalidmp3), false, &h, &crc32);
         TestTrue(
             0x2998bf76385ad9d0 == h.data[0] && 0xdda72b9b7ffb52ac == h.data[1]);
         TestTrue(
@@ -338,7 +872,7 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
             bstring, invalidmp3, bformat("%s%si.mp3", tempdir, pathsep));
         check(sv_file_writefile(cstr(invalidmp3), "not-a-valid-mp3", "wb"));
         quiet_warnings(true);
-        get_hash(cstr(invalidmp3), tempdir, true, &h, &crc32);
+        get_hash(cstr(invalidmp3), true, &h, &crc32);
         quiet_warnings(false);
         TestTrue(
             0x2998bf76385ad9d0 == h.data[0] && 0xdda72b9b7ffb52ac == h.data[1]);
@@ -353,7 +887,7 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), false, false, false));
-        get_hash(cstr(validmp3), tempdir, false, &h, &crc32);
+        get_hash(cstr(validmp3), false, &h, &crc32);
         TestTrue(
             0x32892370d570e3ad == h.data[0] && 0x89b895f43501da14 == h.data[1]);
         TestTrue(
@@ -367,7 +901,7 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), true, false, false));
-        get_hash(cstr(validmp3), tempdir, false, &h, &crc32);
+        get_hash(cstr(validmp3), false, &h, &crc32);
         TestTrue(
             0xaa23935ca198aa6d == h.data[0] && 0xb86c87c3d3cced09 == h.data[1]);
         TestTrue(
@@ -381,11 +915,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), false, false, false));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x611c9c9e3d1e62cc == h.data[0] && 0x1ffaa7d05b187124 == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0xf949debca46ad00aULL == h.data[0] &&
+            0x319ae6a8df67e9e4ULL == h.data[1]);
+        TestTrue(0x490b5e78f7f8c752ULL == h.data[2] &&
+            0xf777666849904b82ULL == h.data[3]);
         TestEqn(0xb6a3e71a, crc32);
     }
 
@@ -395,11 +929,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), true, false, false));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x611c9c9e3d1e62cc == h.data[0] && 0x1ffaa7d05b187124 == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0xf949debca46ad00aULL == h.data[0] &&
+            0x319ae6a8df67e9e4ULL == h.data[1]);
+        TestTrue(0x490b5e78f7f8c752ULL == h.data[2] &&
+            0xf777666849904b82ULL == h.data[3]);
         TestEqn(0xdcf3b99d, crc32);
     }
 
@@ -409,11 +943,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), false, true, false));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x611c9c9e3d1e62cc == h.data[0] && 0x1ffaa7d05b187124 == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0xf949debca46ad00aULL == h.data[0] &&
+            0x319ae6a8df67e9e4ULL == h.data[1]);
+        TestTrue(0x490b5e78f7f8c752ULL == h.data[2] &&
+            0xf777666849904b82ULL == h.data[3]);
         TestEqn(0x15655751, crc32);
     }
 
@@ -423,11 +957,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), true, true, false));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x611c9c9e3d1e62cc == h.data[0] && 0x1ffaa7d05b187124 == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0xf949debca46ad00aULL == h.data[0] &&
+            0x319ae6a8df67e9e4ULL == h.data[1]);
+        TestTrue(0x490b5e78f7f8c752ULL == h.data[2] &&
+            0xf777666849904b82ULL == h.data[3]);
         TestEqn(0x14150f7b, crc32);
     }
 
@@ -437,11 +971,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), false, false, true));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x7d49276b4e05c2bd == h.data[0] && 0x39f840313d6eeb4f == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0x779acc6c98226648ULL == h.data[0] &&
+            0xf4ee8480d4ac6286ULL == h.data[1]);
+        TestTrue(0x68b9237903cd7a9fULL == h.data[2] &&
+            0x99b8fb08fe9c9787ULL == h.data[3]);
         TestEqn(0xc5679762, crc32);
     }
 
@@ -451,11 +985,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), true, false, true));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x7d49276b4e05c2bd == h.data[0] && 0x39f840313d6eeb4f == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0x779acc6c98226648ULL == h.data[0] &&
+            0xf4ee8480d4ac6286ULL == h.data[1]);
+        TestTrue(0x68b9237903cd7a9fULL == h.data[2] &&
+            0x99b8fb08fe9c9787ULL == h.data[3]);
         TestEqn(0xaf37c9e5, crc32);
     }
 
@@ -465,11 +999,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), false, true, true));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x7d49276b4e05c2bd == h.data[0] && 0x39f840313d6eeb4f == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0x779acc6c98226648ULL == h.data[0] &&
+            0xf4ee8480d4ac6286ULL == h.data[1]);
+        TestTrue(0x68b9237903cd7a9fULL == h.data[2] &&
+            0x99b8fb08fe9c9787ULL == h.data[3]);
         TestEqn(0x898585be, crc32);
     }
 
@@ -479,11 +1013,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
         uint32_t crc32 = 0;
         TEST_OPEN_EX(bstring, validmp3, bformat("%s%sv.mp3", tempdir, pathsep));
         check(writevalidmp3(cstr(validmp3), true, true, true));
-        get_hash(cstr(validmp3), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x7d49276b4e05c2bd == h.data[0] && 0x39f840313d6eeb4f == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(validmp3), true, &h, &crc32);
+        TestTrue(0x779acc6c98226648ULL == h.data[0] &&
+            0xf4ee8480d4ac6286ULL == h.data[1]);
+        TestTrue(0x68b9237903cd7a9fULL == h.data[2] &&
+            0x99b8fb08fe9c9787ULL == h.data[3]);
         TestEqn(0x88f5dd94, crc32);
     }
 
@@ -495,11 +1029,11 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
             bformat("%s%shelp%sMMD5=1122334455667788a1a2a3a4a5a6a7a8.mp3",
                 tempdir, pathsep, islinux ? "\n" : ""));
         check(writevalidmp3(cstr(path), true, true, true));
-        get_hash(cstr(path), tempdir, true, &h, &crc32);
-        TestTrue(
-            0x7d49276b4e05c2bd == h.data[0] && 0x39f840313d6eeb4f == h.data[1]);
-        TestTrue(
-            0x0000000000000000 == h.data[2] && 0x0000000000000000 == h.data[3]);
+        get_hash(cstr(path), true, &h, &crc32);
+        TestTrue(0x779acc6c98226648ULL == h.data[0] &&
+            0xf4ee8480d4ac6286ULL == h.data[1]);
+        TestTrue(0x68b9237903cd7a9fULL == h.data[2] &&
+            0x99b8fb08fe9c9787ULL == h.data[3]);
         TestEqn(0x88f5dd94, crc32);
     }
 
@@ -512,7 +1046,7 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
                 tempdir, pathsep, islinux ? "\n" : ""));
         check(sv_file_writefile(cstr(path), "not-a-valid-mp3", "wb"));
         quiet_warnings(true);
-        get_hash(cstr(path), tempdir, true, &h, &crc32);
+        get_hash(cstr(path), true, &h, &crc32);
         quiet_warnings(false);
         TestTrue(
             0x2998bf76385ad9d0 == h.data[0] && 0xdda72b9b7ffb52ac == h.data[1]);
@@ -520,5 +1054,89 @@ SV_BEGIN_TEST_SUITE(tests_hash_audio)
             0xeab56cf2bacbb5e2 == h.data[2] && 0x722db00c51c532f4 == h.data[3]);
         TestEqn(0x67e2ecb6, crc32);
     }
+
+    SV_TEST("flac: changing the tags keeps the hash, changing frames doesn't")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.flac", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, flac1, make_test_flac("artist=a", 1));
+        TEST_OPEN_EX(bstring, flac2, make_test_flac("artist=a longer name", 1));
+        TEST_OPEN_EX(bstring, flac3, make_test_flac("artist=a", 2));
+        TestTrue(audio_hashes_match(cstr(path), filetype_flac, flac1, flac2));
+        TestTrue(!audio_hashes_match(cstr(path), filetype_flac, flac1, flac3));
+        TestTrue(!audio_hash_matches_whole_file(cstr(path), filetype_flac));
+    }
+
+    SV_TEST("flac: malformed or truncated files hash the whole file")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.flac", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, flac, make_test_flac("artist=a", 1));
+        flac->data[4 + 38 + 4 + 8] = 0x00; /* break the frame sync code */
+        write_test_bytes(cstr(path), flac);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_flac));
+        btrunc(flac, 4 + 38 + 4 + 2); /* cut within the comment block */
+        write_test_bytes(cstr(path), flac);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_flac));
+        bassigncstr(flac, "fLaX");
+        write_test_bytes(cstr(path), flac);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_flac));
+    }
+
+    SV_TEST("ogg: changing the comments keeps the hash, changing audio doesn't")
+    {
+        char longtag[300] = {0};
+        memset(longtag, 'x', countof(longtag) - 1);
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.ogg", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, ogg1, make_test_ogg("artist=a", 1));
+        TEST_OPEN_EX(bstring, ogg2, make_test_ogg("artist=b", 1));
+        TEST_OPEN_EX(bstring, ogg3, make_test_ogg(longtag, 1));
+        TEST_OPEN_EX(bstring, ogg4, make_test_ogg("artist=a", 2));
+        TestTrue(audio_hashes_match(cstr(path), filetype_ogg, ogg1, ogg2));
+        TestTrue(audio_hashes_match(cstr(path), filetype_ogg, ogg1, ogg3));
+        TestTrue(!audio_hashes_match(cstr(path), filetype_ogg, ogg1, ogg4));
+        TestTrue(!audio_hash_matches_whole_file(cstr(path), filetype_ogg));
+    }
+
+    SV_TEST("ogg: malformed or truncated files hash the whole file")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.ogg", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, ogg, make_test_ogg("artist=a", 1));
+        TEST_OPEN_EX(bstring, trailing, bstrcpy(ogg));
+        bcatcstr(trailing, "not a page");
+        write_test_bytes(cstr(path), trailing);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_ogg));
+        btrunc(ogg, ogg->slen - 10);
+        write_test_bytes(cstr(path), ogg);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_ogg));
+        bassigncstr(ogg, "OggS");
+        write_test_bytes(cstr(path), ogg);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_ogg));
+    }
+
+    SV_TEST("m4a: changing udta keeps the hash, changing mdat doesn't")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.m4a", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, mp41, make_test_mp4("artist=a", 1));
+        TEST_OPEN_EX(bstring, mp42, make_test_mp4("artist=a longer name", 1));
+        TEST_OPEN_EX(bstring, mp43, make_test_mp4("artist=a", 2));
+        TestTrue(audio_hashes_match(cstr(path), filetype_m4a, mp41, mp42));
+        TestTrue(!audio_hashes_match(cstr(path), filetype_m4a, mp41, mp43));
+        TestTrue(!audio_hash_matches_whole_file(cstr(path), filetype_m4a));
+    }
+
+    SV_TEST("m4a: malformed or truncated files hash the whole file")
+    {
+        TEST_OPEN_EX(bstring, path, bformat("%s%sa.m4a", tempdir, pathsep));
+        TEST_OPEN_EX(bstring, mp4, make_test_mp4("artist=a", 1));
+        TEST_OPEN_EX(bstring, trailing, bstrcpy(mp4));
+        bcatcstr(trailing, "junk");
+        write_test_bytes(cstr(path), trailing);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_m4a));
+        btrunc(mp4, mp4->slen - 10);
+        write_test_bytes(cstr(path), mp4);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_m4a));
+        mp4->data[4] = 0x01; /* an atom type that isn't printable */
+        write_test_bytes(cstr(path), mp4);
+        TestTrue(audio_hash_matches_whole_file(cstr(path), filetype_m4a));
+    }
 }
 SV_END_TEST_SUITE()
@@ -166,7 +166,7 @@ check_result test_tbl_fileslist(svdb_db *db)
     sv_file_row row2 = {0, 6 /*contents_id*/,
         6000ULL * 1024 * 1024, /*contents_length*/
         666 /* last_write_time*/, 1111 /*most_recent_collection*/,
-        sv_filerowstatus_queued};
+        sv_filerowstatus_queued, {21, 22, 23} /*identity*/};
     sv_file_row row3 = {0, 7 /*contents_id*/,
         7000ULL * 1024 * 1024, /*contents_length*/
         777 /* last_write_time*/, 1000 /*most_recent_collection*/,
@@ -218,6 +218,9 @@ check_result test_tbl_fileslist(svdb_db *db)
         svdb_files_row_string(&row2, "", "", srowexpect);
         svdb_files_row_string(&rowgot, "", "", srowgot);
         TestEqs(cstr(srowexpect), cstr(srowgot));
+        TestEqn(21, rowgot.identity.device);
+        TestEqn(22, rowgot.identity.inode);
+        TestEqn(23, rowgot.identity.modtime_ns);
         memset(&rowgot, 0, sizeof(rowgot));
         check(svdb_filesbypath(db, path3, &rowgot));
         svdb_files_row_string(&row3, "", "", srowexpect);
@@ -261,6 +264,60 @@ check_result test_tbl_fileslist(svdb_db *db)
         TestEqn(list->qty, 4);
         bstrlist_close(list);
     }
+    { /* load catalog, find by path */
+        svdb_files_catalog catalog = svdb_files_catalog_open();
+        check(svdb_files_catalog_load(db, &catalog));
+        TestEqn(4, catalog.entries.length);
+        sv_file_row *found = svdb_files_catalog_find(&catalog, path2);
+        TestTrue(found != NULL);
+        svdb_files_row_string(&row2, "", "", srowexpect);
+        svdb_files_row_string(found, "", "", srowgot);
+        TestEqs(cstr(srowexpect), cstr(srowgot));
+        bassigncstr(srowexpect, "/test/addrows/");
+        TestTrue(svdb_files_catalog_find(&catalog, srowexpect) == NULL);
+
+        /* add enough rows to grow the table */
+        for (uint64_t i = 0; i < 3000; i++)
+        {
+            sv_file_row row = {i + 100};
+            bsetfmt(srowexpect, "/test/catalog/%llu", castull(i));
+            svdb_files_catalog_add(&catalog, srowexpect, &row);
+        }
+
+        bassigncstr(srowexpect, "/test/catalog/2999");
+        found = svdb_files_catalog_find(&catalog, srowexpect);
+        TestTrue(found != NULL && found->id == 3099);
+        found = svdb_files_catalog_find(&catalog, path3);
+        TestTrue(found != NULL && found->id == row3.id);
+
+        /* find by identity, which hard links share */
+        os_file_identity identity = {21, 22, 23};
+        os_file_identity otheridentity = {21, 22, 24};
+        found = svdb_files_catalog_findidentity(&catalog, &identity, NULL);
+        TestTrue(found != NULL && found->id == row2.id);
+        TestTrue(!svdb_files_catalog_findidentity(&catalog, &identity, found));
+        TestTrue(
+            !svdb_files_catalog_findidentity(&catalog, &otheridentity, NULL));
+
+        /* a complete row is preferred */
+        bassigncstr(srowexpect, "/test/catalog/1234");
+        found = svdb_files_catalog_find(&catalog, srowexpect);
+        sv_file_row link = *found;
+        link.identity = identity;
+        link.e_status = sv_filerowstatus_complete;
+        svdb_files_catalog_update(&catalog, found, &link);
+        found = svdb_files_catalog_findidentity(&catalog, &identity, NULL);
+        TestTrue(found != NULL && found->id == 1334);
+
+        /* an identity that changes is found under the new one only */
+        link.identity = otheridentity;
+        svdb_files_catalog_update(&catalog, found, &link);
+        found = svdb_files_catalog_findidentity(&catalog, &identity, NULL);
+        TestTrue(found != NULL && found->id == row2.id);
+        found = svdb_files_catalog_findidentity(&catalog, &otheridentity, NULL);
+        TestTrue(found != NULL && found->id == 1334);
+        svdb_files_catalog_close(&catalog);
+    }
     { /* ok to batch delete 0 rows */
         uint64_t filescount = 0;
         check(svdb_filescount(db, &filescount));
@@ -444,14 +501,17 @@ check_result test_tbl_contents(svdb_db *db)
             0x4444444444444444ULL,
             0x5555555555555555ULL,
         }}, /*hash*/
-        0x22222222 /* crc32 */};
+        0x22222222 /* crc32 */, 1 /* hashalgorithm */, 1 /* codec */,
+        0x99 /* blockid */, 5 /* blockoffset */, 0 /* chunkcount */,
+        1 /* deltabaseid */, 1 /* deltadepth */};
     sv_content_row row3 = {0, 3000ULL * 1024 * 1024 /*contents_length*/,
         3003ULL * 1024 * 1024 /* compressed_contents_length */,
         3 /* most_recent_collection */, 33 /*original_collection*/,
         333 /* archivenumber*/,
         {{0x3333333333333333ULL, 0x4444444444444444ULL, 0x5555555555555555ULL,
             0x6666666666666666ULL}}, /*hash*/
-        0x33333333 /* crc32 */};
+        0x33333333 /* crc32 */, 0 /* hashalgorithm */, 0 /* codec */,
+        0 /* blockid */, 0 /* blockoffset */, 2 /* chunkcount */};
 
     check(svdb_txn_open(&txn, db));
 
@@ -561,6 +621,64 @@ check_result test_tbl_contents(svdb_db *db)
         sv_result_close(&res);
         quiet_warnings(false);
     }
+    { /* list the chunks of row 3 */
+        sv_array chunkids = sv_array_open_u64();
+        check(svdb_chunksinsert(db, row3.id, 1, row1.id));
+        check(svdb_chunksinsert(db, row3.id, 0, row2.id));
+        check(svdb_chunksget(db, row3.id, &chunkids));
+        TestEqn(2, chunkids.length);
+        TestEqn(row2.id, sv_array_at64u(&chunkids, 0));
+        TestEqn(row1.id, sv_array_at64u(&chunkids, 1));
+        check(svdb_chunksget(db, row1.id, &chunkids));
+        TestEqn(0, chunkids.length);
+        sv_array_close(&chunkids);
+    }
+    { /* chunks are referenced as recently as the files made from them */
+        check(svdb_contents_setreferencedbyfiles(db, 0));
+        memset(&rowgot, 0, sizeof(rowgot));
+        check(svdb_contentsbyid(db, row1.id, &rowgot));
+        TestEqn(99, rowgot.most_recent_collection);
+        memset(&rowgot, 0, sizeof(rowgot));
+        check(svdb_contentsbyid(db, row2.id, &rowgot));
+        TestEqn(99, rowgot.most_recent_collection);
+        const sv_content_row *rows[] = {&row1, &row2};
+        for (uint32_t i = 0; i < countof(rows); i++)
+        {
+            bstring sql = bformat("UPDATE TblContentsList SET "
+                                  "LastCollectionId=%llu WHERE ContentsId=%llu",
+                castull(rows[i]->most_recent_collection),
+                castull(rows[i]->id));
+            check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+            bdestroy(sql);
+        }
+    }
+    { /* bases are referenced as recently as the deltas made from them */
+        bstring sql = bformat("UPDATE TblContentsList SET LastCollectionId=3 "
+                              "WHERE ContentsId=%llu",
+            castull(row3.id));
+        check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+        check(svdb_contents_setlastreferenced(db, row2.id, 50));
+        check(svdb_contents_setreferencedbyfiles(db, 0));
+        memset(&rowgot, 0, sizeof(rowgot));
+        check(svdb_contentsbyid(db, row1.id, &rowgot));
+        TestEqn(50, rowgot.most_recent_collection);
+        TestEqn(0, rowgot.deltabaseid);
+        memset(&rowgot, 0, sizeof(rowgot));
+        check(svdb_contentsbyid(db, row2.id, &rowgot));
+        TestEqn(row1.id, rowgot.deltabaseid);
+        TestEqn(1, rowgot.deltadepth);
+        const sv_content_row *rows[] = {&row1, &row2};
+        for (uint32_t i = 0; i < countof(rows); i++)
+        {
+            bsetfmt(sql, "UPDATE TblContentsList SET LastCollectionId=%llu "
+                         "WHERE ContentsId=%llu",
+                castull(rows[i]->most_recent_collection),
+                castull(rows[i]->id));
+            check(svdb_runsql(db, cstr(sql), blength(sql), expectchanges));
+        }
+
+        bdestroy(sql);
+    }
     { /* test batch delete of nothing */
         uint64_t count = 0;
         check(svdb_contentscount(db, &count));
@@ -605,6 +723,10 @@ check_result test_tbl_contents(svdb_db *db)
         memset(&rowgot, 1, sizeof(rowgot));
         check(svdb_contentsbyid(db, row1.id, &rowgot));
         TestEqn(0, rowgot.id);
+
+        /* the chunk list of row 3 should be gone */
+        check(svdb_chunksget(db, row3.id, &arr));
+        TestEqn(0, arr.length);
         sv_array_close(&arr);
     }
 
@@ -56,6 +56,7 @@ SV_BEGIN_TEST_SUITE(whole_tests_operations)
     check_b(db.db, "failed to load group");
     grp.days_to_keep_prev_versions = 0;
     grp.separate_metadata = 1;
+    grp.worker_threads = 3;
     check(sv_grp_persist(&db, &grp));
 
     /* run operations */
@@ -200,6 +201,31 @@ check_result hook_call_before_process_queue(void *phook, svdb_db *db)
     return OK;
 }
 
+check_result hook_call_after_checkpoint(void *phook, uint32_t archivenumber)
+{
+    /* simulate the process being killed right after an archive is sealed */
+    sv_result currenterr = {};
+    sv_test_hook *hook = (sv_test_hook *)phook;
+    check_b(!hook || hook->interruptafterarchive != archivenumber,
+        "simulated interruption after archive %u", archivenumber);
+
+cleanup:
+    return currenterr;
+}
+
+check_result hook_get_time(void *phook, time_t *now)
+{
+    /* a clock that moves on by a fixed amount each time it's read */
+    sv_test_hook *hook = (sv_test_hook *)phook;
+    if (hook && hook->secondspertick)
+    {
+        *now = hook->faketime;
+        hook->faketime += hook->secondspertick;
+    }
+
+    return OK;
+}
+
 check_result hook_call_when_restoring_file(
     void *phook, const char *originalpath, bstring destpath)
 {
@@ -233,7 +259,7 @@ check_result tests_op_check_tar_contents(sv_test_hook *hook,
 
     if (expected)
     {
-        check(checkbinarypaths(&ar, false, NULL));
+        check(checkbinarypaths(&ar));
         check(tests_check_tar_contents(
             &ar, cstr(archivepath), expected, check_order));
     }
@@ -880,21 +906,21 @@ check_result test_backup_see_content_changes(const sv_app *app, sv_group *grp,
     /* file 5: appended contents, different lmt */
     check(sv_file_writefile(cstr(hook->filenames[5]), "contents-X-appended", "wb"));
     hook->setlastmodtimes[5]++;
-    hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=10,??, most_recent_collection=2, original_collection=1, archivenumber=1, id=1|"
-        "hash=c8dfdcd0fbd5415f 4bf8394415f5020f 8ae21fd0d5542d16 b212fddd1f288cb6, crc32=3ae33313, contents_length=10,??, most_recent_collection=2, original_collection=1, archivenumber=1, id=2|"
+    hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=1|"
+        "hash=c8dfdcd0fbd5415f 4bf8394415f5020f 8ae21fd0d5542d16 b212fddd1f288cb6, crc32=3ae33313, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=2|"
         "hash=8fed55346e6cd6e9 449a4ea5c3f455fb ba4e41e76f83be39 126788bb2ea203a5, crc32=a3ea62a9, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=3|"
         "hash=20c77a8888e552d8 4f072594795234d4 bddc24838808c52e 7a16f388f1e80710, crc32=d4ed523f, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=4|"
         "hash=85b8a35500a71107 4ebb74fe7b27f5e0 ef8e495615dc984d 864e5255399d02e0, crc32=4a89c79c, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=5|"
         "hash=9f50c1fddbe36b6 63d240fdb8fd9607 af2f66dfcc27af96 e5b9aed399a6767f, crc32=3d8ef70a, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=6|";
-    hook->expectfilerows = "contents_length=10, contents_id=1, last_write_time=1, flags=0, most_recent_collection=2, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.txt|"
-        "contents_length=10, contents_id=2, last_write_time=1, flags=111, most_recent_collection=2, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.txt|"
+    hook->expectfilerows = "contents_length=10, contents_id=1, last_write_time=1, flags=0, most_recent_collection=1, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.txt|"
+        "contents_length=10, contents_id=2, last_write_time=1, flags=111, most_recent_collection=1, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.txt|"
         "contents_length=10, contents_id=3, last_write_time=1, flags=222, most_recent_collection=2, e_status=0, id=3*" pathsep "file\xE1\x84\x81_2.txt|"
         "contents_length=10, contents_id=4, last_write_time=1, flags=333, most_recent_collection=2, e_status=0, id=4*" pathsep "file\xE1\x84\x81_3.txt|"
         "contents_length=10, contents_id=5, last_write_time=1, flags=444, most_recent_collection=2, e_status=0, id=5*" pathsep "file\xE1\x84\x81_4.txt|"
         "contents_length=10, contents_id=6, last_write_time=1, flags=555, most_recent_collection=2, e_status=0, id=6*" pathsep "file\xE1\x84\x81_5.txt|";
     check(run_backup_and_reconnect(app, grp, db, hook, false));
-    hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=10,??, most_recent_collection=2, original_collection=1, archivenumber=1, id=1|"
-        "hash=c8dfdcd0fbd5415f 4bf8394415f5020f 8ae21fd0d5542d16 b212fddd1f288cb6, crc32=3ae33313, contents_length=10,??, most_recent_collection=2, original_collection=1, archivenumber=1, id=2|"
+    hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=1|"
+        "hash=c8dfdcd0fbd5415f 4bf8394415f5020f 8ae21fd0d5542d16 b212fddd1f288cb6, crc32=3ae33313, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=2|"
         "hash=8fed55346e6cd6e9 449a4ea5c3f455fb ba4e41e76f83be39 126788bb2ea203a5, crc32=a3ea62a9, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=3|"
         "hash=20c77a8888e552d8 4f072594795234d4 bddc24838808c52e 7a16f388f1e80710, crc32=d4ed523f, contents_length=10,??, most_recent_collection=2, original_collection=1, archivenumber=1, id=4|"
         "hash=85b8a35500a71107 4ebb74fe7b27f5e0 ef8e495615dc984d 864e5255399d02e0, crc32=4a89c79c, contents_length=10,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=5|"
@@ -902,8 +928,8 @@ check_result test_backup_see_content_changes(const sv_app *app, sv_group *grp,
         "hash=4e228734f4417f88 f176ff37b912b345 1aa7c6aa85f440aa d6bad0d10f7cd5b2, crc32=9215b3c6, contents_length=19,??, most_recent_collection=2, original_collection=2, archivenumber=1, id=7|"
         "hash=1f670f96631263a0 44d3d56cdd109b5f 793f361d46f9a315 bd7ffe48ae75ebe4, crc32=e8deaef, contents_length=10,??, most_recent_collection=2, original_collection=2, archivenumber=1, id=8|"
         "hash=59547001a163df77 25b6786ba1ab3f71 9780a1194748b574 3ce7a9f21f22f5a2, crc32=dd48b016, contents_length=19,??, most_recent_collection=2, original_collection=2, archivenumber=1, id=9|";
-    hook->expectfilerows = "contents_length=10, contents_id=1, last_write_time=1, flags=0, most_recent_collection=2, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.txt|"
-        "contents_length=10, contents_id=2, last_write_time=1, flags=111, most_recent_collection=2, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.txt|"
+    hook->expectfilerows = "contents_length=10, contents_id=1, last_write_time=1, flags=0, most_recent_collection=1, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.txt|"
+        "contents_length=10, contents_id=2, last_write_time=1, flags=111, most_recent_collection=1, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.txt|"
         "contents_length=19, contents_id=7, last_write_time=1, flags=222, most_recent_collection=2, e_status=3, id=3*" pathsep "file\xE1\x84\x81_2.txt|"
         "contents_length=10, contents_id=4, last_write_time=2, flags=333, most_recent_collection=2, e_status=3, id=4*" pathsep "file\xE1\x84\x81_3.txt|"
         "contents_length=10, contents_id=8, last_write_time=2, flags=444, most_recent_collection=2, e_status=3, id=5*" pathsep "file\xE1\x84\x81_4.txt|"
@@ -1082,6 +1108,310 @@ cleanup:
     return currenterr;
 }
 
+check_result test_backup_see_moved_files(const sv_app *app, sv_group *grp,
+    svdb_db *db, sv_test_hook *hook)
+{
+    sv_result currenterr = {};
+    sv_file_row row = {};
+    uint64_t contentscount = 0, contentscountwas = 0;
+    hook->expectcontentrows = hook->expectfilerows = NULL;
+    check(test_operations_backup_reset(
+        app, grp, db, hook, 3, "txt", false, false));
+    uint64_t modtime = os_getmodifiedtime(cstr(hook->filenames[1]));
+    TestTrue(
+        os_setmodifiedtime_nearestsecond(cstr(hook->filenames[1]), modtime));
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[1], &row));
+    uint64_t contentsid = row.contents_id;
+    TestTrue(contentsid != 0);
+    check(svdb_contentscount(db, &contentscountwas));
+
+    /* move file 1 to file 5, and change its contents without changing its
+    length or modified time. the file is recognized by its identity, so its
+    contents aren't read again. */
+    TestTrue(
+        os_move(cstr(hook->filenames[1]), cstr(hook->filenames[5]), false));
+    check(sv_file_writefile(cstr(hook->filenames[5]), "contents-X", "wb"));
+    TestTrue(
+        os_setmodifiedtime_nearestsecond(cstr(hook->filenames[5]), modtime));
+    hook->setlastmodtimes[5] = hook->setlastmodtimes[1];
+    hook->setlastmodtimes[1] = 0;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[1], &row));
+    TestEqn(0, row.id);
+    check(svdb_filesbypath(db, hook->filenames[5], &row));
+    TestEqn(contentsid, row.contents_id);
+    TestEqn(sv_filerowstatus_complete, row.e_status);
+    check(svdb_contentscount(db, &contentscount));
+    TestEqn(contentscountwas, contentscount);
+
+cleanup:
+    return currenterr;
+}
+
+check_result test_backup_record_sparse_files(const sv_app *app, sv_group *grp,
+    svdb_db *db, sv_test_hook *hook)
+{
+    sv_result currenterr = {};
+    sv_file_row row = {};
+    sv_file file = {};
+    TEST_OPEN_EX(sv_array, zeros, sv_array_open(1, 0));
+    hook->expectcontentrows = hook->expectfilerows = NULL;
+    check(test_operations_backup_reset(
+        app, grp, db, hook, 2, "txt", false, true));
+    check(svdb_filesbypath(db, hook->filenames[0], &row));
+    TestTrue(row.id != 0 && !row.sparse);
+
+    /* seeking past the end of file 0 leaves a hole in it. file 1 is as
+    long, but its zeros are written out. */
+    check(sv_file_open(&file, cstr(hook->filenames[0]), "wb"));
+    TestEqn(0, fseek(file.file, 1024 * 1024, SEEK_SET));
+    TestEqn(1, fwrite("x", 1, 1, file.file));
+    sv_file_close(&file);
+    sv_array_appendzeros(&zeros, 1024 * 1024 + 1);
+    check(sv_file_open(&file, cstr(hook->filenames[1]), "wb"));
+    TestEqn(1, fwrite(zeros.buffer, zeros.length, 1, file.file));
+    sv_file_close(&file);
+    hook->setlastmodtimes[0]++;
+    hook->setlastmodtimes[1]++;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[0], &row));
+    TestEqn(islinux, row.sparse);
+    check(svdb_filesbypath(db, hook->filenames[1], &row));
+    TestTrue(!row.sparse);
+
+    /* a file that was moved keeps what was recorded for it */
+    TestTrue(
+        os_move(cstr(hook->filenames[0]), cstr(hook->filenames[5]), false));
+    hook->setlastmodtimes[5] = hook->setlastmodtimes[0];
+    hook->setlastmodtimes[0] = 0;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[5], &row));
+    TestEqn(islinux, row.sparse);
+
+cleanup:
+    sv_array_close(&zeros);
+    return currenterr;
+}
+
+check_result test_backup_store_deltas(const sv_app *app, sv_group *grp,
+    svdb_db *db, sv_test_hook *hook)
+{
+    sv_result currenterr = {};
+    sv_file_row row = {};
+    sv_content_row contentsrow = {};
+    TEST_OPEN(bstring, text);
+    hook->expectcontentrows = hook->expectfilerows = NULL;
+    check(test_operations_backup_reset(
+        app, grp, db, hook, 1, "txt", false, false));
+    grp->delta_chain_length = 2;
+    for (uint32_t i = 0; i < 4000; i++)
+    {
+        bformata(text, "line %u\n", i);
+    }
+
+    check(sv_file_writefile(cstr(hook->filenames[0]), cstr(text), "wb"));
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[0], &row));
+    uint64_t firstid = row.contents_id;
+    TestTrue(firstid != 0);
+
+    /* a small edit is stored as a delta */
+    text->data[100] = 'x';
+    check(sv_file_writefile(cstr(hook->filenames[0]), cstr(text), "wb"));
+    hook->setlastmodtimes[0]++;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_filesbypath(db, hook->filenames[0], &row));
+    check(svdb_contentsbyid(db, row.contents_id, &contentsrow));
+    TestEqn(firstid, contentsrow.deltabaseid);
+    TestEqn(1, contentsrow.deltadepth);
+
+    /* contents with nothing in common with the previous ones are stored
+    whole, from what the worker thread already compressed. the first time
+    the file grows, so its start is checked before it's compressed. */
+    const uint32_t counts[] = {6000, 2000};
+    for (uint32_t j = 0; j < countof(counts); j++)
+    {
+        uint32_t count = counts[j];
+        btrunc(text, 0);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            bformata(text, "%u other %u\n", i * 7919, count);
+        }
+
+        check(sv_file_writefile(cstr(hook->filenames[0]), cstr(text), "wb"));
+        hook->setlastmodtimes[0]++;
+        check(run_backup_and_reconnect(app, grp, db, hook, false));
+        check(svdb_filesbypath(db, hook->filenames[0], &row));
+        check(svdb_contentsbyid(db, row.contents_id, &contentsrow));
+        TestEqn(0, contentsrow.deltabaseid);
+        TestEqn(blength(text), contentsrow.contents_length);
+        TestTrue(contentsrow.compressed_contents_length > 0 &&
+            contentsrow.compressed_contents_length <
+                contentsrow.contents_length);
+    }
+
+    grp->delta_chain_length = 0;
+
+cleanup:
+    bdestroy(text);
+    return currenterr;
+}
+
+check_result test_backup_resume_interrupted(const sv_app *app,
+    sv_group *grp, svdb_db *db, sv_test_hook *hook)
+{
+    sv_result currenterr = {};
+    sv_file_row row = {};
+    sv_array collections = sv_array_open(sizeof32u(sv_collection_row), 0);
+    uint64_t contentscount = 0;
+    TEST_OPEN3(bstring, large, path, dbpath);
+    hook->expectcontentrows = hook->expectfilerows = NULL;
+    check(test_operations_backup_reset(app, grp, db, hook, 4, "jpg", false, false));
+    grp->approx_archive_size_bytes = 100 * 1024;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bstr_fill(large, (char)('a' + i), 60 * 1024);
+        check(sv_file_writefile(cstr(hook->filenames[i]), cstr(large), "wb"));
+    }
+
+    /* each file needs its own archive. interrupt the run right after the
+    second archive is sealed; the first two files are already committed. */
+    bassign(dbpath, db->path);
+    hook->interruptafterarchive = 2;
+    expect_err_with_message(
+        sv_backup(app, grp, db, hook), "simulated interruption");
+    hook->interruptafterarchive = 0;
+    check(svdb_connect(db, cstr(dbpath)));
+    check(svdb_collectionsget(db, &collections, true));
+    TestEqn(1, collections.length);
+    TestEqn(0, ((sv_collection_row *)sv_array_at(&collections, 0))
+                   ->time_finished);
+    check(svdb_filesbypath(db, hook->filenames[1], &row));
+    TestEqn(sv_filerowstatus_complete, row.e_status);
+    check(svdb_filesbypath(db, hook->filenames[2], &row));
+    TestEqn(sv_filerowstatus_queued, row.e_status);
+    bsetfmt(path, "%s%s00001_00002.tar", cstr(hook->path_readytoupload), pathsep);
+    TestTrue(os_file_exists(cstr(path)));
+    bsetfmt(path, "%s%s00001_00003.tar", cstr(hook->path_readytoupload), pathsep);
+    TestTrue(!os_file_exists(cstr(path)));
+
+    /* change file 0 without changing its length or modified time. the rerun
+    continues the same collection and doesn't read committed files again. */
+    bstr_fill(large, 'z', 60 * 1024);
+    check(sv_file_writefile(cstr(hook->filenames[0]), cstr(large), "wb"));
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    sv_array_truncatelength(&collections, 0);
+    check(svdb_collectionsget(db, &collections, true));
+    TestEqn(1, collections.length);
+    TestTrue(((sv_collection_row *)sv_array_at(&collections, 0))
+                 ->time_finished != 0);
+    check(svdb_contentscount(db, &contentscount));
+    TestEqn(4, contentscount);
+    check(svdb_filesbypath(db, hook->filenames[0], &row));
+    TestEqn(1, row.contents_id);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        check(svdb_filesbypath(db, hook->filenames[i], &row));
+        TestEqn(sv_filerowstatus_complete, row.e_status);
+        TestEqn(1, row.most_recent_collection);
+    }
+
+    bsetfmt(path, "%s%s00001_00004.tar", cstr(hook->path_readytoupload), pathsep);
+    TestTrue(os_file_exists(cstr(path)));
+    bsetfmt(path, "%s%s00001_00005.tar", cstr(hook->path_readytoupload), pathsep);
+    TestTrue(!os_file_exists(cstr(path)));
+    check(tests_op_check_tar_contents(hook, "00001_00002.tar",
+        "00000002.file|filenames.txt^61440|89", true));
+    grp->approx_archive_size_bytes = 32 * 1024 * 1024;
+
+cleanup:
+    sv_array_close(&collections);
+    bdestroy(large);
+    bdestroy(path);
+    bdestroy(dbpath);
+    return currenterr;
+}
+
+check_result test_backup_window(const sv_app *app, sv_group *grp,
+    svdb_db *db, sv_test_hook *hook)
+{
+    sv_result currenterr = {};
+    sv_file_row row = {};
+    sv_array collections = sv_array_open(sizeof32u(sv_collection_row), 0);
+    TEST_OPEN(bstring, large);
+    TEST_OPEN(bstring, path);
+    hook->expectcontentrows = hook->expectfilerows = NULL;
+    check(test_operations_backup_reset(app, grp, db, hook, 4, "jpg", false, false));
+    const int sizes[] = {4000, 1000, 3000, 2000};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        bstr_fill(large, (char)('a' + i), sizes[i]);
+        check(sv_file_writefile(cstr(hook->filenames[i]), cstr(large), "wb"));
+    }
+
+    /* the clock moves on 25 seconds each time it's read, so a one-minute
+    window has time for two files. smaller files go first. */
+    grp->backup_window_minutes = 1;
+    grp->io_limit_bytes_per_second = 1024 * 1024;
+    grp->background_priority = 1;
+    hook->secondspertick = 25;
+    hook->faketime = 0;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    check(svdb_collectionsget(db, &collections, true));
+    TestEqn(1, collections.length);
+    TestEqn(0, ((sv_collection_row *)sv_array_at(&collections, 0))
+                   ->time_finished);
+    const int expectstatus[] = {sv_filerowstatus_queued,
+        sv_filerowstatus_complete, sv_filerowstatus_queued,
+        sv_filerowstatus_complete};
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        check(svdb_filesbypath(db, hook->filenames[i], &row));
+        TestEqn(expectstatus[i], row.e_status);
+    }
+
+    /* the next run carries on with the same collection and finishes it */
+    hook->faketime = 0;
+    check(run_backup_and_reconnect(app, grp, db, hook, false));
+    sv_array_truncatelength(&collections, 0);
+    check(svdb_collectionsget(db, &collections, true));
+    TestEqn(1, collections.length);
+    const sv_collection_row *collection =
+        (const sv_collection_row *)sv_array_at(&collections, 0);
+    TestTrue(collection->time_finished != 0);
+    TestEqn(4, collection->count_new_contents);
+    TestEqn(10000, collection->count_new_contents_bytes);
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        check(svdb_filesbypath(db, hook->filenames[i], &row));
+        TestEqn(sv_filerowstatus_complete, row.e_status);
+        TestEqn(sizes[i], row.contents_length);
+    }
+
+    /* the run's report only covers the two files left for it */
+    bsetfmt(path, "%s%sperf%s%s_backup.json", cstr(app->path_app_data),
+        pathsep, pathsep, cstr(grp->grpname));
+    check(sv_file_readfile(cstr(path), large));
+    TestTrue(s_contains(cstr(large), "\"success\": true"));
+    TestTrue(s_contains(cstr(large), "{\"phase\": \"hash\", \"calls\": 2, "));
+    bsetfmt(path, "%s%sperf%sglacial_backup_%s_backup.prom",
+        cstr(app->path_app_data), pathsep, pathsep, cstr(grp->grpname));
+    check(sv_file_readfile(cstr(path), large));
+    TestTrue(s_contains(cstr(large), "phase=\"tar\"} 7000\n"));
+
+    grp->backup_window_minutes = 0;
+    grp->io_limit_bytes_per_second = 0;
+    grp->background_priority = 0;
+    hook->secondspertick = 0;
+
+cleanup:
+    sv_array_close(&collections);
+    bdestroy(large);
+    bdestroy(path);
+    return currenterr;
+}
+
 check_result test_backup_add_mp3(const sv_app *app, sv_group *grp,
     svdb_db *db, sv_test_hook *hook)
 {
@@ -1100,7 +1430,7 @@ check_result test_backup_add_mp3(const sv_app *app, sv_group *grp,
     check(run_backup_and_reconnect(app, grp, db, hook, true));
 
     hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=1,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=1|"
-        "hash=611c9c9e3d1e62cc 1ffaa7d05b187124 0 0, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=1, original_collection=1, archivenumber=1, id=2|";
+        "hash=59421c74c21ba9e3 e23589740a3bda85 d0c31dfd05eae940 dcdc327ab8e66120, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=1, original_collection=1, archivenumber=1, id=2|";
     hook->expectfilerows = "contents_length=1, contents_id=1, last_write_time=1, flags=0, most_recent_collection=1, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.mp3|"
         "contents_length=1, contents_id=2, last_write_time=1, flags=111, most_recent_collection=1, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.mp3|"
         "contents_length=1, contents_id=2, last_write_time=1, flags=222, most_recent_collection=1, e_status=3, id=3*" pathsep "file\xE1\x84\x81_2.mp3|"
@@ -1151,9 +1481,9 @@ check_result test_backup_ignore_tag_changes(const sv_app *app, sv_group *grp,
     hook->setlastmodtimes[6]++;
 
     hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=1,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=1|"
-        "hash=611c9c9e3d1e62cc 1ffaa7d05b187124 0 0, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=2, original_collection=1, archivenumber=1, id=2|";
+        "hash=59421c74c21ba9e3 e23589740a3bda85 d0c31dfd05eae940 dcdc327ab8e66120, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=1, original_collection=1, archivenumber=1, id=2|";
     hook->expectfilerows = "contents_length=1, contents_id=1, last_write_time=1, flags=0, most_recent_collection=2, e_status=0, id=1*" pathsep "file\xE1\x84\x81_0.mp3|"
-        "contents_length=1, contents_id=2, last_write_time=1, flags=111, most_recent_collection=2, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.mp3|"
+        "contents_length=1, contents_id=2, last_write_time=1, flags=111, most_recent_collection=1, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.mp3|"
         "contents_length=1, contents_id=2, last_write_time=1, flags=222, most_recent_collection=2, e_status=0, id=3*" pathsep "file\xE1\x84\x81_2.mp3|"
         "contents_length=1, contents_id=2, last_write_time=1, flags=333, most_recent_collection=2, e_status=0, id=4*" pathsep "file\xE1\x84\x81_3.mp3|"
         "contents_length=1, contents_id=2, last_write_time=1, flags=444, most_recent_collection=2, e_status=0, id=5*" pathsep "file\xE1\x84\x81_4.mp3|"
@@ -1162,12 +1492,12 @@ check_result test_backup_ignore_tag_changes(const sv_app *app, sv_group *grp,
     check(run_backup_and_reconnect(app, grp, db, hook, true));
 
     hook->expectcontentrows = "hash=fcd1572cd1921b1a 35718c89e8fdc127 d5332a8e5503b4b8 4efdba7c141ea729, crc32=4de40385, contents_length=1,??, most_recent_collection=1, original_collection=1, archivenumber=1, id=1|"
-        "hash=611c9c9e3d1e62cc 1ffaa7d05b187124 0 0, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=2, original_collection=1, archivenumber=1, id=2|"
+        "hash=59421c74c21ba9e3 e23589740a3bda85 d0c31dfd05eae940 dcdc327ab8e66120, crc32=b6a3e71a, contents_length=1,3???, most_recent_collection=2, original_collection=1, archivenumber=1, id=2|"
         "hash=4d098b3072969adc 635dfe534db06698 d2307aea1e18b7b3 922bbf0481ef8e6b, crc32=95bcd25d, contents_length=1,??, most_recent_collection=2, original_collection=2, archivenumber=1, id=3|"
         "hash=6e1b0f02bb2220c4 aba9f88dca9fd76f 6d2e86e5f79b4f25 b039cedc3e4fd7af, crc32=b4e1484f, contents_length=1,3???, most_recent_collection=2, original_collection=2, archivenumber=1, id=4|"
-        "hash=7d49276b4e05c2bd 39f840313d6eeb4f 0 0, crc32=c5679762, contents_length=1,3???, most_recent_collection=2, original_collection=2, archivenumber=1, id=5|";
+        "hash=c3fc7d86a663db1e 19d4eab16d175bc 7de0e805a82a6a15 73dadf05f0311c2c, crc32=c5679762, contents_length=1,3???, most_recent_collection=2, original_collection=2, archivenumber=1, id=5|";
     hook->expectfilerows = "contents_length=1, contents_id=3, last_write_time=2, flags=0, most_recent_collection=2, e_status=3, id=1*" pathsep "file\xE1\x84\x81_0.mp3|"
-        "contents_length=1, contents_id=2, last_write_time=1, flags=111, most_recent_collection=2, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.mp3|"
+        "contents_length=1, contents_id=2, last_write_time=1, flags=111, most_recent_collection=1, e_status=3, id=2*" pathsep "file\xE1\x84\x81_1.mp3|"
         "contents_length=1, contents_id=4, last_write_time=2, flags=222, most_recent_collection=2, e_status=3, id=3*" pathsep "file\xE1\x84\x81_2.mp3|"
         "contents_length=1, contents_id=2, last_write_time=2, flags=333, most_recent_collection=2, e_status=3, id=4*" pathsep "file\xE1\x84\x81_3.mp3|"
         "contents_length=1, contents_id=5, last_write_time=2, flags=444, most_recent_collection=2, e_status=3, id=5*" pathsep "file\xE1\x84\x81_4.mp3|"
@@ -1240,7 +1570,7 @@ check_result test_operations_restore(
         op.test_context = hook;
         check(ar_manager_open(
             &op.archiver, cstr(app->path_app_data), cstr(grp->grpname), 0, 0));
-        check(checkbinarypaths(&op.archiver.ar, false, NULL));
+        check(checkbinarypaths(&op.archiver.ar));
         TestTrue(os_create_dirs(cstr(op.working_dir_archived)));
         TestTrue(os_create_dirs(cstr(op.working_dir_unarchived)));
 
@@ -1346,6 +1676,11 @@ check_result test_operations_backup(
     check(test_backup_see_metadata_changes(app, grp, db, hook));
     check(test_backup_archive_sizing(app, grp, db, hook));
     check(test_backup_no_changed_files(app, grp, db, hook));
+    check(test_backup_see_moved_files(app, grp, db, hook));
+    check(test_backup_record_sparse_files(app, grp, db, hook));
+    check(test_backup_store_deltas(app, grp, db, hook));
+    check(test_backup_resume_interrupted(app, grp, db, hook));
+    check(test_backup_window(app, grp, db, hook));
     check(test_backup_add_mp3(app, grp, db, hook));
     check(test_backup_ignore_tag_changes(app, grp, db, hook));
 
@@ -197,6 +197,25 @@ check_result sv_grp_load(svdb_db *db, sv_group *self, const char *grpname)
         db, s_and_len("separate_metadata"), &self->separate_metadata));
     check(svdb_getint(
         db, s_and_len("pause_duration_seconds"), &self->pause_duration_seconds));
+    check(
+        svdb_getint(db, s_and_len("worker_threads"), &self->worker_threads));
+    check(
+        svdb_getint(db, s_and_len("hash_algorithm"), &self->hash_algorithm));
+    check(svdb_getint(db, s_and_len("read_engine"), &self->read_engine));
+    check(svdb_getint(db, s_and_len("codec"), &self->codec));
+    check(svdb_getint(db, s_and_len("codec_level"), &self->codec_level));
+    check(svdb_getint(db, s_and_len("solid_threshold_bytes"),
+        &self->solid_threshold_bytes));
+    check(svdb_getint(db, s_and_len("chunk_threshold_bytes"),
+        &self->chunk_threshold_bytes));
+    check(svdb_getint(
+        db, s_and_len("delta_chain_length"), &self->delta_chain_length));
+    check(svdb_getint(
+        db, s_and_len("backup_window_minutes"), &self->backup_window_minutes));
+    check(svdb_getint(db, s_and_len("io_limit_bytes_per_second"),
+        &self->io_limit_bytes_per_second));
+    check(svdb_getint(
+        db, s_and_len("background_priority"), &self->background_priority));
 
 cleanup:
     return currenterr;
@@ -219,25 +238,28 @@ check_result sv_grp_persist(svdb_db *db, const sv_group *self)
         db, s_and_len("separate_metadata"), self->separate_metadata));
     check(svdb_setint(
         db, s_and_len("pause_duration_seconds"), self->pause_duration_seconds));
+    check(svdb_setint(db, s_and_len("worker_threads"), self->worker_threads));
+    check(svdb_setint(db, s_and_len("hash_algorithm"), self->hash_algorithm));
+    check(svdb_setint(db, s_and_len("read_engine"), self->read_engine));
+    check(svdb_setint(db, s_and_len("codec"), self->codec));
+    check(svdb_setint(db, s_and_len("codec_level"), self->codec_level));
+    check(svdb_setint(db, s_and_len("solid_threshold_bytes"),
+        self->solid_threshold_bytes));
+    check(svdb_setint(db, s_and_len("chunk_threshold_bytes"),
+        self->chunk_threshold_bytes));
+    check(svdb_setint(
+        db, s_and_len("delta_chain_length"), self->delta_chain_length));
+    check(svdb_setint(
+        db, s_and_len("backup_window_minutes"), self->backup_window_minutes));
+    check(svdb_setint(db, s_and_len("io_limit_bytes_per_second"),
+        self->io_limit_bytes_per_second));
+    check(svdb_setint(
+        db, s_and_len("background_priority"), self->background_priority));
 
 cleanup:
     return currenterr;
 }
 
-bool sv_grp_isincluded(
-    const sv_group *self, const char *path, unused_ptr(bstrlist))
-{
-    for (int i = 0; i < self->exclusion_patterns->qty; i++)
-    {
-        if (fnmatch_simple(blist_view(self->exclusion_patterns, i), path))
-        {
-            return false;
-        }
-    }
-
-    return true;
-}
-
 void sv_grp_close(sv_group *self)
 {
     if (self)
@@ -321,9 +343,7 @@ check_result sv_app_run_lowpriv(sv_app *app, unused(int))
     {
         printf("We support running GlacialBackup in a user account that "
                "has restricted privileges. This can be useful to minimize the "
-               "impact of any security vulnerability in xz or ffmpeg. (ffmpeg "
-               "is only used if you have enabled the skip-audio-metadata "
-               "feature.)\n");
+               "impact of any security vulnerability in xz.\n");
 
 #ifdef __linux__
         printf("\n\nStep 1) Create a user account, give it 'Read' and "
@@ -705,7 +725,7 @@ check_result app_edit_setting(sv_app *app, int setting)
                  "the entire mp3 is added each time backups are run. With this "
                  "feature enabled, only changes to the actual audio data are "
                  "archived. We support this feature for mp3, ogg, m4a, and flac "
-                 "files, and use ffmpeg to perform the computation.\nEnter 1 to "
+                 "files, and read the audio data directly.\nEnter 1 to "
                  "enable and 0 to disable. The setting is currently %d.";
         ptr = &grp.separate_metadata;
         valmax = 1;
@@ -745,6 +765,145 @@ check_result app_edit_setting(sv_app *app, int setting)
         ptr = &grp.pause_duration_seconds;
         valmin = 0;
         valmax = 500;
+        break;
+    case sv_set_worker_threads:
+        prompt = "Set number of threads used when running backups...\n\n"
+                 "Files are hashed and compressed on this many threads at "
+                 "once. Each thread can use about 100Mb of memory while "
+                 "compressing. Enter 0 to choose automatically based on the "
+                 "number of processors, or 1 to use a single thread. The "
+                 "current value is %d.";
+        ptr = &grp.worker_threads;
+        valmin = 0;
+        valmax = 64;
+        break;
+    case sv_set_hash_algorithm:
+        prompt = "Set how file contents are hashed...\n\n"
+                 "0) SpookyHash, read start to finish on one thread.\n"
+                 "1) A tree of SpookyHash leaves. Large files are split into "
+                 "1Mb pieces that are hashed on several threads at once, "
+                 "which is much faster for files such as disk images.\n\n"
+                 "Files already backed up keep their existing hash; the new "
+                 "setting applies to files that are added or changed. The "
+                 "current value is %d.";
+        ptr = &grp.hash_algorithm;
+        valmin = 0;
+        valmax = sv_hashalgorithm_count - 1;
+        break;
+    case sv_set_read_engine:
+        prompt = "Set how files are read when backing up...\n\n"
+                 "0) Read through a buffer. Files that were backed up stay in "
+                 "the operating system's file cache.\n"
+                 "1) Map large files into memory and drop each part from the "
+                 "file cache once it has been hashed, so that running a "
+                 "backup doesn't push other programs' data out of memory. "
+                 "Recommended for busy servers. Linux only.\n\n"
+                 "The current value is %d.";
+        ptr = &grp.read_engine;
+        valmin = 0;
+        valmax = sv_readengine_count - 1;
+        break;
+    case sv_set_codec:
+        prompt = "Set how files are compressed...\n\n"
+                 "0) xz, at the same strength as xz -6. Smallest archives, "
+                 "but compresses only a few Mb per second on each thread.\n"
+                 "1) zstd, at the level chosen in \"Set compression level\". "
+                 "Much faster, and at higher levels nearly as small as xz.\n\n"
+                 "Files already backed up stay in their existing format and "
+                 "can still be restored. The current value is %d.";
+        ptr = &grp.codec;
+        valmin = 0;
+        valmax = ar_codec_count - 1;
+        break;
+    case sv_set_codec_level:
+        prompt = "Set compression level...\n\n"
+                 "Used when files are compressed with zstd. Level 3 is fast "
+                 "enough for daily backups, and level 19 compresses nearly as "
+                 "well as xz. Higher levels look further back for repeated "
+                 "data, using up to 128Mb more memory on each thread. The "
+                 "current value is %d.";
+        ptr = &grp.codec_level;
+        valmin = 1;
+        valmax = 19;
+        break;
+    case sv_set_solid_threshold_bytes:
+        prompt = "Set size below which files are packed together...\n\n"
+                 "Small files, such as source code, compress much better "
+                 "when many of them are compressed together in one block of "
+                 "up to 4Mb. Restoring one of them decompresses its whole "
+                 "block, and compacting only removes a block once every file "
+                 "in it is no longer needed. Enter 0 to compress every file "
+                 "separately. The current value is %d Kb.";
+        ptr = &grp.solid_threshold_bytes;
+        scalefactor = 1024;
+        valmin = 0;
+        valmax = 1024;
+        break;
+    case sv_set_chunk_threshold_bytes:
+        prompt = "Set size above which files are split into chunks...\n\n"
+                 "Large files that change a little at a time, such as disk "
+                 "images, databases, and mailboxes, are split into chunks of "
+                 "up to about 1Mb at boundaries chosen by their contents. "
+                 "Only the chunks that changed are added to the next backup, "
+                 "even if data was inserted or removed. Enter 0 to always "
+                 "store whole files. The current value is %d Mb.";
+        ptr = &grp.chunk_threshold_bytes;
+        scalefactor = 1024 * 1024;
+        valmin = 0;
+        valmax = 4095;
+        break;
+    case sv_set_delta_chain_length:
+        prompt = "Set how changed files are stored as differences...\n\n"
+                 "When a file up to 128Mb changes, store only the difference "
+                 "from its previous version if that is less than half the "
+                 "size of the file. Files of any size that have only had data "
+                 "added to the end, such as logs and mailboxes, store just the "
+                 "new data. Restoring it first restores the previous "
+                 "version, so this limits how many differences can be stacked "
+                 "on top of each other before the whole file is stored "
+                 "again. Enter 0 to always store whole files. The current "
+                 "value is %d.";
+        ptr = &grp.delta_chain_length;
+        valmin = 0;
+        valmax = 16;
+        break;
+    case sv_set_backup_window_minutes:
+        prompt = "Set how long backups may run...\n\n"
+                 "When backups have run for this many minutes, no more files "
+                 "are started. The archive being written is finished and "
+                 "saved, and the files that are left are backed up the next "
+                 "time backups run. Files changed in the last day are backed "
+                 "up first, then smaller files before larger ones. Enter 0 "
+                 "to let backups run until every file is done. The current "
+                 "value is %d minutes.";
+        ptr = &grp.backup_window_minutes;
+        valmin = 0;
+        valmax = 24 * 60;
+        break;
+    case sv_set_io_limit_bytes_per_second:
+        prompt = "Set a limit on disk use while backing up...\n\n"
+                 "Reading files and writing archives together won't go "
+                 "faster than this many Mb per second, averaged over a "
+                 "second or so, however many threads are running. Use this "
+                 "to keep backups from slowing down a busy server. Enter 0 "
+                 "for no limit. The current value is %d Mb per second.";
+        ptr = &grp.io_limit_bytes_per_second;
+        scalefactor = 1024 * 1024;
+        valmin = 0;
+        valmax = 4095;
+        break;
+    case sv_set_background_priority:
+        prompt = "Run backups in the background...\n\n"
+                 "When this feature is enabled, the threads that read and "
+                 "compress files run at the lowest cpu priority, and on "
+                 "Linux only use the disk when no other program is using "
+                 "it. Each file is dropped from the file cache once it has "
+                 "been archived. This applies when more than one thread is "
+                 "used. Enter 1 to enable and 0 to disable. The setting is "
+                 "currently %d.";
+        ptr = &grp.background_priority;
+        valmax = 1;
+        break;
     default:
         break;
     }
@@ -840,6 +999,10 @@ check_result sv_verify_archives(
 
     bstrlist *names = bstrlist_open();
     bstrlist *sums = bstrlist_open();
+    sv_perf perf = {};
+    sv_perf_open(&perf, "verify");
+    sv_perf_span span = sv_perf_begin();
+    uint64_t bytesread = 0, count = 0;
     check(svdb_archives_get_checksums(db, names, sums));
     check_b(names->qty == sums->qty, "should be same number. got %d, %d",
         names->qty, sums->qty);
@@ -865,6 +1028,8 @@ check_result sv_verify_archives(
             if (os_file_exists(cstr(path)))
             {
                 check(get_file_checksum_string(cstr(path), checksum_got));
+                bytesread += os_getfilesize(cstr(path));
+                count++;
                 if (verify_archive_checksum(
                         blist_view(names, i), cstr(checksum_got), names, sums))
                 {
@@ -900,12 +1065,16 @@ check_result sv_verify_archives(
         }
     }
 
+    sv_perf_end(&perf, sv_perf_checksum, &span, bytesread, 0, count);
     if (!countmismatches)
     {
         alert("");
     }
 
 cleanup:
+    sv_perf_write(&perf, cstr(app->path_app_data), cstr(grp->grpname),
+        currenterr.code == 0);
+    sv_perf_close(&perf);
     bdestroy(path);
     bdestroy(dir);
     bdestroy(checksum_got);
@@ -922,6 +1091,17 @@ void add_default_group_settings(sv_group *grp)
     grp->days_to_keep_prev_versions = 30;
     grp->pause_duration_seconds = 30;
     grp->separate_metadata = 0;
+    grp->worker_threads = 0;
+    grp->hash_algorithm = sv_hashalgorithm_spooky;
+    grp->read_engine = sv_readengine_read;
+    grp->codec = ar_codec_xz;
+    grp->codec_level = 3;
+    grp->solid_threshold_bytes = 0;
+    grp->chunk_threshold_bytes = 0;
+    grp->delta_chain_length = 0;
+    grp->backup_window_minutes = 0;
+    grp->io_limit_bytes_per_second = 0;
+    grp->background_priority = 0;
 
     bstrlist_appendcstr(grp->exclusion_patterns, "*.tmp");
     bstrlist_appendcstr(grp->exclusion_patterns, "*.pyc");
@@ -27,6 +27,17 @@ typedef struct sv_group
     uint32_t approx_archive_size_bytes;
     uint32_t compact_threshold_bytes;
     uint32_t pause_duration_seconds;
+    uint32_t worker_threads;
+    uint32_t hash_algorithm;
+    uint32_t read_engine;
+    uint32_t codec;
+    uint32_t codec_level;
+    uint32_t solid_threshold_bytes;
+    uint32_t chunk_threshold_bytes;
+    uint32_t delta_chain_length;
+    uint32_t backup_window_minutes;
+    uint32_t io_limit_bytes_per_second;
+    uint32_t background_priority;
 } sv_group;
 
 typedef struct sv_app
@@ -42,8 +53,6 @@ typedef struct sv_app
 void sv_grp_close(sv_group *self);
 check_result sv_grp_load(svdb_db *db, sv_group *self, const char *grpname);
 check_result sv_grp_persist(svdb_db *db, const sv_group *self);
-bool sv_grp_isincluded(
-    const sv_group *self, const char *path, bstrlist *messages);
 
 void sv_app_close(sv_app *self);
 check_result sv_app_load(sv_app *self, const char *dir, bool low_access);
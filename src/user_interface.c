@@ -33,6 +33,21 @@ check_result ui_action_exit(unused_ptr(sv_app), unused(int))
     exit(0);
 }
 
+check_result ui_action_benchmark_hashes(sv_app *app, unused(int))
+{
+    sv_result currenterr = {};
+    printf("Checksum speed for each crc32 implementation:\n");
+    sv_crc32_benchmark(1024);
+    printf("\nContent hash speed:\n");
+    sv_contenthash_benchmark(4096);
+    printf("\nReading a file that isn't cached, with each read engine:\n");
+    check(sv_hasher_benchmark(cstr(app->path_temp_unarchived), 512));
+    alert("");
+
+cleanup:
+    return currenterr;
+}
+
 noreturn_start() check_result ui_action_tests(unused_ptr(sv_app), unused(int))
 {
     sv_log_register_active_logger(NULL);
@@ -109,6 +124,26 @@ check_result ui_menu_edit_grp(sv_app *app, unused(int))
             sv_set_pause_duration},
         {"Skip metadata changes...", &app_edit_setting,
             sv_set_separate_metadata_enabled},
+        {"Set number of threads used when running backups...",
+            &app_edit_setting, sv_set_worker_threads},
+        {"Set how file contents are hashed...", &app_edit_setting,
+            sv_set_hash_algorithm},
+        {"Set how files are read when backing up...", &app_edit_setting,
+            sv_set_read_engine},
+        {"Set how files are compressed...", &app_edit_setting, sv_set_codec},
+        {"Set compression level...", &app_edit_setting, sv_set_codec_level},
+        {"Set size below which files are packed together...",
+            &app_edit_setting, sv_set_solid_threshold_bytes},
+        {"Set size above which files are split into chunks...",
+            &app_edit_setting, sv_set_chunk_threshold_bytes},
+        {"Set how changed files are stored as differences...",
+            &app_edit_setting, sv_set_delta_chain_length},
+        {"Set how long backups may run...", &app_edit_setting,
+            sv_set_backup_window_minutes},
+        {"Set a limit on disk use while backing up...", &app_edit_setting,
+            sv_set_io_limit_bytes_per_second},
+        {"Run backups in the background...", &app_edit_setting,
+            sv_set_background_priority},
         {"Back", NULL}, {NULL, NULL}};
 
     return menu_choose_action("Edit backup group...", entries, app, NULL);
@@ -123,6 +158,8 @@ check_result ui_menu_more(sv_app *app, unused(int))
             sv_run_compact},
         {"Verify archive integrity", &sv_application_run, sv_run_verify},
         {"Run tests", &ui_action_tests},
+        {"Benchmark checksum, hash, and read speed",
+            &ui_action_benchmark_hashes},
         {"Run backups with low-privilege account...", &sv_app_run_lowpriv},
         {"Back", NULL}, {NULL, NULL}};
 
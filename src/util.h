@@ -35,9 +35,11 @@ GNU General Public License for more details.
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <setjmp.h>
 #include <signal.h>
 #include <strings.h>
 #include <sys/file.h>
+#include <sys/mman.h>
 #include <sys/sendfile.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -13,6 +13,12 @@ GNU General Public License for more details.
 */
 
 #include "util_archiver.h"
+#if SV_USE_LIBLZMA
+#include <lzma.h>
+#endif
+#if SV_USE_LIBZSTD
+#include <zstd.h>
+#endif
 
 check_result ar_manager_open(ar_manager *self, const char *pathapp,
     const char *grpname, uint32_t collectionid, uint32_t archivesize)
@@ -29,6 +35,8 @@ check_result ar_manager_open(ar_manager *self, const char *pathapp,
     self->limitperarchive = 25 * 1000;
     self->collectionid = collectionid;
     self->target_archive_size = archivesize;
+    self->solid_blocksize = 4 * 1024 * 1024;
+    self->solid_buffer = sv_array_open(sizeof32u(byte), 0);
     self->currentarchive = bstring_open();
     self->current_names = bstrlist_open();
     self->current_sizes = sv_array_open_u64();
@@ -38,19 +46,77 @@ check_result ar_manager_open(ar_manager *self, const char *pathapp,
 check_result ar_manager_begin(ar_manager *self)
 {
     sv_result currenterr = {};
+    bstring stale = bstring_open();
 
     /* clear tmp folders */
-    sv_log_fmt("ar_manager_begin, collection=%u", self->collectionid);
+    sv_log_fmt("ar_manager_begin, collection=%u, resume after %u",
+        self->collectionid, self->resume_after);
     check_b(os_create_dirs(cstr(self->path_working)),
         "couldn't create or access %s", cstr(self->path_working));
     check(os_tryuntil_deletefiles(cstr(self->path_working), "*"));
     check_b(os_create_dirs(cstr(self->path_staging)),
         "couldn't create or access %s", cstr(self->path_staging));
     check(os_tryuntil_deletefiles(cstr(self->path_staging), "*"));
-    self->currentarchivenum = 0;
+
+    /* an interrupted run can leave an archive that was sealed but whose rows
+    weren't committed, so nothing refers to it */
+    for (uint32_t i = self->resume_after + 1;; i++)
+    {
+        bsetfmt(stale, "%s%s%05x_%05x.tar", cstr(self->path_readytoupload),
+            pathsep, self->collectionid, i);
+        if (!os_file_exists(cstr(stale)))
+        {
+            break;
+        }
+
+        check_b(os_tryuntil_remove(cstr(stale)), "couldn't delete %s",
+            cstr(stale));
+    }
+
+    self->currentarchivenum = self->resume_after;
     check(ar_manager_advance_to_next(self));
 
 cleanup:
+    bdestroy(stale);
+    return currenterr;
+}
+
+/* make a rename into dir survive a power loss */
+static void ar_util_syncdir(const char *dir)
+{
+#if __linux__
+    int fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0)
+    {
+        (void)fsync(fd);
+        close(fd);
+    }
+#else
+    /* ntfs journals the rename itself */
+    (void)dir;
+#endif
+}
+
+/* move a finished archive out of staging, then tell the caller, who can now
+commit the rows that refer to it. */
+static check_result ar_manager_seal(ar_manager *self)
+{
+    sv_result currenterr = {};
+    bstring dest = bformat("%s%s%05x_%05x.tar", cstr(self->path_readytoupload),
+        pathsep, self->collectionid, self->currentarchivenum);
+    check_b(os_create_dirs(cstr(self->path_readytoupload)),
+        "couldn't create or access %s", cstr(self->path_readytoupload));
+    check_b(os_tryuntil_move(cstr(self->currentarchive), cstr(dest), true),
+        "couldn't move %s to %s", cstr(self->currentarchive), cstr(dest));
+    ar_util_syncdir(cstr(self->path_readytoupload));
+    if (self->sealed_callback)
+    {
+        check(self->sealed_callback(
+            self->sealed_context, self->currentarchivenum));
+    }
+
+cleanup:
+    bdestroy(dest);
     return currenterr;
 }
 
@@ -62,6 +128,8 @@ check_result ar_manager_advance_to_next(ar_manager *self)
     sv_log_fmt("finishing archive %s with %d files", cstr(self->currentarchive),
         self->current_names->qty);
 
+    /* rows already point at the pending block, so it goes in this archive */
+    check(ar_manager_flush_block(self));
     if (self->currentarchivenum > 0 && self->current_names->qty > 0)
     {
         /* add filenames.txt */
@@ -69,14 +137,17 @@ check_result ar_manager_advance_to_next(ar_manager *self)
         {
             sv_file_close(&self->namestextfile);
             sv_log_fmt("adding %s", cstr(namestextpath));
-            check(ar_util_add(&self->ar, cstr(self->currentarchive),
-                cstr(namestextpath), "filenames.txt", 0));
+            check(ar_tar_writer_add(
+                &self->writer, cstr(namestextpath), "filenames.txt", NULL));
         }
 
+        check(ar_tar_writer_finish(&self->writer));
         check(ar_util_verify(&self->ar, cstr(self->currentarchive),
             self->current_names, &self->current_sizes));
+        check(ar_manager_seal(self));
     }
 
+    ar_tar_writer_close(&self->writer);
     self->currentarchivenum++;
     bstrlist_clear(self->current_names);
     sv_array_truncatelength(&self->current_sizes, 0);
@@ -92,16 +163,176 @@ cleanup:
     return currenterr;
 }
 
+check_result ar_manager_tar_add(
+    ar_manager *self, const char *input, const char *namewithin)
+{
+    sv_result currenterr = {};
+    if (!self->writer.file.file)
+    {
+        /* open lazily, so that an archive with no files is never created */
+        check(ar_tar_writer_open(&self->writer, cstr(self->currentarchive)));
+    }
+
+    check(ar_tar_writer_add(&self->writer, input, namewithin, NULL));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_manager_tar_add_compressed(ar_manager *self,
+    const char *input, const char *namewithin, uint64_t *compressedsize)
+{
+    sv_result currenterr = {};
+    os_lockedfilehandle handle = {};
+    if (!self->writer.file.file)
+    {
+        check(ar_tar_writer_open(&self->writer, cstr(self->currentarchive)));
+    }
+
+    check(os_lockedfilehandle_open(&handle, input, true, NULL));
+    check(ar_tar_writer_add_compressed(&self->writer, &handle, namewithin,
+        self->codec, self->codec_level, compressedsize));
+
+cleanup:
+    os_lockedfilehandle_close(&handle);
+    return currenterr;
+}
+
+/* the member just compressed into the archive made it too large. its bytes
+are moved to the next archive as they are, instead of compressing again. */
+static check_result ar_manager_move_last_to_next(
+    ar_manager *self, const char *namewithin, uint64_t compressedsize)
+{
+    sv_result currenterr = {};
+    bstring moved =
+        bformat("%s%s%s", cstr(self->path_working), pathsep, namewithin);
+    check(ar_tar_writer_take_last(&self->writer, compressedsize, cstr(moved)));
+    check(ar_manager_advance_to_next(self));
+    check(ar_manager_tar_add(self, cstr(moved), namewithin));
+
+cleanup:
+    log_b(os_tryuntil_remove(cstr(moved)), "couldn't delete %s", cstr(moved));
+    bdestroy(moved);
+    return currenterr;
+}
+
+check_result ar_manager_flush_block(ar_manager *self)
+{
+    sv_result currenterr = {};
+    if (self->solid_blockid)
+    {
+        uint64_t compressedsize = 0;
+        char namewithin[PATH_MAX] = {0};
+        snprintf(namewithin, countof(namewithin) - 1, "%08llx.blk.%s",
+            castull(self->solid_blockid), ar_codec_suffix(self->codec));
+        sv_log_fmt("flushing block %s with %u bytes", namewithin,
+            self->solid_buffer.length);
+        if (!self->writer.file.file)
+        {
+            check(
+                ar_tar_writer_open(&self->writer, cstr(self->currentarchive)));
+        }
+
+        check(ar_tar_writer_add_compressed_buffer(&self->writer,
+            self->solid_buffer.buffer, self->solid_buffer.length, namewithin,
+            self->codec, self->codec_level, &compressedsize));
+        bstrlist_appendcstr(self->current_names, namewithin);
+        sv_array_add64u(&self->current_sizes, compressedsize);
+        sv_array_truncatelength(&self->solid_buffer, 0);
+        self->solid_blockid = 0;
+    }
+
+cleanup:
+    return currenterr;
+}
+
+/* whether a file of this size is packed into the shared block */
+bool ar_manager_packs(
+    const ar_manager *self, bool already_compressed, uint64_t size)
+{
+    return !already_compressed && ar_codec_in_process(self->codec) &&
+        size < self->solid_threshold;
+}
+
+static check_result ar_manager_add_to_block(ar_manager *self,
+    const byte *data, uint64_t size, uint64_t contentid, uint64_t *blockid,
+    uint64_t *blockoffset)
+{
+    sv_result currenterr = {};
+
+    /* the pending block is counted at its uncompressed size, so the archive
+    can't grow much past its target once the block is compressed */
+    if (self->writer.offset + self->solid_buffer.length + size >
+            self->target_archive_size ||
+        self->current_names->qty > self->limitperarchive)
+    {
+        if (self->current_names->qty > 0 || self->solid_buffer.length > 0)
+        {
+            check(ar_manager_advance_to_next(self));
+        }
+    }
+    else if (self->solid_buffer.length + size > self->solid_blocksize)
+    {
+        check(ar_manager_flush_block(self));
+    }
+
+    /* an empty file has no bytes to copy, and data can be NULL */
+    *blockoffset = self->solid_buffer.length;
+    if (size)
+    {
+        sv_array_append(&self->solid_buffer, data, cast64u32u(size));
+    }
+    if (!self->solid_blockid)
+    {
+        self->solid_blockid = contentid;
+    }
+
+    *blockid = self->solid_blockid;
+
+cleanup:
+    return currenterr;
+}
+
+/* pack bytes from memory into the shared block, e.g. a small file that the
+caller has read from the handle it was hashed from. */
+check_result ar_manager_add_buffer_to_block(ar_manager *self,
+    const byte *data, uint32_t len, const char *displayname,
+    uint64_t contentid, uint32_t *archivenumber, uint64_t *blockid,
+    uint64_t *blockoffset)
+{
+    sv_result currenterr = {};
+    check(ar_manager_add_to_block(
+        self, data, len, contentid, blockid, blockoffset));
+    *archivenumber = self->currentarchivenum;
+    fprintf(self->namestextfile.file, "%08llx\t%s\t%08llx.blk+%llu\n",
+        castull(contentid), displayname, castull(*blockid),
+        castull(*blockoffset));
+
+cleanup:
+    return currenterr;
+}
+
 check_result ar_manager_add(ar_manager *self, const char *input,
     bool already_compressed, uint64_t contentid, uint32_t *archivenumber,
-    uint64_t *compressedsize)
+    uint64_t *compressedsize, uint64_t *blockid, uint64_t *blockoffset)
 {
     sv_result currenterr = {};
     *compressedsize = 0;
+    *blockid = 0;
+    *blockoffset = 0;
     bool add_file_directly_to_tar = already_compressed;
-    uint64_t archivesize = os_getfilesize(cstr(self->currentarchive));
+    uint64_t archivesize = self->writer.offset;
+    uint64_t inputsize = self->solid_threshold ? os_getfilesize(input) : 0;
+    sv_array contents = sv_array_open(1, 0);
 
-    if (add_file_directly_to_tar)
+    if (ar_manager_packs(self, already_compressed, inputsize))
+    {
+        /* the block is compressed later, so *compressedsize stays 0 */
+        check(ar_util_readall(input, &contents));
+        check(ar_manager_add_to_block(self, contents.buffer, contents.length,
+            contentid, blockid, blockoffset));
+    }
+    else if (add_file_directly_to_tar)
     {
         *compressedsize = os_getfilesize(input);
         if (archivesize + *compressedsize > self->target_archive_size ||
@@ -114,15 +345,38 @@ check_result ar_manager_add(ar_manager *self, const char *input,
         char namewithinarchive[PATH_MAX] = {0};
         snprintf(namewithinarchive, countof(namewithinarchive) - 1,
             "%08llx.file", castull(contentid));
-        check(ar_util_add(&self->ar, cstr(self->currentarchive), input,
-            namewithinarchive, *compressedsize));
+        check(ar_manager_tar_add(self, input, namewithinarchive));
         bstrlist_appendcstr(self->current_names, namewithinarchive);
     }
+    else if (ar_codec_in_process(self->codec))
+    {
+        char namewithin[PATH_MAX] = {0};
+        snprintf(namewithin, countof(namewithin) - 1, "%08llx.%s",
+            castull(contentid), ar_codec_suffix(self->codec));
+
+        /* compress straight into the archive. the compressed size isn't
+        known until afterwards, so if it didn't fit, move it to the next. */
+        check(ar_manager_tar_add_compressed(
+            self, input, namewithin, compressedsize));
+        if ((archivesize + *compressedsize > self->target_archive_size ||
+                self->current_names->qty > self->limitperarchive) &&
+            self->current_names->qty > 0)
+        {
+            check(ar_manager_move_last_to_next(
+                self, namewithin, *compressedsize));
+        }
+
+        bstrlist_appendcstr(self->current_names, namewithin);
+    }
     else
     {
+        char namewithin[PATH_MAX] = {0};
+        snprintf(namewithin, countof(namewithin) - 1, "%08llx.xz",
+            castull(contentid));
+
         /* make a xz file */
-        bsetfmt(self->ar.tmp_xz_name, "%s%s%08llx.xz", cstr(self->path_working),
-            pathsep, castull(contentid));
+        bsetfmt(self->ar.tmp_xz_name, "%s%s%s", cstr(self->path_working),
+            pathsep, namewithin);
         check_b(os_tryuntil_remove(cstr(self->ar.tmp_xz_name)),
             "couldn't delete %s", cstr(self->ar.tmp_xz_name));
         check(ar_util_xz_add(&self->ar, input, cstr(self->ar.tmp_xz_name)));
@@ -135,19 +389,57 @@ check_result ar_manager_add(ar_manager *self, const char *input,
         }
 
         /* add xz file to the tar */
-        char namewithin[PATH_MAX] = {0};
-        snprintf(namewithin, countof(namewithin) - 1, "%08llx.xz",
-            castull(contentid));
         check_b(*compressedsize > 0, "file %s cannot have size 0",
             cstr(self->ar.tmp_xz_name));
-        check(ar_util_add(&self->ar, cstr(self->currentarchive),
-            cstr(self->ar.tmp_xz_name), namewithin, *compressedsize));
+        check(
+            ar_manager_tar_add(self, cstr(self->ar.tmp_xz_name), namewithin));
         log_b(os_tryuntil_remove(cstr(self->ar.tmp_xz_name)),
             "couldn't delete %s", cstr(self->ar.tmp_xz_name));
-        os_get_filename(cstr(self->ar.tmp_xz_name), self->ar.tmp_filename);
-        bstrlist_append(self->current_names, self->ar.tmp_filename);
+        bstrlist_appendcstr(self->current_names, namewithin);
+    }
+
+    *archivenumber = self->currentarchivenum;
+    if (*blockid)
+    {
+        fprintf(self->namestextfile.file, "%08llx\t%s\t%08llx.blk+%llu\n",
+            castull(contentid), input, castull(*blockid),
+            castull(*blockoffset));
+    }
+    else
+    {
+        sv_array_add64u(&self->current_sizes, *compressedsize);
+        fprintf(self->namestextfile.file, "%08llx\t%s\n", castull(contentid),
+            input);
+    }
+
+cleanup:
+    sv_array_close(&contents);
+    return currenterr;
+}
+
+/* add a file that was already compressed with this manager's codec, e.g. by
+a backup worker thread. the compressed file is deleted afterwards. */
+check_result ar_manager_add_compressedfile(ar_manager *self,
+    const char *input, const char *compressedfile, uint64_t contentid,
+    uint32_t *archivenumber, uint64_t *compressedsize)
+{
+    sv_result currenterr = {};
+    char namewithin[PATH_MAX] = {0};
+    snprintf(namewithin, countof(namewithin) - 1, "%08llx.%s",
+        castull(contentid), ar_codec_suffix(self->codec));
+    *compressedsize = os_getfilesize(compressedfile);
+    if (self->writer.offset + *compressedsize > self->target_archive_size ||
+        self->current_names->qty > self->limitperarchive)
+    {
+        check(ar_manager_advance_to_next(self));
     }
 
+    /* add compressed file to the tar */
+    check_b(*compressedsize > 0, "file %s cannot have size 0", compressedfile);
+    check(ar_manager_tar_add(self, compressedfile, namewithin));
+    log_b(os_tryuntil_remove(compressedfile), "couldn't delete %s",
+        compressedfile);
+    bstrlist_appendcstr(self->current_names, namewithin);
     *archivenumber = self->currentarchivenum;
     sv_array_add64u(&self->current_sizes, *compressedsize);
     fprintf(self->namestextfile.file, "%08llx\t%s\n", castull(contentid), input);
@@ -156,420 +448,1789 @@ cleanup:
     return currenterr;
 }
 
-check_result ar_manager_finish(ar_manager *self)
+/* add bytes from memory, e.g. one chunk of a large file, compressing them
+with this manager's codec. */
+check_result ar_manager_add_buffer(ar_manager *self, const byte *data,
+    uint32_t len, const char *displayname, uint64_t contentid,
+    uint32_t *archivenumber, uint64_t *compressedsize)
 {
     sv_result currenterr = {};
-    bstring pattern = bstring_open();
-    bstrlist *list = bstrlist_open();
-
-    /* ensure that archive is complete. */
-    sv_log_fmt("finish archiving %u", self->collectionid);
-    check(ar_manager_advance_to_next(self));
+    char namewithin[PATH_MAX] = {0};
+    uint64_t archivesize = self->writer.offset;
+    snprintf(namewithin, countof(namewithin) - 1, "%08llx.%s",
+        castull(contentid), ar_codec_suffix(self->codec));
+    check_b(ar_codec_in_process(self->codec), "codec %u can't compress %s",
+        self->codec, displayname);
+    if (!self->writer.file.file)
+    {
+        check(ar_tar_writer_open(&self->writer, cstr(self->currentarchive)));
+    }
 
-    /* delete temporary files */
-    bsetfmt(pattern, "%05llx_*.tar", castull(self->collectionid));
-    check(
-        os_tryuntil_deletefiles(cstr(self->path_readytoupload), cstr(pattern)));
+    /* as in ar_manager_add, if it didn't fit, move it to the next archive */
+    check(ar_tar_writer_add_compressed_buffer(&self->writer, data, len,
+        namewithin, self->codec, self->codec_level, compressedsize));
+    if ((archivesize + *compressedsize > self->target_archive_size ||
+            self->current_names->qty > self->limitperarchive) &&
+        self->current_names->qty > 0)
+    {
+        check(ar_manager_move_last_to_next(self, namewithin, *compressedsize));
+    }
 
-    /* move files from staging to readytoupload */
-    int moved = 0;
-    check(os_tryuntil_movebypattern(cstr(self->path_staging), "*.tar",
-        cstr(self->path_readytoupload), true, &moved));
+    bstrlist_appendcstr(self->current_names, namewithin);
+    *archivenumber = self->currentarchivenum;
+    sv_array_add64u(&self->current_sizes, *compressedsize);
+    fprintf(self->namestextfile.file, "%08llx\t%s\n", castull(contentid),
+        displayname);
 
 cleanup:
-    bdestroy(pattern);
-    bstrlist_close(list);
     return currenterr;
 }
 
-check_result ar_manager_restore(ar_manager *self, const char *archive,
-    uint64_t contentid, const char *working_dir_archived, const char *dest)
+check_result ar_manager_finish(ar_manager *self)
 {
     sv_result currenterr = {};
-    bstring destparent = bstring_open();
-    bstring was_restrict_write_access = bstrcpy(restrict_write_access);
-    bstring namewithin = bformat("%08llx.*", castull(contentid));
-    bstring path_file = bformat(
-        "%s%s%08llx.file", working_dir_archived, pathsep, castull(contentid));
-    bstring path_xz = bformat(
-        "%s%s%08llx.xz", working_dir_archived, pathsep, castull(contentid));
 
-    sv_log_fmt("restore %s file %08llx to %s", archive, contentid, dest);
-    check_b(os_isabspath(archive) && os_file_exists(archive),
-        "couldn't find archive %s.", archive);
-    check_b(os_file_exists(cstr(self->ar.xz_binary)), "couldn't find archiver.");
-    check_b(contentid, "contentid cannot be 0.");
-    check_b(os_tryuntil_remove(cstr(path_file)), "couldn't remove %s",
-        cstr(path_file));
-    check_b(
-        os_tryuntil_remove(cstr(path_xz)), "couldn't remove %s", cstr(path_xz));
+    /* ensure that archive is complete. each archive was moved to
+    readytoupload as it was sealed. */
+    sv_log_fmt("finish archiving %u", self->collectionid);
+    check(ar_manager_advance_to_next(self));
 
-    check(ar_util_extract_overwrite(&self->ar, archive, cstr(namewithin),
-        working_dir_archived, self->ar.tmp_results));
+cleanup:
+    return currenterr;
+}
 
-    if (os_file_exists(cstr(path_file)))
-    {
-        /* file wasn't compressed, no decompression needed */
-    }
-    else if (os_file_exists(cstr(path_xz)))
-    {
-        /* it's a .xz archive */
-        check(ar_util_xz_extract_overwrite(
-            &self->ar, cstr(path_xz), cstr(path_file)));
-    }
-    else
+/* copy length bytes of in, starting at offset, to the end of out */
+static check_result ar_util_copy_range(FILE *in, const char *inpath,
+    uint64_t offset, uint64_t length, FILE *out, const char *outpath)
+{
+    sv_result currenterr = {};
+    const uint32_t buflen = 64 * 1024;
+    byte *buf = sv_calloc(buflen, 1);
+#if __linux__
+    check_errno(fseeko(in, cast64u64s(offset), SEEK_SET), inpath);
+#else
+    check_errno(_fseeki64(in, cast64u64s(offset), SEEK_SET), inpath);
+#endif
+    while (length > 0)
     {
-        check_b(false, "nothing found for %s in archive %s", cstr(path_file),
-            archive);
+        uint32_t chunk = cast64u32u(MIN(length, buflen));
+        check_b(fread(buf, chunk, 1, in) == 1, "couldn't read %s", inpath);
+        check_b(fwrite(buf, chunk, 1, out) == 1, "couldn't write to %s",
+            outpath);
+        length -= chunk;
     }
 
-    /* move to destination */
-    os_get_parent(dest, destparent);
-    check_b(os_isabspath(cstr(destparent)),
-        "couldn't get parent of directory %s", dest);
-    check_b(os_create_dirs(cstr(destparent)),
-        "couldn't create directories for %s", cstr(destparent));
-    bassigncstr(restrict_write_access, cstr(destparent));
-    check_b(os_tryuntil_move(cstr(path_file), dest, true),
-        "couldn't move %s to %s", cstr(path_file), dest);
-    check_b(os_file_exists(dest), "expected to have moved file to %s", dest);
-
 cleanup:
-    bassign(restrict_write_access, was_restrict_write_access);
-    bdestroy(was_restrict_write_access);
-    bdestroy(destparent);
-    bdestroy(namewithin);
-    bdestroy(path_file);
-    bdestroy(path_xz);
+    sv_freenull(buf);
     return currenterr;
 }
 
-ar_util ar_util_open(void)
+/* a file that had holes when it was backed up gets a hole on restore
+wherever an aligned block of it is all zeros, so that it doesn't take its
+full size on disk. 64k rather than the page size, to avoid fragmenting the
+data between the holes. */
+static const uint64_t ArSparseBlock = 64 * 1024;
+
+static bool ar_util_iszero(const byte *data, uint64_t len)
 {
-    ar_util self = {};
-    self.tar_binary = bstring_open();
-    self.xz_binary = bstring_open();
-    self.audiotag_binary = bstring_open();
-    self.tmp_arg_tar = bstring_open();
-    self.tmp_inner_name = bstring_open();
-    self.tmp_combined = bstring_open();
-    self.tmp_ascii = bstring_open();
-    self.tmp_results = bstring_open();
-    self.tmp_filename = bstring_open();
-    self.tmp_xz_name = bstring_open();
-    self.list = bstrlist_open();
-    return self;
+    return len == 0 || (data[0] == 0 && memcmp(data, data + 1, len - 1) == 0);
 }
 
-check_result get_tar_archive_parameter(const char *archive, bstring s)
+/* write data at *offset, seeking past each aligned block of zeros instead of
+writing it. call ar_util_write_sparse_end afterwards in case the file ends
+with a hole. */
+check_result ar_util_write_sparse(FILE *out, const char *outpath,
+    const byte *data, uint64_t len, uint64_t *offset)
 {
     sv_result currenterr = {};
-    check_b(os_isabspath(archive), "not abs path %s", archive);
-    if (islinux)
-    {
-        bsetfmt(s, "--file=%s", archive);
-    }
-    else
+    while (len > 0)
     {
-        /* from C:\dir\file.tar to --file=/C/dir/file.tar
-        another possibility: -C //./C:/dir --file=file.tar
-        another possibility, if on the same drive: --file=\dir\file.tar */
-        check_b(archive[1] == ':' && archive[2] == '\\',
-            "we currently require paths in the form x:\\ but got %s", archive);
-        bstr_assignstatic(s, "--file=/");
-        bconchar(s, archive[0]);
-        bcatcstr(s, archive + 2);
-        bstr_replaceall(s, "\\", "/");
+        uint64_t chunk = MIN(len, ArSparseBlock - *offset % ArSparseBlock);
+        if (chunk == ArSparseBlock && ar_util_iszero(data, chunk))
+        {
+#if __linux__
+            check_errno(fseeko(out, cast64u64s(chunk), SEEK_CUR), outpath);
+#else
+            check_errno(_fseeki64(out, cast64u64s(chunk), SEEK_CUR), outpath);
+#endif
+        }
+        else
+        {
+            check_b(fwrite(data, chunk, 1, out) == 1, "couldn't write to %s",
+                outpath);
+        }
+
+        data += chunk;
+        len -= chunk;
+        *offset += chunk;
     }
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_add(ar_util *self, const char *tarpath,
-    const char *inputpath, const char *namewithin, uint64_t inputsize)
+check_result ar_util_write_sparse_end(
+    FILE *out, const char *outpath, uint64_t length)
 {
     sv_result currenterr = {};
-    confirm_writable(tarpath);
-    check_b(s_endwith(tarpath, ".tar"), "%s", tarpath);
-    bsetfmt(self->tmp_inner_name, "--transform=s/.*/%s/", namewithin);
-    bstr_replaceall(self->tmp_inner_name, "\\", "\\\\"); /* escape backslashes */
-    check_b(
-        !s_contains(namewithin, "/"), "name cannot contain / %s", namewithin);
-    check_b(islinux || (inputsize < 1024ULL * 1024 * 1024),
-        "tar on windows does not support files of this size. %s %llu", inputpath,
-        castull(inputsize));
-
-    check(get_tar_archive_parameter(tarpath, self->tmp_arg_tar));
-    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--append",
-        "--dereference", /* add file symlink points to, not symlink. */
-        "--no-wildcards", /* do not use wildcards */
-        "--no-unquote", /* do not parse backslash escape sequences */
-        "--format=gnu", cstr(self->tmp_inner_name), cstr(self->tmp_arg_tar),
-        "--", inputpath, NULL};
-
-    bsetfmt(self->tmp_results, "Context: tar add %s %s", tarpath, inputpath);
-    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
-        self->tmp_combined, true, 1 /* exit code 1 is ok */, 0));
+    check_b(fflush(out) == 0, "couldn't write to %s", outpath);
+#if __linux__
+    check_errno(ftruncate(fileno(out), cast64u64s(length)), outpath);
+#else
+    check_errno(_chsize_s(_fileno(out), cast64u64s(length)), outpath);
+#endif
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_verify(ar_util *self, const char *tarpath,
-    const bstrlist *expectedcontents, const sv_array *expectedsizes)
+#if __linux__
+static bool ar_util_punch(int fd, uint64_t start, uint64_t end)
+{
+    return start >= end ||
+        fallocate64(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+            cast64u64s(start), cast64u64s(end - start)) == 0;
+}
+#endif
+
+/* make holes in a restored file that was written densely, for example by
+the xz binary. only the ranges that hold data are read, so this is cheap for
+a file that is already sparse. it's fine if the filesystem can't do it. */
+static check_result ar_util_punch_holes(const char *path)
 {
     sv_result currenterr = {};
-    check_b(s_endwith(tarpath, ".tar"), "%s", tarpath);
-    check(get_tar_archive_parameter(tarpath, self->tmp_arg_tar));
-    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--list",
-        "--verbose", cstr(self->tmp_arg_tar), NULL};
+#if __linux__
+    byte *buf = sv_calloc(cast64u32u(ArSparseBlock), 1);
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    check_errno(fd, path);
+    struct stat64 st = {};
+    check_errno(fstat64(fd, &st), path);
+    uint64_t size = cast64s64u(st.st_size), offset = 0;
+    while (offset < size)
+    {
+        int64_t data = lseek64(fd, cast64u64s(offset), SEEK_DATA);
+        int64_t hole = data < 0 ? -1 : lseek64(fd, data, SEEK_HOLE);
+        if (hole < 0)
+        {
+            /* ENXIO, the rest of the file is a hole */
+            break;
+        }
 
-    bsetfmt(self->tmp_results, "Context: tar verify %s", tarpath);
-    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
-        self->tmp_combined, true, 0, 0));
-    check_b(cast32s32u(expectedcontents->qty) == expectedsizes->length,
-        "%d != %d", expectedcontents->qty, expectedsizes->length);
+        /* punch each run of aligned zero blocks overlapping this data */
+        uint64_t end = MIN(cast64s64u(hole), size);
+        offset = cast64s64u(data) - cast64s64u(data) % ArSparseBlock;
+        uint64_t runstart = offset;
+        for (; offset < end; offset += ArSparseBlock)
+        {
+            uint64_t len = MIN(ArSparseBlock, size - offset);
+            check_b(pread64(fd, buf, len, cast64u64s(offset)) == (ssize_t)len,
+                "couldn't read %s", path);
+            if (len < ArSparseBlock || !ar_util_iszero(buf, len))
+            {
+                if (!ar_util_punch(fd, runstart, offset))
+                {
+                    break;
+                }
+
+                runstart = offset + len;
+            }
+        }
+
+        if (!ar_util_punch(fd, runstart, MIN(offset, size)))
+        {
+            sv_log_fmt("couldn't punch holes in %s (%d)", path, errno);
+            break;
+        }
+    }
+
+cleanup:
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+
+    sv_freenull(buf);
+#else
+    (void)path;
+#endif
+    return currenterr;
+}
+
+check_result ar_manager_copy_from_block(const char *blockpath,
+    uint64_t offset, uint64_t length, const char *dest)
+{
+    sv_result currenterr = {};
+    sv_file in = {}, out = {};
+    check_b(offset + length <= os_getfilesize(blockpath),
+        "block %s is too short for %llu bytes at %llu", blockpath,
+        castull(length), castull(offset));
+    check(sv_file_open(&in, blockpath, "rb"));
+    check(sv_file_open(&out, dest, "wb"));
+    check(ar_util_copy_range(in.file, blockpath, offset, length, out.file,
+        dest));
+
+cleanup:
+    sv_file_close(&in);
+    sv_file_close(&out);
+    return currenterr;
+}
+
+/* a delta rebuilds a file from an older version of it, the base. it starts
+with "GBD1" and the base and target lengths, followed by instructions that
+either copy a range of the base ('C' offset length) or add literal bytes
+('A' length bytes). all numbers are stored as little-endian varints. */
+static const uint32_t ar_delta_block = 32;
+static const uint64_t ar_delta_prime = 0x100000001b3ULL;
+const uint64_t ar_delta_maxsize = 128 * 1024 * 1024;
+
+static void ar_delta_putvarint(sv_array *out, uint64_t n)
+{
+    while (true)
+    {
+        byte b = (byte)(n & 0x7f);
+        n >>= 7;
+        b = n ? (byte)(b | 0x80) : b;
+        sv_array_append(out, &b, 1);
+        if (!n)
+        {
+            break;
+        }
+    }
+}
+
+static bool ar_delta_getvarint(
+    const byte *delta, uint32_t len, uint32_t *pos, uint64_t *n)
+{
+    *n = 0;
+    for (uint32_t shift = 0; shift < 64 && *pos < len; shift += 7)
+    {
+        byte b = delta[(*pos)++];
+        *n |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void ar_delta_putadd(sv_array *out, const byte *data, uint32_t len)
+{
+    if (len)
+    {
+        byte op = 'A';
+        sv_array_append(out, &op, 1);
+        ar_delta_putvarint(out, len);
+        sv_array_append(out, data, len);
+    }
+}
+
+static void ar_delta_putcopy(sv_array *out, uint64_t offset, uint64_t len)
+{
+    byte op = 'C';
+    sv_array_append(out, &op, 1);
+    ar_delta_putvarint(out, offset);
+    ar_delta_putvarint(out, len);
+}
+
+static uint64_t ar_delta_hash(const byte *data)
+{
+    uint64_t h = 0;
+    for (uint32_t i = 0; i < ar_delta_block; i++)
+    {
+        h = h * ar_delta_prime + data[i];
+    }
+
+    return h;
+}
+
+/* index every aligned block of the base, then slide a rolling hash over the
+target. a hit is verified and grown in both directions into a copy. */
+void ar_delta_encode(const byte *base, uint32_t baselen, const byte *target,
+    uint32_t targetlen, sv_array *delta)
+{
+    uint64_t power = 1;
+    for (uint32_t i = 0; i < ar_delta_block - 1; i++)
+    {
+        power *= ar_delta_prime;
+    }
+
+    uint32_t bits = 10;
+    while (bits < 28 && (1U << bits) < (baselen / ar_delta_block) * 2)
+    {
+        bits++;
+    }
+
+    uint32_t *table = (uint32_t *)sv_calloc(1U << bits, sizeof32u(uint32_t));
+    for (uint32_t off = 0; off + ar_delta_block <= baselen;
+         off += ar_delta_block)
+    {
+        uint32_t *slot = &table[ar_delta_hash(base + off) >> (64 - bits)];
+        *slot = *slot ? *slot : off + 1;
+    }
+
+    sv_array_truncatelength(delta, 0);
+    sv_array_append(delta, "GBD1", 4);
+    ar_delta_putvarint(delta, baselen);
+    ar_delta_putvarint(delta, targetlen);
+    uint32_t literal = 0, pos = 0;
+    uint64_t h = targetlen >= ar_delta_block ? ar_delta_hash(target) : 0;
+    while (pos + ar_delta_block <= targetlen)
+    {
+        uint32_t candidate = table[h >> (64 - bits)];
+        if (candidate &&
+            memcmp(base + candidate - 1, target + pos, ar_delta_block) == 0)
+        {
+            uint32_t off = candidate - 1, len = ar_delta_block;
+            while (off + len < baselen && pos + len < targetlen &&
+                base[off + len] == target[pos + len])
+            {
+                len++;
+            }
+            while (pos > literal && off > 0 && base[off - 1] == target[pos - 1])
+            {
+                pos--;
+                off--;
+                len++;
+            }
+
+            ar_delta_putadd(delta, target + literal, pos - literal);
+            ar_delta_putcopy(delta, off, len);
+            pos += len;
+            literal = pos;
+            if (pos + ar_delta_block <= targetlen)
+            {
+                h = ar_delta_hash(target + pos);
+            }
+        }
+        else
+        {
+            if (pos + ar_delta_block < targetlen)
+            {
+                h = (h - target[pos] * power) * ar_delta_prime +
+                    target[pos + ar_delta_block];
+            }
+
+            pos++;
+        }
+    }
+
+    ar_delta_putadd(delta, target + literal, targetlen - literal);
+    sv_freenull(table);
+}
+
+/* check the header of a delta against the base it will be applied to */
+static check_result ar_delta_header(const byte *delta, uint32_t deltalen,
+    uint64_t baselen, uint32_t *pos, uint64_t *targetlen)
+{
+    sv_result currenterr = {};
+    uint64_t expectbase = 0;
+    *pos = 4;
+    check_b(deltalen >= 4 && memcmp(delta, "GBD1", 4) == 0,
+        "not a delta, header not found");
+    bool ok = ar_delta_getvarint(delta, deltalen, pos, &expectbase) &&
+        ar_delta_getvarint(delta, deltalen, pos, targetlen);
+    check_b(ok, "delta header is truncated");
+    check_b(expectbase == baselen,
+        "delta expects a base of %llu bytes, got %llu", castull(expectbase),
+        castull(baselen));
+
+cleanup:
+    return currenterr;
+}
+
+/* read the instruction at pos. for 'C' offset is in the base, and for 'A'
+it is the position of the literal bytes in the delta. */
+static check_result ar_delta_next(const byte *delta, uint32_t deltalen,
+    uint64_t baselen, uint32_t *pos, byte *op, uint64_t *offset,
+    uint64_t *len)
+{
+    sv_result currenterr = {};
+    *op = delta[(*pos)++];
+    if (*op == 'C')
+    {
+        bool ok = ar_delta_getvarint(delta, deltalen, pos, offset) &&
+            ar_delta_getvarint(delta, deltalen, pos, len) &&
+            *offset + *len <= baselen;
+        check_b(ok, "delta copy out of range at %u", *pos);
+    }
+    else if (*op == 'A')
+    {
+        bool ok = ar_delta_getvarint(delta, deltalen, pos, len) &&
+            *len <= deltalen - *pos;
+        check_b(ok, "delta add out of range at %u", *pos);
+        *offset = *pos;
+        *pos += cast64u32u(*len);
+    }
+    else
+    {
+        check_b(false, "unknown delta instruction %d at %u", *op, *pos);
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_delta_apply(const byte *base, uint32_t baselen,
+    const byte *delta, uint32_t deltalen, sv_array *target)
+{
+    sv_result currenterr = {};
+    uint32_t pos = 0;
+    uint64_t expecttarget = 0;
+    sv_array_truncatelength(target, 0);
+    check(ar_delta_header(delta, deltalen, baselen, &pos, &expecttarget));
+    check_b(expecttarget < UINT32_MAX, "delta target is too large");
+    sv_array_reserve(target, cast64u32u(expecttarget));
+    while (pos < deltalen)
+    {
+        byte op = 0;
+        uint64_t offset = 0, len = 0;
+        check(ar_delta_next(
+            delta, deltalen, baselen, &pos, &op, &offset, &len));
+        check_b(target->length + len <= expecttarget,
+            "delta is longer than expected");
+        sv_array_append(target, op == 'C' ? base + offset : delta + offset,
+            cast64u32u(len));
+    }
+
+    check_b(target->length == expecttarget,
+        "delta made %u bytes, expected %llu", target->length,
+        castull(expecttarget));
+
+cleanup:
+    return currenterr;
+}
+
+/* a delta that copies all of a base of baselen bytes and then adds tail,
+for a file that has only been appended to */
+void ar_delta_encode_append(
+    uint64_t baselen, const byte *tail, uint32_t taillen, sv_array *delta)
+{
+    sv_array_truncatelength(delta, 0);
+    sv_array_append(delta, "GBD1", 4);
+    ar_delta_putvarint(delta, baselen);
+    ar_delta_putvarint(delta, baselen + taillen);
+    if (baselen)
+    {
+        ar_delta_putcopy(delta, 0, baselen);
+    }
+
+    ar_delta_putadd(delta, tail, taillen);
+}
+
+check_result ar_util_readall(const char *path, sv_array *out)
+{
+    sv_result currenterr = {};
+    sv_file f = {};
+    uint64_t size = os_getfilesize(path);
+    sv_array_truncatelength(out, 0);
+    check_b(size < UINT32_MAX, "file %s is too large to read at once", path);
+    check(sv_file_open(&f, path, "rb"));
+    sv_array_reserve(out, cast64u32u(size));
+    check_b(!size || fread(out->buffer, cast64u32u(size), 1, f.file) == 1,
+        "couldn't read %s", path);
+    out->length = cast64u32u(size);
+
+cleanup:
+    sv_file_close(&f);
+    return currenterr;
+}
+
+/* rebuild a file in the working directory from its delta and base. ranges
+are copied from the base file as they're needed, so only the delta has to
+fit in memory. */
+static check_result ar_delta_apply_files(
+    const char *basepath, const char *deltapath, const char *dest)
+{
+    sv_result currenterr = {};
+    sv_array delta = sv_array_open(1, 0);
+    sv_file base = {}, out = {};
+    uint64_t baselen = os_getfilesize(basepath);
+    uint64_t written = 0, expecttarget = 0;
+    uint32_t pos = 0;
+    check(ar_util_readall(deltapath, &delta));
+    check(ar_delta_header(
+        delta.buffer, delta.length, baselen, &pos, &expecttarget));
+    check(sv_file_open(&base, basepath, "rb"));
+    check(sv_file_open(&out, dest, "wb"));
+    while (pos < delta.length)
+    {
+        byte op = 0;
+        uint64_t offset = 0, len = 0;
+        check(ar_delta_next(
+            delta.buffer, delta.length, baselen, &pos, &op, &offset, &len));
+        check_b(written + len <= expecttarget, "delta is longer than expected");
+        if (op == 'C')
+        {
+            check(ar_util_copy_range(
+                base.file, basepath, offset, len, out.file, dest));
+        }
+        else
+        {
+            check_b(!len ||
+                    fwrite(delta.buffer + offset, cast64u32u(len), 1,
+                        out.file) == 1,
+                "couldn't write to %s", dest);
+        }
+
+        written += len;
+    }
+
+    check_b(written == expecttarget, "delta made %llu bytes, expected %llu",
+        castull(written), castull(expecttarget));
+
+cleanup:
+    sv_file_close(&base);
+    sv_file_close(&out);
+    sv_array_close(&delta);
+    return currenterr;
+}
+
+/* move a file restored into the working directory to its destination,
+which is the only place outside app data that a restore may write to. */
+check_result ar_manager_move_restored(const char *src, const char *dest)
+{
+    sv_result currenterr = {};
+    bstring destparent = bstring_open();
+    bstring was_restrict_write_access = bstrcpy(restrict_write_access);
+    os_get_parent(dest, destparent);
+    check_b(os_isabspath(cstr(destparent)),
+        "couldn't get parent of directory %s", dest);
+    check_b(os_create_dirs(cstr(destparent)),
+        "couldn't create directories for %s", cstr(destparent));
+    bassigncstr(restrict_write_access, cstr(destparent));
+    check_b(os_tryuntil_move(src, dest, true), "couldn't move %s to %s", src,
+        dest);
+    check_b(os_file_exists(dest), "expected to have moved file to %s", dest);
+
+cleanup:
+    bassign(restrict_write_access, was_restrict_write_access);
+    bdestroy(was_restrict_write_access);
+    bdestroy(destparent);
+    return currenterr;
+}
+
+check_result ar_manager_restore(ar_manager *self, const char *archive,
+    uint64_t contentid, uint32_t codec, uint64_t blockid, uint64_t blockoffset,
+    uint64_t length, const char *deltabase, bool sparse,
+    const char *working_dir_archived, const char *dest)
+{
+    sv_result currenterr = {};
+    bstring namewithin = blockid
+        ? bformat("%08llx.blk.%s", castull(blockid), ar_codec_suffix(codec))
+        : bformat("%08llx.*", castull(contentid));
+    bstring path_file = bformat(
+        "%s%s%08llx.file", working_dir_archived, pathsep, castull(contentid));
+    bstring path_compressed = blockid
+        ? bformat("%s%s%s", working_dir_archived, pathsep, cstr(namewithin))
+        : bformat("%s%s%08llx.%s", working_dir_archived, pathsep,
+              castull(contentid), ar_codec_suffix(codec));
+    bstring path_block = bformat(
+        "%s%s%08llx.blk", working_dir_archived, pathsep, castull(blockid));
+    bstring path_applied = bformat("%s%s%08llx.applied",
+        working_dir_archived, pathsep, castull(contentid));
+    bool holesmade = false;
+
+    sv_log_fmt("restore %s file %08llx to %s", archive, contentid, dest);
+    check_b(os_isabspath(archive) && os_file_exists(archive),
+        "couldn't find archive %s.", archive);
+    check_b(codec < ar_codec_count, "unknown codec %u", codec);
+    check_b(codec != ar_codec_xz || os_file_exists(cstr(self->ar.xz_binary)),
+        "couldn't find archiver.");
+    check_b(contentid, "contentid cannot be 0.");
+    check_b(os_tryuntil_remove(cstr(path_file)), "couldn't remove %s",
+        cstr(path_file));
+    check_b(os_tryuntil_remove(cstr(path_compressed)), "couldn't remove %s",
+        cstr(path_compressed));
+    check_b(os_tryuntil_remove(cstr(path_block)), "couldn't remove %s",
+        cstr(path_block));
+    check_b(os_tryuntil_remove(cstr(path_applied)), "couldn't remove %s",
+        cstr(path_applied));
+
+    check(ar_util_extract_overwrite(&self->ar, archive, cstr(namewithin),
+        working_dir_archived, self->ar.tmp_results));
+
+    if (blockid)
+    {
+        /* decompress only this file's block, then take its range */
+        check_b(os_file_exists(cstr(path_compressed)),
+            "nothing found for block %s in archive %s", cstr(namewithin),
+            archive);
+        if (codec == ar_codec_zstd)
+        {
+            check(ar_util_zstd_extract_overwrite(
+                &self->ar, cstr(path_compressed), cstr(path_block), false));
+        }
+        else
+        {
+            check(ar_util_xz_extract_overwrite(
+                &self->ar, cstr(path_compressed), cstr(path_block)));
+        }
+
+        check(ar_manager_copy_from_block(
+            cstr(path_block), blockoffset, length, cstr(path_file)));
+        log_b(os_tryuntil_remove(cstr(path_block)), "couldn't delete %s",
+            cstr(path_block));
+        log_b(os_tryuntil_remove(cstr(path_compressed)), "couldn't delete %s",
+            cstr(path_compressed));
+    }
+    else if (os_file_exists(cstr(path_file)))
+    {
+        /* file wasn't compressed, no decompression needed */
+    }
+    else if (os_file_exists(cstr(path_compressed)) && codec == ar_codec_zstd)
+    {
+        /* this can leave holes as it decompresses */
+        holesmade = sparse && !deltabase;
+        check(ar_util_zstd_extract_overwrite(
+            &self->ar, cstr(path_compressed), cstr(path_file), holesmade));
+    }
+    else if (os_file_exists(cstr(path_compressed)))
+    {
+        /* it's a .xz archive */
+        check(ar_util_xz_extract_overwrite(
+            &self->ar, cstr(path_compressed), cstr(path_file)));
+    }
+    else
+    {
+        check_b(false, "nothing found for %s in archive %s", cstr(path_file),
+            archive);
+    }
+
+    if (deltabase)
+    {
+        /* what we extracted is a delta against deltabase */
+        check(ar_delta_apply_files(
+            deltabase, cstr(path_file), cstr(path_applied)));
+        log_b(os_tryuntil_remove(cstr(path_file)), "couldn't delete %s",
+            cstr(path_file));
+        if (sparse)
+        {
+            check(ar_util_punch_holes(cstr(path_applied)));
+        }
+
+        check(ar_manager_move_restored(cstr(path_applied), dest));
+    }
+    else
+    {
+        if (sparse && !holesmade)
+        {
+            check(ar_util_punch_holes(cstr(path_file)));
+        }
+
+        check(ar_manager_move_restored(cstr(path_file), dest));
+    }
+
+cleanup:
+    bdestroy(namewithin);
+    bdestroy(path_file);
+    bdestroy(path_compressed);
+    bdestroy(path_block);
+    bdestroy(path_applied);
+    return currenterr;
+}
+
+ar_util ar_util_open(void)
+{
+    ar_util self = {};
+    self.tar_binary = bstring_open();
+    self.xz_binary = bstring_open();
+    self.tmp_arg_tar = bstring_open();
+    self.tmp_inner_name = bstring_open();
+    self.tmp_combined = bstring_open();
+    self.tmp_ascii = bstring_open();
+    self.tmp_results = bstring_open();
+    self.tmp_filename = bstring_open();
+    self.tmp_xz_name = bstring_open();
+    self.list = bstrlist_open();
+    return self;
+}
+
+check_result get_tar_archive_parameter(const char *archive, bstring s)
+{
+    sv_result currenterr = {};
+    check_b(os_isabspath(archive), "not abs path %s", archive);
+    if (islinux)
+    {
+        bsetfmt(s, "--file=%s", archive);
+    }
+    else
+    {
+        /* from C:\dir\file.tar to --file=/C/dir/file.tar
+        another possibility: -C //./C:/dir --file=file.tar
+        another possibility, if on the same drive: --file=\dir\file.tar */
+        check_b(archive[1] == ':' && archive[2] == '\\',
+            "we currently require paths in the form x:\\ but got %s", archive);
+        bstr_assignstatic(s, "--file=/");
+        bconchar(s, archive[0]);
+        bcatcstr(s, archive + 2);
+        bstr_replaceall(s, "\\", "/");
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_add(ar_util *self, const char *tarpath,
+    const char *inputpath, const char *namewithin, uint64_t inputsize)
+{
+    sv_result currenterr = {};
+    confirm_writable(tarpath);
+    check_b(s_endwith(tarpath, ".tar"), "%s", tarpath);
+    bsetfmt(self->tmp_inner_name, "--transform=s/.*/%s/", namewithin);
+    bstr_replaceall(self->tmp_inner_name, "\\", "\\\\"); /* escape backslashes */
+    check_b(
+        !s_contains(namewithin, "/"), "name cannot contain / %s", namewithin);
+    check_b(islinux || (inputsize < 1024ULL * 1024 * 1024),
+        "tar on windows does not support files of this size. %s %llu", inputpath,
+        castull(inputsize));
+
+    check(get_tar_archive_parameter(tarpath, self->tmp_arg_tar));
+    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--append",
+        "--dereference", /* add file symlink points to, not symlink. */
+        "--no-wildcards", /* do not use wildcards */
+        "--no-unquote", /* do not parse backslash escape sequences */
+        "--format=gnu", cstr(self->tmp_inner_name), cstr(self->tmp_arg_tar),
+        "--", inputpath, NULL};
+
+    bsetfmt(self->tmp_results, "Context: tar add %s %s", tarpath, inputpath);
+    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
+        self->tmp_combined, true, 1 /* exit code 1 is ok */, 0));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_verify(ar_util *self, const char *tarpath,
+    const bstrlist *expectedcontents, const sv_array *expectedsizes)
+{
+    sv_result currenterr = {};
+    check_b(s_endwith(tarpath, ".tar"), "%s", tarpath);
+    check(get_tar_archive_parameter(tarpath, self->tmp_arg_tar));
+    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--list",
+        "--verbose", cstr(self->tmp_arg_tar), NULL};
+
+    bsetfmt(self->tmp_results, "Context: tar verify %s", tarpath);
+    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
+        self->tmp_combined, true, 0, 0));
+    check_b(cast32s32u(expectedcontents->qty) == expectedsizes->length,
+        "%d != %d", expectedcontents->qty, expectedsizes->length);
+
+    /* walk through the tar file listing, checking filename and size. */
+    int pos = 0;
+    for (int i = 0; i < expectedcontents->qty; i++)
+    {
+        bsetfmt(self->tmp_filename, " %llu ",
+            castull(sv_array_at64u(expectedsizes, cast32s32u(i))));
+        pos = binstr(self->tmp_results, pos + 1, self->tmp_filename);
+        check_b(pos != BSTR_ERR,
+            "couldn't find entry for filesize %s "
+            "in %s",
+            cstr(self->tmp_filename), cstr(self->tmp_results));
+
+        bsetfmt(self->tmp_filename, " %s\n", blist_view(expectedcontents, i));
+        pos = binstr(self->tmp_results, pos + 1, self->tmp_filename);
+        check_b(pos != BSTR_ERR, "couldn't find entry for file %s in %s",
+            cstr(self->tmp_filename), cstr(self->tmp_results));
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_xz_verify_impl(ar_util *self, const char *path)
+{
+    sv_result currenterr = {};
+    check_b(os_getfilesize(path) > 0, "%s should not be 0 bytes", path);
+    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--test", "--verbose",
+        "--", /* in case path begins with a - */
+        path, NULL};
+
+    bsetfmt(self->tmp_results, "Context: xz validate %s", path);
+    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
+        self->tmp_combined, true, 1 /* exit code 1 is ok */, 0));
+
+    if (s_contains(cstr(self->tmp_results), ".xz:") ||
+        s_contains(cstr(self->tmp_results), ".XZ:"))
+    {
+        os_get_filename(path, self->tmp_filename);
+        bstr_replaceall(self->tmp_results, path, "");
+        bstr_replaceall(self->tmp_results, cstr(self->tmp_filename), "");
+        int countcolons = 0;
+        for (int i = 0; i < blength(self->tmp_results); i++)
+        {
+            if (cstr(self->tmp_results)[i] == ':')
+            {
+                countcolons++;
+            }
+        }
+
+        check_b(countcolons == 1,
+            "results from xz validate indicate error, %s %s", path,
+            cstr(self->tmp_results));
+    }
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_xz_add_impl(
+    ar_util *self, const char *input, const char *dest)
+{
+    sv_result currenterr = {};
+    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--compress",
+        "--keep", "--stdout",
+        "--force", /* compress even if hardlink, setuid, etc */
+        "--check=crc32", /* for added compatibility */
+        "-6", /* compression strength 6 */
+        "--", /* in case path begins with a - */
+        input, NULL};
+
+    /* redirect stdout; there is no flag to specify location. */
+    confirm_writable(dest);
+    bsetfmt(self->tmp_results, "Context: xz add %s", input);
+    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
+        self->tmp_combined, true, 1 /* exit code 1 is ok */, dest));
+    check_b(os_file_exists(dest), "couldn't find output %s", dest);
+
+    /* xz sometimes returns exit code 1 (success) even on fatal errors.
+    for example, hold an exclusive lock, it writes an error to stderr
+    but returns 1. so, double-check that the file is good. */
+    check(ar_util_xz_verify(self, dest));
+
+cleanup:
+    return currenterr;
+}
 
-    /* walk through the tar file listing, checking filename and size. */
-    int pos = 0;
-    for (int i = 0; i < expectedcontents->qty; i++)
+check_result ar_util_xz_extract_overwrite_impl(
+    ar_util *self, const char *archive, const char *dest)
+{
+    sv_result currenterr = {};
+    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--decompress",
+        "--keep", "--stdout", "--quiet",
+        "--quiet", /* add --quiet twice to suppress messages in stderr */
+        "--force", /* decompress even if setuid, etc */
+        "--", /* in case path begins with a - */
+        archive, NULL};
+
+    /* redirect stdout; there is no flag to specify location. */
+    confirm_writable(dest);
+    bsetfmt(self->tmp_results, "Context: xz extract %s", archive);
+    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
+        self->tmp_combined, true, 1 /* exit code 1 is ok */, dest));
+    check_b(os_file_exists(dest), "couldn't find output %s", dest);
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_xz_add(ar_util *self, const char *input, const char *dest)
+{
+    /* xz-utils on windows does not support unicode names, so use the
+    8.3 short path as a workaround. */
+    sv_result currenterr = {};
+    check_b(os_get_short_path(input, self->tmp_ascii),
+        "couldn't get short path %s", input);
+    check_b(os_file_exists(cstr(self->tmp_ascii)),
+        "couldn't see short path %s %s", input, cstr(self->tmp_ascii));
+    check(ar_util_xz_add_impl(self, cstr(self->tmp_ascii), dest));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_xz_extract_overwrite(
+    ar_util *self, const char *path, const char *dest)
+{
+    sv_result currenterr = {};
+    check_b(os_get_short_path(path, self->tmp_ascii),
+        "couldn't get short path %s", path);
+    check_b(os_file_exists(cstr(self->tmp_ascii)),
+        "couldn't see short path %s %s", path, cstr(self->tmp_ascii));
+    check(ar_util_xz_extract_overwrite_impl(self, cstr(self->tmp_ascii), dest));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_xz_verify(ar_util *self, const char *path)
+{
+    sv_result currenterr = {};
+    check_b(os_get_short_path(path, self->tmp_ascii),
+        "couldn't get short path %s", path);
+    check_b(os_file_exists(cstr(self->tmp_ascii)),
+        "couldn't see short path %s %s", path, cstr(self->tmp_ascii));
+    check(ar_util_xz_verify_impl(self, cstr(self->tmp_ascii)));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_extract_overwrite(ar_util *self, const char *archive,
+    const char *namewithin, const char *tmpdir, bstring saved_to)
+{
+    sv_result currenterr = {};
+    bsetfmt(self->tmp_filename, "%s%s%s", tmpdir, pathsep, namewithin);
+    check_b(os_tryuntil_remove(cstr(self->tmp_filename)), "couldn't remove %s",
+        cstr(self->tmp_filename));
+    check(get_tar_archive_parameter(archive, self->tmp_arg_tar));
+    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--extract",
+        "--no-same-owner", /* save as current user, we'll chown later */
+        "--no-same-permissions", /* save as default mode, we'll chmod later */
+        "--wildcards", /* extracting '*' will extract all files */
+        "--unlink-first", /* overwrite any existing file */
+        cstr(self->tmp_arg_tar), "--", namewithin, NULL};
+
+    confirm_writable(tmpdir);
+    check_b(os_setcwd(tmpdir), "failed to set wd %s", tmpdir);
+    bsetfmt(
+        self->tmp_results, "Context: tar extract %s %s", archive, namewithin);
+    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
+        self->tmp_combined, true, 0, 0));
+    check_b(
+        s_endwith(namewithin, "*") || os_file_exists(cstr(self->tmp_filename)),
+        "file not found at %s", cstr(self->tmp_filename));
+    bassign(saved_to, self->tmp_filename);
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_util_delete(ar_util *self, const char *archive,
+    const char *tmpdir_tar, const char *tmpdir, const sv_array *contentids)
+{
+    sv_result currenterr = {};
+    bstring out = bformat("%s%souttmp.tar", tmpdir_tar, pathsep);
+    bstring innername = bstring_open();
+    ar_tar_writer writer = {};
+    confirm_writable(tmpdir);
+    confirm_writable(cstr(out));
+    if (!contentids || !contentids->length)
     {
-        bsetfmt(self->tmp_filename, " %llu ",
-            castull(sv_array_at64u(expectedsizes, cast32s32u(i))));
-        pos = binstr(self->tmp_results, pos + 1, self->tmp_filename);
-        check_b(pos != BSTR_ERR,
-            "couldn't find entry for filesize %s "
-            "in %s",
-            cstr(self->tmp_filename), cstr(self->tmp_results));
+        goto cleanup;
+    }
+
+    /* create a "output_tar" before overwriting the archive for resiliency.
+    why create a new archive instead of using tar --delete ?
+    1) consider deleting 2000 small files from an archive.
+    even in batches of 100, this is 20 * 64Mb of disk writes, inefficient.
+    2) avoid the need to be concerned with cmd limits and building arg list.
+    3) tar --delete fails if any of the names aren't within the archive. */
+    check_b(os_create_dirs(tmpdir), "couldn't create %s", tmpdir);
+    check(os_tryuntil_deletefiles(tmpdir, "*"));
+    check(ar_util_extract_overwrite(self, archive, "*", tmpdir, NULL));
+    sv_log_fmt("delete_from_archive %s tmpdir=%s "
+               "tmp=%s",
+        archive, tmpdir, cstr(out));
+
+    for (uint32_t i = 0; i < contentids->length; i++)
+    {
+        sv_log_fmt("del:%08llx", castull(sv_array_at64u(contentids, i)));
+        bsetfmt(self->tmp_filename, "%s%s%08llx.file", tmpdir, pathsep,
+            castull(sv_array_at64u(contentids, i)));
+        check_b(os_remove(cstr(self->tmp_filename)), "couldn't remove %s",
+            cstr(self->tmp_filename));
+        for (uint32_t codec = 0; codec < ar_codec_count; codec++)
+        {
+            bsetfmt(self->tmp_filename, "%s%s%08llx.%s", tmpdir, pathsep,
+                castull(sv_array_at64u(contentids, i)),
+                ar_codec_suffix(codec));
+            check_b(os_remove(cstr(self->tmp_filename)), "couldn't remove %s",
+                cstr(self->tmp_filename));
+            bsetfmt(self->tmp_filename, "%s%s%08llx.blk.%s", tmpdir, pathsep,
+                castull(sv_array_at64u(contentids, i)),
+                ar_codec_suffix(codec));
+            check_b(os_remove(cstr(self->tmp_filename)), "couldn't remove %s",
+                cstr(self->tmp_filename));
+        }
+    }
+
+    /* create a new archive */
+    check_b(os_remove(cstr(out)), "couldn't remove %s", cstr(out));
+    check(os_listfiles(tmpdir, self->list, true)); /* should be sorted */
+    check(ar_tar_writer_open(&writer, cstr(out)));
+    for (int i = 0; i < self->list->qty; i++)
+    {
+        os_get_filename(blist_view(self->list, i), innername);
+        check(ar_tar_writer_add(
+            &writer, blist_view(self->list, i), cstr(innername), NULL));
+    }
+
+    check(ar_tar_writer_finish(&writer));
+    check(os_tryuntil_deletefiles(tmpdir, "*"));
+    check_b(os_tryuntil_move(cstr(out), archive, true),
+        "couldn't move %s overwriting %s", cstr(out), archive);
+
+cleanup:
+    ar_tar_writer_close(&writer);
+    bdestroy(innername);
+    bdestroy(out);
+    return currenterr;
+}
+
+/* header layout from the GNU tar manual, "Basic Tar Format" */
+typedef struct ar_tar_header
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+} ar_tar_header;
+
+static const byte ar_tar_zeros[512] = {0};
+
+/* tar pads the archive to a whole record, 20 blocks by default */
+static const uint64_t ar_tar_recordsize = 20 * 512;
+
+void ar_tar_write_number(char *field, uint32_t fieldlen, uint64_t n)
+{
+    if (n < (1ULL << (3 * (fieldlen - 1))))
+    {
+        /* zero-padded octal and a nul, the same as GNU tar writes */
+        snprintf(
+            field, fieldlen, "%0*llo", cast32u32s(fieldlen - 1), castull(n));
+    }
+    else
+    {
+        /* too large for octal, use GNU's base-256 extension */
+        memset(field, 0, fieldlen);
+        for (uint32_t i = fieldlen - 1; i > 0; i--, n >>= 8)
+        {
+            field[i] = (char)(n & 0xff);
+        }
+
+        field[0] = (char)0x80;
+    }
+}
+
+check_result ar_tar_writer_header(ar_tar_writer *self,
+    const char *namewithin, uint64_t size, uint64_t modtime)
+{
+    sv_result currenterr = {};
+    ar_tar_header header = {};
+    staticassert(sizeof(header) == 512);
+    check_b(strlen(namewithin) < sizeof(header.name), "name too long %s",
+        namewithin);
+    check_b(
+        !s_contains(namewithin, "/"), "name cannot contain / %s", namewithin);
+
+    memcpy(header.name, namewithin, strlen(namewithin));
+    ar_tar_write_number(header.mode, sizeof32u(header.mode), 0644);
+    ar_tar_write_number(header.uid, sizeof32u(header.uid), 0);
+    ar_tar_write_number(header.gid, sizeof32u(header.gid), 0);
+    ar_tar_write_number(header.size, sizeof32u(header.size), size);
+    ar_tar_write_number(header.mtime, sizeof32u(header.mtime), modtime);
+    header.typeflag = '0';
+    memcpy(header.magic, "ustar ", sizeof(header.magic));
+    memcpy(header.version, " ", sizeof(header.version));
+
+    /* the checksum is computed as if the checksum field were all spaces */
+    uint32_t checksum = 0;
+    memset(header.chksum, ' ', sizeof(header.chksum));
+    for (uint32_t i = 0; i < sizeof32u(header); i++)
+    {
+        checksum += ((const byte *)&header)[i];
+    }
+
+    snprintf(header.chksum, sizeof(header.chksum) - 1, "%06o", checksum);
+    check_b(fwrite(&header, sizeof(header), 1, self->file.file) == 1,
+        "couldn't write to %s", cstr(self->path));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_tar_writer_seek(ar_tar_writer *self, uint64_t offset)
+{
+    sv_result currenterr = {};
+#if __linux__
+    check_errno(fseeko(self->file.file, cast64u64s(offset), SEEK_SET),
+        cstr(self->path));
+#else
+    check_errno(_fseeki64(self->file.file, cast64u64s(offset), SEEK_SET),
+        cstr(self->path));
+#endif
+
+cleanup:
+    return currenterr;
+}
+
+void ar_tar_writer_rollback(ar_tar_writer *self)
+{
+    /* discard a partially-written member, so the next one starts cleanly */
+    if (self->file.file)
+    {
+        sv_log_fmt("rollback %s to %llu", cstr(self->path),
+            castull(self->offset));
+        int ret = 0;
+        fflush(self->file.file);
+#if __linux__
+        log_errno_to(ret, ftruncate(fileno(self->file.file),
+                              cast64u64s(self->offset)),
+            cstr(self->path));
+#else
+        log_errno_to(ret,
+            _chsize_s(_fileno(self->file.file), cast64u64s(self->offset)),
+            cstr(self->path));
+#endif
+        sv_result result = ar_tar_writer_seek(self, self->offset);
+        sv_result_close(&result);
+    }
+}
+
+void ar_tar_writer_undo_last(ar_tar_writer *self)
+{
+    self->offset = self->offset_lastmember;
+    ar_tar_writer_rollback(self);
+}
+
+/* undo the last member, after copying its size bytes of contents to dest,
+so that they can be added to another archive without being written again */
+check_result ar_tar_writer_take_last(
+    ar_tar_writer *self, uint64_t size, const char *dest)
+{
+    sv_result currenterr = {};
+    sv_file in = {}, out = {};
+    uint64_t start = self->offset_lastmember + sizeof(ar_tar_header);
+    check_b(self->file.file && start + size <= self->offset,
+        "no member of size %llu to take from %s", castull(size),
+        cstr(self->path));
+    check_b(fflush(self->file.file) == 0, "couldn't write to %s",
+        cstr(self->path));
+    check(sv_file_open(&in, cstr(self->path), "rb"));
+    check(sv_file_open(&out, dest, "wb"));
+    check(ar_util_copy_range(
+        in.file, cstr(self->path), start, size, out.file, dest));
+    check_b(fflush(out.file) == 0, "couldn't write to %s", dest);
+    ar_tar_writer_undo_last(self);
+
+cleanup:
+    sv_file_close(&in);
+    sv_file_close(&out);
+    return currenterr;
+}
+
+check_result ar_tar_writer_open(ar_tar_writer *self, const char *tarpath)
+{
+    sv_result currenterr = {};
+    set_self_zero();
+    self->path = bfromcstr(tarpath);
+    self->tmp_permissions = bstring_open();
+
+    self->enc = ar_encoder_open();
+    check_b(s_endwith(tarpath, ".tar"), "%s", tarpath);
+    check(sv_file_open(&self->file, tarpath, "wb"));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_tar_writer_add_handle(ar_tar_writer *self,
+    os_lockedfilehandle *handle, const char *namewithin,
+    uint64_t *sizewritten)
+{
+    sv_result currenterr = {};
+    uint64_t size = 0, modtime = 0;
+    check_b(self->file.file, "archive is not open %s", cstr(self->path));
+    check_b(handle->fd > 0, "bad file handle %s", cstr(handle->loggingcontext));
+    check(os_lockedfilehandle_stat(
+        handle, &size, &modtime, self->tmp_permissions));
+    check_errno(cast64s32s(lseek(handle->fd, 0, SEEK_SET)),
+        cstr(handle->loggingcontext));
+    check(ar_tar_writer_header(
+        self, namewithin, size, os_ostime_to_posixtime(modtime)));
+
+    /* copy exactly the size given in the header, even if the file is
+    currently being written to */
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+        int bytes = 0;
+        uint32_t toread = cast64u32u(MIN(remaining, self->enc.buflen32u));
+        log_errno_to(bytes,
+            cast64s32s(read(handle->fd, self->enc.buf, toread)),
+            cstr(handle->loggingcontext));
+        check_b(bytes > 0, "couldn't read %s, %llu bytes remaining",
+            cstr(handle->loggingcontext), castull(remaining));
+        os_throttle_take_active(cast32s32u(bytes));
+        check_b(
+            fwrite(self->enc.buf, cast32s32u(bytes), 1, self->file.file) == 1,
+            "couldn't write to %s", cstr(self->path));
+        remaining -= cast32s32u(bytes);
+    }
+
+    uint32_t padding = cast64u32u((512 - (size % 512)) % 512);
+    check_b(padding == 0 ||
+            fwrite(ar_tar_zeros, padding, 1, self->file.file) == 1,
+        "couldn't write to %s", cstr(self->path));
+    self->offset_lastmember = self->offset;
+    self->offset += sizeof(ar_tar_header) + size + padding;
+    if (sizewritten)
+    {
+        *sizewritten = size;
+    }
+
+cleanup:
+    if (currenterr.code)
+    {
+        ar_tar_writer_rollback(self);
+    }
+
+    return currenterr;
+}
+
+check_result ar_tar_writer_add(ar_tar_writer *self, const char *inputpath,
+    const char *namewithin, uint64_t *sizewritten)
+{
+    sv_result currenterr = {};
+    os_lockedfilehandle handle = {};
+    check(os_lockedfilehandle_open(&handle, inputpath, true, NULL));
+    check(ar_tar_writer_add_handle(self, &handle, namewithin, sizewritten));
+
+cleanup:
+    os_lockedfilehandle_close(&handle);
+    return currenterr;
+}
+
+const char *ar_codec_suffix(uint32_t codec)
+{
+    return codec == ar_codec_zstd ? "zst" : "xz";
+}
+
+bool ar_codec_in_process(uint32_t codec)
+{
+    /* zstd is only ever used in-process, xz can fall back to the binary */
+#if SV_USE_LIBLZMA
+    (void)codec;
+    return true;
+#else
+    return codec != ar_codec_xz;
+#endif
+}
+
+ar_encoder ar_encoder_open(void)
+{
+    /* same buffer size as sv_hasher */
+    ar_encoder ret = {};
+    ret.buflen32u = 64 * 1024;
+    ret.buf = os_aligned_malloc(ret.buflen32u, 4096);
+    ret.outbuf = os_aligned_malloc(ret.buflen32u, 4096);
+    return ret;
+}
+
+void ar_encoder_close(ar_encoder *self)
+{
+    if (self)
+    {
+        os_aligned_free(&self->buf);
+        os_aligned_free(&self->outbuf);
+#if SV_USE_LIBLZMA
+        if (self->xzstream)
+        {
+            lzma_end((lzma_stream *)self->xzstream);
+            sv_freenull(self->xzstream);
+        }
+#endif
+#if SV_USE_LIBZSTD
+        ZSTD_freeCCtx((ZSTD_CCtx *)self->zstdstream);
+#endif
+        set_self_zero();
+    }
+}
+
+#if SV_USE_LIBLZMA
+static check_result ar_encoder_xz_begin(ar_encoder *self)
+{
+    sv_result currenterr = {};
 
-        bsetfmt(self->tmp_filename, " %s\n", blist_view(expectedcontents, i));
-        pos = binstr(self->tmp_results, pos + 1, self->tmp_filename);
-        check_b(pos != BSTR_ERR, "couldn't find entry for file %s in %s",
-            cstr(self->tmp_filename), cstr(self->tmp_results));
+    /* re-initializing an encoder reuses its memory, so keep the stream */
+    if (!self->xzstream)
+    {
+        lzma_stream init = LZMA_STREAM_INIT;
+        self->xzstream = sv_calloc(1, sizeof32u(lzma_stream));
+        memcpy(self->xzstream, &init, sizeof(init));
     }
 
+    lzma_stream *strm = (lzma_stream *)self->xzstream;
+    lzma_ret ret = lzma_easy_encoder(strm, 6, LZMA_CHECK_CRC32);
+    check_b(ret == LZMA_OK, "lzma_easy_encoder failed %d", ret);
+    strm->next_in = NULL;
+    strm->avail_in = 0;
+    strm->next_out = self->outbuf;
+    strm->avail_out = self->buflen32u;
+
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_xz_verify_impl(ar_util *self, const char *path)
+static check_result ar_encoder_xz_code(ar_encoder *self, lzma_action action,
+    FILE *out, const char *outpath, uint64_t *written)
 {
     sv_result currenterr = {};
-    check_b(os_getfilesize(path) > 0, "%s should not be 0 bytes", path);
-    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--test", "--verbose",
-        "--", /* in case path begins with a - */
-        path, NULL};
-
-    bsetfmt(self->tmp_results, "Context: xz validate %s", path);
-    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
-        self->tmp_combined, true, 1 /* exit code 1 is ok */, 0));
-
-    if (s_contains(cstr(self->tmp_results), ".xz:") ||
-        s_contains(cstr(self->tmp_results), ".XZ:"))
+    lzma_stream *strm = (lzma_stream *)self->xzstream;
+    while (true)
     {
-        os_get_filename(path, self->tmp_filename);
-        bstr_replaceall(self->tmp_results, path, "");
-        bstr_replaceall(self->tmp_results, cstr(self->tmp_filename), "");
-        int countcolons = 0;
-        for (int i = 0; i < blength(self->tmp_results); i++)
+        lzma_ret ret = lzma_code(strm, action);
+        check_b(ret == LZMA_OK || ret == LZMA_STREAM_END,
+            "compressing to %s failed %d", outpath, ret);
+        if (strm->avail_out == 0 || ret == LZMA_STREAM_END)
         {
-            if (cstr(self->tmp_results)[i] == ':')
-            {
-                countcolons++;
-            }
+            uint32_t len = self->buflen32u - cast64u32u(strm->avail_out);
+            os_throttle_take_active(len);
+            check_b(len == 0 || fwrite(self->outbuf, len, 1, out) == 1,
+                "couldn't write to %s", outpath);
+            *written += len;
+            strm->next_out = self->outbuf;
+            strm->avail_out = self->buflen32u;
         }
 
-        check_b(countcolons == 1,
-            "results from xz validate indicate error, %s %s", path,
-            cstr(self->tmp_results));
+        if (ret == LZMA_STREAM_END ||
+            (action == LZMA_RUN && strm->avail_in == 0))
+        {
+            break;
+        }
     }
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_xz_add_impl(
-    ar_util *self, const char *input, const char *dest)
+static check_result ar_encoder_xz_write(ar_encoder *self, const byte *data,
+    uint32_t len, FILE *out, const char *outpath, uint64_t *written)
 {
-    sv_result currenterr = {};
-    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--compress",
-        "--keep", "--stdout",
-        "--force", /* compress even if hardlink, setuid, etc */
-        "--check=crc32", /* for added compatibility */
-        "-6", /* compression strength 6 */
-        "--", /* in case path begins with a - */
-        input, NULL};
+    lzma_stream *strm = (lzma_stream *)self->xzstream;
+    strm->next_in = data;
+    strm->avail_in = len;
+    return ar_encoder_xz_code(self, LZMA_RUN, out, outpath, written);
+}
 
-    /* redirect stdout; there is no flag to specify location. */
-    confirm_writable(dest);
-    bsetfmt(self->tmp_results, "Context: xz add %s", input);
-    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
-        self->tmp_combined, true, 1 /* exit code 1 is ok */, dest));
-    check_b(os_file_exists(dest), "couldn't find output %s", dest);
+static check_result ar_encoder_xz_end(
+    ar_encoder *self, FILE *out, const char *outpath, uint64_t *written)
+{
+    return ar_encoder_xz_code(self, LZMA_FINISH, out, outpath, written);
+}
 
-    /* xz sometimes returns exit code 1 (success) even on fatal errors.
-    for example, hold an exclusive lock, it writes an error to stderr
-    but returns 1. so, double-check that the file is good. */
-    check(ar_util_xz_verify(self, dest));
+bool ar_xz_trial_size(const byte *data, uint32_t len, uint64_t *compressedsize)
+{
+    size_t outlen = lzma_stream_buffer_bound(len);
+    size_t outpos = 0;
+    byte *out = sv_calloc(cast64u32u(outlen), 1);
+    lzma_ret ret = lzma_easy_buffer_encode(
+        0, LZMA_CHECK_NONE, NULL, data, len, out, &outpos, outlen);
+    *compressedsize = outpos;
+    sv_freenull(out);
+    return ret == LZMA_OK;
+}
+#else
+static check_result ar_encoder_xz_begin(unused_ptr(ar_encoder))
+{
+    sv_result currenterr = {};
+    check_b(false, "built without SV_USE_LIBLZMA, can't compress");
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_xz_extract_overwrite_impl(
-    ar_util *self, const char *archive, const char *dest)
+static check_result ar_encoder_xz_write(unused_ptr(ar_encoder),
+    unused_ptr(const byte), unused(uint32_t), unused_ptr(FILE),
+    unused_ptr(const char), unused_ptr(uint64_t))
+{
+    return ar_encoder_xz_begin(NULL);
+}
+
+static check_result ar_encoder_xz_end(unused_ptr(ar_encoder),
+    unused_ptr(FILE), unused_ptr(const char), unused_ptr(uint64_t))
+{
+    return ar_encoder_xz_begin(NULL);
+}
+
+bool ar_xz_trial_size(
+    unused_ptr(const byte), unused(uint32_t), uint64_t *compressedsize)
+{
+    *compressedsize = 0;
+    return false;
+}
+#endif
+
+#if SV_USE_LIBZSTD
+/* long-distance matching looks back as far as 128Mb, the largest window a
+decoder accepts by default. a smaller file never needs a window larger than
+itself, which keeps memory down when compressing many small files. */
+static const uint32_t ar_zstd_windowlog_min = 10;
+static const uint32_t ar_zstd_windowlog_max = 27;
+
+static check_result ar_encoder_zstd_begin(
+    ar_encoder *self, uint32_t level, uint64_t sizehint)
 {
     sv_result currenterr = {};
-    const char *args[] = {linuxonly(cstr(self->xz_binary)) "--decompress",
-        "--keep", "--stdout", "--quiet",
-        "--quiet", /* add --quiet twice to suppress messages in stderr */
-        "--force", /* decompress even if setuid, etc */
-        "--", /* in case path begins with a - */
-        archive, NULL};
+    if (!self->zstdstream)
+    {
+        self->zstdstream = ZSTD_createCCtx();
+        check_b(self->zstdstream, "ZSTD_createCCtx failed");
+    }
 
-    /* redirect stdout; there is no flag to specify location. */
-    confirm_writable(dest);
-    bsetfmt(self->tmp_results, "Context: xz extract %s", archive);
-    check(os_tryuntil_run(cstr(self->xz_binary), args, self->tmp_results,
-        self->tmp_combined, true, 1 /* exit code 1 is ok */, dest));
-    check_b(os_file_exists(dest), "couldn't find output %s", dest);
+    uint32_t windowlog = ar_zstd_windowlog_min;
+    while (windowlog < ar_zstd_windowlog_max && (1ULL << windowlog) < sizehint)
+    {
+        windowlog++;
+    }
+
+    int clevel = level == 0 ? ZSTD_CLEVEL_DEFAULT
+                            : (int)MIN(level, cast32s32u(ZSTD_maxCLevel()));
+    ZSTD_CCtx *cctx = (ZSTD_CCtx *)self->zstdstream;
+    const struct
+    {
+        ZSTD_cParameter param;
+        int value;
+    } params[] = {{ZSTD_c_compressionLevel, clevel},
+        {ZSTD_c_checksumFlag, 1}, {ZSTD_c_enableLongDistanceMatching, 1},
+        {ZSTD_c_windowLog, cast32u32s(windowlog)}};
+
+    ZSTD_CCtx_reset(cctx, ZSTD_reset_session_and_parameters);
+    for (uint32_t i = 0; i < countof32u(params); i++)
+    {
+        size_t ret =
+            ZSTD_CCtx_setParameter(cctx, params[i].param, params[i].value);
+        check_b(!ZSTD_isError(ret), "couldn't set zstd parameter %d, %s",
+            params[i].param, ZSTD_getErrorName(ret));
+    }
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_xz_add(ar_util *self, const char *input, const char *dest)
+static check_result ar_encoder_zstd_code(ar_encoder *self,
+    ZSTD_inBuffer *input, ZSTD_EndDirective mode, FILE *out,
+    const char *outpath, uint64_t *written)
 {
-    /* xz-utils on windows does not support unicode names, so use the
-    8.3 short path as a workaround. */
     sv_result currenterr = {};
-    check_b(os_get_short_path(input, self->tmp_ascii),
-        "couldn't get short path %s", input);
-    check_b(os_file_exists(cstr(self->tmp_ascii)),
-        "couldn't see short path %s %s", input, cstr(self->tmp_ascii));
-    check(ar_util_xz_add_impl(self, cstr(self->tmp_ascii), dest));
+    ZSTD_CCtx *cctx = (ZSTD_CCtx *)self->zstdstream;
+    while (true)
+    {
+        ZSTD_outBuffer output = {self->outbuf, self->buflen32u, 0};
+        size_t remaining = ZSTD_compressStream2(cctx, &output, input, mode);
+        check_b(!ZSTD_isError(remaining), "compressing to %s failed %s",
+            outpath, ZSTD_getErrorName(remaining));
+        os_throttle_take_active(output.pos);
+        check_b(
+            output.pos == 0 || fwrite(self->outbuf, output.pos, 1, out) == 1,
+            "couldn't write to %s", outpath);
+        *written += output.pos;
+
+        /* when finishing, keep going until the frame is flushed */
+        if (mode == ZSTD_e_end ? remaining == 0 : input->pos == input->size)
+        {
+            break;
+        }
+    }
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_xz_extract_overwrite(
-    ar_util *self, const char *path, const char *dest)
+static check_result ar_encoder_zstd_write(ar_encoder *self, const byte *data,
+    uint32_t len, FILE *out, const char *outpath, uint64_t *written)
+{
+    ZSTD_inBuffer input = {data, len, 0};
+    return ar_encoder_zstd_code(
+        self, &input, ZSTD_e_continue, out, outpath, written);
+}
+
+static check_result ar_encoder_zstd_end(
+    ar_encoder *self, FILE *out, const char *outpath, uint64_t *written)
+{
+    ZSTD_inBuffer input = {NULL, 0, 0};
+    return ar_encoder_zstd_code(
+        self, &input, ZSTD_e_end, out, outpath, written);
+}
+
+check_result ar_util_zstd_extract_overwrite(unused_ptr(ar_util),
+    const char *archivepath, const char *dest, bool sparse)
 {
     sv_result currenterr = {};
-    check_b(os_get_short_path(path, self->tmp_ascii),
-        "couldn't get short path %s", path);
-    check_b(os_file_exists(cstr(self->tmp_ascii)),
-        "couldn't see short path %s %s", path, cstr(self->tmp_ascii));
-    check(ar_util_xz_extract_overwrite_impl(self, cstr(self->tmp_ascii), dest));
+    sv_file in = {}, out = {};
+    ZSTD_DCtx *dctx = ZSTD_createDCtx();
+    uint32_t inlen = cast64u32u(ZSTD_DStreamInSize());
+    uint32_t outlen = cast64u32u(ZSTD_DStreamOutSize());
+    byte *inbuf = sv_calloc(inlen, 1);
+    byte *outbuf = sv_calloc(outlen, 1);
+    size_t remaining = 0;
+    uint64_t written = 0;
+    bool sawinput = false;
+    confirm_writable(dest);
+    check_b(dctx, "ZSTD_createDCtx failed");
+    check(sv_file_open(&in, archivepath, "rb"));
+    check(sv_file_open(&out, dest, "wb"));
+    while (true)
+    {
+        ZSTD_inBuffer input = {inbuf, fread(inbuf, 1, inlen, in.file), 0};
+        check_b(!ferror(in.file), "couldn't read %s", archivepath);
+        if (input.size == 0)
+        {
+            break;
+        }
+
+        sawinput = true;
+        while (input.pos < input.size)
+        {
+            ZSTD_outBuffer output = {outbuf, outlen, 0};
+            remaining = ZSTD_decompressStream(dctx, &output, &input);
+            check_b(!ZSTD_isError(remaining), "decompressing %s failed %s",
+                archivepath, ZSTD_getErrorName(remaining));
+            if (sparse)
+            {
+                check(ar_util_write_sparse(
+                    out.file, dest, outbuf, output.pos, &written));
+            }
+            else
+            {
+                check_b(output.pos == 0 ||
+                        fwrite(outbuf, output.pos, 1, out.file) == 1,
+                    "couldn't write to %s", dest);
+                written += output.pos;
+            }
+        }
+    }
+
+    /* the decoder verified the content checksum when the frame ended */
+    check_b(sawinput && remaining == 0, "%s is truncated", archivepath);
+    check(ar_util_write_sparse_end(out.file, dest, written));
 
 cleanup:
+    sv_file_close(&in);
+    sv_file_close(&out);
+    ZSTD_freeDCtx(dctx);
+    sv_freenull(inbuf);
+    sv_freenull(outbuf);
     return currenterr;
 }
+#else
+static check_result ar_encoder_zstd_begin(
+    unused_ptr(ar_encoder), unused(uint32_t), unused(uint64_t))
+{
+    sv_result currenterr = {};
+    check_b(false, "built without SV_USE_LIBZSTD, can't use zstd");
 
-check_result ar_util_xz_verify(ar_util *self, const char *path)
+cleanup:
+    return currenterr;
+}
+
+static check_result ar_encoder_zstd_write(unused_ptr(ar_encoder),
+    unused_ptr(const byte), unused(uint32_t), unused_ptr(FILE),
+    unused_ptr(const char), unused_ptr(uint64_t))
+{
+    return ar_encoder_zstd_begin(NULL, 0, 0);
+}
+
+static check_result ar_encoder_zstd_end(unused_ptr(ar_encoder),
+    unused_ptr(FILE), unused_ptr(const char), unused_ptr(uint64_t))
+{
+    return ar_encoder_zstd_begin(NULL, 0, 0);
+}
+
+check_result ar_util_zstd_extract_overwrite(unused_ptr(ar_util),
+    unused_ptr(const char), unused_ptr(const char), unused(bool))
+{
+    return ar_encoder_zstd_begin(NULL, 0, 0);
+}
+#endif
+
+check_result ar_encoder_begin(
+    ar_encoder *self, uint32_t codec, uint32_t level, uint64_t sizehint)
 {
     sv_result currenterr = {};
-    check_b(os_get_short_path(path, self->tmp_ascii),
-        "couldn't get short path %s", path);
-    check_b(os_file_exists(cstr(self->tmp_ascii)),
-        "couldn't see short path %s %s", path, cstr(self->tmp_ascii));
-    check(ar_util_xz_verify_impl(self, cstr(self->tmp_ascii)));
+    check_b(codec < ar_codec_count, "unknown codec %u", codec);
+    self->codec = codec;
+    if (codec == ar_codec_zstd)
+    {
+        check(ar_encoder_zstd_begin(self, level, sizehint));
+    }
+    else
+    {
+        check(ar_encoder_xz_begin(self));
+    }
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_extract_overwrite(ar_util *self, const char *archive,
-    const char *namewithin, const char *tmpdir, bstring saved_to)
+check_result ar_encoder_write(ar_encoder *self, const byte *data,
+    uint32_t len, FILE *out, const char *outpath, uint64_t *written)
+{
+    return self->codec == ar_codec_zstd
+        ? ar_encoder_zstd_write(self, data, len, out, outpath, written)
+        : ar_encoder_xz_write(self, data, len, out, outpath, written);
+}
+
+check_result ar_encoder_end(
+    ar_encoder *self, FILE *out, const char *outpath, uint64_t *written)
+{
+    return self->codec == ar_codec_zstd
+        ? ar_encoder_zstd_end(self, out, outpath, written)
+        : ar_encoder_xz_end(self, out, outpath, written);
+}
+
+check_result ar_encoder_run(ar_encoder *self, uint32_t codec, uint32_t level,
+    os_lockedfilehandle *handle, uint64_t size, FILE *out,
+    const char *outpath, uint64_t *written)
 {
     sv_result currenterr = {};
-    bsetfmt(self->tmp_filename, "%s%s%s", tmpdir, pathsep, namewithin);
-    check_b(os_tryuntil_remove(cstr(self->tmp_filename)), "couldn't remove %s",
-        cstr(self->tmp_filename));
-    check(get_tar_archive_parameter(archive, self->tmp_arg_tar));
-    const char *args[] = {linuxonly(cstr(self->tar_binary)) "--extract",
-        "--no-same-owner", /* save as current user, we'll chown later */
-        "--no-same-permissions", /* save as default mode, we'll chmod later */
-        "--wildcards", /* extracting '*' will extract all files */
-        "--unlink-first", /* overwrite any existing file */
-        cstr(self->tmp_arg_tar), "--", namewithin, NULL};
+    *written = 0;
+    check(ar_encoder_begin(self, codec, level, size));
+    uint64_t remaining = size;
+    while (remaining > 0)
+    {
+        int bytes = 0;
+        uint32_t toread = cast64u32u(MIN(remaining, self->buflen32u));
+        log_errno_to(bytes, cast64s32s(read(handle->fd, self->buf, toread)),
+            cstr(handle->loggingcontext));
+        check_b(bytes > 0, "couldn't read %s, %llu bytes remaining",
+            cstr(handle->loggingcontext), castull(remaining));
+        os_throttle_take_active(cast32s32u(bytes));
+        check(ar_encoder_write(
+            self, self->buf, cast32s32u(bytes), out, outpath, written));
+        remaining -= cast32s32u(bytes);
+    }
 
-    confirm_writable(tmpdir);
-    check_b(os_setcwd(tmpdir), "failed to set wd %s", tmpdir);
-    bsetfmt(
-        self->tmp_results, "Context: tar extract %s %s", archive, namewithin);
-    check(os_tryuntil_run(cstr(self->tar_binary), args, self->tmp_results,
-        self->tmp_combined, true, 0, 0));
-    check_b(
-        s_endwith(namewithin, "*") || os_file_exists(cstr(self->tmp_filename)),
-        "file not found at %s", cstr(self->tmp_filename));
-    bassign(saved_to, self->tmp_filename);
+    check(ar_encoder_end(self, out, outpath, written));
 
 cleanup:
     return currenterr;
 }
 
-check_result ar_util_delete(ar_util *self, const char *archive,
-    const char *tmpdir_tar, const char *tmpdir, const sv_array *contentids)
+static check_result ar_tar_writer_end_compressed(ar_tar_writer *self,
+    const char *namewithin, uint64_t modtime, uint64_t written)
 {
+    /* both codecs have already written a checksum of the input into the
+    stream, so unlike ar_util_xz_add there is no need to decompress again */
     sv_result currenterr = {};
-    bstring out = bformat("%s%souttmp.tar", tmpdir_tar, pathsep);
-    bstring innername = bstring_open();
-    confirm_writable(tmpdir);
-    confirm_writable(cstr(out));
-    if (!contentids || !contentids->length)
+    uint32_t padding = cast64u32u((512 - (written % 512)) % 512);
+    check_b(padding == 0 ||
+            fwrite(ar_tar_zeros, padding, 1, self->file.file) == 1,
+        "couldn't write to %s", cstr(self->path));
+    check(ar_tar_writer_seek(self, self->offset));
+    check(ar_tar_writer_header(self, namewithin, written, modtime));
+    self->offset_lastmember = self->offset;
+    self->offset += sizeof(ar_tar_header) + written + padding;
+    check(ar_tar_writer_seek(self, self->offset));
+
+cleanup:
+    return currenterr;
+}
+
+check_result ar_tar_writer_add_compressed(ar_tar_writer *self,
+    os_lockedfilehandle *handle, const char *namewithin, uint32_t codec,
+    uint32_t level, uint64_t *compressedsize)
+{
+    sv_result currenterr = {};
+    uint64_t size = 0, modtime = 0, written = 0;
+    *compressedsize = 0;
+    check_b(self->file.file, "archive is not open %s", cstr(self->path));
+    check_b(handle->fd > 0, "bad file handle %s", cstr(handle->loggingcontext));
+    check(os_lockedfilehandle_stat(
+        handle, &size, &modtime, self->tmp_permissions));
+    check_errno(cast64s32s(lseek(handle->fd, 0, SEEK_SET)),
+        cstr(handle->loggingcontext));
+
+    /* the size in the header is filled in once compression is done */
+    modtime = os_ostime_to_posixtime(modtime);
+    check(ar_tar_writer_header(self, namewithin, 0, modtime));
+    check(ar_encoder_run(&self->enc, codec, level, handle, size,
+        self->file.file, cstr(self->path), &written));
+
+    check(ar_tar_writer_end_compressed(self, namewithin, modtime, written));
+    *compressedsize = written;
+
+cleanup:
+    if (currenterr.code)
     {
-        goto cleanup;
+        ar_tar_writer_rollback(self);
     }
 
-    /* create a "output_tar" before overwriting the archive for resiliency.
-    why create a new archive instead of using tar --delete ?
-    1) consider deleting 2000 small files from an archive.
-    even in batches of 100, this is 20 * 64Mb of disk writes, inefficient.
-    2) avoid the need to be concerned with cmd limits and building arg list.
-    3) tar --delete fails if any of the names aren't within the archive. */
-    check_b(os_create_dirs(tmpdir), "couldn't create %s", tmpdir);
-    check(os_tryuntil_deletefiles(tmpdir, "*"));
-    check(ar_util_extract_overwrite(self, archive, "*", tmpdir, NULL));
-    sv_log_fmt("delete_from_archive %s tmpdir=%s "
-               "tmp=%s",
-        archive, tmpdir, cstr(out));
+    return currenterr;
+}
 
-    for (uint32_t i = 0; i < contentids->length; i++)
+check_result ar_tar_writer_add_compressed_buffer(ar_tar_writer *self,
+    const byte *data, uint32_t len, const char *namewithin, uint32_t codec,
+    uint32_t level, uint64_t *compressedsize)
+{
+    sv_result currenterr = {};
+    uint64_t written = 0;
+    uint64_t modtime = cast64s64u(time(NULL));
+    *compressedsize = 0;
+    check_b(self->file.file, "archive is not open %s", cstr(self->path));
+    check(ar_tar_writer_header(self, namewithin, 0, modtime));
+    check(ar_encoder_begin(&self->enc, codec, level, len));
+    check(ar_encoder_write(
+        &self->enc, data, len, self->file.file, cstr(self->path), &written));
+    check(ar_encoder_end(
+        &self->enc, self->file.file, cstr(self->path), &written));
+    check(ar_tar_writer_end_compressed(self, namewithin, modtime, written));
+    *compressedsize = written;
+
+cleanup:
+    if (currenterr.code)
     {
-        sv_log_fmt("del:%08llx", castull(sv_array_at64u(contentids, i)));
-        bsetfmt(self->tmp_filename, "%s%s%08llx.file", tmpdir, pathsep,
-            castull(sv_array_at64u(contentids, i)));
-        check_b(os_remove(cstr(self->tmp_filename)), "couldn't remove %s",
-            cstr(self->tmp_filename));
-        bsetfmt(self->tmp_filename, "%s%s%08llx.xz", tmpdir, pathsep,
-            castull(sv_array_at64u(contentids, i)));
-        check_b(os_remove(cstr(self->tmp_filename)), "couldn't remove %s",
-            cstr(self->tmp_filename));
+        ar_tar_writer_rollback(self);
     }
 
-    /* create a new archive */
-    check_b(os_remove(cstr(out)), "couldn't remove %s", cstr(out));
-    check(os_listfiles(tmpdir, self->list, true)); /* should be sorted */
-    for (int i = 0; i < self->list->qty; i++)
+    return currenterr;
+}
+
+check_result ar_tar_writer_finish(ar_tar_writer *self)
+{
+    sv_result currenterr = {};
+    check_b(self->file.file, "archive is not open %s", cstr(self->path));
+
+    /* end-of-archive is two zero blocks, then pad to a whole record */
+    uint64_t end = self->offset + 2 * sizeof(ar_tar_zeros);
+    end += (ar_tar_recordsize - (end % ar_tar_recordsize)) % ar_tar_recordsize;
+    for (uint64_t i = self->offset; i < end; i += sizeof(ar_tar_zeros))
     {
-        os_get_filename(blist_view(self->list, i), innername);
-        check(ar_util_add(
-            self, cstr(out), blist_view(self->list, i), cstr(innername), 0));
+        check_b(fwrite(ar_tar_zeros, sizeof(ar_tar_zeros), 1,
+                    self->file.file) == 1,
+            "couldn't write to %s", cstr(self->path));
     }
 
-    check(os_tryuntil_deletefiles(tmpdir, "*"));
-    check_b(os_tryuntil_move(cstr(out), archive, true),
-        "couldn't move %s overwriting %s", cstr(out), archive);
+    check_b(fflush(self->file.file) == 0, "couldn't write to %s",
+        cstr(self->path));
+#if __linux__
+    check_errno(fsync(fileno(self->file.file)), cstr(self->path));
+#else
+    check_errno(_commit(_fileno(self->file.file)), cstr(self->path));
+#endif
+    sv_file_close(&self->file);
 
 cleanup:
-    bdestroy(innername);
-    bdestroy(out);
     return currenterr;
 }
 
+void ar_tar_writer_close(ar_tar_writer *self)
+{
+    if (self)
+    {
+        sv_file_close(&self->file);
+        bdestroy(self->path);
+        bdestroy(self->tmp_permissions);
+        ar_encoder_close(&self->enc);
+        set_self_zero();
+    }
+}
+
 void ar_manager_close(ar_manager *self)
 {
     if (self)
@@ -579,7 +2240,9 @@ void ar_manager_close(ar_manager *self)
         bdestroy(self->path_readytoupload);
         bdestroy(self->currentarchive);
         sv_array_close(&self->current_sizes);
+        sv_array_close(&self->solid_buffer);
         sv_file_close(&self->namestextfile);
+        ar_tar_writer_close(&self->writer);
         ar_util_close(&self->ar);
         set_self_zero();
     }
@@ -591,7 +2254,6 @@ void ar_util_close(ar_util *self)
     {
         bdestroy(self->xz_binary);
         bdestroy(self->tar_binary);
-        bdestroy(self->audiotag_binary);
         bdestroy(self->tmp_filename);
         bdestroy(self->tmp_arg_tar);
         bdestroy(self->tmp_inner_name);
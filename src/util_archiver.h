@@ -22,7 +22,6 @@ typedef struct ar_util
 {
     bstring tar_binary;
     bstring xz_binary;
-    bstring audiotag_binary;
     bstrlist *list;
     bstring tmp_arg_tar;
     bstring tmp_inner_name;
@@ -50,6 +49,91 @@ check_result ar_util_xz_verify(ar_util *self, const char *archivepath);
 check_result ar_util_xz_extract_overwrite(
     ar_util *self, const char *archivepath, const char *destination);
 
+/* how file contents are compressed within an archive. each contents row
+records its codec, so changing a group's codec doesn't affect restoring files
+that were archived earlier. */
+typedef enum ar_codec
+{
+    ar_codec_xz = 0,
+    ar_codec_zstd,
+    ar_codec_count
+} ar_codec;
+
+const char *ar_codec_suffix(uint32_t codec);
+bool ar_codec_in_process(uint32_t codec);
+check_result ar_util_zstd_extract_overwrite(ar_util *self,
+    const char *archivepath, const char *destination, bool sparse);
+check_result ar_util_write_sparse(FILE *out, const char *outpath,
+    const byte *data, uint64_t len, uint64_t *offset);
+check_result ar_util_write_sparse_end(
+    FILE *out, const char *outpath, uint64_t length);
+
+/* xz compresses with the same settings as xz -6 --check=crc32 and ignores the
+level. zstd uses the level, a content checksum, and long-distance matching.
+holds its own buffers, so each thread that compresses needs its own encoder. */
+typedef struct ar_encoder
+{
+    byte *buf;
+    byte *outbuf;
+    uint32_t buflen32u;
+    uint32_t codec;
+    void *xzstream;
+    void *zstdstream;
+} ar_encoder;
+
+ar_encoder ar_encoder_open(void);
+void ar_encoder_close(ar_encoder *self);
+check_result ar_encoder_begin(
+    ar_encoder *self, uint32_t codec, uint32_t level, uint64_t sizehint);
+check_result ar_encoder_write(ar_encoder *self, const byte *data,
+    uint32_t len, FILE *out, const char *outpath, uint64_t *written);
+check_result ar_encoder_end(
+    ar_encoder *self, FILE *out, const char *outpath, uint64_t *written);
+check_result ar_encoder_run(ar_encoder *self, uint32_t codec, uint32_t level,
+    os_lockedfilehandle *handle, uint64_t size, FILE *out,
+    const char *outpath, uint64_t *written);
+bool ar_xz_trial_size(const byte *data, uint32_t len, uint64_t *compressedsize);
+
+/* writes a GNU-format tar in-process, appending members at a tracked offset
+instead of running tar --append, which rescans the whole archive each time. */
+typedef struct ar_tar_writer
+{
+    sv_file file;
+    bstring path;
+    bstring tmp_permissions;
+    uint64_t offset;
+    uint64_t offset_lastmember;
+    ar_encoder enc;
+} ar_tar_writer;
+
+void ar_tar_writer_close(ar_tar_writer *self);
+check_result ar_tar_writer_open(ar_tar_writer *self, const char *tarpath);
+check_result ar_tar_writer_add(ar_tar_writer *self, const char *inputpath,
+    const char *namewithin, uint64_t *sizewritten);
+check_result ar_tar_writer_add_handle(ar_tar_writer *self,
+    os_lockedfilehandle *handle, const char *namewithin,
+    uint64_t *sizewritten);
+check_result ar_tar_writer_add_compressed(ar_tar_writer *self,
+    os_lockedfilehandle *handle, const char *namewithin, uint32_t codec,
+    uint32_t level, uint64_t *compressedsize);
+check_result ar_tar_writer_add_compressed_buffer(ar_tar_writer *self,
+    const byte *data, uint32_t len, const char *namewithin, uint32_t codec,
+    uint32_t level, uint64_t *compressedsize);
+check_result ar_tar_writer_finish(ar_tar_writer *self);
+void ar_tar_writer_undo_last(ar_tar_writer *self);
+check_result ar_tar_writer_take_last(
+    ar_tar_writer *self, uint64_t size, const char *dest);
+
+/* called once an archive has been sealed and moved to path_readytoupload */
+typedef check_result (*fn_archive_sealed)(
+    void *context, uint32_t archivenumber);
+
+/* files smaller than solid_threshold are packed together into one
+compressed block, named after the first contentsid in it, so that many small
+files share a dictionary. rows record the block and the offset within it.
+the block is buffered in memory and always written into the archive that was
+current when its files were added. archives are numbered from resume_after+1,
+which is non-zero when carrying on with a collection that was interrupted. */
 typedef struct ar_manager
 {
     ar_util ar;
@@ -59,11 +143,21 @@ typedef struct ar_manager
     uint32_t collectionid;
     int32_t limitperarchive;
     uint64_t target_archive_size;
+    uint32_t codec;
+    uint32_t codec_level;
+    uint64_t solid_threshold;
+    uint32_t solid_blocksize;
+    uint64_t solid_blockid;
+    sv_array solid_buffer;
     bstring currentarchive;
+    ar_tar_writer writer;
     uint32_t currentarchivenum;
     sv_file namestextfile;
     sv_array current_sizes;
     bstrlist *current_names;
+    uint32_t resume_after;
+    fn_archive_sealed sealed_callback;
+    void *sealed_context;
 } ar_manager;
 
 void ar_manager_close(ar_manager *self);
@@ -71,10 +165,34 @@ check_result ar_manager_begin(ar_manager *self);
 check_result ar_manager_finish(ar_manager *self);
 check_result ar_manager_advance_to_next(ar_manager *self);
 check_result ar_manager_restore(ar_manager *self, const char *archive,
-    uint64_t contentid, const char *working_dir_archived, const char *dest);
+    uint64_t contentid, uint32_t codec, uint64_t blockid, uint64_t blockoffset,
+    uint64_t length, const char *deltabase, bool sparse,
+    const char *working_dir_archived, const char *dest);
 check_result ar_manager_add(ar_manager *self, const char *pathinput,
     bool iscompressed, uint64_t contentsid, uint32_t *archivenumber,
-    uint64_t *compressedsize);
+    uint64_t *compressedsize, uint64_t *blockid, uint64_t *blockoffset);
+check_result ar_manager_flush_block(ar_manager *self);
+bool ar_manager_packs(
+    const ar_manager *self, bool already_compressed, uint64_t size);
+check_result ar_manager_add_buffer_to_block(ar_manager *self,
+    const byte *data, uint32_t len, const char *displayname,
+    uint64_t contentid, uint32_t *archivenumber, uint64_t *blockid,
+    uint64_t *blockoffset);
+check_result ar_manager_add_compressedfile(ar_manager *self,
+    const char *pathinput, const char *compressedfile, uint64_t contentsid,
+    uint32_t *archivenumber, uint64_t *compressedsize);
+check_result ar_manager_add_buffer(ar_manager *self, const byte *data,
+    uint32_t len, const char *displayname, uint64_t contentid,
+    uint32_t *archivenumber, uint64_t *compressedsize);
+check_result ar_manager_move_restored(const char *src, const char *dest);
+extern const uint64_t ar_delta_maxsize;
+void ar_delta_encode(const byte *base, uint32_t baselen, const byte *target,
+    uint32_t targetlen, sv_array *delta);
+check_result ar_delta_apply(const byte *base, uint32_t baselen,
+    const byte *delta, uint32_t deltalen, sv_array *target);
+void ar_delta_encode_append(
+    uint64_t baselen, const byte *tail, uint32_t taillen, sv_array *delta);
+check_result ar_util_readall(const char *path, sv_array *out);
 check_result ar_manager_open(ar_manager *self, const char *pathapp,
     const char *grpname, uint32_t collectionid, uint32_t archivesize);
 
@@ -13,365 +13,2149 @@ GNU General Public License for more details.
 */
 
 #include "util_audio_tags.h"
+#include <math.h>
 
 uint64_t SvdpHashSeed1 = 0;
 uint64_t SvdpHashSeed2 = 0;
 const uint64_t AudioFilesizePlaceholder = 1;
+const uint64_t SvTreeHashLeafSize = 1024 * 1024;
+const uint64_t SvChunkAvgSize = 1024 * 1024;
 
-check_result get_audio_hash_without_tags_impl(
-    const char *ffmpeg, const char *path, hash256 *hash)
+/* if separating metadata, ignore filesize changes for audio files;
+the changed filesize could be just due to the audio tag changing. */
+void adjustfilesize_if_audio_file(uint32_t separatemetadata, efiletype ext,
+    uint64_t size_from_disk, uint64_t *outputsize)
+{
+    if (separatemetadata && ext != filetype_none && ext != filetype_binary)
+    {
+        *outputsize = AudioFilesizePlaceholder;
+    }
+    else
+    {
+        *outputsize = size_from_disk;
+    }
+}
+
+/* CRC-32 version 2.0.0 by Craig Bruce, 2006-04-29. */
+/* http://www.csbruce.com/~csbruce/software/crc32.c */
+/* PUBLIC-DOMAIN SOFTWARE. */
+static const uint32_t crc32_table[] = {0x00000000, 0x77073096, 0xEE0E612C,
+    0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3, 0x0EDB8832,
+    0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07,
+    0x90BF1D91, 0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D,
+    0x6DDDE4EB, 0xF4D4B551, 0x83D385C7, 0x136C9856, 0x646BA8C0, 0xFD62F97A,
+    0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8,
+    0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD,
+    0xA50AB56B, 0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3,
+    0x45DF5C75, 0xDCD60DCF, 0xABD13D59, 0x26D930AC, 0x51DE003A, 0xC8D75180,
+    0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F, 0x2802B89E,
+    0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB,
+    0xB6662D3D, 0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589,
+    0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433, 0x7807C9A2, 0x0F00F934, 0x9609A88E,
+    0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01, 0x6B6B51F4,
+    0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1,
+    0xF50FC457, 0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF,
+    0x15DA2D49, 0x8CD37CF3, 0xFBD44C65, 0x4DB26158, 0x3AB551CE, 0xA3BC0074,
+    0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A,
+    0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F,
+    0xDD0D7CC9, 0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525,
+    0x206F85B3, 0xB966D409, 0xCE61E49F, 0x5EDEF90E, 0x29D9C998, 0xB0D09822,
+    0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320,
+    0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615,
+    0x73DC1683, 0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B,
+    0x9309FF9D, 0x0A00AE27, 0x7D079EB1, 0xF00F9344, 0x8708A3D2, 0x1E01F268,
+    0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7, 0xFED41B76,
+    0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43,
+    0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1,
+    0xA6BC5767, 0x3FB506DD, 0x48B2364B, 0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6,
+    0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79, 0xCB61B38C,
+    0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9,
+    0x5505262F, 0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7,
+    0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D, 0x9B64C2B0, 0xEC63F226, 0x756AA39C,
+    0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713, 0x95BF4A82,
+    0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7,
+    0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD,
+    0xF6B9265B, 0x6FB077E1, 0x18B74777, 0x88085AE6, 0xFF0F6A70, 0x66063BCA,
+    0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45, 0xA00AE278,
+    0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D,
+    0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53,
+    0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9, 0xBDBDF21C, 0xCABAC28A, 0x53B39330,
+    0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF, 0xB3667A2E,
+    0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B,
+    0x2D02EF8D};
+
+/* crc32_slices[k][i] is the crc of byte i followed by k zero bytes, so that
+slicing-by-n can look up n bytes at once instead of one at a time. */
+static uint32_t crc32_slices[16][256];
+static uint32_t (*crc32_best)(uint32_t, const byte *, uint64_t);
+
+static uint32_t crc32_bytewise(uint32_t crc, const byte *buf, uint64_t len)
+{
+    for (uint64_t i = 0; i < len; i++)
+    {
+        crc = (crc >> 8) ^ crc32_table[(crc ^ buf[i]) & 0xff];
+    }
+
+    return crc;
+}
+
+static inline uint32_t crc32_read_le32(const byte *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+        ((uint32_t)p[3] << 24);
+}
+
+static uint32_t crc32_slice8(uint32_t crc, const byte *buf, uint64_t len)
+{
+    const uint32_t(*t)[256] = (const uint32_t(*)[256])crc32_slices;
+    while (len >= 8)
+    {
+        uint32_t a = crc32_read_le32(buf) ^ crc;
+        uint32_t b = crc32_read_le32(buf + 4);
+        crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^
+            t[5][(a >> 16) & 0xff] ^ t[4][a >> 24] ^ t[3][b & 0xff] ^
+            t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+        buf += 8;
+        len -= 8;
+    }
+
+    return crc32_bytewise(crc, buf, len);
+}
+
+static uint32_t crc32_slice16(uint32_t crc, const byte *buf, uint64_t len)
+{
+    const uint32_t(*t)[256] = (const uint32_t(*)[256])crc32_slices;
+    while (len >= 16)
+    {
+        uint32_t a = crc32_read_le32(buf) ^ crc;
+        uint32_t b = crc32_read_le32(buf + 4);
+        uint32_t c = crc32_read_le32(buf + 8);
+        uint32_t d = crc32_read_le32(buf + 12);
+        crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^
+            t[13][(a >> 16) & 0xff] ^ t[12][a >> 24] ^ t[11][b & 0xff] ^
+            t[10][(b >> 8) & 0xff] ^ t[9][(b >> 16) & 0xff] ^ t[8][b >> 24] ^
+            t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff] ^ t[5][(c >> 16) & 0xff] ^
+            t[4][c >> 24] ^ t[3][d & 0xff] ^ t[2][(d >> 8) & 0xff] ^
+            t[1][(d >> 16) & 0xff] ^ t[0][d >> 24];
+        buf += 16;
+        len -= 16;
+    }
+
+    return crc32_bytewise(crc, buf, len);
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SV_CRC32_HAS_CLMUL 1
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define SV_TARGET_CLMUL __attribute__((target("pclmul,sse4.1")))
+#else
+#include <intrin.h>
+#define SV_TARGET_CLMUL
+#endif
+
+/* fold 64 bytes at a time with carry-less multiplies, see Intel's "Fast CRC
+Computation for Generic Polynomials Using PCLMULQDQ Instruction". the
+constants are for the reflected gzip polynomial. */
+SV_TARGET_CLMUL static uint32_t crc32_clmul(
+    uint32_t crc, const byte *buf, uint64_t len)
+{
+    if (len < 64)
+    {
+        return crc32_slice16(crc, buf, len);
+    }
+
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    len -= 64;
+    while (len >= 64)
+    {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+            _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+            _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+            _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+            _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    }
+
+    /* fold the four lanes into one, then any remaining 16 byte blocks */
+    __m128i lanes[] = {x2, x3, x4};
+    for (uint32_t i = 0; i < countof32u(lanes); i++)
+    {
+        __m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lanes[i]), lo);
+    }
+
+    while (len >= 16)
+    {
+        __m128i lo = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, lo),
+            _mm_loadu_si128((const __m128i *)buf));
+        buf += 16;
+        len -= 16;
+    }
+
+    /* fold 128 bits to 64, then Barrett-reduce to 32 */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    crc = (uint32_t)_mm_extract_epi32(x1, 1);
+    return crc32_slice16(crc, buf, len);
+}
+
+static bool crc32_cpu_has_clmul(void)
+{
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") &&
+        __builtin_cpu_supports("sse4.1");
+#else
+    int info[4] = {};
+    __cpuid(info, 1);
+    return (info[2] & (1 << 1)) != 0 && (info[2] & (1 << 19)) != 0;
+#endif
+}
+#else
+#define SV_CRC32_HAS_CLMUL 0
+#endif
+
+static void crc32_init_once(void)
+{
+    for (uint32_t i = 0; i < 256; i++)
+    {
+        crc32_slices[0][i] = crc32_table[i];
+    }
+
+    for (uint32_t k = 1; k < 16; k++)
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t prev = crc32_slices[k - 1][i];
+            crc32_slices[k][i] = (prev >> 8) ^ crc32_table[prev & 0xff];
+        }
+    }
+
+    crc32_best = &crc32_slice16;
+#if SV_CRC32_HAS_CLMUL
+    if (crc32_cpu_has_clmul())
+    {
+        crc32_best = &crc32_clmul;
+    }
+#endif
+}
+
+#if __linux__
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+static void crc32_init(void)
+{
+    (void)pthread_once(&crc32_once, &crc32_init_once);
+}
+#else
+static INIT_ONCE crc32_once = INIT_ONCE_STATIC_INIT;
+static BOOL CALLBACK crc32_init_once_win(
+    PINIT_ONCE once, PVOID param, PVOID *context)
+{
+    (void)once;
+    (void)param;
+    (void)context;
+    crc32_init_once();
+    return TRUE;
+}
+
+static void crc32_init(void)
+{
+    (void)InitOnceExecuteOnce(&crc32_once, &crc32_init_once_win, NULL, NULL);
+}
+#endif
+
+static const char *const crc32_kernel_names[] = {
+    "bytewise", "slice8", "slice16", "clmul"};
+
+const char *sv_crc32_kernel_name(sv_crc32_kernel kernel)
+{
+    staticassert(countof(crc32_kernel_names) == sv_crc32_kernel_count);
+    return kernel < sv_crc32_kernel_count ? crc32_kernel_names[kernel] : "";
+}
+
+bool sv_crc32_kernel_supported(sv_crc32_kernel kernel)
+{
+    crc32_init();
+#if SV_CRC32_HAS_CLMUL
+    if (kernel == sv_crc32_kernel_clmul)
+    {
+        return crc32_best == &crc32_clmul;
+    }
+#endif
+
+    return kernel < sv_crc32_kernel_clmul;
+}
+
+/* same results as the classic byte-at-a-time loop, so stored crc32 values
+remain valid whichever kernel is used. */
+uint32_t sv_crc32_kernel_run(
+    sv_crc32_kernel kernel, uint32_t incrc32, const void *buf, uint64_t len)
+{
+    crc32_init();
+    uint32_t crc = incrc32 ^ 0xFFFFFFFF;
+    const byte *bytes = (const byte *)buf;
+    switch (kernel)
+    {
+    case sv_crc32_kernel_bytewise:
+        crc = crc32_bytewise(crc, bytes, len);
+        break;
+    case sv_crc32_kernel_slice8:
+        crc = crc32_slice8(crc, bytes, len);
+        break;
+    case sv_crc32_kernel_slice16:
+        crc = crc32_slice16(crc, bytes, len);
+        break;
+    default:
+        check_fatal(sv_crc32_kernel_supported(kernel),
+            "crc32 kernel %d not supported", kernel);
+        crc = crc32_best(crc, bytes, len);
+        break;
+    }
+
+    return crc ^ 0xFFFFFFFF;
+}
+
+uint32_t sv_crc32(uint32_t incrc32, const void *buf, uint64_t len)
+{
+    crc32_init();
+    return crc32_best(incrc32 ^ 0xFFFFFFFF, (const byte *)buf, len) ^
+        0xFFFFFFFF;
+}
+
+/* print the throughput of each kernel on an in-memory buffer, which is the
+ceiling on how fast we can checksum a file that is already cached. */
+void sv_crc32_benchmark(uint32_t megabytes)
+{
+    const uint32_t buflen = 16 * 1024 * 1024;
+    byte *buf = sv_calloc(buflen, 1);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < buflen; i++)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (byte)(state >> 56);
+    }
+
+    uint32_t passes = MAX(1, megabytes / (buflen / (1024 * 1024)));
+    for (int k = 0; k < sv_crc32_kernel_count; k++)
+    {
+        if (!sv_crc32_kernel_supported((sv_crc32_kernel)k))
+        {
+            printf("%-10s not supported on this cpu\n",
+                sv_crc32_kernel_name((sv_crc32_kernel)k));
+            continue;
+        }
+
+        int64_t s0 = 0, s1 = 0;
+        int32_t ms0 = 0, ms1 = 0;
+        uint32_t crc = 0;
+        os_clock_gettime(&s0, &ms0);
+        for (uint32_t pass = 0; pass < passes; pass++)
+        {
+            crc = sv_crc32_kernel_run((sv_crc32_kernel)k, crc, buf, buflen);
+        }
+
+        os_clock_gettime(&s1, &ms1);
+        double seconds = (double)(s1 - s0) + (ms1 - ms0) / 1000.0;
+        double gb = (double)passes * buflen / (1024.0 * 1024.0 * 1024.0);
+        printf("%-10s %8.2f GB/s (crc32 %08x)\n",
+            sv_crc32_kernel_name((sv_crc32_kernel)k),
+            seconds > 0 ? gb / seconds : 0.0, crc);
+    }
+
+    sv_freenull(buf);
+}
+
+/* a positioned read that doesn't move the file pointer, so that several
+threads can read from the same handle. */
+static bool sv_read_at(int fd, uint64_t offset, void *buf, uint32_t len)
+{
+#ifdef __linux__
+    return pread64(fd, buf, len, cast64u64s(offset)) == (ssize_t)len;
+#else
+    HANDLE h = (HANDLE)_get_osfhandle(fd);
+    OVERLAPPED overlapped = {0};
+    DWORD got = 0;
+    overlapped.Offset = lower32(offset);
+    overlapped.OffsetHigh = upper32(offset);
+    return h != INVALID_HANDLE_VALUE &&
+        ReadFile(h, buf, len, &got, &overlapped) && got == len;
+#endif
+}
+
+/* a file has holes if fewer blocks are allocated than its size needs. */
+static bool sv_is_sparse(int fd, uint64_t minsize)
+{
+#ifdef __linux__
+    struct stat64 st = {};
+    return fstat64(fd, &st) == 0 && cast64s64u(st.st_size) >= minsize &&
+        cast64s64u(st.st_blocks) * 512 < cast64s64u(st.st_size);
+#else
+    (void)fd;
+    (void)minsize;
+    return false;
+#endif
+}
+
+/* whether all of a range is a hole, which reads as zeros without any i/o. */
+static bool sv_is_hole(int fd, uint64_t offset, uint64_t len)
+{
+#ifdef __linux__
+    int64_t data = lseek64(fd, cast64u64s(offset), SEEK_DATA);
+    return data >= 0 ? cast64s64u(data) >= offset + len : errno == ENXIO;
+#else
+    (void)fd;
+    (void)offset;
+    (void)len;
+    return false;
+#endif
+}
+
+/* ask the kernel to evict the pages of a range we've finished reading. */
+static void sv_drop_cache(int fd, uint64_t offset, uint64_t len)
+{
+#ifdef __linux__
+    (void)posix_fadvise64(
+        fd, cast64u64s(offset), cast64u64s(len), POSIX_FADV_DONTNEED);
+#else
+    (void)fd;
+    (void)offset;
+    (void)len;
+#endif
+}
+
+static uint32_t gf2_matrix_times(const uint32_t *mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec; vec >>= 1, mat++)
+    {
+        sum ^= (vec & 1) ? *mat : 0;
+    }
+
+    return sum;
+}
+
+static void gf2_matrix_square(uint32_t *square, const uint32_t *mat)
+{
+    for (int n = 0; n < 32; n++)
+    {
+        square[n] = gf2_matrix_times(mat, mat[n]);
+    }
+}
+
+/* the crc32 of A followed by B, given crc32(A), crc32(B) and the length of
+B. from zlib's crc32_combine, by Mark Adler. */
+uint32_t sv_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    uint32_t even[32] = {0}, odd[32] = {0};
+    if (len2 == 0)
+    {
+        return crc1;
+    }
+
+    /* the operator for one zero bit, then two and four zero bits */
+    odd[0] = 0xEDB88320;
+    for (int n = 1; n < 32; n++)
+    {
+        odd[n] = 1U << (n - 1);
+    }
+
+    gf2_matrix_square(even, odd);
+    gf2_matrix_square(odd, even);
+    while (len2 != 0)
+    {
+        gf2_matrix_square(even, odd);
+        crc1 = (len2 & 1) ? gf2_matrix_times(even, crc1) : crc1;
+        len2 >>= 1;
+        if (len2 == 0)
+        {
+            break;
+        }
+
+        gf2_matrix_square(odd, even);
+        crc1 = (len2 & 1) ? gf2_matrix_times(odd, crc1) : crc1;
+        len2 >>= 1;
+    }
+
+    return crc1 ^ crc2;
+}
+
+static void sv_treehash_leaf_begin(spooky_state *leaf, uint64_t index)
+{
+    spooky_init(leaf, SvdpHashSeed1, SvdpHashSeed2 ^ index);
+}
+
+static void sv_treehash_leaf_end(spooky_state *leaf, spooky_state *root)
+{
+    uint64_t words[4] = {0};
+    spooky_final(leaf, &words[0], &words[1], &words[2], &words[3]);
+    spooky_update(root, words, sizeof(words));
+}
+
+void sv_contenthash_init(sv_contenthash *self, uint32_t algorithm)
+{
+    set_self_zero();
+    self->algorithm = algorithm;
+    spooky_init(&self->state, SvdpHashSeed1, SvdpHashSeed2);
+    sv_treehash_leaf_begin(&self->leaf, 0);
+}
+
+void sv_contenthash_update(sv_contenthash *self, const void *buf, uint64_t len)
+{
+    const byte *bytes = (const byte *)buf;
+    self->length += len;
+    if (self->algorithm != sv_hashalgorithm_spookytree)
+    {
+        spooky_update(&self->state, bytes, len);
+        return;
+    }
+
+    while (len)
+    {
+        uint64_t take = MIN(len, SvTreeHashLeafSize - self->leaffill);
+        spooky_update(&self->leaf, bytes, take);
+        self->leaffill += take;
+        bytes += take;
+        len -= take;
+        if (self->leaffill == SvTreeHashLeafSize)
+        {
+            sv_treehash_leaf_end(&self->leaf, &self->state);
+            self->leafindex++;
+            self->leaffill = 0;
+            sv_treehash_leaf_begin(&self->leaf, self->leafindex);
+        }
+    }
+}
+
+void sv_contenthash_final(sv_contenthash *self, hash256 *hash)
+{
+    if (self->algorithm == sv_hashalgorithm_spookytree)
+    {
+        /* an empty input still has one (empty) leaf */
+        if (self->leaffill || self->leafindex == 0)
+        {
+            sv_treehash_leaf_end(&self->leaf, &self->state);
+        }
+
+        spooky_update(&self->state, &self->length, sizeof(self->length));
+    }
+
+    spooky_final(&self->state, &hash->data[0], &hash->data[1], &hash->data[2],
+        &hash->data[3]);
+}
+
+typedef struct sv_treehash_segment
+{
+    int fd;
+    const byte *mem;
+    uint64_t filesize;
+    uint64_t firstleaf;
+    uint64_t endleaf;
+    uint64_t *leafhashes;
+    bool wantcrc32;
+    bool dropcache;
+    bool sparse;
+    bool background;
+    uint32_t crc32;
+    bool failed;
+    os_thread thread;
+} sv_treehash_segment;
+
+static void sv_treehash_segment_run(void *context)
+{
+    sv_treehash_segment *seg = (sv_treehash_segment *)context;
+    if (seg->background && !os_thread_is_background())
+    {
+        os_thread_set_background();
+    }
+
+    uint32_t leafsize = cast64u32u(SvTreeHashLeafSize);
+    byte *buf = seg->mem ? NULL : sv_calloc(leafsize, 1);
+    byte *zeros = seg->sparse ? sv_calloc(leafsize, 1) : NULL;
+    for (uint64_t i = seg->firstleaf; i < seg->endleaf && !seg->failed; i++)
+    {
+        uint64_t offset = i * SvTreeHashLeafSize;
+        uint64_t len = MIN(SvTreeHashLeafSize, seg->filesize - offset);
+        const byte *data = seg->mem ? seg->mem + offset : buf;
+        if (seg->sparse && sv_is_hole(seg->fd, offset, len))
+        {
+            /* hash the leaf's zeros without reading them */
+            data = zeros;
+        }
+        else if (!seg->mem)
+        {
+            os_throttle_take_active(len);
+            if (!sv_read_at(seg->fd, offset, buf, cast64u32u(len)))
+            {
+                seg->failed = true;
+                break;
+            }
+        }
+
+        if (seg->dropcache)
+        {
+            sv_drop_cache(seg->fd, offset, len);
+        }
+
+        spooky_state leaf = {};
+        uint64_t *out = &seg->leafhashes[4 * i];
+        sv_treehash_leaf_begin(&leaf, i);
+        spooky_update(&leaf, data, len);
+        spooky_final(&leaf, &out[0], &out[1], &out[2], &out[3]);
+        seg->crc32 = seg->wantcrc32 ? sv_crc32(seg->crc32, data, len) : 0;
+    }
+
+    sv_freenull(buf);
+    sv_freenull(zeros);
+}
+
+/* gives the same hash and crc32 as sending the whole input through
+sv_contenthash_update, but the leaves are split into one contiguous run per
+thread. reads from mem if it is given, otherwise from fd. pass NULL for crc32
+to skip computing it. */
+static check_result sv_treehash_parallel(const char *loggingcontext, int fd,
+    const byte *mem, uint64_t filesize, uint32_t threads, bool dropcache,
+    hash256 *hash, uint32_t *crc32)
+{
+    sv_result currenterr = {};
+    uint64_t leaves = MAX(1, (filesize + SvTreeHashLeafSize - 1) /
+            SvTreeHashLeafSize);
+    threads = cast64u32u(MAX(1, MIN(threads, leaves)));
+    uint64_t *leafhashes =
+        (uint64_t *)sv_calloc(cast64u32u(4 * leaves), sizeof32u(uint64_t));
+    sv_treehash_segment *segs = (sv_treehash_segment *)sv_calloc(
+        threads, sizeof32u(sv_treehash_segment));
+    bool failed = false;
+    bool sparse = !mem && sv_is_sparse(fd, 0);
+    *hash = hash256zeros;
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        segs[t].fd = fd;
+        segs[t].wantcrc32 = crc32 != NULL;
+        segs[t].dropcache = dropcache;
+        segs[t].sparse = sparse;
+        segs[t].background = os_thread_is_background();
+        segs[t].mem = mem;
+        segs[t].filesize = filesize;
+        segs[t].firstleaf = leaves * t / threads;
+        segs[t].endleaf = leaves * (t + 1) / threads;
+        segs[t].leafhashes = leafhashes;
+    }
+
+    /* this thread takes the first segment itself */
+    for (uint32_t t = 1; t < threads; t++)
+    {
+        check(os_thread_start(
+            &segs[t].thread, &sv_treehash_segment_run, &segs[t]));
+    }
+
+    sv_treehash_segment_run(&segs[0]);
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        os_thread_join(&segs[t].thread);
+        failed |= segs[t].failed;
+    }
+
+    check_b(!failed, "couldn't read %s", loggingcontext);
+    spooky_state root = {};
+    spooky_init(&root, SvdpHashSeed1, SvdpHashSeed2);
+    spooky_update(&root, leafhashes, 4 * leaves * sizeof(uint64_t));
+    spooky_update(&root, &filesize, sizeof(filesize));
+    spooky_final(&root, &hash->data[0], &hash->data[1], &hash->data[2],
+        &hash->data[3]);
+    for (uint32_t t = 0; crc32 && t < threads; t++)
+    {
+        uint64_t start = segs[t].firstleaf * SvTreeHashLeafSize;
+        uint64_t end = MIN(segs[t].endleaf * SvTreeHashLeafSize, filesize);
+        *crc32 = sv_crc32_combine(
+            t == 0 ? 0 : *crc32, segs[t].crc32, end - start);
+    }
+
+cleanup:
+    /* if a thread couldn't be started, wait for the ones that were */
+    for (uint32_t t = 0; t < threads; t++)
+    {
+        os_thread_join(&segs[t].thread);
+    }
+
+    sv_freenull(segs);
+    sv_freenull(leafhashes);
+    return currenterr;
+}
+
+static double sv_benchmark_seconds(int64_t s0, int32_t ms0)
+{
+    int64_t s1 = 0;
+    int32_t ms1 = 0;
+    os_clock_gettime(&s1, &ms1);
+    return (double)(s1 - s0) + (ms1 - ms0) / 1000.0;
+}
+
+/* compare spooky_update, which runs on one core, with the tree hash on one
+thread and on every processor. */
+void sv_contenthash_benchmark(uint32_t megabytes)
+{
+    const uint32_t buflen = 64 * 1024 * 1024;
+    byte *buf = sv_calloc(buflen, 1);
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < buflen; i++)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (byte)(state >> 56);
+    }
+
+    uint32_t passes = MAX(1, megabytes / (buflen / (1024 * 1024)));
+    double gb = (double)passes * buflen / (1024.0 * 1024.0 * 1024.0);
+    uint32_t cpus = os_cpu_count();
+    for (int mode = 0; mode < 3; mode++)
+    {
+        int64_t s0 = 0;
+        int32_t ms0 = 0;
+        hash256 hash = {};
+        os_clock_gettime(&s0, &ms0);
+        for (uint32_t pass = 0; pass < passes; pass++)
+        {
+            if (mode == 0)
+            {
+                spooky_state spooky = {};
+                spooky_init(&spooky, SvdpHashSeed1, SvdpHashSeed2);
+                spooky_update(&spooky, buf, buflen);
+                spooky_final(&spooky, &hash.data[0], &hash.data[1],
+                    &hash.data[2], &hash.data[3]);
+            }
+            else if (mode == 1)
+            {
+                sv_contenthash tree = {};
+                sv_contenthash_init(&tree, sv_hashalgorithm_spookytree);
+                sv_contenthash_update(&tree, buf, buflen);
+                sv_contenthash_final(&tree, &hash);
+            }
+            else
+            {
+                check_warn(sv_treehash_parallel("benchmark", -1, buf, buflen,
+                               cpus, false, &hash, NULL),
+                    NULL, exit_on_err);
+            }
+        }
+
+        double seconds = sv_benchmark_seconds(s0, ms0);
+        const char *names[] = {"spooky_update", "tree, 1 thread", "tree"};
+        printf("%-16s %8.2f GB/s", names[mode], seconds > 0 ? gb / seconds : 0);
+        printf(mode == 2 ? " on %u threads\n" : "\n", cpus);
+    }
+
+    sv_freenull(buf);
+}
+
+check_result sv_hasher_tree_parallel(sv_hasher *self, int fd,
+    uint64_t filesize, uint32_t threads, hash256 *hash, uint32_t *crc32)
+{
+    sv_result currenterr = {};
+    check_b(fd > 0, "bad file handle %s", self->loggingcontext);
+    check(sv_treehash_parallel(self->loggingcontext, fd, NULL, filesize,
+        threads, self->readengine == sv_readengine_mmap, hash, crc32));
+
+cleanup:
+    return currenterr;
+}
+
+/* read() buffers start small, since most files are small, and double each
+time a read fills the buffer. for benchmarks on my machines, 64k is slightly
+faster than 4k and growing to 1Mb helps large files a little more. */
+static const uint32_t SvHasherBufMin = 64 * 1024;
+static const uint32_t SvHasherBufMax = 1024 * 1024;
+
+/* sv_readengine_mmap maps files at least this large, one window at a time */
+static const uint64_t SvHasherMapMin = 1024 * 1024;
+static const uint64_t SvHasherMapWindow = 16 * 1024 * 1024;
+
+sv_hasher sv_hasher_open(
+    const char *loggingcontext, uint32_t algorithm, uint32_t readengine)
+{
+    sv_hasher ret = {0};
+    ret.buflen32u = SvHasherBufMin;
+    check_fatal(ret.buflen32u % 4096 == 0, "must be multiple of 4096.");
+    ret.buf = os_aligned_malloc(ret.buflen32u, 4096);
+    ret.loggingcontext = loggingcontext;
+    ret.algorithm = algorithm;
+    ret.readengine = readengine;
+    sv_contenthash_init(&ret.state, algorithm);
+    return ret;
+}
+
+void sv_hasher_close(sv_hasher *self)
+{
+    if (self)
+    {
+        os_aligned_free(&self->buf);
+        set_self_zero();
+    }
+}
+
+/* called with each piece of the file in order */
+typedef check_result (*sv_hasher_fn)(
+    void *context, uint64_t offset, const byte *data, uint32_t len);
+
+static check_result sv_hasher_each_read(
+    sv_hasher *self, int fd, sv_hasher_fn fn, void *context)
+{
+    sv_result currenterr = {};
+    uint64_t offset = 0;
+    while (true)
+    {
+        int bytes = 0;
+        log_errno_to(bytes, cast64s32s(read(fd, self->buf, self->buflen32u)),
+            "%s", self->loggingcontext);
+
+        check_b(bytes >= 0, "read()");
+        if (bytes == 0)
+        {
+            break;
+        }
+
+        os_throttle_take_active(cast32s32u(bytes));
+        check(fn(context, offset, self->buf, cast32s32u(bytes)));
+        offset += cast32s32u(bytes);
+        if (cast32s32u(bytes) == self->buflen32u &&
+            self->buflen32u < SvHasherBufMax)
+        {
+            os_aligned_free(&self->buf);
+            self->buflen32u *= 2;
+            self->buf = os_aligned_malloc(self->buflen32u, 4096);
+        }
+    }
+
+    if (self->readengine == sv_readengine_mmap)
+    {
+        sv_drop_cache(fd, 0, 0);
+    }
+
+cleanup:
+    return currenterr;
+}
+
+#ifdef __linux__
+/* large files are sent through fn a buffer at a time, at the largest size */
+static void sv_hasher_growbuf(sv_hasher *self)
+{
+    if (self->buflen32u < SvHasherBufMax)
+    {
+        os_aligned_free(&self->buf);
+        self->buflen32u = SvHasherBufMax;
+        self->buf = os_aligned_malloc(self->buflen32u, 4096);
+    }
+}
+
+/* touching a mapped page past the end of a file that another process has
+truncated raises SIGBUS. while a mapping is being read, the handler jumps back
+to sv_hasher_copy_mapped so that it's reported as a failed read. */
+static _Thread_local sigjmp_buf *sv_hasher_sigbus_jmp;
+static pthread_once_t sv_hasher_sigbus_once = PTHREAD_ONCE_INIT;
+
+static void sv_hasher_sigbus(int sig, siginfo_t *info, void *context)
+{
+    (void)info;
+    (void)context;
+    if (sv_hasher_sigbus_jmp)
+    {
+        siglongjmp(*sv_hasher_sigbus_jmp, 1);
+    }
+
+    /* not ours; the fault repeats and the default action runs */
+    signal(sig, SIG_DFL);
+}
+
+static void sv_hasher_sigbus_install(void)
+{
+    struct sigaction action = {0};
+    action.sa_sigaction = &sv_hasher_sigbus;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    check_fatal(sigaction(SIGBUS, &action, NULL) == 0, "sigaction failed");
+}
+
+/* copy from a mapping, returning false if the file was truncated under it.
+only the memcpy runs under the guard: jumping out of fn could leave an
+encoder, stdio or the heap half-updated. */
+static bool sv_hasher_copy_mapped(byte *dest, const byte *map, uint32_t len)
+{
+    sigjmp_buf jmp;
+    if (sigsetjmp(jmp, 1) != 0)
+    {
+        sv_hasher_sigbus_jmp = NULL;
+        return false;
+    }
+
+    sv_hasher_sigbus_jmp = &jmp;
+    memcpy(dest, map, len);
+    sv_hasher_sigbus_jmp = NULL;
+    return true;
+}
+
+static check_result sv_hasher_each_mapped(sv_hasher *self, int fd,
+    uint64_t filesize, sv_hasher_fn fn, void *context)
+{
+    sv_result currenterr = {};
+    (void)pthread_once(&sv_hasher_sigbus_once, &sv_hasher_sigbus_install);
+    sv_hasher_growbuf(self);
+    for (uint64_t offset = 0; offset < filesize; offset += SvHasherMapWindow)
+    {
+        uint64_t len = MIN(SvHasherMapWindow, filesize - offset);
+        byte *map = (byte *)mmap64(
+            NULL, len, PROT_READ, MAP_SHARED, fd, cast64u64s(offset));
+        check_b(map != MAP_FAILED, "couldn't map %s (%d)",
+            self->loggingcontext, errno);
+        (void)madvise(map, len, MADV_SEQUENTIAL);
+
+        /* the pages are read as they're copied out */
+        os_throttle_take_active(len);
+        bool copied = true;
+        sv_result fnresult = {};
+        for (uint64_t pos = 0; pos < len && copied && !fnresult.code;
+             pos += self->buflen32u)
+        {
+            uint32_t piece = cast64u32u(MIN(self->buflen32u, len - pos));
+            copied = sv_hasher_copy_mapped(self->buf, map + pos, piece);
+            if (copied)
+            {
+                fnresult = fn(context, offset + pos, self->buf, piece);
+            }
+        }
+
+        /* drop the pages behind the read cursor */
+        (void)munmap(map, len);
+        sv_drop_cache(fd, offset, len);
+        check_b(copied, "couldn't read %s, it may have been truncated",
+            self->loggingcontext);
+        check(fnresult);
+    }
+
+cleanup:
+    return currenterr;
+}
+
+/* sends a sparse file through fn, reading only the ranges that hold data.
+each hole is sent as the run of zeros that reading it would have given, so
+the hash is the same as for the same bytes stored densely. */
+static check_result sv_hasher_each_sparse(sv_hasher *self, int fd,
+    uint64_t filesize, sv_hasher_fn fn, void *context)
+{
+    sv_result currenterr = {};
+    sv_hasher_growbuf(self);
+    uint64_t offset = 0;
+    while (offset < filesize)
+    {
+        /* ENXIO means there's no more data, the rest is a hole */
+        int64_t data = lseek64(fd, cast64u64s(offset), SEEK_DATA);
+        check_b(data >= 0 || errno == ENXIO, "couldn't seek %s (%d)",
+            self->loggingcontext, errno);
+        uint64_t datastart = data >= 0 ? MIN(cast64s64u(data), filesize)
+                                       : filesize;
+        if (offset < datastart)
+        {
+            memset(self->buf, 0, self->buflen32u);
+        }
+
+        while (offset < datastart)
+        {
+            uint32_t len = cast64u32u(MIN(self->buflen32u, datastart - offset));
+            check(fn(context, offset, self->buf, len));
+            offset += len;
+        }
+
+        int64_t hole = offset < filesize
+            ? lseek64(fd, cast64u64s(offset), SEEK_HOLE)
+            : cast64u64s(filesize);
+        check_b(hole >= 0, "couldn't seek %s (%d)", self->loggingcontext,
+            errno);
+        uint64_t dataend = MIN(cast64s64u(hole), filesize);
+        while (offset < dataend)
+        {
+            uint32_t len = cast64u32u(MIN(self->buflen32u, dataend - offset));
+            os_throttle_take_active(len);
+            check_b(sv_read_at(fd, offset, self->buf, len),
+                "couldn't read %s, it may have been truncated",
+                self->loggingcontext);
+            check(fn(context, offset, self->buf, len));
+            if (self->readengine == sv_readengine_mmap)
+            {
+                sv_drop_cache(fd, offset, len);
+            }
+
+            offset += len;
+        }
+    }
+
+cleanup:
+    return currenterr;
+}
+#endif
+
+/* sends the file through fn, reading it with the hasher's read engine */
+static check_result sv_hasher_each(
+    sv_hasher *self, int fd, sv_hasher_fn fn, void *context)
+{
+    sv_result currenterr = {};
+    check_b(fd > 0, "bad file handle %s", self->loggingcontext);
+    check_errno(cast64s32s(lseek(fd, 0, SEEK_SET)), "%s", self->loggingcontext);
+#ifdef __linux__
+    struct stat64 st = {};
+    check_errno(fstat64(fd, &st), "%s", self->loggingcontext);
+    if (sv_is_sparse(fd, SvHasherMapMin))
+    {
+        check(sv_hasher_each_sparse(
+            self, fd, cast64s64u(st.st_size), fn, context));
+        goto cleanup;
+    }
+
+    if (self->readengine == sv_readengine_mmap)
+    {
+        (void)posix_fadvise64(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (cast64s64u(st.st_size) >= SvHasherMapMin)
+        {
+            check(sv_hasher_each_mapped(
+                self, fd, cast64s64u(st.st_size), fn, context));
+            goto cleanup;
+        }
+    }
+#endif
+
+    check(sv_hasher_each_read(self, fd, fn, context));
+
+cleanup:
+    return currenterr;
+}
+
+typedef struct sv_hasher_wholefile_context
+{
+    sv_hasher *self;
+    hash256 *hash;
+    uint32_t *crc32;
+} sv_hasher_wholefile_context;
+
+static check_result sv_hasher_wholefile_fn(
+    void *context, uint64_t offset, const byte *data, uint32_t len)
+{
+    (void)offset;
+    sv_hasher_wholefile_context *ctx = (sv_hasher_wholefile_context *)context;
+    if (ctx->hash)
+    {
+        sv_contenthash_update(&ctx->self->state, data, len);
+    }
+
+    *ctx->crc32 = sv_crc32(*ctx->crc32, data, len);
+    return OK;
+}
+
+check_result sv_hasher_wholefile(
+    sv_hasher *self, int fd, hash256 *hash, uint32_t *crc32)
+{
+    sv_result currenterr = {};
+    sv_hasher_wholefile_context ctx = {self, hash, crc32};
+    *crc32 = 0;
+    if (hash)
+    {
+        *hash = hash256zeros;
+        sv_contenthash_init(&self->state, self->algorithm);
+    }
+
+    check(sv_hasher_each(self, fd, &sv_hasher_wholefile_fn, &ctx));
+    if (hash)
+    {
+        sv_contenthash_final(&self->state, hash);
+    }
+
+cleanup:
+    return currenterr;
+}
+
+/* how many bytes of the file are in the page cache, or 0 if we can't tell */
+static uint64_t sv_cache_resident(int fd, uint64_t filesize)
+{
+    uint64_t resident = 0;
+#ifdef __linux__
+    uint64_t pagesize = cast64s64u(sysconf(_SC_PAGESIZE));
+    uint64_t pages = (filesize + pagesize - 1) / pagesize;
+    void *map = mmap64(NULL, filesize, PROT_READ, MAP_SHARED, fd, 0);
+    if (map != MAP_FAILED)
+    {
+        byte *vec = sv_calloc(cast64u32u(pages), 1);
+        if (mincore(map, filesize, vec) == 0)
+        {
+            for (uint64_t i = 0; i < pages; i++)
+            {
+                resident += (vec[i] & 1) ? pagesize : 0;
+            }
+        }
+
+        sv_freenull(vec);
+        (void)munmap(map, filesize);
+    }
+#else
+    (void)fd;
+    (void)filesize;
+#endif
+    return resident;
+}
+
+/* hash a temporary file with each read engine, starting with none of it in
+the page cache, and report how much of it is still cached afterwards. */
+check_result sv_hasher_benchmark(const char *dir, uint32_t megabytes)
+{
+    sv_result currenterr = {};
+    const uint32_t chunk = 1024 * 1024;
+    const char *names[] = {"read", "mmap"};
+    staticassert(countof(names) == sv_readengine_count);
+    bstring path = bformat("%s%sbenchmark_read.tmp", dir, pathsep);
+    byte *buf = sv_calloc(chunk, 1);
+    sv_file f = {};
+    os_lockedfilehandle handle = {};
+    sv_hasher hasher = {};
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (uint32_t i = 0; i < chunk; i++)
+    {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buf[i] = (byte)(state >> 56);
+    }
+
+    check(sv_file_open(&f, cstr(path), "wb"));
+    for (uint32_t i = 0; i < megabytes; i++)
+    {
+        memcpy(buf, &i, sizeof(i));
+        check_b(fwrite(buf, 1, chunk, f.file) == chunk, "couldn't write to %s",
+            cstr(path));
+    }
+
+    /* dirty pages can't be dropped, so write them out first */
+    check_b(fflush(f.file) == 0, "couldn't write to %s", cstr(path));
+#ifdef __linux__
+    check_errno(fsync(fileno(f.file)), "%s", cstr(path));
+#endif
+    sv_file_close(&f);
+    for (uint32_t engine = 0; engine < sv_readengine_count; engine++)
+    {
+        hash256 hash = {};
+        uint32_t crc32 = 0;
+        int64_t s0 = 0;
+        int32_t ms0 = 0;
+        check(os_lockedfilehandle_open(&handle, cstr(path), true, NULL));
+        sv_drop_cache(handle.fd, 0, 0);
+        hasher = sv_hasher_open(cstr(path), sv_hashalgorithm_spooky, engine);
+        os_clock_gettime(&s0, &ms0);
+        check(sv_hasher_wholefile(&hasher, handle.fd, &hash, &crc32));
+        double seconds = sv_benchmark_seconds(s0, ms0);
+        uint64_t resident =
+            sv_cache_resident(handle.fd, (uint64_t)megabytes * chunk);
+        printf("%-6s %8.2f MB/s, %llu of %u Mb left in the page cache\n",
+            names[engine], seconds > 0 ? megabytes / seconds : 0,
+            castull(resident / chunk), megabytes);
+        sv_hasher_close(&hasher);
+        os_lockedfilehandle_close(&handle);
+    }
+
+cleanup:
+    sv_hasher_close(&hasher);
+    os_lockedfilehandle_close(&handle);
+    sv_file_close(&f);
+    os_remove(cstr(path));
+    sv_freenull(buf);
+    bdestroy(path);
+    return currenterr;
+}
+
+static const uint32_t extensions_compressed[] = {
+    chars_to_uint32('\0', '\0', '7', 'z'), chars_to_uint32('\0', '\0', 'g', 'z'),
+    chars_to_uint32('\0', '\0', 'x', 'z'), chars_to_uint32('\0', 'a', 'c', 'e'),
+    chars_to_uint32('\0', 'a', 'p', 'e'), chars_to_uint32('\0', 'a', 'r', 'j'),
+    chars_to_uint32('\0', 'b', 'z', '2'), chars_to_uint32('\0', 'c', 'a', 'b'),
+    chars_to_uint32('\0', 'j', 'p', 'g'), chars_to_uint32('\0', 'l', 'h', 'a'),
+    chars_to_uint32('\0', 'l', 'z', 'h'), chars_to_uint32('\0', 'r', 'a', 'r'),
+    chars_to_uint32('\0', 't', 'a', 'z'), chars_to_uint32('\0', 't', 'g', 'z'),
+    chars_to_uint32('\0', 'z', 'i', 'p'), chars_to_uint32('\0', 'p', 'n', 'g'),
+    chars_to_uint32('\0', 'a', 'v', 'i'), chars_to_uint32('\0', 'm', 'o', 'v'),
+    chars_to_uint32('\0', 'm', 'p', '4'), chars_to_uint32('\0', 'f', 'l', 'v'),
+    chars_to_uint32('\0', 'w', 'm', 'a'), chars_to_uint32('j', 'p', 'e', 'g'),
+    chars_to_uint32('w', 'e', 'b', 'p'), chars_to_uint32('w', 'e', 'b', 'm'),
+    chars_to_uint32('a', 'l', 'a', 'c')};
+
+uint32_t extension_into_uint32(const char *s, int len)
+{
+    const char *last_char = s + (len - 1);
+    if (len < 5)
+    {
+        return 0;
+    }
+    else if (*(last_char - 2) == '.')
+    {
+        return chars_to_uint32('\0', '\0', *(last_char - 1), *(last_char));
+    }
+    else if (*(last_char - 3) == '.')
+    {
+        return chars_to_uint32(
+            '\0', *(last_char - 2), *(last_char - 1), *(last_char));
+    }
+    else if (*(last_char - 4) == '.')
+    {
+        return chars_to_uint32(
+            *(last_char - 3), *(last_char - 2), *(last_char - 1), *(last_char));
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+efiletype get_file_extension_info(const char *filename, int len)
+{
+    uint32_t ext = extension_into_uint32(filename, len);
+    efiletype ret = filetype_none;
+    if (ext)
+    {
+        switch (ext)
+        {
+        case chars_to_uint32('\0', 'o', 'g', 'g'):
+            return filetype_ogg;
+        case chars_to_uint32('\0', 'm', 'p', '3'):
+            return filetype_mp3;
+        case chars_to_uint32('\0', 'm', 'p', '4'):
+            return filetype_mp4;
+        case chars_to_uint32('\0', 'm', '4', 'a'):
+            return filetype_m4a;
+        case chars_to_uint32('f', 'l', 'a', 'c'):
+            return filetype_flac;
+        }
+
+        for (size_t i = 0; i < countof(extensions_compressed); i++)
+        {
+            if (ext == extensions_compressed[i])
+            {
+                ret = filetype_binary;
+            }
+        }
+    }
+
+    return ret;
+}
+
+/* files smaller than this are compressed without being sampled */
+static const uint64_t SvClassifyMinSize = 64 * 1024;
+
+/* how much of the start of a file is sampled */
+static const uint32_t SvClassifySampleSize = 256 * 1024;
+
+/* once this many files with an extension have all sampled the same way, the
+rest of them are routed without being sampled */
+static const uint32_t SvClassifyAgree = 4;
+
+typedef struct sv_magic
+{
+    uint32_t offset;
+    uint32_t len;
+    const char *bytes;
+} sv_magic;
+
+/* formats that are already compressed or encrypted */
+static const sv_magic magics_compressed[] = {
+    {0, 4, "\x28\xb5\x2f\xfd"}, /* zstd */
+    {0, 6, "\xfd"
+           "7zXZ\x00"}, /* xz */
+    {0, 2, "\x1f\x8b"}, /* gzip */
+    {0, 3, "BZh"}, /* bzip2 */
+    {0, 6, "7z\xbc\xaf\x27\x1c"}, /* 7z */
+    {0, 6, "Rar!\x1a\x07"}, /* rar */
+    {0, 4, "PK\x03\x04"}, /* zip, docx, jar, apk */
+    {0, 4, "\x04\x22\x4d\x18"}, /* lz4 */
+    {0, 4, "LZIP"}, /* lzip */
+    {0, 4, "MSCF"}, /* cab */
+    {0, 3, "\xff\xd8\xff"}, /* jpeg */
+    {0, 8, "\x89PNG\r\n\x1a\n"}, /* png */
+    {0, 4, "GIF8"}, /* gif */
+    {8, 4, "WEBP"}, /* webp */
+    {4, 4, "ftyp"}, /* heic, avif, mp4, mov */
+    {0, 4, "\x1a\x45\xdf\xa3"}, /* mkv, webm */
+    {0, 4, "OggS"}, /* ogg, opus */
+    {0, 4, "fLaC"}, /* flac */
+    {0, 6, "LUKS\xba\xbe"}, /* luks encrypted volume */
+};
+
+/* bits per byte, from how often each byte value appears */
+static double sv_sample_entropy(const byte *data, uint32_t len)
+{
+    uint32_t counts[256] = {0};
+    double entropy = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        counts[data[i]]++;
+    }
+
+    for (uint32_t i = 0; i < countof(counts); i++)
+    {
+        if (counts[i])
+        {
+            double p = (double)counts[i] / len;
+            entropy -= p * log2(p);
+        }
+    }
+
+    return entropy;
+}
+
+static bool sv_sample_incompressible(const byte *data, uint32_t len)
+{
+    for (uint32_t i = 0; i < countof(magics_compressed); i++)
+    {
+        const sv_magic *magic = &magics_compressed[i];
+        if (magic->offset + magic->len <= len &&
+            memcmp(data + magic->offset, magic->bytes, magic->len) == 0)
+        {
+            return true;
+        }
+    }
+
+    /* text and most uncompressed binary formats are far below 8 bits/byte */
+    if (sv_sample_entropy(data, len) < 7.5)
+    {
+        return false;
+    }
+
+    /* data can have every byte value equally often and still compress well,
+    e.g. a table that counts up, so confirm with the fastest xz preset. if xz
+    saves less than 1/32 of the sample, xz -6 won't be worth running. */
+    uint64_t compressed = 0;
+    return !ar_xz_trial_size(data, len, &compressed) ||
+        compressed > len - len / 32;
+}
+
+void sv_compress_classifier_init(sv_compress_classifier *self)
+{
+    set_self_zero();
+    os_mutex_init(&self->mutex);
+    self->stats = sv_array_open(sizeof32u(sv_extension_stats), 0);
+    self->isopen = true;
+}
+
+void sv_compress_classifier_close(sv_compress_classifier *self)
+{
+    if (self && self->isopen)
+    {
+        os_mutex_close(&self->mutex);
+        sv_array_close(&self->stats);
+        set_self_zero();
+    }
+}
+
+/* the caller must hold the lock */
+static sv_extension_stats *sv_compress_classifier_find(
+    sv_compress_classifier *self, uint32_t ext, bool add)
+{
+    for (uint32_t i = 0; i < self->stats.length; i++)
+    {
+        sv_extension_stats *stat =
+            (sv_extension_stats *)sv_array_at(&self->stats, i);
+        if (stat->ext == ext)
+        {
+            return stat;
+        }
+    }
+
+    if (add)
+    {
+        sv_extension_stats stat = {ext, 0, 0};
+        sv_array_append(&self->stats, &stat, 1);
+        return (sv_extension_stats *)sv_array_at(
+            &self->stats, self->stats.length - 1);
+    }
+
+    return NULL;
+}
+
+/* each entry is the extension as hex, then how many sampled files with
+that extension were compressible and how many were not */
+void sv_compress_classifier_load(
+    sv_compress_classifier *self, const bstrlist *saved)
+{
+    for (int i = 0; i < saved->qty; i++)
+    {
+        sv_extension_stats stat = {};
+        if (sscanf(blist_view(saved, i), "%x %u %u", &stat.ext,
+                &stat.compressible, &stat.incompressible) == 3)
+        {
+            os_mutex_lock(&self->mutex);
+            *sv_compress_classifier_find(self, stat.ext, true) = stat;
+            os_mutex_unlock(&self->mutex);
+        }
+    }
+}
+
+void sv_compress_classifier_save(sv_compress_classifier *self, bstrlist *out)
+{
+    bstring s = bstring_open();
+    bstrlist_clear(out);
+    os_mutex_lock(&self->mutex);
+    for (uint32_t i = 0; i < self->stats.length; i++)
+    {
+        const sv_extension_stats *stat =
+            (const sv_extension_stats *)sv_array_atconst(&self->stats, i);
+        bsetfmt(s, "%08x %u %u", stat->ext, stat->compressible,
+            stat->incompressible);
+        bstrlist_append(out, s);
+    }
+
+    os_mutex_unlock(&self->mutex);
+    bdestroy(s);
+}
+
+/* decides whether a file that has no known compressed extension is worth
+sending through xz, from its magic number and a sample of its first bytes.
+safe to call from several threads. */
+check_result sv_compress_classifier_run(sv_compress_classifier *self,
+    const char *path, int fd, uint64_t filesize, bool *incompressible)
+{
+    sv_result currenterr = {};
+    byte *sample = NULL;
+    *incompressible = false;
+    if (filesize < SvClassifyMinSize)
+    {
+        goto cleanup;
+    }
+
+    /* files without an extension have nothing in common, always sample */
+    uint32_t ext = extension_into_uint32(path, strlen32s(path));
+    os_mutex_lock(&self->mutex);
+    sv_extension_stats *found =
+        ext ? sv_compress_classifier_find(self, ext, false) : NULL;
+    bool decided = found &&
+        (found->compressible == 0 || found->incompressible == 0) &&
+        found->compressible + found->incompressible >= SvClassifyAgree;
+    *incompressible = decided && found->incompressible > 0;
+    self->routed += decided ? 1 : 0;
+    os_mutex_unlock(&self->mutex);
+    if (decided)
+    {
+        goto cleanup;
+    }
+
+    uint32_t len = cast64u32u(MIN(filesize, SvClassifySampleSize));
+    sample = sv_calloc(len, 1);
+    check_b(sv_read_at(fd, 0, sample, len), "couldn't read %s", path);
+    *incompressible = sv_sample_incompressible(sample, len);
+    os_mutex_lock(&self->mutex);
+    self->sampled++;
+    if (ext)
+    {
+        found = sv_compress_classifier_find(self, ext, true);
+        found->compressible += *incompressible ? 0 : 1;
+        found->incompressible += *incompressible ? 1 : 0;
+    }
+
+    os_mutex_unlock(&self->mutex);
+
+cleanup:
+    sv_freenull(sample);
+    return currenterr;
+}
+
+/* read exactly len bytes at offset */
+static uint32_t audio_be32(const byte *b)
+{
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) |
+        ((uint32_t)b[2] << 8) | (uint32_t)b[3];
+}
+
+static uint32_t audio_le32(const byte *b)
+{
+    return ((uint32_t)b[3] << 24) | ((uint32_t)b[2] << 16) |
+        ((uint32_t)b[1] << 8) | (uint32_t)b[0];
+}
+
+/* the audio data is kept as a list of [start, end) offsets */
+static void audio_range_add(sv_array *ranges, uint64_t start, uint64_t end)
+{
+    if (start < end && ranges->length &&
+        sv_array_at64u(ranges, ranges->length - 1) == start)
+    {
+        *(uint64_t *)sv_array_at(ranges, ranges->length - 1) = end;
+    }
+    else if (start < end)
+    {
+        sv_array_add64u(ranges, start);
+        sv_array_add64u(ranges, end);
+    }
+}
+
+static uint64_t audio_skip_id3v2(int fd, uint64_t filesize, uint64_t start)
+{
+    byte header[10] = {0};
+    while (start + sizeof(header) <= filesize &&
+        sv_read_at(fd, start, header, sizeof32u(header)) &&
+        memcmp(header, "ID3", 3) == 0)
+    {
+        /* the size is "syncsafe", 7 bits per byte */
+        uint64_t size = ((uint64_t)(header[6] & 0x7f) << 21) |
+            ((uint64_t)(header[7] & 0x7f) << 14) |
+            ((uint64_t)(header[8] & 0x7f) << 7) | (uint64_t)(header[9] & 0x7f);
+        bool hasfooter = (header[5] & 0x10) != 0;
+        start += sizeof(header) + size + (hasfooter ? sizeof(header) : 0);
+    }
+
+    return MIN(start, filesize);
+}
+
+/* move the end back past an ID3v1 tag, an APEv2 tag, and zero padding.
+writevalidmp3 shows that a tagger can leave zeros after the ID3v1 tag. */
+static uint64_t audio_skip_trailing_tags(int fd, uint64_t start, uint64_t end)
+{
+    byte tail[4096] = {0};
+    uint64_t tailstart = end - MIN(end - start, sizeof(tail));
+    if (!sv_read_at(fd, tailstart, tail, cast64u32u(end - tailstart)))
+    {
+        return end;
+    }
+
+    uint64_t padded = end;
+    while (padded > tailstart && tail[padded - 1 - tailstart] == 0)
+    {
+        padded--;
+    }
+
+    for (uint64_t candidate = padded; candidate <= end; candidate++)
+    {
+        if (candidate >= tailstart + 128 &&
+            memcmp(tail + (candidate - 128 - tailstart), "TAG", 3) == 0)
+        {
+            end = candidate - 128;
+            break;
+        }
+    }
+
+    if (end >= tailstart + 32 &&
+        memcmp(tail + (end - 32 - tailstart), "APETAGEX", 8) == 0)
+    {
+        /* the size in the footer doesn't count the optional header */
+        const byte *footer = tail + (end - 32 - tailstart);
+        uint64_t size = audio_le32(footer + 12) +
+            ((audio_le32(footer + 20) & 0x80000000U) ? 32 : 0);
+        end -= MIN(size, end - start);
+    }
+
+    while (end > tailstart && tail[end - 1 - tailstart] == 0)
+    {
+        end--;
+    }
+
+    return end;
+}
+
+static bool audio_payload_mp3(int fd, uint64_t filesize, sv_array *ranges)
 {
-    sv_result currenterr = {};
-    *hash = hash256zeros;
-    const char *args[] = {linuxonly(ffmpeg) "-i", path,
-        /* disable video, don't read album art as a video stream */
-        "-vn",
-        /* use mp3 bitstream, not converted to signed 16-bit */
-        "-c:a", "copy", "-threads", "1", "-f", "md5",
-        /* send to stdout */
-        "-", NULL};
+    byte sync[2] = {0};
+    uint64_t start = audio_skip_id3v2(fd, filesize, 0);
+    uint64_t end = audio_skip_trailing_tags(fd, start, filesize);
+    if (end - start >= sizeof(sync) &&
+        sv_read_at(fd, start, sync, sizeof32u(sync)) && sync[0] == 0xff &&
+        (sync[1] & 0xe0) == 0xe0)
+    {
+        audio_range_add(ranges, start, end);
+        return true;
+    }
+
+    return false;
+}
 
-    bstring getoutput = bformat("Context: get hash %s", path);
-    bstring useargscombined = bstring_open();
-    check(os_tryuntil_run(ffmpeg, args, getoutput, useargscombined, true, 0, 0));
+static bool audio_payload_flac(int fd, uint64_t filesize, sv_array *ranges)
+{
+    byte header[4] = {0};
+    uint64_t start = audio_skip_id3v2(fd, filesize, 0);
+    if (!sv_read_at(fd, start, header, sizeof32u(header)) ||
+        memcmp(header, "fLaC", 4) != 0)
+    {
+        return false;
+    }
 
-    check_b(readhash(cstr(getoutput), hash),
-        "ffmpeg failed for file %s output=%s", path, cstr(getoutput));
+    /* skip streaminfo, vorbis comments, pictures, and the other blocks */
+    bool lastblock = false;
+    start += sizeof(header);
+    while (!lastblock && sv_read_at(fd, start, header, sizeof32u(header)))
+    {
+        lastblock = (header[0] & 0x80) != 0;
+        start += sizeof(header) + (audio_be32(header) & 0xffffff);
+    }
 
-cleanup:
-    bdestroy(getoutput);
-    bdestroy(useargscombined);
-    return currenterr;
+    /* the first frame begins with a sync code */
+    start = MIN(start, filesize);
+    uint64_t end = audio_skip_trailing_tags(fd, start, filesize);
+    if (lastblock && end - start >= 2 &&
+        sv_read_at(fd, start, header, 2) && header[0] == 0xff &&
+        (header[1] & 0xfe) == 0xf8)
+    {
+        audio_range_add(ranges, start, end);
+        return true;
+    }
+
+    return false;
 }
 
-bool readhash(const char *output, hash256 *hash)
+typedef struct audio_ogg_stream
 {
-    *hash = hash256zeros;
-    byte *hashbytes = (byte *)hash;
+    uint32_t serial;
+    uint32_t packets;
+    bool skipping;
+} audio_ogg_stream;
 
-    /* don't search for the string "Press [q] to stop, [?] for help",
-    it's not always present. */
-    const char *search = "\nMD5=";
-    const char *found = strstr(output, search);
+/* the second packet of a vorbis, opus, theora, or ogg-flac stream */
+static bool audio_ogg_iscomments(int fd, uint64_t offset, uint64_t filesize)
+{
+    byte start[8] = {0};
+    uint32_t len = cast64u32u(MIN(sizeof(start), filesize - offset));
+    return sv_read_at(fd, offset, start, len) &&
+        (memcmp(start, "\x03vorbis", 7) == 0 ||
+            memcmp(start, "OpusTags", 8) == 0 ||
+            memcmp(start, "\x81theora", 7) == 0 || (start[0] & 0x7f) == 4);
+}
 
-    if (found)
+/* hash the packets in each page, but not the page headers (their
+checksums and sequence numbers change when the comments change size) and
+not the comment packets. */
+static bool audio_payload_ogg(int fd, uint64_t filesize, sv_array *ranges)
+{
+    sv_array streams = sv_array_open(sizeof32u(audio_ogg_stream), 0);
+    byte header[27 + 255] = {0};
+    uint64_t pos = 0;
+    while (pos + 27 <= filesize && sv_read_at(fd, pos, header, 27) &&
+        memcmp(header, "OggS", 4) == 0 &&
+        sv_read_at(fd, pos + 27, header + 27, header[26]))
     {
-        found += strlen(search);
-        for (int j = 0; j < 32; j++)
+        audio_ogg_stream *stream = NULL;
+        uint32_t serial = audio_le32(header + 14);
+        for (uint32_t i = 0; i < streams.length && !stream; i++)
+        {
+            stream = (audio_ogg_stream *)sv_array_at(&streams, i);
+            stream = stream->serial == serial ? stream : NULL;
+        }
+
+        if (!stream)
+        {
+            audio_ogg_stream newstream = {serial};
+            sv_array_append(&streams, &newstream, 1);
+            stream = (audio_ogg_stream *)sv_array_at(
+                &streams, streams.length - 1);
+        }
+
+        /* a lacing value under 255 ends a packet */
+        bool continued = (header[5] & 0x01) != 0;
+        uint64_t offset = pos + 27 + header[26];
+        for (uint32_t i = 0; i < header[26]; i++)
         {
-            if (!isxdigit((unsigned char)found[j]))
+            uint32_t lacing = header[27 + i];
+            if (i == 0 ? !continued : header[27 + i - 1] < 255)
             {
-                sv_log_fmt("not enough hex digits. %s", output);
-                return false;
+                stream->skipping = stream->packets == 1 &&
+                    audio_ogg_iscomments(fd, offset, filesize);
+            }
+
+            if (!stream->skipping)
+            {
+                audio_range_add(ranges, offset, MIN(offset + lacing, filesize));
             }
+
+            stream->packets += lacing < 255 ? 1 : 0;
+            offset += lacing;
         }
 
-        int results[16] = {0};
-        int matched = sscanf(found,
-            "%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-            &results[0], &results[1], &results[2], &results[3], &results[4],
-            &results[5], &results[6], &results[7], &results[8], &results[9],
-            &results[10], &results[11], &results[12], &results[13], &results[14],
-            &results[15]);
+        pos = offset;
+    }
+
+    /* stopping early at a chunk that isn't a page, or running past the end
+    with a truncated page, means we don't know where the audio is */
+    sv_array_close(&streams);
+    return pos == filesize && ranges->length > 0;
+}
+
+/* hash the contents of the mdat atoms, tags are kept in moov/udta */
+static bool audio_payload_mp4(int fd, uint64_t filesize, sv_array *ranges)
+{
+    byte header[16] = {0};
+    uint64_t pos = 0;
+    while (pos + 8 <= filesize && sv_read_at(fd, pos, header, 8))
+    {
+        uint64_t size = audio_be32(header);
+        uint64_t headerlen = 8;
+        if (size == 1 && sv_read_at(fd, pos + 8, header + 8, 8))
+        {
+            size = ((uint64_t)audio_be32(header + 8) << 32) |
+                audio_be32(header + 12);
+            headerlen = 16;
+        }
+        else if (size == 0)
+        {
+            size = filesize - pos;
+        }
 
-        if (matched == 16)
+        for (uint32_t i = 4; i < 8; i++)
         {
-            for (int j = 0; j < 16; j++)
+            if (header[i] < 0x20 || header[i] > 0x7e)
             {
-                hashbytes[j] = (byte)results[j];
+                return false;
             }
-
-            return true;
         }
-        else
+
+        /* a truncated atom means we don't know where the audio is */
+        if (size < headerlen || size > filesize - pos)
         {
-            sv_log_fmt("not all hex digits read %d %s", matched, output);
             return false;
         }
+
+        if (memcmp(header + 4, "mdat", 4) == 0)
+        {
+            audio_range_add(ranges, pos + headerlen, pos + size);
+        }
+
+        pos += size;
     }
-    else
+
+    return pos == filesize && ranges->length > 0;
+}
+
+static bool get_audio_payload(
+    int fd, efiletype ext, uint64_t filesize, sv_array *ranges)
+{
+    switch (ext)
     {
-        sv_log_fmt("string '%s' not seen. %s", search, output);
+    case filetype_mp3:
+        return audio_payload_mp3(fd, filesize, ranges);
+    case filetype_flac:
+        return audio_payload_flac(fd, filesize, ranges);
+    case filetype_ogg:
+        return audio_payload_ogg(fd, filesize, ranges);
+    case filetype_mp4:
+    case filetype_m4a:
+        return audio_payload_mp4(fd, filesize, ranges);
+    default:
         return false;
     }
 }
 
-check_result get_audio_hash_without_tags(
-    const char *ffmpeg, const char *path, hash256 *hash)
+typedef struct sv_hasher_ranges_context
 {
-    sv_result currenterr = {};
-
-    /* ffmpeg sometimes returns md5(''), in which case we should retry. */
-    extern uint32_t max_tries;
-    const uint64_t md5empty1 = 0x4b2008fd98c1dd4ULL,
-                   md5empty2 = 0x7e42f8ec980980e9ULL;
-    for (uint32_t attempt = 0; attempt < max_tries; attempt++)
+    sv_hasher *self;
+    const sv_array *ranges;
+    uint32_t next;
+    uint32_t *crc32;
+} sv_hasher_ranges_context;
+
+static check_result sv_hasher_ranges_fn(
+    void *context, uint64_t offset, const byte *data, uint32_t len)
+{
+    sv_hasher_ranges_context *ctx = (sv_hasher_ranges_context *)context;
+    uint64_t bufend = offset + len;
+    while (ctx->next < ctx->ranges->length)
     {
-        check(get_audio_hash_without_tags_impl(ffmpeg, path, hash));
-        if (hash->data[0] == md5empty1 && hash->data[1] == md5empty2)
+        uint64_t start = MAX(sv_array_at64u(ctx->ranges, ctx->next), offset);
+        uint64_t end = MIN(sv_array_at64u(ctx->ranges, ctx->next + 1), bufend);
+        if (start < end)
         {
-            log_b(0, "get_audio_hash_without_tags got md5('') hash.");
+            sv_contenthash_update(&ctx->self->state, data + (start - offset),
+                cast64u32u(end - start));
         }
-        else
+
+        if (sv_array_at64u(ctx->ranges, ctx->next + 1) > bufend)
         {
             break;
         }
+
+        ctx->next += 2;
     }
 
+    *ctx->crc32 = sv_crc32(*ctx->crc32, data, len);
+    return OK;
+}
+
+/* like sv_hasher_wholefile, but only the bytes in ranges are hashed. the
+crc32 still covers the whole file. */
+static check_result sv_hasher_ranges(sv_hasher *self, int fd,
+    const sv_array *ranges, hash256 *hash, uint32_t *crc32)
+{
+    sv_result currenterr = {};
+    sv_hasher_ranges_context ctx = {self, ranges, 0, crc32};
+    *hash = hash256zeros;
+    *crc32 = 0;
+    sv_contenthash_init(&self->state, self->algorithm);
+    check(sv_hasher_each(self, fd, &sv_hasher_ranges_fn, &ctx));
+    sv_contenthash_final(&self->state, hash);
+
 cleanup:
     return currenterr;
 }
 
-/* if using ffmpeg, ignore filesize changes for audio files;
-the changed filesize could be just due to the audio tag changing. */
-void adjustfilesize_if_audio_file(uint32_t use_ffmpeg, efiletype ext,
-    uint64_t size_from_disk, uint64_t *outputsize)
+/* below this size the tree hash is computed on the calling thread */
+static const uint64_t SvTreeHashParallelMin = 8 * 1024 * 1024;
+
+check_result hash_of_file(os_lockedfilehandle *handle, uint32_t separateaudio,
+    efiletype ext, uint32_t algorithm, uint32_t readengine, hash256 *out_hash,
+    uint32_t *outcrc32)
 {
-    if (use_ffmpeg && ext != filetype_none && ext != filetype_binary)
+    sv_result currenterr = {};
+    sv_hasher hasher =
+        sv_hasher_open(cstr(handle->loggingcontext), algorithm, readengine);
+    sv_array ranges = sv_array_open_u64();
+    uint64_t filesize = 0, modtime = 0;
+    bool isaudio = ext != filetype_none && ext != filetype_binary;
+    if (isaudio && separateaudio)
     {
-        *outputsize = AudioFilesizePlaceholder;
+        check(os_lockedfilehandle_stat(handle, &filesize, &modtime, NULL));
+        if (get_audio_payload(handle->fd, ext, filesize, &ranges))
+        {
+            /* hash only the audio data, so that editing tags is not seen
+            as a change to the file */
+            check(sv_hasher_ranges(
+                &hasher, handle->fd, &ranges, out_hash, outcrc32));
+            goto cleanup;
+        }
+
+        /* ok, maybe it's an audio format we don't support,
+        fall back to hashing data. */
+        sv_log_fmt("%s type=%d falling back to hash",
+            cstr(handle->loggingcontext), ext);
     }
-    else
+
+    if (algorithm == sv_hashalgorithm_spookytree)
     {
-        *outputsize = size_from_disk;
+        /* spread the leaves of a large file across threads */
+        check_b(handle->fd > 0, "bad file handle %s",
+            cstr(handle->loggingcontext));
+        check(os_lockedfilehandle_stat(handle, &filesize, &modtime, NULL));
+        if (filesize >= SvTreeHashParallelMin)
+        {
+            uint32_t threads = MIN(8, os_cpu_count());
+            check(sv_hasher_tree_parallel(
+                &hasher, handle->fd, filesize, threads, out_hash, outcrc32));
+            goto cleanup;
+        }
     }
-}
 
-/* CRC-32 version 2.0.0 by Craig Bruce, 2006-04-29. */
-/* http://www.csbruce.com/~csbruce/software/crc32.c */
-/* PUBLIC-DOMAIN SOFTWARE. */
-static uint32_t Crc32_ComputeBuf(uint32_t incrc32, const void *buf, int buflen)
-{
-    static const uint32_t crc_table[] = {0x00000000, 0x77073096, 0xEE0E612C,
-        0x990951BA, 0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3, 0x0EDB8832,
-        0x79DCB8A4, 0xE0D5E91E, 0x97D2D988, 0x09B64C2B, 0x7EB17CBD, 0xE7B82D07,
-        0x90BF1D91, 0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE, 0x1ADAD47D,
-        0x6DDDE4EB, 0xF4D4B551, 0x83D385C7, 0x136C9856, 0x646BA8C0, 0xFD62F97A,
-        0x8A65C9EC, 0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8,
-        0x4C69105E, 0xD56041E4, 0xA2677172, 0x3C03E4D1, 0x4B04D447, 0xD20D85FD,
-        0xA50AB56B, 0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940, 0x32D86CE3,
-        0x45DF5C75, 0xDCD60DCF, 0xABD13D59, 0x26D930AC, 0x51DE003A, 0xC8D75180,
-        0xBFD06116, 0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F, 0x2802B89E,
-        0x5F058808, 0xC60CD9B2, 0xB10BE924, 0x2F6F7C87, 0x58684C11, 0xC1611DAB,
-        0xB6662D3D, 0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A, 0x71B18589,
-        0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433, 0x7807C9A2, 0x0F00F934, 0x9609A88E,
-        0xE10E9818, 0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01, 0x6B6B51F4,
-        0x1C6C6162, 0x856530D8, 0xF262004E, 0x6C0695ED, 0x1B01A57B, 0x8208F4C1,
-        0xF50FC457, 0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF,
-        0x15DA2D49, 0x8CD37CF3, 0xFBD44C65, 0x4DB26158, 0x3AB551CE, 0xA3BC0074,
-        0xD4BB30E2, 0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A,
-        0x346ED9FC, 0xAD678846, 0xDA60B8D0, 0x44042D73, 0x33031DE5, 0xAA0A4C5F,
-        0xDD0D7CC9, 0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086, 0x5768B525,
-        0x206F85B3, 0xB966D409, 0xCE61E49F, 0x5EDEF90E, 0x29D9C998, 0xB0D09822,
-        0xC7D7A8B4, 0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320,
-        0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A, 0xEAD54739, 0x9DD277AF, 0x04DB2615,
-        0x73DC1683, 0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B,
-        0x9309FF9D, 0x0A00AE27, 0x7D079EB1, 0xF00F9344, 0x8708A3D2, 0x1E01F268,
-        0x6906C2FE, 0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7, 0xFED41B76,
-        0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC, 0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43,
-        0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1,
-        0xA6BC5767, 0x3FB506DD, 0x48B2364B, 0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6,
-        0x41047A60, 0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79, 0xCB61B38C,
-        0xBC66831A, 0x256FD2A0, 0x5268E236, 0xCC0C7795, 0xBB0B4703, 0x220216B9,
-        0x5505262F, 0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7,
-        0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D, 0x9B64C2B0, 0xEC63F226, 0x756AA39C,
-        0x026D930A, 0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713, 0x95BF4A82,
-        0xE2B87A14, 0x7BB12BAE, 0x0CB61B38, 0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7,
-        0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E, 0x81BE16CD,
-        0xF6B9265B, 0x6FB077E1, 0x18B74777, 0x88085AE6, 0xFF0F6A70, 0x66063BCA,
-        0x11010B5C, 0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45, 0xA00AE278,
-        0xD70DD2EE, 0x4E048354, 0x3903B3C2, 0xA7672661, 0xD06016F7, 0x4969474D,
-        0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0, 0xA9BCAE53,
-        0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9, 0xBDBDF21C, 0xCABAC28A, 0x53B39330,
-        0x24B4A3A6, 0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF, 0xB3667A2E,
-        0xC4614AB8, 0x5D681B02, 0x2A6F2B94, 0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B,
-        0x2D02EF8D};
-
-    unsigned char *bytebuf = 0;
-    uint32_t crc32 = incrc32 ^ 0xFFFFFFFF;
-    bytebuf = (unsigned char *)buf;
-    staticassert(countof(crc_table) == 256);
-    for (int i = 0; i < buflen; i++)
-    {
-        uint32_t index = (crc32 ^ bytebuf[i]) & 0xFF;
-        crc32 = (crc32 >> 8) ^ crc_table[index];
-    }
-
-    return (crc32 ^ 0xFFFFFFFF);
-}
-
-sv_hasher sv_hasher_open(const char *loggingcontext)
-{
-    sv_hasher ret = {0};
+    /* normal hash of the bytes on disk */
+    check(sv_hasher_wholefile(&hasher, handle->fd, out_hash, outcrc32));
 
-    /* for benchmarks on my machines, buffer size of 64k is
-    slightly faster than 4k and slightly slower than 256k */
-    ret.buflen32u = 64 * 1024;
-    check_fatal(ret.buflen32u < (1U << 20), "must be smaller than 20bits");
-    check_fatal(ret.buflen32u % 4096 == 0, "must be multiple of 4096.");
-    ret.buf = os_aligned_malloc(ret.buflen32u, 4096);
-    ret.loggingcontext = loggingcontext;
-    spooky_init(&ret.state, SvdpHashSeed1, SvdpHashSeed2);
-    return ret;
+cleanup:
+    sv_array_close(&ranges);
+    sv_hasher_close(&hasher);
+    return currenterr;
 }
 
-void sv_hasher_close(sv_hasher *self)
+typedef struct sv_hasher_compress_context
 {
-    if (self)
-    {
-        os_aligned_free(&self->buf);
-        set_self_zero();
-    }
+    sv_hasher *self;
+    ar_encoder *enc;
+    FILE *out;
+    const char *outpath;
+    uint32_t *crc32;
+    uint64_t *compressedsize;
+} sv_hasher_compress_context;
+
+static check_result sv_hasher_compress_fn(
+    void *context, uint64_t offset, const byte *data, uint32_t len)
+{
+    (void)offset;
+    sv_hasher_compress_context *ctx = (sv_hasher_compress_context *)context;
+    sv_contenthash_update(&ctx->self->state, data, len);
+    *ctx->crc32 = sv_crc32(*ctx->crc32, data, len);
+    return ar_encoder_write(
+        ctx->enc, data, len, ctx->out, ctx->outpath, ctx->compressedsize);
 }
 
-check_result sv_hasher_wholefile(
-    sv_hasher *self, int fd, hash256 *hash, uint32_t *crc32)
+/* like sv_hasher_wholefile, but each buffer read is also sent to an
+encoder, so that a file that needs compressing is only read once. the
+encoder must already have been started with ar_encoder_begin. */
+check_result sv_hasher_wholefile_compress(sv_hasher *self, int fd,
+    ar_encoder *enc, const char *outpath, hash256 *hash, uint32_t *crc32,
+    uint64_t *compressedsize)
 {
     sv_result currenterr = {};
+    sv_file out = {};
+    *hash = hash256zeros;
     *crc32 = 0;
-    if (hash)
-    {
-        *hash = hash256zeros;
-        spooky_init(&self->state, SvdpHashSeed1, SvdpHashSeed2);
-    }
+    *compressedsize = 0;
+    sv_contenthash_init(&self->state, self->algorithm);
+    check(sv_file_open(&out, outpath, "wb"));
 
-    check_b(fd > 0, "bad file handle %s", self->loggingcontext);
-    check_errno(cast64s32s(lseek(fd, 0, SEEK_SET)), "%s", self->loggingcontext);
-
-    while (true)
-    {
-        int bytes = 0;
-        log_errno_to(bytes, cast64s32s(read(fd, self->buf, self->buflen32u)),
-            "%s", self->loggingcontext);
+    sv_hasher_compress_context ctx = {
+        self, enc, out.file, outpath, crc32, compressedsize};
+    check(sv_hasher_each(self, fd, &sv_hasher_compress_fn, &ctx));
+    check(ar_encoder_end(enc, out.file, outpath, compressedsize));
+    check_b(fflush(out.file) == 0, "couldn't write to %s", outpath);
+    sv_contenthash_final(&self->state, hash);
 
-        check_b(bytes >= 0, "read()");
-        if (bytes == 0)
-        {
-            break;
-        }
+cleanup:
+    sv_file_close(&out);
+    return currenterr;
+}
 
-        if (hash)
-        {
-            spooky_update(&self->state, self->buf, cast32s32u(bytes));
-        }
+check_result hash_of_file_and_compress(os_lockedfilehandle *handle,
+    ar_encoder *enc, uint32_t codec, uint32_t level, const char *outpath,
+    uint32_t algorithm, uint32_t readengine, hash256 *out_hash,
+    uint32_t *outcrc32, uint64_t *compressedsize)
+{
+    sv_result currenterr = {};
+    uint64_t size = 0, modtime = 0;
+    bstring permissions = bstring_open();
+    sv_hasher hasher =
+        sv_hasher_open(cstr(handle->loggingcontext), algorithm, readengine);
+    check(os_lockedfilehandle_stat(handle, &size, &modtime, permissions));
+    check(ar_encoder_begin(enc, codec, level, size));
+    check(sv_hasher_wholefile_compress(&hasher, handle->fd, enc, outpath,
+        out_hash, outcrc32, compressedsize));
 
-        *crc32 = Crc32_ComputeBuf(*crc32, self->buf, bytes);
-    }
+cleanup:
+    bdestroy(permissions);
+    sv_hasher_close(&hasher);
+    return currenterr;
+}
 
-    if (hash)
+typedef struct sv_hasher_prefix_context
+{
+    sv_hasher *self;
+    uint64_t prefixlength;
+    hash256 *prefixhash;
+    uint32_t *crc32;
+    uint32_t *tailcrc32;
+} sv_hasher_prefix_context;
+
+static check_result sv_hasher_prefix_fn(
+    void *context, uint64_t offset, const byte *data, uint32_t len)
+{
+    sv_hasher_prefix_context *ctx = (sv_hasher_prefix_context *)context;
+    uint32_t before = offset < ctx->prefixlength
+        ? cast64u32u(MIN(len, ctx->prefixlength - offset))
+        : 0;
+    sv_contenthash_update(&ctx->self->state, data, before);
+    if (before && offset + before == ctx->prefixlength)
     {
-        spooky_final(&self->state, &hash->data[0], &hash->data[1],
-            &hash->data[2], &hash->data[3]);
+        /* finish a copy of the state, the original carries on */
+        sv_contenthash prefix = ctx->self->state;
+        sv_contenthash_final(&prefix, ctx->prefixhash);
     }
 
+    sv_contenthash_update(&ctx->self->state, data + before, len - before);
+    *ctx->tailcrc32 = sv_crc32(*ctx->tailcrc32, data + before, len - before);
+    *ctx->crc32 = sv_crc32(*ctx->crc32, data, len);
+    return OK;
+}
+
+/* hash a file that used to be prefixlength bytes long, and also get the hash
+of its first prefixlength bytes and the crc32 of the rest. the file is read
+once: the hash state is checkpointed at the old length. if the file is now
+shorter than that, prefixhash is left as zeros. */
+check_result hash_of_file_and_prefix(os_lockedfilehandle *handle,
+    uint32_t algorithm, uint32_t readengine, uint64_t prefixlength,
+    hash256 *out_prefixhash, hash256 *out_hash, uint32_t *outcrc32,
+    uint32_t *outtailcrc32)
+{
+    sv_result currenterr = {};
+    sv_hasher hasher =
+        sv_hasher_open(cstr(handle->loggingcontext), algorithm, readengine);
+    sv_hasher_prefix_context ctx = {
+        &hasher, prefixlength, out_prefixhash, outcrc32, outtailcrc32};
+    *out_prefixhash = hash256zeros;
+    *out_hash = hash256zeros;
+    *outcrc32 = 0;
+    *outtailcrc32 = 0;
+    sv_contenthash_init(&hasher.state, algorithm);
+    check(sv_hasher_each(&hasher, handle->fd, &sv_hasher_prefix_fn, &ctx));
+    sv_contenthash_final(&hasher.state, out_hash);
+
 cleanup:
+    sv_hasher_close(&hasher);
     return currenterr;
 }
 
-static const uint32_t extensions_compressed[] = {
-    chars_to_uint32('\0', '\0', '7', 'z'), chars_to_uint32('\0', '\0', 'g', 'z'),
-    chars_to_uint32('\0', '\0', 'x', 'z'), chars_to_uint32('\0', 'a', 'c', 'e'),
-    chars_to_uint32('\0', 'a', 'p', 'e'), chars_to_uint32('\0', 'a', 'r', 'j'),
-    chars_to_uint32('\0', 'b', 'z', '2'), chars_to_uint32('\0', 'c', 'a', 'b'),
-    chars_to_uint32('\0', 'j', 'p', 'g'), chars_to_uint32('\0', 'l', 'h', 'a'),
-    chars_to_uint32('\0', 'l', 'z', 'h'), chars_to_uint32('\0', 'r', 'a', 'r'),
-    chars_to_uint32('\0', 't', 'a', 'z'), chars_to_uint32('\0', 't', 'g', 'z'),
-    chars_to_uint32('\0', 'z', 'i', 'p'), chars_to_uint32('\0', 'p', 'n', 'g'),
-    chars_to_uint32('\0', 'a', 'v', 'i'), chars_to_uint32('\0', 'm', 'o', 'v'),
-    chars_to_uint32('\0', 'm', 'p', '4'), chars_to_uint32('\0', 'f', 'l', 'v'),
-    chars_to_uint32('\0', 'w', 'm', 'a'), chars_to_uint32('j', 'p', 'e', 'g'),
-    chars_to_uint32('w', 'e', 'b', 'p'), chars_to_uint32('w', 'e', 'b', 'm'),
-    chars_to_uint32('a', 'l', 'a', 'c')};
-
-uint32_t extension_into_uint32(const char *s, int len)
+void sv_chunker_init(sv_chunker *self, uint32_t algorithm,
+    uint64_t avgchunksize, sv_array *chunks)
 {
-    const char *last_char = s + (len - 1);
-    if (len < 5)
+    memset(self, 0, sizeof(*self));
+    uint64_t bits = 0;
+    while ((2ULL << bits) <= avgchunksize)
     {
-        return 0;
-    }
-    else if (*(last_char - 2) == '.')
-    {
-        return chars_to_uint32('\0', '\0', *(last_char - 1), *(last_char));
-    }
-    else if (*(last_char - 3) == '.')
-    {
-        return chars_to_uint32(
-            '\0', *(last_char - 2), *(last_char - 1), *(last_char));
-    }
-    else if (*(last_char - 4) == '.')
-    {
-        return chars_to_uint32(
-            *(last_char - 3), *(last_char - 2), *(last_char - 1), *(last_char));
+        bits++;
     }
-    else
+
+    /* the gear table only has to look random and never change, so fill it
+    from splitmix64 with a fixed seed */
+    uint64_t seed = 0x6A09E667F3BCC908ULL;
+    for (uint32_t i = 0; i < countof32u(self->gear); i++)
     {
-        return 0;
+        seed += 0x9E3779B97F4A7C15ULL;
+        uint64_t z = seed;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        self->gear[i] = z ^ (z >> 31);
     }
+
+    /* normalized chunking: a stricter mask before the average size and a
+    looser one after it keep most chunks close to the average */
+    self->avgsize = 1ULL << bits;
+    self->minsize = self->avgsize / 4;
+    self->maxsize = self->avgsize * 8;
+    self->maskstrict = ~0ULL << (64 - MIN(63, bits + 2));
+    self->maskloose = ~0ULL << (64 - (bits > 2 ? bits - 2 : 1));
+    self->chunks = chunks;
+    sv_contenthash_init(&self->state, algorithm);
+    sv_array_truncatelength(chunks, 0);
 }
 
-efiletype get_file_extension_info(const char *filename, int len)
+static void sv_chunker_emit(sv_chunker *self)
 {
-    uint32_t ext = extension_into_uint32(filename, len);
-    efiletype ret = filetype_none;
-    if (ext)
+    sv_chunk chunk = {self->start, self->fill, {{0}}, self->crc32};
+    sv_contenthash_final(&self->state, &chunk.hash);
+    sv_array_append(self->chunks, &chunk, 1);
+    sv_contenthash_init(&self->state, self->state.algorithm);
+    self->start += self->fill;
+    self->fill = 0;
+    self->crc32 = 0;
+    self->fingerprint = 0;
+}
+
+/* how many bytes of data belong to the current chunk. no chunk can end
+before minsize, so those bytes are skipped without rolling the hash; the gear
+hash only depends on the last 64 bytes, so nothing is lost. */
+static uint64_t sv_chunker_scan(
+    sv_chunker *self, const byte *data, uint64_t len, bool *found)
+{
+    uint64_t fingerprint = self->fingerprint;
+    uint64_t limit = MIN(len, self->maxsize - self->fill);
+    uint64_t normal = self->avgsize > self->fill
+        ? MIN(limit, self->avgsize - self->fill)
+        : 0;
+    uint64_t i = self->fill < self->minsize
+        ? MIN(limit, self->minsize - self->fill)
+        : 0;
+    *found = false;
+    for (; i < normal; i++)
     {
-        switch (ext)
+        fingerprint = (fingerprint << 1) + self->gear[data[i]];
+        if (!(fingerprint & self->maskstrict))
         {
-        case chars_to_uint32('\0', 'o', 'g', 'g'):
-            return filetype_ogg;
-        case chars_to_uint32('\0', 'm', 'p', '3'):
-            return filetype_mp3;
-        case chars_to_uint32('\0', 'm', 'p', '4'):
-            return filetype_mp4;
-        case chars_to_uint32('\0', 'm', '4', 'a'):
-            return filetype_m4a;
-        case chars_to_uint32('f', 'l', 'a', 'c'):
-            return filetype_flac;
+            *found = true;
+            i++;
+            goto done;
         }
+    }
 
-        for (size_t i = 0; i < countof(extensions_compressed); i++)
+    for (; i < limit; i++)
+    {
+        fingerprint = (fingerprint << 1) + self->gear[data[i]];
+        if (!(fingerprint & self->maskloose))
         {
-            if (ext == extensions_compressed[i])
-            {
-                ret = filetype_binary;
-            }
+            *found = true;
+            i++;
+            goto done;
         }
     }
 
-    return ret;
+    *found = self->fill + i == self->maxsize;
+
+done:
+    self->fingerprint = fingerprint;
+    return i;
 }
 
-check_result hash_of_file(os_lockedfilehandle *handle, uint32_t useffmpeg,
-    efiletype ext, const char *ffmpeg, hash256 *out_hash, uint32_t *outcrc32)
+void sv_chunker_update(sv_chunker *self, const byte *data, uint64_t len)
 {
-    sv_result currenterr = {};
-    sv_hasher hasher = sv_hasher_open(cstr(handle->loggingcontext));
-    if (ext != filetype_none && ext != filetype_binary && useffmpeg)
+    while (len > 0)
     {
-        const char *path = cstr(handle->loggingcontext);
-        check_b(os_file_exists(path), "not found %s", path);
-        check_b(os_file_exists(ffmpeg), "not found %s", ffmpeg);
-        sv_result res = get_audio_hash_without_tags(ffmpeg, path, out_hash);
-
-        if (res.code)
+        bool found = false;
+        uint64_t take = sv_chunker_scan(self, data, len, &found);
+        sv_contenthash_update(&self->state, data, take);
+        self->crc32 = sv_crc32(self->crc32, data, take);
+        self->fill += take;
+        if (found)
         {
-            /* ok, maybe it's an audio format ffmpeg doesn't support,
-            fall back to hashing data. */
-            sv_result_close(&res);
-            sv_log_fmt("%s type=%d falling back to hash", path, ext);
-            check(sv_hasher_wholefile(&hasher, handle->fd, out_hash, outcrc32));
-        }
-        else
-        {
-            /* get the crc32. */
-            check(sv_hasher_wholefile(&hasher, handle->fd, NULL, outcrc32));
+            sv_chunker_emit(self);
         }
+
+        data += take;
+        len -= take;
     }
-    else
+}
+
+void sv_chunker_final(sv_chunker *self)
+{
+    if (self->fill)
+    {
+        sv_chunker_emit(self);
+    }
+}
+
+typedef struct sv_hasher_chunks_context
+{
+    sv_hasher *self;
+    sv_chunker *chunker;
+} sv_hasher_chunks_context;
+
+static check_result sv_hasher_chunks_fn(
+    void *context, uint64_t offset, const byte *data, uint32_t len)
+{
+    (void)offset;
+    sv_hasher_chunks_context *ctx = (sv_hasher_chunks_context *)context;
+    sv_contenthash_update(&ctx->self->state, data, len);
+    sv_chunker_update(ctx->chunker, data, len);
+    return OK;
+}
+
+/* hash the whole file and each of its chunks in one read. the whole-file
+crc32 is assembled from the chunks' crcs instead of being computed twice. */
+check_result hash_of_file_and_chunks(os_lockedfilehandle *handle,
+    uint32_t algorithm, uint32_t readengine, uint64_t avgchunksize,
+    hash256 *out_hash, uint32_t *outcrc32, sv_array *chunks)
+{
+    sv_result currenterr = {};
+    sv_chunker chunker = {};
+    sv_hasher hasher =
+        sv_hasher_open(cstr(handle->loggingcontext), algorithm, readengine);
+    sv_hasher_chunks_context ctx = {&hasher, &chunker};
+    *out_hash = hash256zeros;
+    *outcrc32 = 0;
+    sv_chunker_init(&chunker, algorithm, avgchunksize, chunks);
+    sv_contenthash_init(&hasher.state, algorithm);
+    check(sv_hasher_each(&hasher, handle->fd, &sv_hasher_chunks_fn, &ctx));
+    sv_chunker_final(&chunker);
+    sv_contenthash_final(&hasher.state, out_hash);
+    for (uint32_t i = 0; i < chunks->length; i++)
     {
-        /* normal hash of the bytes on disk */
-        check(sv_hasher_wholefile(&hasher, handle->fd, out_hash, outcrc32));
+        const sv_chunk *chunk = (const sv_chunk *)sv_array_at(chunks, i);
+        *outcrc32 = sv_crc32_combine(*outcrc32, chunk->crc32, chunk->length);
     }
 
 cleanup:
@@ -399,7 +2183,7 @@ check_result sv_basic_crc32_wholefile(const char *file, uint32_t *crc32)
             break;
         }
 
-        *crc32 = Crc32_ComputeBuf(*crc32, buf, cast64u32s(amtread));
+        *crc32 = sv_crc32(*crc32, buf, amtread);
     }
 
 cleanup:
@@ -462,7 +2246,8 @@ check_result get_file_checksum_string(const char *path, bstring s)
     uint64_t filesize = os_getfilesize(path);
     os_lockedfilehandle handle = {};
     check(os_lockedfilehandle_open(&handle, path, true, NULL));
-    check(hash_of_file(&handle, 0, filetype_binary, "", &hash, &crc));
+    check(hash_of_file(&handle, 0, filetype_binary, sv_hashalgorithm_spooky,
+        sv_readengine_read, &hash, &crc));
     bstrclear(s);
     hash256tostr(&hash, s);
     bformata(s, ",crc32-%08X,size-%llu", crc, filesize);
@@ -472,41 +2257,6 @@ cleanup:
     return currenterr;
 }
 
-check_result check_ffmpeg_works(
-    ar_util *ar, uint32_t useffmpeg, const char *tmpdir)
-{
-    sv_result currenterr = {};
-    hash256 hash = {};
-    sv_result res = {};
-    bstring path = bformat("%s%stest.mp3", tmpdir, pathsep);
-    if (useffmpeg)
-    {
-        check_fatal(tmpdir, "null ptr");
-        check_b(os_create_dirs(tmpdir), "could not create %s", tmpdir);
-        check(writevalidmp3(cstr(path), false, false, false));
-        const char *msg =
-            "\n\nWe were not able to verify that ffmpeg "
-            "is installed. Possible reasons: 1) ffmpeg is not correctly "
-            "installed \n2) an incompatable version of ffmpeg is installed\n"
-            "To continue without using this feature, go to 'Edit Group' "
-            "and turn off the 'separate audio metadata' feature.\n\n";
-        res = get_audio_hash_without_tags(
-            cstr(ar->audiotag_binary), cstr(path), &hash);
-
-        check_b(res.code == 0, "%s. %s", msg, cstr(res.msg));
-        check_b(hash.data[0] == 0x611c9c9e3d1e62ccULL &&
-                hash.data[1] == 0x1ffaa7d05b187124ULL && hash.data[2] == 0 &&
-                hash.data[3] == 0,
-            "%llx %llx\nhashes not equal. %s", castull(hash.data[0]),
-            castull(hash.data[1]), msg);
-    }
-
-cleanup:
-    sv_result_close(&res);
-    bdestroy(path);
-    return currenterr;
-}
-
 void get_tar_version_from_string(bstring s, double *version)
 {
     *version = 0.0;
@@ -550,8 +2300,7 @@ cleanup:
 }
 
 #ifdef __linux__
-check_result checkbinarypaths(
-    ar_util *ar, uint32_t useffmpeg, const char *temp_path)
+check_result checkbinarypaths(ar_util *ar)
 {
     sv_result currenterr = {};
     check(os_binarypath("xz", ar->xz_binary));
@@ -565,28 +2314,12 @@ check_result checkbinarypaths(
         "We are not able to "
         "continue. This program requires GNU 'tar'.");
     check(verify_tar_version(ar));
-    if (useffmpeg)
-    {
-        /* example instructions for mint/ubuntu
-            cat /etc/os-release, see that we are on ubuntu 14.04
-            name for this version is 'trusty'
-            sudo apt-add-repository ppa:mc3man/trusty-media
-            sudo apt-get update
-            sudo apt-get install ffmpeg */
-        check(os_binarypath("ffmpeg", ar->audiotag_binary));
-        check_b(os_file_exists(cstr(ar->audiotag_binary)),
-            "When the use_ffmpeg feature is used, ffmpeg is needed. "
-            "Please either install ffmpeg or disable the "
-            "'Skip metadata changes' feature (under Edit Group).");
-        check(check_ffmpeg_works(ar, useffmpeg, temp_path));
-    }
 
 cleanup:
     return currenterr;
 }
 #else
-check_result checkbinarypaths(
-    ar_util *ar, uint32_t useffmpeg, const char *temp_path)
+check_result checkbinarypaths(ar_util *ar)
 {
     sv_result currenterr = {};
     bstring dir = os_getthisprocessdir();
@@ -621,17 +2354,6 @@ check_result checkbinarypaths(
         "We were not able to find the program 'tools\\xz.exe'");
     check(verify_tar_version(ar));
 
-    if (useffmpeg)
-    {
-        bsetfmt(ar->audiotag_binary, "%s%sffmpeg.exe", cstr(tools), pathsep);
-        check_b(os_file_exists(cstr(ar->audiotag_binary)),
-            "We were not "
-            "able to find tools\\ffmpeg.exe. Please either download "
-            "ffmpeg.exe and place it in the tools directory, or disable "
-            "the 'Skip metadata changes' feature (under Edit Group).");
-        check(check_ffmpeg_works(ar, useffmpeg, temp_path));
-    }
-
 cleanup:
     bdestroy(dir);
     bdestroy(tools);
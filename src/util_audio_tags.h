@@ -17,14 +17,77 @@ GNU General Public License for more details.
 
 #include "util_archiver.h"
 
+typedef enum sv_hashalgorithm
+{
+    sv_hashalgorithm_spooky = 0,
+    sv_hashalgorithm_spookytree,
+    sv_hashalgorithm_count,
+} sv_hashalgorithm;
+
+/* a content hash computed incrementally. for sv_hashalgorithm_spookytree the
+input is cut into SvTreeHashLeafSize leaves that are hashed independently,
+and the root hashes the list of leaf hashes, so that the leaves of one large
+file can be hashed on several threads. */
+typedef struct sv_contenthash
+{
+    uint32_t algorithm;
+    spooky_state state;
+    spooky_state leaf;
+    uint64_t leafindex;
+    uint64_t leaffill;
+    uint64_t length;
+} sv_contenthash;
+
+/* how sv_hasher reads a file. sv_readengine_mmap maps large files with
+MADV_SEQUENTIAL and drops each part from the page cache once it is hashed, so
+that backing up a server doesn't evict the working set of its other
+processes. on Windows both engines read() through a buffer. */
+typedef enum sv_readengine
+{
+    sv_readengine_read = 0,
+    sv_readengine_mmap,
+    sv_readengine_count,
+} sv_readengine;
+
 typedef struct sv_hasher
 {
     byte *buf;
     uint32_t buflen32u;
-    spooky_state state;
+    uint32_t algorithm;
+    uint32_t readengine;
+    sv_contenthash state;
     const char *loggingcontext;
 } sv_hasher;
 
+/* one piece of a file cut by sv_chunker */
+typedef struct sv_chunk
+{
+    uint64_t offset;
+    uint64_t length;
+    hash256 hash;
+    uint32_t crc32;
+} sv_chunk;
+
+/* content-defined chunking in the style of FastCDC. a gear hash is rolled
+over the data and a chunk ends where its top bits are all zero, so that
+inserting bytes near the start of a file only changes the chunks around the
+insertion and the rest still match what is already in the archives. */
+typedef struct sv_chunker
+{
+    uint64_t gear[256];
+    uint64_t minsize;
+    uint64_t avgsize;
+    uint64_t maxsize;
+    uint64_t maskstrict;
+    uint64_t maskloose;
+    uint64_t fingerprint;
+    uint64_t start;
+    uint64_t fill;
+    uint32_t crc32;
+    sv_contenthash state;
+    sv_array *chunks;
+} sv_chunker;
+
 typedef enum efiletype
 {
     filetype_none = 0,
@@ -36,21 +99,87 @@ typedef enum efiletype
     filetype_binary,
 } efiletype;
 
+/* what sampling has found for each extension, see
+sv_compress_classifier_run */
+typedef struct sv_extension_stats
+{
+    uint32_t ext;
+    uint32_t compressible;
+    uint32_t incompressible;
+} sv_extension_stats;
+
+typedef struct sv_compress_classifier
+{
+    os_mutex mutex;
+    sv_array stats;
+    uint64_t sampled;
+    uint64_t routed;
+    bool isopen;
+} sv_compress_classifier;
+
 extern uint64_t SvdpHashSeed1;
 extern uint64_t SvdpHashSeed2;
+extern const uint64_t SvTreeHashLeafSize;
+extern const uint64_t SvChunkAvgSize;
 efiletype get_file_extension_info(const char *filename, int len);
 void adjustfilesize_if_audio_file(uint32_t separatemetadata, efiletype ext,
     uint64_t size_from_disk, uint64_t *outputsize);
-check_result checkbinarypaths(
-    ar_util *ar, uint32_t separatemetadata, const char *temp_path);
-bool readhash(const char *stdout_from_proc, hash256 *out_hash);
+check_result checkbinarypaths(ar_util *ar);
 check_result hash_of_file(os_lockedfilehandle *handle, uint32_t separateaudio,
-    efiletype ext, const char *metadatabinary, hash256 *out_hash,
+    efiletype ext, uint32_t algorithm, uint32_t readengine, hash256 *out_hash,
     uint32_t *outcrc32);
+check_result hash_of_file_and_compress(os_lockedfilehandle *handle,
+    ar_encoder *enc, uint32_t codec, uint32_t level, const char *outpath,
+    uint32_t algorithm, uint32_t readengine, hash256 *out_hash,
+    uint32_t *outcrc32, uint64_t *compressedsize);
+check_result hash_of_file_and_chunks(os_lockedfilehandle *handle,
+    uint32_t algorithm, uint32_t readengine, uint64_t avgchunksize,
+    hash256 *out_hash, uint32_t *outcrc32, sv_array *chunks);
+check_result hash_of_file_and_prefix(os_lockedfilehandle *handle,
+    uint32_t algorithm, uint32_t readengine, uint64_t prefixlength,
+    hash256 *out_prefixhash, hash256 *out_hash, uint32_t *outcrc32,
+    uint32_t *outtailcrc32);
+void sv_chunker_init(sv_chunker *self, uint32_t algorithm,
+    uint64_t avgchunksize, sv_array *chunks);
+void sv_chunker_update(sv_chunker *self, const byte *data, uint64_t len);
+void sv_chunker_final(sv_chunker *self);
+void sv_contenthash_init(sv_contenthash *self, uint32_t algorithm);
+void sv_contenthash_update(sv_contenthash *self, const void *buf, uint64_t len);
+void sv_contenthash_final(sv_contenthash *self, hash256 *hash);
+void sv_contenthash_benchmark(uint32_t megabytes);
+sv_hasher sv_hasher_open(
+    const char *loggingcontext, uint32_t algorithm, uint32_t readengine);
+void sv_hasher_close(sv_hasher *self);
+check_result sv_hasher_wholefile(
+    sv_hasher *self, int fd, hash256 *hash, uint32_t *crc32);
+check_result sv_hasher_benchmark(const char *dir, uint32_t megabytes);
+check_result sv_hasher_tree_parallel(sv_hasher *self, int fd,
+    uint64_t filesize, uint32_t threads, hash256 *hash, uint32_t *crc32);
+typedef enum sv_crc32_kernel
+{
+    sv_crc32_kernel_bytewise,
+    sv_crc32_kernel_slice8,
+    sv_crc32_kernel_slice16,
+    sv_crc32_kernel_clmul,
+    sv_crc32_kernel_count,
+} sv_crc32_kernel;
+
+uint32_t sv_crc32(uint32_t incrc32, const void *buf, uint64_t len);
+uint32_t sv_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+uint32_t sv_crc32_kernel_run(
+    sv_crc32_kernel kernel, uint32_t incrc32, const void *buf, uint64_t len);
+bool sv_crc32_kernel_supported(sv_crc32_kernel kernel);
+const char *sv_crc32_kernel_name(sv_crc32_kernel kernel);
+void sv_crc32_benchmark(uint32_t megabytes);
+void sv_compress_classifier_init(sv_compress_classifier *self);
+void sv_compress_classifier_close(sv_compress_classifier *self);
+void sv_compress_classifier_load(
+    sv_compress_classifier *self, const bstrlist *saved);
+void sv_compress_classifier_save(sv_compress_classifier *self, bstrlist *out);
+check_result sv_compress_classifier_run(sv_compress_classifier *self,
+    const char *path, int fd, uint64_t filesize, bool *incompressible);
 check_result sv_basic_crc32_wholefile(const char *file, uint32_t *crc32);
 check_result get_file_checksum_string(const char *filepath, bstring s);
-check_result check_ffmpeg_works(
-    ar_util *ar, uint32_t separatemetadata, const char *tmpdir);
 check_result writevalidmp3(
     const char *path, bool changeid3, bool changeid3length, bool changedata);
 
@@ -18,6 +18,14 @@ GNU General Public License for more details.
 uint32_t max_tries = 10;
 uint32_t sleep_between_tries = 500;
 
+/* processes started by the calling thread, so that a caller can see how many
+were launched during a phase of its work */
+static _Thread_local uint64_t os_run_process_launched;
+uint64_t os_run_process_count(void)
+{
+    return os_run_process_launched;
+}
+
 #if __linux__
 #include <sys/sendfile.h>
 #include <sys/wait.h>
@@ -249,8 +257,16 @@ check_result os_lockedfilehandle_open(os_lockedfilehandle *self,
         *filenotfound = false;
     }
 
+    /* reading the file shouldn't cost a write to update its access time.
+    only the owner may ask for that, so try again without it. */
     errno = 0;
-    self->fd = open(path, O_RDONLY | O_BINARY);
+    self->fd = open(path, O_RDONLY | O_BINARY | O_NOATIME);
+    if (self->fd < 0 && errno == EPERM)
+    {
+        errno = 0;
+        self->fd = open(path, O_RDONLY | O_BINARY);
+    }
+
     if (self->fd < 0 && errno == ENOENT && !os_file_exists(path) && filenotfound)
     {
         set_self_zero();
@@ -289,6 +305,44 @@ cleanup:
     return currenterr;
 }
 
+static void os_get_identity(const struct stat64 *st, os_file_identity *identity)
+{
+    identity->device = (uint64_t)st->st_dev;
+    identity->inode = (uint64_t)st->st_ino;
+    identity->modtime_ns = (uint64_t)st->st_mtim.tv_sec * 1000000000ULL +
+        (uint64_t)st->st_mtim.tv_nsec;
+}
+
+check_result os_lockedfilehandle_identity(
+    os_lockedfilehandle *self, os_file_identity *identity)
+{
+    sv_result currenterr = {};
+    struct stat64 st = {};
+    check_errno(fstat64(self->fd, &st), cstr(self->loggingcontext));
+    os_get_identity(&st, identity);
+
+cleanup:
+    return currenterr;
+}
+
+/* evict the file from the page cache once we're done with it */
+void os_lockedfilehandle_dropcache(os_lockedfilehandle *self)
+{
+    if (self->fd > 0)
+    {
+        (void)posix_fadvise64(self->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+}
+
+/* whether the file has holes, that is, fewer blocks allocated than its size
+needs. restore recreates holes only in the files that had them. */
+bool os_lockedfilehandle_sparse(os_lockedfilehandle *self)
+{
+    struct stat64 st = {};
+    return self->fd > 0 && fstat64(self->fd, &st) == 0 &&
+        cast64s64u(st.st_blocks) * 512 < cast64s64u(st.st_size);
+}
+
 bool os_setcwd(const char *s)
 {
     int ret = 0;
@@ -466,12 +520,18 @@ void os_init(void)
     /* not needed in linux */
 }
 
-void os_get_permissions(const struct stat64 *st, bstring permissions)
+static void os_format_permissions(
+    uint32_t mode, uint32_t gid, uint32_t uid, bstring permissions)
 {
     /* don't save the type-of-file */
-    mode_t permissions_only = st->st_mode & 0x0fff;
-    bsetfmt(permissions, "p%x|g%x|u%x", (uint32_t)permissions_only,
-        (uint32_t)st->st_gid, (uint32_t)st->st_uid);
+    uint32_t permissions_only = mode & 0x0fff;
+    bsetfmt(permissions, "p%x|g%x|u%x", permissions_only, gid, uid);
+}
+
+void os_get_permissions(const struct stat64 *st, bstring permissions)
+{
+    os_format_permissions((uint32_t)st->st_mode, (uint32_t)st->st_gid,
+        (uint32_t)st->st_uid, permissions);
 }
 
 check_result os_set_permissions(const char *filepath, const bstring permissions)
@@ -559,164 +619,666 @@ bool os_try_set_readable(const char *filepath, bool setreadable)
     return false;
 }
 
-static check_result os_recurse_impl_dir(os_recurse_params *params,
-    bstrlist *dirs, bool *retriable_err, bstring currentdir, bstring tmpfullpath,
-    bstring permissions)
+typedef enum os_recurse_entry_kind
+{
+    os_recurse_entry_file = 0,
+    os_recurse_entry_dir,
+    os_recurse_entry_symlink,
+    os_recurse_entry_statfailed,
+} os_recurse_entry_kind;
+
+/* the name is kept at nameoffset in the node's names buffer; the full path
+is only built when the entry is delivered. */
+typedef struct os_recurse_entry
+{
+    uint32_t nameoffset;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint64_t modtime;
+    uint64_t size;
+    os_file_identity identity;
+    os_recurse_entry_kind kind;
+} os_recurse_entry;
+
+typedef enum os_recurse_node_state
+{
+    os_recurse_node_queued = 0,
+    os_recurse_node_listing,
+    os_recurse_node_listed,
+} os_recurse_node_state;
+
+struct os_recurse_deque;
+
+/* one directory. its entries are listed on any thread, but are delivered to
+the callback only on the thread that called os_recurse. */
+typedef struct os_recurse_node
+{
+    bstring path;
+    int depth;
+    os_recurse_node_state state;
+    sv_array entries;
+    bstring names;
+    sv_array children;
+    sv_result error;
+    struct os_recurse_deque *deque;
+} os_recurse_node;
+
+typedef struct os_recurse_deque
+{
+    sv_array nodes;
+    uint32_t head;
+} os_recurse_deque;
+
+struct os_recurse_walker;
+typedef struct os_recurse_worker
+{
+    struct os_recurse_walker *walker;
+    os_recurse_deque deque;
+    os_thread thread;
+} os_recurse_worker;
+
+/* each worker lists directories from the bottom of its own deque, pushing
+the subdirectories it finds, and steals from the top of the others' deques
+when its own is empty. callbacks are made in the same order as a
+single-threaded depth-first walk. */
+typedef struct os_recurse_walker
+{
+    os_recurse_params *params;
+    os_mutex mutex;
+    os_cond cond_work;
+    os_cond cond_listed;
+    os_recurse_worker *workers;
+    uint32_t threadsstarted;
+    uint32_t nextdeque;
+    uint64_t buffered;
+    bool stopping;
+    sv_array stack;
+} os_recurse_walker;
+
+/* stop listing ahead when this many entries are waiting to be delivered */
+const uint64_t os_recurse_max_buffered = 256 * 1024;
+
+/* read this much of a directory per getdents64 call */
+const uint32_t os_recurse_direntbuf_len = 256 * 1024;
+
+static os_recurse_node *os_recurse_node_open(const char *path, int depth)
+{
+    os_recurse_node *node =
+        (os_recurse_node *)sv_calloc(1, sizeof32u(os_recurse_node));
+    node->path = bfromcstr(path);
+    node->depth = depth;
+    node->entries = sv_array_open(sizeof32u(os_recurse_entry), 0);
+    node->names = bstring_open();
+    node->children = sv_array_open(sizeof32u(os_recurse_node *), 0);
+    return node;
+}
+
+static void os_recurse_node_clear(os_recurse_node *node)
+{
+    sv_array_truncatelength(&node->entries, 0);
+    bstrclear(node->names);
+}
+
+static void os_recurse_node_close(os_recurse_node *node)
+{
+    if (node)
+    {
+        for (uint32_t i = 0; i < node->children.length; i++)
+        {
+            os_recurse_node_close(
+                *(os_recurse_node **)sv_array_at(&node->children, i));
+        }
+
+        os_recurse_node_clear(node);
+        sv_array_close(&node->entries);
+        sv_array_close(&node->children);
+        sv_result_close(&node->error);
+        bdestroy(node->names);
+        bdestroy(node->path);
+        sv_freenull(node);
+    }
+}
+
+static void os_recurse_node_add(os_recurse_node *node,
+    os_recurse_entry_kind kind, const char *name, const struct stat64 *st)
+{
+    os_recurse_entry entry = {};
+    entry.kind = kind;
+    entry.nameoffset = cast32s32u(blength(node->names));
+    entry.modtime = UINT64_MAX;
+    entry.size = UINT64_MAX;
+    if (st)
+    {
+        entry.mode = st->st_mode;
+        entry.uid = st->st_uid;
+        entry.gid = st->st_gid;
+        entry.modtime = cast64s64u(st->st_mtime);
+        entry.size = cast64s64u(st->st_size);
+        os_get_identity(st, &entry.identity);
+    }
+
+    /* keep the terminating zero so that the name can be read in place */
+    bcatblk(node->names, name, strlen32s(name) + 1);
+    sv_array_append(&node->entries, &entry, 1);
+}
+
+static const char *os_recurse_entry_name(
+    const os_recurse_node *node, const os_recurse_entry *entry)
+{
+    return (const char *)node->names->data + entry->nameoffset;
+}
+
+/* stat relative to the open directory, so that the kernel doesn't have to
+walk the full path again for every file. */
+static void os_recurse_impl_entry(os_recurse_node *node, int dirfd,
+    const char *name, unsigned char type)
+{
+    struct stat64 st = {0};
+    if (type == DT_UNKNOWN)
+    {
+        /* some filesystems don't fill in d_type */
+        if (fstatat64(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            return;
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            type = DT_LNK;
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            type = DT_DIR;
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            type = DT_REG;
+        }
+    }
+
+    if (type == DT_LNK)
+    {
+        sv_log_fmt("skipping symlink, %s/%s", cstr(node->path), name);
+        os_recurse_node_add(node, os_recurse_entry_symlink, name, NULL);
+    }
+    else if (type == DT_DIR)
+    {
+        os_recurse_node_add(node, os_recurse_entry_dir, name, NULL);
+    }
+    else if (type == DT_REG)
+    {
+        /* get file info*/
+        errno = 0;
+        int statresult = fstatat64(dirfd, name, &st, 0);
+        if (statresult < 0 && errno == ENOENT)
+        {
+            sv_log_fmt("note, ENOENT seen during iteration %s/%s",
+                cstr(node->path), name);
+        }
+        else if (statresult < 0)
+        {
+            sv_log_fmt("stat failed, %s/%s errno=%d", cstr(node->path), name,
+                errno);
+            os_recurse_node_add(node, os_recurse_entry_statfailed, name, NULL);
+        }
+        else
+        {
+            os_recurse_node_add(node, os_recurse_entry_file, name, &st);
+        }
+    }
+}
+
+static check_result os_recurse_impl_dir(
+    os_recurse_node *node, bool *retriable_err, byte *direntbuf)
 {
     sv_result currenterr = {};
     *retriable_err = false;
-    bstrclear(tmpfullpath);
     errno = 0;
-    DIR *dir = opendir(cstr(currentdir));
-    if (dir == NULL && errno != ENOENT)
+    int dirfd =
+        open(cstr(node->path), O_RDONLY | O_DIRECTORY | O_CLOEXEC | O_NOCTTY);
+    if (dirfd < 0 && errno != ENOENT)
     {
         *retriable_err = true;
         char buf[BUFSIZ] = "";
         os_errno_to_buffer(errno, buf, countof(buf));
-        check_b(0, "Could not list \n%s\ncode %s (%d)", cstr(currentdir), buf,
+        check_b(0, "Could not list \n%s\ncode %s (%d)", cstr(node->path), buf,
             errno);
     }
 
-    while (dir)
+    while (dirfd >= 0)
     {
+        /* read many entries per syscall */
         errno = 0;
-        struct dirent *entry = readdir(dir);
-        if (!entry)
+        ssize_t bytesread =
+            getdents64(dirfd, direntbuf, os_recurse_direntbuf_len);
+        if (bytesread < 0)
         {
-            if (errno != 0)
-            {
-                *retriable_err = true;
-                char buf[BUFSIZ] = "";
-                os_errno_to_buffer(errno, buf, countof(buf));
-                check_b(0,
-                    "Could not continue listing \n%s\n"
-                    "code %s %d",
-                    cstr(currentdir), buf, errno);
-            }
-            break;
+            *retriable_err = true;
+            char buf[BUFSIZ] = "";
+            os_errno_to_buffer(errno, buf, countof(buf));
+            check_b(0,
+                "Could not continue listing \n%s\n"
+                "code %s %d",
+                cstr(node->path), buf, errno);
         }
-        else if (s_equal(".", entry->d_name) || s_equal("..", entry->d_name))
+        else if (bytesread == 0)
         {
-            continue;
+            break;
         }
 
-        bassign(tmpfullpath, currentdir);
-        bstr_catstatic(tmpfullpath, "/");
-        bcatcstr(tmpfullpath, entry->d_name);
-        if (entry->d_type == DT_LNK)
+        for (ssize_t pos = 0; pos < bytesread;)
         {
-            sv_log_fmt("skipping symlink, %s", cstr(tmpfullpath));
-            bstr_catstatic(tmpfullpath, ", skipped symlink");
-            bstrlist_append(params->messages, tmpfullpath);
-        }
-        else if (entry->d_type == DT_DIR)
-        {
-            bstrlist_append(dirs, tmpfullpath);
-            check(params->callback(
-                params->context, tmpfullpath, UINT64_MAX, UINT64_MAX, NULL));
-        }
-        else if (entry->d_type == DT_REG)
-        {
-            /* get file info*/
-            struct stat64 st = {0};
-            errno = 0;
-            int statresult = stat64(cstr(tmpfullpath), &st);
-            if (statresult < 0 && errno == ENOENT)
-            {
-                sv_log_fmt(
-                    "note, ENOENT seen during iteration %s", cstr(tmpfullpath));
-            }
-            else if (statresult < 0)
+            struct dirent64 *entry = (struct dirent64 *)(direntbuf + pos);
+            pos += entry->d_reclen;
+            if (!s_equal(".", entry->d_name) && !s_equal("..", entry->d_name))
             {
-                sv_log_fmt("stat failed, %s errno=%d", cstr(tmpfullpath), errno);
-                bstr_catstatic(tmpfullpath, " could not access stat");
-                bstrlist_append(params->messages, tmpfullpath);
-            }
-            else
-            {
-                os_get_permissions(&st, permissions);
-                check(params->callback(params->context, tmpfullpath,
-                    cast64s64u(st.st_mtime), cast64s64u(st.st_size),
-                    permissions));
+                os_recurse_impl_entry(
+                    node, dirfd, entry->d_name, entry->d_type);
             }
         }
     }
 cleanup:
-    if (dir)
+    if (dirfd >= 0)
     {
-        closedir(dir);
+        close(dirfd);
     }
 
     return currenterr;
 }
 
-check_result os_recurse_impl(os_recurse_params *params, int currentdepth,
-    bstring currentdir, bstring tmpfullpath, bstring permissions)
+/* list a directory, retrying on errors. safe to call from any thread,
+because nothing is sent to the callback yet. */
+static void os_recurse_list_node(
+    os_recurse_walker *walker, os_recurse_node *node, byte *direntbuf)
 {
-    sv_result currenterr = {};
-    sv_result attempt_dir = {};
-    bstrlist *dirs = bstrlist_open();
-    for (int attempt = 0; attempt < max_tries; attempt++)
+    for (uint32_t attempt = 0; attempt < max_tries; attempt++)
     {
-        /* traverse just this directory */
         bool retriable_err = false;
-        sv_result_close(&attempt_dir);
-        attempt_dir = os_recurse_impl_dir(
-            params, dirs, &retriable_err, currentdir, tmpfullpath, permissions);
-        if (!attempt_dir.code || !retriable_err)
+        sv_result_close(&node->error);
+        node->error = os_recurse_impl_dir(node, &retriable_err, direntbuf);
+        if (!node->error.code || !retriable_err)
         {
-            check(attempt_dir);
             break;
         }
-        else
+        else if (attempt + 1 < max_tries)
         {
-            bstrlist_clear(dirs);
+            os_recurse_node_clear(node);
             os_sleep(sleep_between_tries);
         }
     }
 
-    if (attempt_dir.code)
+    /* only make nodes for the subdirectories we'll go into */
+    if (node->depth < walker->params->max_recursion_depth)
     {
-        /* still seeing a retriable_err after max_tries */
-        bstrlist_append(params->messages, attempt_dir.msg);
+        for (uint32_t i = 0; i < node->entries.length; i++)
+        {
+            os_recurse_entry *entry =
+                (os_recurse_entry *)sv_array_at(&node->entries, i);
+            if (entry->kind == os_recurse_entry_dir)
+            {
+                bstring path = bformat("%s/%s/", cstr(node->path),
+                    os_recurse_entry_name(node, entry));
+                if (!walker->params->skipdir ||
+                    !walker->params->skipdir(walker->params->context, path))
+                {
+                    btrunc(path, blength(path) - 1);
+                    os_recurse_node *child =
+                        os_recurse_node_open(cstr(path), node->depth + 1);
+                    sv_array_append(&node->children, &child, 1);
+                }
+
+                bdestroy(path);
+            }
+        }
     }
+}
 
-    /* recurse into subdirectories */
-    if (currentdepth < params->max_recursion_depth)
+static void os_recurse_deque_push(
+    os_recurse_deque *deque, os_recurse_node *node)
+{
+    node->deque = deque;
+    sv_array_append(&deque->nodes, &node, 1);
+}
+
+static void os_recurse_deque_remove(os_recurse_deque *deque, uint32_t index)
+{
+    os_recurse_node **nodes = (os_recurse_node **)sv_array_at(&deque->nodes, 0);
+    nodes[index]->deque = NULL;
+    memmove(&nodes[index], &nodes[index + 1],
+        sizeof(os_recurse_node *) * (deque->nodes.length - index - 1));
+    sv_array_truncatelength(&deque->nodes, deque->nodes.length - 1);
+    if (deque->head >= deque->nodes.length)
     {
-        for (uint32_t i = 0; i < dirs->qty; i++)
+        deque->head = 0;
+        sv_array_truncatelength(&deque->nodes, 0);
+    }
+}
+
+/* called with the lock held. the newest node is taken from our own deque,
+the oldest node from anyone else's. */
+static os_recurse_node *os_recurse_take_work(
+    os_recurse_walker *walker, os_recurse_deque *own)
+{
+    if (walker->buffered >= os_recurse_max_buffered)
+    {
+        return NULL;
+    }
+    else if (own->nodes.length > own->head)
+    {
+        os_recurse_node *node = *(os_recurse_node **)sv_array_at(
+            &own->nodes, own->nodes.length - 1);
+        os_recurse_deque_remove(own, own->nodes.length - 1);
+        return node;
+    }
+
+    for (uint32_t i = 0; i < walker->params->threads; i++)
+    {
+        os_recurse_deque *other = &walker->workers[i].deque;
+        if (other->nodes.length > other->head)
         {
-            check(os_recurse_impl(params, currentdepth + 1, dirs->entry[i],
-                tmpfullpath, permissions));
+            os_recurse_node *node =
+                *(os_recurse_node **)sv_array_at(&other->nodes, other->head);
+            other->head++;
+            node->deque = NULL;
+            if (other->head >= other->nodes.length)
+            {
+                other->head = 0;
+                sv_array_truncatelength(&other->nodes, 0);
+            }
+
+            return node;
         }
     }
-    else if (params->max_recursion_depth != 0)
+
+    return NULL;
+}
+
+/* called with the lock held, after a node is listed */
+static void os_recurse_finish_listing(
+    os_recurse_walker *walker, os_recurse_node *node, os_recurse_deque *own)
+{
+    walker->buffered += node->entries.length;
+    if (walker->params->threads)
     {
-        check_b(0, "recursion limit reached in dir %s", cstr(currentdir));
+        /* push in reverse so that the first subdirectory is listed next,
+        which is also the next one the callback will want. */
+        os_recurse_deque *deque =
+            own ? own : &walker->workers[walker->nextdeque].deque;
+        walker->nextdeque = (walker->nextdeque + 1) % walker->params->threads;
+        for (uint32_t i = node->children.length; i > 0; i--)
+        {
+            os_recurse_deque_push(deque,
+                *(os_recurse_node **)sv_array_at(&node->children, i - 1));
+        }
+    }
+
+    node->state = os_recurse_node_listed;
+    os_cond_broadcast(&walker->cond_listed);
+    os_cond_broadcast(&walker->cond_work);
+}
+
+static void os_recurse_worker_thread(void *context)
+{
+    os_recurse_worker *worker = (os_recurse_worker *)context;
+    os_recurse_walker *walker = worker->walker;
+    byte *direntbuf = sv_calloc(1, os_recurse_direntbuf_len);
+    os_mutex_lock(&walker->mutex);
+    while (!walker->stopping)
+    {
+        os_recurse_node *node = os_recurse_take_work(walker, &worker->deque);
+        if (!node)
+        {
+            os_cond_wait(&walker->cond_work, &walker->mutex);
+            continue;
+        }
+
+        node->state = os_recurse_node_listing;
+        os_mutex_unlock(&walker->mutex);
+        os_recurse_list_node(walker, node, direntbuf);
+        os_mutex_lock(&walker->mutex);
+        os_recurse_finish_listing(walker, node, &worker->deque);
+    }
+
+    os_mutex_unlock(&walker->mutex);
+    sv_freenull(direntbuf);
+}
+
+static check_result os_recurse_walker_start(
+    os_recurse_walker *walker, os_recurse_params *params)
+{
+    sv_result currenterr = {};
+    walker->params = params;
+    walker->stack = sv_array_open(sizeof32u(os_recurse_node *), 0);
+    os_mutex_init(&walker->mutex);
+    os_cond_init(&walker->cond_work);
+    os_cond_init(&walker->cond_listed);
+    os_recurse_node *root = os_recurse_node_open(params->root, 0);
+    sv_array_append(&walker->stack, &root, 1);
+    check_b(os_isabspath(params->root), "expected full path but got %s",
+        params->root);
+
+    walker->workers = (os_recurse_worker *)sv_calloc(
+        MAX(1, params->threads), sizeof32u(os_recurse_worker));
+    for (uint32_t i = 0; i < params->threads; i++)
+    {
+        walker->workers[i].walker = walker;
+        walker->workers[i].deque.nodes =
+            sv_array_open(sizeof32u(os_recurse_node *), 0);
+    }
+
+    if (params->threads)
+    {
+        os_recurse_deque_push(&walker->workers[0].deque, root);
+    }
+
+    for (uint32_t i = 0; i < params->threads; i++)
+    {
+        check(os_thread_start(&walker->workers[i].thread,
+            &os_recurse_worker_thread, &walker->workers[i]));
+        walker->threadsstarted++;
     }
 
 cleanup:
-    bstrlist_close(dirs);
     return currenterr;
 }
 
-check_result os_recurse(os_recurse_params *params)
+static void os_recurse_walker_close(os_recurse_walker *walker)
+{
+    if (walker && walker->params)
+    {
+        os_mutex_lock(&walker->mutex);
+        walker->stopping = true;
+        os_cond_broadcast(&walker->cond_work);
+        os_mutex_unlock(&walker->mutex);
+        for (uint32_t i = 0; i < walker->threadsstarted; i++)
+        {
+            os_thread_join(&walker->workers[i].thread);
+        }
+
+        for (uint32_t i = 0; walker->workers && i < walker->params->threads;
+             i++)
+        {
+            sv_array_close(&walker->workers[i].deque.nodes);
+        }
+
+        /* every node is reachable from the stack */
+        for (uint32_t i = 0; i < walker->stack.length; i++)
+        {
+            os_recurse_node_close(
+                *(os_recurse_node **)sv_array_at(&walker->stack, i));
+        }
+
+        sv_array_close(&walker->stack);
+        sv_freenull(walker->workers);
+        os_cond_close(&walker->cond_work);
+        os_cond_close(&walker->cond_listed);
+        os_mutex_close(&walker->mutex);
+        memset(walker, 0, sizeof(*walker));
+    }
+}
+
+/* get the next directory in depth-first order, listing it here if no worker
+has started on it, so that we never wait on a worker that's held back. */
+static void os_recurse_walker_next(
+    os_recurse_walker *walker, os_recurse_node *node, byte *direntbuf)
+{
+    os_mutex_lock(&walker->mutex);
+    if (node->state == os_recurse_node_queued)
+    {
+        if (node->deque)
+        {
+            os_recurse_deque *deque = node->deque;
+            for (uint32_t i = deque->head; i < deque->nodes.length; i++)
+            {
+                if (*(os_recurse_node **)sv_array_at(&deque->nodes, i) == node)
+                {
+                    os_recurse_deque_remove(deque, i);
+                    break;
+                }
+            }
+        }
+
+        node->state = os_recurse_node_listing;
+        os_mutex_unlock(&walker->mutex);
+        os_recurse_list_node(walker, node, direntbuf);
+        os_mutex_lock(&walker->mutex);
+        os_recurse_finish_listing(walker, node, NULL);
+    }
+
+    while (node->state != os_recurse_node_listed)
+    {
+        os_cond_wait(&walker->cond_listed, &walker->mutex);
+    }
+
+    walker->buffered -= node->entries.length;
+    os_cond_broadcast(&walker->cond_work);
+    os_mutex_unlock(&walker->mutex);
+}
+
+static check_result os_recurse_walker_run(os_recurse_walker *walker)
 {
     sv_result currenterr = {};
-    bstring currentdir = bfromcstr(params->root);
+    os_recurse_params *params = walker->params;
+    os_recurse_node *node = NULL;
+    byte *direntbuf = sv_calloc(1, os_recurse_direntbuf_len);
     bstring tmpfullpath = bstring_open();
     bstring permissions = bstring_open();
-    check_b(os_isabspath(params->root), "expected full path but got %s",
-        params->root);
-    check(os_recurse_impl(params, 0, currentdir, tmpfullpath, permissions));
+    while (walker->stack.length)
+    {
+        node = *(os_recurse_node **)sv_array_at(
+            &walker->stack, walker->stack.length - 1);
+        sv_array_truncatelength(&walker->stack, walker->stack.length - 1);
+        os_recurse_walker_next(walker, node, direntbuf);
+        for (uint32_t i = 0; i < node->entries.length; i++)
+        {
+            os_recurse_entry *entry =
+                (os_recurse_entry *)sv_array_at(&node->entries, i);
+            bassign(tmpfullpath, node->path);
+            bstr_catstatic(tmpfullpath, "/");
+            bcatcstr(tmpfullpath, os_recurse_entry_name(node, entry));
+            if (entry->kind == os_recurse_entry_symlink)
+            {
+                bstr_catstatic(tmpfullpath, ", skipped symlink");
+                bstrlist_append(params->messages, tmpfullpath);
+            }
+            else if (entry->kind == os_recurse_entry_statfailed)
+            {
+                bstr_catstatic(tmpfullpath, " could not access stat");
+                bstrlist_append(params->messages, tmpfullpath);
+            }
+            else if (entry->kind == os_recurse_entry_dir)
+            {
+                check(params->callback(params->context, tmpfullpath,
+                    entry->modtime, entry->size, NULL));
+            }
+            else
+            {
+                os_format_permissions(
+                    entry->mode, entry->gid, entry->uid, permissions);
+                if (params->identity)
+                {
+                    *params->identity = entry->identity;
+                }
+
+                check(params->callback(params->context, tmpfullpath,
+                    entry->modtime, entry->size, permissions));
+            }
+        }
+
+        if (node->error.code)
+        {
+            /* still seeing a retriable_err after max_tries */
+            bstrlist_append(params->messages, node->error.msg);
+        }
+
+        /* recurse into subdirectories */
+        if (node->depth < params->max_recursion_depth)
+        {
+            for (uint32_t i = node->children.length; i > 0; i--)
+            {
+                sv_array_append(&walker->stack,
+                    sv_array_at(&node->children, i - 1), 1);
+            }
+
+            sv_array_truncatelength(&node->children, 0);
+        }
+        else if (params->max_recursion_depth != 0)
+        {
+            check_b(0, "recursion limit reached in dir %s", cstr(node->path));
+        }
+
+        os_recurse_node_close(node);
+        node = NULL;
+    }
 
 cleanup:
-    bdestroy(currentdir);
+    if (node)
+    {
+        /* its children may still be queued or being listed on a worker, so
+        leave the node on the stack for os_recurse_walker_close to free
+        after the workers have been joined. */
+        sv_array_append(&walker->stack, &node, 1);
+    }
+
+    sv_freenull(direntbuf);
     bdestroy(tmpfullpath);
     bdestroy(permissions);
     return currenterr;
 }
 
+check_result os_recurse_many(os_recurse_params *params, uint32_t count)
+{
+    sv_result currenterr = {};
+    os_recurse_walker *walkers =
+        (os_recurse_walker *)sv_calloc(count, sizeof32u(os_recurse_walker));
+
+    /* start walking every root at once, but deliver them one at a time */
+    for (uint32_t i = 0; i < count; i++)
+    {
+        check(os_recurse_walker_start(&walkers[i], &params[i]));
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        check(os_recurse_walker_run(&walkers[i]));
+        os_recurse_walker_close(&walkers[i]);
+    }
+
+cleanup:
+    for (uint32_t i = 0; i < count; i++)
+    {
+        os_recurse_walker_close(&walkers[i]);
+    }
+
+    sv_freenull(walkers);
+    return currenterr;
+}
+
+check_result os_recurse(os_recurse_params *params)
+{
+    return os_recurse_many(params, 1);
+}
+
 void os_run_process_child(const char *path, const char *const args[],
     const char *stdout_to_file, int child_to_parent[2], int *rcode)
 {
@@ -816,10 +1378,13 @@ check_result os_run_process(const char *path, const char *const args[],
         path);
     check_b(os_file_exists(path),
         "os_run_process needs existing file but given %s.", path);
-    check_errno(pipe(child_to_parent));
+    /* O_CLOEXEC so that a process started concurrently by another thread
+    doesn't inherit our pipe and hold it open. dup2 in the child clears it. */
+    check_errno(pipe2(child_to_parent, O_CLOEXEC));
     int forkresult = 0;
     log_errno_to(forkresult, fork());
     check_b(forkresult >= 0, "fork()");
+    pid = forkresult;
     if (forkresult == 0)
     {
         /* child */
@@ -834,6 +1399,7 @@ check_result os_run_process(const char *path, const char *const args[],
     {
         /* parent */
         int status = -1;
+        os_run_process_launched++;
 
         /* need to waitpid() before going to cleanup and closing handles. */
         sv_result r =
@@ -1166,6 +1732,37 @@ cleanup:
     return currenterr;
 }
 
+check_result os_lockedfilehandle_identity(
+    os_lockedfilehandle *self, os_file_identity *identity)
+{
+    sv_result currenterr = {};
+    BY_HANDLE_FILE_INFORMATION info = {0};
+    BOOL ret = FALSE;
+    log_win32_to(ret, GetFileInformationByHandle(self->os_handle, &info),
+        FALSE, cstr(self->loggingcontext));
+    check_b(ret, "GetFileInformationByHandle");
+    identity->device = info.dwVolumeSerialNumber;
+    identity->inode = make_u64(info.nFileIndexHigh, info.nFileIndexLow);
+    identity->modtime_ns = 100 *
+        make_u64(info.ftLastWriteTime.dwHighDateTime,
+            info.ftLastWriteTime.dwLowDateTime);
+
+cleanup:
+    return currenterr;
+}
+
+void os_lockedfilehandle_dropcache(unused_ptr(os_lockedfilehandle))
+{
+    /* windows has no way to evict one file, but background mode already
+    gives the thread's reads a low memory priority */
+}
+
+bool os_lockedfilehandle_sparse(unused_ptr(os_lockedfilehandle))
+{
+    /* restore doesn't make sparse files on windows */
+    return false;
+}
+
 bool os_setcwd(const char *s)
 {
     sv_wstr ws = sv_wstr_widen(s);
@@ -1409,9 +2006,17 @@ static check_result os_recurse_impl_dir(os_recurse_params *params,
             wcscmp(L"..", found.cFileName) != 0)
         {
             /* add to a list of directories */
-            sv_wstr dirpath = sv_wstr_open(PATH_MAX);
-            sv_wstr_append(&dirpath, wpcstr(tmpfullpath));
-            sv_array_append(w_dirs, (const byte *)&dirpath, 1);
+            bstr_catstatic(tmpfullpath_utf8, "\\");
+            bool skip = params->skipdir &&
+                params->skipdir(params->context, tmpfullpath_utf8);
+            btrunc(tmpfullpath_utf8, blength(tmpfullpath_utf8) - 1);
+            if (!skip)
+            {
+                sv_wstr dirpath = sv_wstr_open(PATH_MAX);
+                sv_wstr_append(&dirpath, wpcstr(tmpfullpath));
+                sv_array_append(w_dirs, (const byte *)&dirpath, 1);
+            }
+
             check(params->callback(params->context, tmpfullpath_utf8, UINT64_MAX,
                 UINT64_MAX, NULL));
         }
@@ -1422,6 +2027,12 @@ static check_result os_recurse_impl_dir(os_recurse_params *params,
                 found.ftLastWriteTime.dwLowDateTime);
             uint64_t filesize =
                 make_u64(found.nFileSizeHigh, found.nFileSizeLow);
+            if (params->identity)
+            {
+                /* listing a directory doesn't give the file index */
+                memset(params->identity, 0, sizeof(*params->identity));
+            }
+
             check(params->callback(
                 params->context, tmpfullpath_utf8, modtime, filesize, 0));
         }
@@ -1525,6 +2136,19 @@ cleanup:
     return currenterr;
 }
 
+check_result os_recurse_many(os_recurse_params *params, uint32_t count)
+{
+    /* not yet parallel on windows, params->threads is ignored */
+    sv_result currenterr = {};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        check(os_recurse(&params[i]));
+    }
+
+cleanup:
+    return currenterr;
+}
+
 check_result os_run_process(const char *path, const char *const args[],
     bstring output, bstring useargscombined, bool fastjoinargs,
     const char *stdout_to_file, os_lockedfilehandle *providestdin, int *retcode)
@@ -1600,6 +2224,7 @@ check_result os_run_process(const char *path, const char *const args[],
     }
 
     bstrclear(output);
+    os_run_process_launched++;
     check_win32(BOOL,
         CreateProcessW(NULL,
             (wchar_t *)wcstr(argscombined), /* must be writable */
@@ -31,6 +31,16 @@ typedef struct os_lockedfilehandle
     int fd;
 } os_lockedfilehandle;
 
+/* tells a file apart from other files wherever it is. hard links to a file
+share its identity, and a file keeps its identity when it is renamed or moved
+within the same volume. zero when not known. */
+typedef struct os_file_identity
+{
+    uint64_t device;
+    uint64_t inode;
+    uint64_t modtime_ns;
+} os_file_identity;
+
 void os_lockedfilehandle_close(os_lockedfilehandle *self);
 void os_fd_close(int *fd);
 check_result os_lockedfilehandle_open(os_lockedfilehandle *self,
@@ -39,6 +49,10 @@ check_result os_lockedfilehandle_tryuntil_open(os_lockedfilehandle *self,
     const char *path, bool allowread, bool *filenotfound);
 check_result os_lockedfilehandle_stat(os_lockedfilehandle *self, uint64_t *size,
     uint64_t *modtime, bstring permissions);
+check_result os_lockedfilehandle_identity(
+    os_lockedfilehandle *self, os_file_identity *identity);
+void os_lockedfilehandle_dropcache(os_lockedfilehandle *self);
+bool os_lockedfilehandle_sparse(os_lockedfilehandle *self);
 
 bool os_file_exists(const char *filepath);
 bool os_dir_exists(const char *filepath);
@@ -67,6 +81,8 @@ typedef sv_result (*FnRecurseThroughFilesCallback)(void *context,
     const bstring filepath, uint64_t modtime, uint64_t filesize,
     const bstring permissions);
 
+typedef bool (*FnRecurseSkipDirCallback)(void *context, const bstring dirpath);
+
 typedef struct os_recurse_params
 {
     void *context;
@@ -74,6 +90,18 @@ typedef struct os_recurse_params
     FnRecurseThroughFilesCallback callback;
     int max_recursion_depth;
     bstrlist *messages;
+
+    /* if nonzero, directories are listed ahead on this many threads. the
+    callback is still only called on this thread, in the same order. */
+    uint32_t threads;
+
+    /* optional. if it returns true, the directory is not opened. dirpath
+    ends with a path separator. may be called from any thread. */
+    FnRecurseSkipDirCallback skipdir;
+
+    /* optional. filled in with the identity of each file just before it is
+    passed to the callback, where the platform can tell cheaply. */
+    os_file_identity *identity;
 } os_recurse_params;
 
 struct stat64;
@@ -89,6 +117,7 @@ check_result os_binarypath_impl(
     sv_pseudosplit *spl, const char *binname, bstring out);
 check_result os_set_permissions(const char *filepath, const bstring permissions);
 check_result os_recurse(os_recurse_params *params);
+check_result os_recurse_many(os_recurse_params *params, uint32_t count);
 check_result os_binarypath(const char *binname, bstring out);
 void os_get_permissions(const struct stat64 *st, bstring permissions);
 bool os_try_set_readable(const char *filepath, bool readable);
@@ -103,6 +132,7 @@ check_result os_run_process(const char *path, const char *const args[],
     bstring output, bstring useargscombined, bool fastjoinargs,
     const char *stdout_to_file, os_lockedfilehandle *providestdin,
     int *outretcode);
+uint64_t os_run_process_count(void);
 check_result os_tryuntil_run(const char *path, const char *const args[],
     bstring output, bstring useargscombined, bool fastjoinargs,
     int acceptretcode, const char *stdout_to_file);
@@ -64,6 +64,8 @@ check_result sv_log_open(sv_log *self, const char *dir)
     set_self_zero();
     self->dir = bfromcstr(dir);
     self->cap_filesize = 8 * 1024 * 1024;
+    os_mutex_init(&self->mutex);
+    self->has_mutex = true;
 
     check(
         readlatestnumberfromfilename(dir, "log", ".txt", &self->logfilenumber));
@@ -83,6 +85,11 @@ void sv_log_close(sv_log *self)
     {
         bdestroy(self->dir);
         sv_file_close(&self->logfile);
+        if (self->has_mutex)
+        {
+            os_mutex_close(&self->mutex);
+        }
+
         set_self_zero();
     }
 }
@@ -150,8 +157,10 @@ void sv_log_write(const char *s)
 {
     if (sv_log_currentFile())
     {
+        os_mutex_lock(&p_sv_log->mutex);
         sv_log_addnewline();
         fputs(s, sv_log_currentFile());
+        os_mutex_unlock(&p_sv_log->mutex);
     }
 }
 
@@ -159,10 +168,12 @@ void sv_log_writes(const char *s1, const char *s2)
 {
     if (sv_log_currentFile())
     {
+        os_mutex_lock(&p_sv_log->mutex);
         sv_log_addnewline();
         fputs(s1, sv_log_currentFile());
         fputc(' ', sv_log_currentFile());
         fputs(s2, sv_log_currentFile());
+        os_mutex_unlock(&p_sv_log->mutex);
     }
 }
 
@@ -170,7 +181,9 @@ void sv_log_flush(void)
 {
     if (sv_log_currentFile())
     {
+        os_mutex_lock(&p_sv_log->mutex);
         fflush(sv_log_currentFile());
+        os_mutex_unlock(&p_sv_log->mutex);
     }
 }
 
@@ -179,15 +192,286 @@ void sv_log_fmt(const char *fmt, ...)
 {
     if (sv_log_currentFile())
     {
+        os_mutex_lock(&p_sv_log->mutex);
         sv_log_addnewline();
         va_list args;
         va_start(args, fmt);
         vfprintf(sv_log_currentFile(), fmt, args);
         va_end(args);
+        os_mutex_unlock(&p_sv_log->mutex);
     }
 }
 #endif
 
+void sv_perf_open(sv_perf *self, const char *operation)
+{
+    set_self_zero();
+    os_mutex_init(&self->mutex);
+    self->has_mutex = true;
+    self->operation = operation;
+    self->started = (uint64_t)time(NULL);
+    self->startedus = os_clock_monotonic_us();
+}
+
+void sv_perf_close(sv_perf *self)
+{
+    if (self)
+    {
+        if (self->has_mutex)
+        {
+            os_mutex_close(&self->mutex);
+        }
+
+        set_self_zero();
+    }
+}
+
+/* a span is measured on the thread that ends it, so begin and end it on the
+same thread */
+sv_perf_span sv_perf_begin(void)
+{
+    sv_perf_span span = {};
+    span.wallus = os_clock_monotonic_us();
+    span.cpuus = os_thread_cpu_us();
+    span.processes = os_run_process_count();
+    return span;
+}
+
+/* a NULL self is allowed, so callers don't need to check whether they are
+being measured */
+void sv_perf_end(sv_perf *self, sv_perf_phase phase, const sv_perf_span *span,
+    uint64_t bytesread, uint64_t byteswritten, uint64_t files)
+{
+    if (!self || !self->has_mutex || phase >= sv_perf_phase_count)
+    {
+        return;
+    }
+
+    uint64_t wallus = os_clock_monotonic_us() - span->wallus;
+    uint64_t cpuus = os_thread_cpu_us() - span->cpuus;
+    uint64_t processes = os_run_process_count() - span->processes;
+    os_mutex_lock(&self->mutex);
+    sv_perf_counters *counters = &self->phases[phase];
+    counters->calls += 1;
+    counters->wall_us += wallus;
+    counters->cpu_us += cpuus;
+    counters->bytes_read += bytesread;
+    counters->bytes_written += byteswritten;
+    counters->files += files;
+    counters->subprocesses += processes;
+    os_mutex_unlock(&self->mutex);
+}
+
+const char *sv_perf_phase_name(sv_perf_phase phase)
+{
+    static const char *const names[sv_perf_phase_count] = {"enumerate",
+        "queue", "hash", "compress", "tar", "db_commit", "makecopyofdb",
+        "checksum", "extract", "upload"};
+    return phase < sv_perf_phase_count ? names[phase] : "";
+}
+
+/* the same escaping works for json strings and prometheus label values */
+static void sv_perf_catescaped(bstring out, const char *s)
+{
+    for (; *s; s++)
+    {
+        if (*s == '\\' || *s == '"')
+        {
+            bconchar(out, '\\');
+            bconchar(out, *s);
+        }
+        else if (*s == '\n')
+        {
+            bcatcstr(out, "\\n");
+        }
+        else
+        {
+            bconchar(out, *s);
+        }
+    }
+}
+
+static double sv_perf_seconds(uint64_t us)
+{
+    return (double)us / 1000000.0;
+}
+
+void sv_perf_tojson(
+    const sv_perf *self, const char *grpname, bool success, bstring out)
+{
+    bstrclear(out);
+    bcatcstr(out, "{\n  \"operation\": \"");
+    sv_perf_catescaped(out, self->operation);
+    bcatcstr(out, "\",\n  \"group\": \"");
+    sv_perf_catescaped(out, grpname);
+    bformata(out,
+        "\",\n  \"started\": %llu,\n  \"wall_seconds\": %.6f,\n"
+        "  \"success\": %s,\n  \"phases\": [\n",
+        castull(self->started), sv_perf_seconds(self->wall_us),
+        success ? "true" : "false");
+    for (uint32_t i = 0; i < sv_perf_phase_count; i++)
+    {
+        const sv_perf_counters *c = &self->phases[i];
+        bformata(out,
+            "    {\"phase\": \"%s\", \"calls\": %llu, "
+            "\"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, "
+            "\"read_bytes\": %llu, \"written_bytes\": %llu, "
+            "\"files\": %llu, \"subprocesses\": %llu}%s\n",
+            sv_perf_phase_name((sv_perf_phase)i), castull(c->calls),
+            sv_perf_seconds(c->wall_us), sv_perf_seconds(c->cpu_us),
+            castull(c->bytes_read), castull(c->bytes_written),
+            castull(c->files), castull(c->subprocesses),
+            i + 1 < sv_perf_phase_count ? "," : "");
+    }
+
+    bcatcstr(out, "  ]\n}\n");
+}
+
+static void sv_perf_catlabels(
+    const sv_perf *self, const char *grpname, const char *phase, bstring out)
+{
+    bcatcstr(out, "{group=\"");
+    sv_perf_catescaped(out, grpname);
+    bcatcstr(out, "\",operation=\"");
+    sv_perf_catescaped(out, self->operation);
+    bcatcstr(out, "\"");
+    if (phase)
+    {
+        bformata(out, ",phase=\"%s\"", phase);
+    }
+
+    bcatcstr(out, "} ");
+}
+
+/* every phase is written, even ones that didn't run, so that the series
+stay the same from one run to the next. in the format read by
+node_exporter's textfile collector. */
+void sv_perf_toprom(
+    const sv_perf *self, const char *grpname, bool success, bstring out)
+{
+    static const struct
+    {
+        const char *name;
+        const char *help;
+        size_t offset;
+        bool isus;
+    } metrics[] = {
+        {"phase_wall_seconds", "Wall time spent in the phase.",
+            offsetof(sv_perf_counters, wall_us), true},
+        {"phase_cpu_seconds", "Cpu time spent in the phase.",
+            offsetof(sv_perf_counters, cpu_us), true},
+        {"phase_read_bytes", "Bytes read during the phase.",
+            offsetof(sv_perf_counters, bytes_read), false},
+        {"phase_written_bytes", "Bytes written during the phase.",
+            offsetof(sv_perf_counters, bytes_written), false},
+        {"phase_files", "Files handled during the phase.",
+            offsetof(sv_perf_counters, files), false},
+        {"phase_subprocesses", "Processes started during the phase.",
+            offsetof(sv_perf_counters, subprocesses), false},
+    };
+
+    bstrclear(out);
+    for (size_t m = 0; m < countof(metrics); m++)
+    {
+        bformata(out,
+            "# HELP glacial_backup_%s %s\n# TYPE glacial_backup_%s gauge\n",
+            metrics[m].name, metrics[m].help, metrics[m].name);
+        for (uint32_t i = 0; i < sv_perf_phase_count; i++)
+        {
+            const byte *counters = (const byte *)&self->phases[i];
+            uint64_t value = 0;
+            memcpy(&value, counters + metrics[m].offset, sizeof(value));
+            bformata(out, "glacial_backup_%s", metrics[m].name);
+            sv_perf_catlabels(
+                self, grpname, sv_perf_phase_name((sv_perf_phase)i), out);
+            if (metrics[m].isus)
+            {
+                bformata(out, "%.6f\n", sv_perf_seconds(value));
+            }
+            else
+            {
+                bformata(out, "%llu\n", castull(value));
+            }
+        }
+    }
+
+    bcatcstr(out, "# HELP glacial_backup_run_wall_seconds Wall time of the "
+                  "run.\n# TYPE glacial_backup_run_wall_seconds gauge\n"
+                  "glacial_backup_run_wall_seconds");
+    sv_perf_catlabels(self, grpname, NULL, out);
+    bformata(out, "%.6f\n", sv_perf_seconds(self->wall_us));
+    bcatcstr(out, "# HELP glacial_backup_run_timestamp_seconds When the run "
+                  "started.\n# TYPE glacial_backup_run_timestamp_seconds "
+                  "gauge\nglacial_backup_run_timestamp_seconds");
+    sv_perf_catlabels(self, grpname, NULL, out);
+    bformata(out, "%llu\n", castull(self->started));
+    bcatcstr(out, "# HELP glacial_backup_run_success 1 if the run "
+                  "succeeded.\n# TYPE glacial_backup_run_success gauge\n"
+                  "glacial_backup_run_success");
+    sv_perf_catlabels(self, grpname, NULL, out);
+    bformata(out, "%d\n", success ? 1 : 0);
+}
+
+static void sv_perf_writefile(
+    const char *dir, const char *name, const char *contents)
+{
+    bstring path = bformat("%s%s%s", dir, pathsep, name);
+    bstring tmppath = bformat("%s.tmp", cstr(path));
+    sv_result result = sv_file_writefile(cstr(tmppath), contents, "wb");
+    if (result.code)
+    {
+        sv_log_fmt("could not write %s %s", cstr(tmppath), cstr(result.msg));
+    }
+    else if (!os_tryuntil_move(cstr(tmppath), cstr(path), true))
+    {
+        sv_log_fmt("could not move %s to %s", cstr(tmppath), cstr(path));
+    }
+
+    sv_result_close(&result);
+    bdestroy(path);
+    bdestroy(tmppath);
+}
+
+/* write <appdir>/perf/<group>_<operation>.json, and a .prom file in the same
+directory that node_exporter's textfile collector can be pointed at. each
+run replaces the last one's report. a report that can't be written is only
+logged, it isn't a reason to fail the operation. */
+void sv_perf_write(
+    sv_perf *self, const char *appdir, const char *grpname, bool success)
+{
+    if (!self || !self->has_mutex)
+    {
+        return;
+    }
+
+    /* a run that failed might still have workers ending spans */
+    bstring dir = bformat("%s%sperf", appdir, pathsep);
+    bstring name = bstring_open();
+    bstring json = bstring_open();
+    bstring prom = bstring_open();
+    os_mutex_lock(&self->mutex);
+    self->wall_us = os_clock_monotonic_us() - self->startedus;
+    sv_perf_tojson(self, grpname, success, json);
+    sv_perf_toprom(self, grpname, success, prom);
+    os_mutex_unlock(&self->mutex);
+    if (!os_create_dirs(cstr(dir)))
+    {
+        sv_log_fmt("could not create %s", cstr(dir));
+    }
+    else
+    {
+        bsetfmt(name, "%s_%s.json", grpname, self->operation);
+        sv_perf_writefile(cstr(dir), cstr(name), cstr(json));
+        bsetfmt(name, "glacial_backup_%s_%s.prom", grpname, self->operation);
+        sv_perf_writefile(cstr(dir), cstr(name), cstr(prom));
+    }
+
+    bdestroy(dir);
+    bdestroy(name);
+    bdestroy(json);
+    bdestroy(prom);
+}
+
 /* from 1 to "/path/file001.txt" */
 void appendnumbertofilename(const char *dir, const char *prefix,
     const char *suffix, uint32_t number, bstring out)
@@ -703,6 +987,306 @@ void fnmatch_isvalid(const char *pattern, bstring response)
     }
 }
 
+/* children are kept in a linked list, few patterns share a prefix */
+typedef struct fnmatch_trie_node
+{
+    uint32_t firstchild;
+    uint32_t nextsibling;
+    char c;
+    bool prefixend;
+    bool exactend;
+} fnmatch_trie_node;
+
+static uint64_t fnmatch_compiled_hash(const char *s, uint32_t len)
+{
+    /* fnv-1a, the suffixes are short */
+    uint64_t hash = 14695981039346656037ULL;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)s[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* "*.ext", where ext has no wildcards or separators */
+static bool fnmatch_compiled_issuffix(const char *pattern)
+{
+    if (pattern[0] != '*' || pattern[1] != '.')
+    {
+        return false;
+    }
+
+    for (const char *p = pattern + 1; *p; p++)
+    {
+        if (*p == '*' || *p == '?' || *p == '/' || *p == '\\')
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint32_t fnmatch_trie_child(const sv_array *trie, uint32_t node, char c)
+{
+    uint32_t child =
+        ((const fnmatch_trie_node *)sv_array_atconst(trie, node))->firstchild;
+    while (child &&
+        ((const fnmatch_trie_node *)sv_array_atconst(trie, child))->c != c)
+    {
+        child = ((const fnmatch_trie_node *)sv_array_atconst(trie, child))
+                    ->nextsibling;
+    }
+
+    return child;
+}
+
+static void fnmatch_trie_add(
+    sv_array *trie, const char *s, uint32_t len, bool prefix)
+{
+    uint32_t node = 0;
+    for (uint32_t i = 0; i < len; i++)
+    {
+        uint32_t child = fnmatch_trie_child(trie, node, s[i]);
+        if (!child)
+        {
+            fnmatch_trie_node newnode = {};
+            newnode.c = s[i];
+            newnode.nextsibling =
+                ((fnmatch_trie_node *)sv_array_at(trie, node))->firstchild;
+            child = trie->length;
+            sv_array_append(trie, &newnode, 1);
+            ((fnmatch_trie_node *)sv_array_at(trie, node))->firstchild = child;
+        }
+
+        node = child;
+    }
+
+    fnmatch_trie_node *end = (fnmatch_trie_node *)sv_array_at(trie, node);
+    end->prefixend |= prefix;
+    end->exactend |= !prefix;
+}
+
+/* with allowexact false, only "literal*" patterns are considered */
+static bool fnmatch_trie_match(
+    const sv_array *trie, const char *s, bool allowexact)
+{
+    uint32_t node = 0;
+    while (true)
+    {
+        const fnmatch_trie_node *current =
+            (const fnmatch_trie_node *)sv_array_atconst(trie, node);
+        if (current->prefixend)
+        {
+            return true;
+        }
+        else if (*s == '\0')
+        {
+            return allowexact && current->exactend;
+        }
+        else if (!(node = fnmatch_trie_child(trie, node, *s)))
+        {
+            return false;
+        }
+
+        s++;
+    }
+}
+
+/* only '*' and '?' are special. after a mismatch we only need to return to
+the most recent '*', so this never recurses or backtracks further. */
+static bool fnmatch_glob(const char *pattern, const char *s)
+{
+    const char *star = NULL;
+    const char *mark = NULL;
+    while (*s)
+    {
+        if (*pattern == '?' || (*pattern != '*' && *pattern == *s))
+        {
+            pattern++;
+            s++;
+        }
+        else if (*pattern == '*')
+        {
+            star = pattern++;
+            mark = s;
+        }
+        else if (star)
+        {
+            pattern = star + 1;
+            s = ++mark;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+static bool fnmatch_compiled_hassuffix(
+    const fnmatch_compiled *self, const char *s, uint32_t len)
+{
+    const uint32_t *slots = (const uint32_t *)self->suffixslots.buffer;
+    uint64_t mask = self->suffixslots.length - 1;
+    uint64_t slot = fnmatch_compiled_hash(s, len) & mask;
+    while (slots[slot])
+    {
+        const bstring suffix = self->suffixes->entry[slots[slot] - 1];
+        if (blength(suffix) == cast32u32s(len) &&
+            memcmp(suffix->data, s, len) == 0)
+        {
+            return true;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return false;
+}
+
+fnmatch_compiled fnmatch_compiled_open(const bstrlist *patterns)
+{
+    fnmatch_compiled self = {};
+    self.suffixes = bstrlist_open();
+    self.others = bstrlist_open();
+    self.trie = sv_array_open(sizeof32u(fnmatch_trie_node), 0);
+    sv_array_appendzeros(&self.trie, 1);
+    for (int i = 0; i < patterns->qty; i++)
+    {
+        const char *pattern = blist_view(patterns, i);
+        uint32_t literal = cast64u32u(strcspn(pattern, "*?"));
+        uint32_t stars = cast64u32u(strspn(pattern + literal, "*"));
+        if (literal == 0 && stars > 0 && pattern[stars] == '\0')
+        {
+            self.matchall = true;
+        }
+        else if (pattern[literal + stars] == '\0')
+        {
+            fnmatch_trie_add(&self.trie, pattern, literal, stars > 0);
+        }
+        else if (fnmatch_compiled_issuffix(pattern))
+        {
+            bstrlist_appendcstr(self.suffixes, pattern + 1);
+        }
+        else
+        {
+            bstrlist_appendcstr(self.others, pattern);
+        }
+    }
+
+    /* open addressing with linear probing, at most half full. a slot holds
+    an index into suffixes, plus one, so that zero means empty. */
+    uint32_t slotcount = 16;
+    while (slotcount < cast32s32u(self.suffixes->qty) * 2)
+    {
+        slotcount *= 2;
+    }
+
+    self.suffixslots = sv_array_open(sizeof32u(uint32_t), 0);
+    sv_array_appendzeros(&self.suffixslots, slotcount);
+    uint32_t *slots = (uint32_t *)self.suffixslots.buffer;
+    for (int i = 0; i < self.suffixes->qty; i++)
+    {
+        const bstring suffix = self.suffixes->entry[i];
+        uint64_t slot = fnmatch_compiled_hash((const char *)suffix->data,
+                            cast32s32u(blength(suffix))) &
+            (slotcount - 1);
+        while (slots[slot])
+        {
+            slot = (slot + 1) & (slotcount - 1);
+        }
+
+        slots[slot] = cast32s32u(i) + 1;
+    }
+
+    return self;
+}
+
+bool fnmatch_compiled_any(const fnmatch_compiled *self, const char *s)
+{
+    if (self->matchall)
+    {
+        return true;
+    }
+
+    if (self->suffixes->qty)
+    {
+        /* try every ".ext" ending of the last path component */
+        uint32_t len = strlen32u(s);
+        for (uint32_t i = len; i > 0; i--)
+        {
+            char c = s[i - 1];
+            if (c == '/' || c == '\\')
+            {
+                break;
+            }
+            else if (c == '.' &&
+                fnmatch_compiled_hassuffix(self, s + i - 1, len - i + 1))
+            {
+                return true;
+            }
+        }
+    }
+
+    if (fnmatch_trie_match(&self->trie, s, true))
+    {
+        return true;
+    }
+
+    for (int i = 0; i < self->others->qty; i++)
+    {
+        if (fnmatch_glob(blist_view(self->others, i), s))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* true if every path under dir would be matched, dir ending in a separator.
+a pattern ending in '*' that matches dir matches anything appended to it,
+so whole directories can be skipped without changing any results. */
+bool fnmatch_compiled_anyunder(const fnmatch_compiled *self, const char *dir)
+{
+    if (self->matchall || fnmatch_trie_match(&self->trie, dir, false))
+    {
+        return true;
+    }
+
+    for (int i = 0; i < self->others->qty; i++)
+    {
+        const char *pattern = blist_view(self->others, i);
+        if (s_endwith(pattern, "*") && fnmatch_glob(pattern, dir))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void fnmatch_compiled_close(fnmatch_compiled *self)
+{
+    if (self)
+    {
+        bstrlist_close(self->suffixes);
+        bstrlist_close(self->others);
+        sv_array_close(&self->suffixslots);
+        sv_array_close(&self->trie);
+        set_self_zero();
+    }
+}
+
 void bstrlist_split(bstrlist *list, const bstring s, char delim)
 {
     struct genBstrList blist = {};
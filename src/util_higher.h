@@ -17,6 +17,15 @@ GNU General Public License for more details.
 
 #include "util.h"
 
+#if __linux__
+#include <pthread.h>
+typedef pthread_mutex_t os_mutex;
+typedef pthread_cond_t os_cond;
+#else
+typedef CRITICAL_SECTION os_mutex;
+typedef CONDITION_VARIABLE os_cond;
+#endif
+
 typedef struct sv_log
 {
     bstring dir;
@@ -25,6 +34,8 @@ typedef struct sv_log
     uint32_t counter;
     int32_t cap_filesize;
     int64_t start_of_day;
+    os_mutex mutex;
+    bool has_mutex;
 } sv_log;
 
 extern const uint32_t sv_log_check_size_period;
@@ -43,6 +54,67 @@ uint32_t readnumberfromfilename(
 check_result readlatestnumberfromfilename(const char *dir, const char *prefix,
     const char *suffix, uint32_t *latestnumber);
 
+/* time, cpu, bytes and processes used by each phase of an operation. spans
+can end on any thread, so a phase run by several workers can add up to more
+than the operation's wall time. phases can nest: queue includes whatever
+hashing and compression the main thread did while it walked the queue. */
+typedef enum sv_perf_phase
+{
+    sv_perf_enumerate,
+    sv_perf_queue,
+    sv_perf_hash,
+    sv_perf_compress,
+    sv_perf_tar,
+    sv_perf_db_commit,
+    sv_perf_makecopyofdb,
+    sv_perf_checksum,
+    sv_perf_extract,
+    sv_perf_upload,
+    sv_perf_phase_count,
+} sv_perf_phase;
+
+typedef struct sv_perf_counters
+{
+    uint64_t calls;
+    uint64_t wall_us;
+    uint64_t cpu_us;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t files;
+    uint64_t subprocesses;
+} sv_perf_counters;
+
+typedef struct sv_perf
+{
+    os_mutex mutex;
+    const char *operation;
+    uint64_t started;
+    uint64_t startedus;
+    uint64_t wall_us;
+    sv_perf_counters phases[sv_perf_phase_count];
+    bool has_mutex;
+} sv_perf;
+
+typedef struct sv_perf_span
+{
+    uint64_t wallus;
+    uint64_t cpuus;
+    uint64_t processes;
+} sv_perf_span;
+
+void sv_perf_open(sv_perf *self, const char *operation);
+void sv_perf_close(sv_perf *self);
+sv_perf_span sv_perf_begin(void);
+void sv_perf_end(sv_perf *self, sv_perf_phase phase, const sv_perf_span *span,
+    uint64_t bytesread, uint64_t byteswritten, uint64_t files);
+const char *sv_perf_phase_name(sv_perf_phase phase);
+void sv_perf_tojson(
+    const sv_perf *self, const char *grpname, bool success, bstring out);
+void sv_perf_toprom(
+    const sv_perf *self, const char *grpname, bool success, bstring out);
+void sv_perf_write(
+    sv_perf *self, const char *appdir, const char *grpname, bool success);
+
 struct sv_app;
 typedef sv_result (*FnMenuCallback)(struct sv_app *, int);
 typedef struct menu_action_entry
@@ -106,6 +178,29 @@ bool ws_equal(const wchar_t *s1, const wchar_t *s2);
 bool fnmatch_simple(const char *pattern, const char *string);
 void fnmatch_isvalid(const char *pattern, bstring response);
 
+/* a list of patterns compiled once, so that a path can be checked against
+all of them at little more than the cost of one. gives the same answer as
+calling fnmatch_simple with each pattern in turn. */
+typedef struct fnmatch_compiled
+{
+    bool matchall;
+
+    /* "*.ext" patterns, in a hash set keyed by the suffix */
+    bstrlist *suffixes;
+    sv_array suffixslots;
+
+    /* "literal*" and "literal" patterns, in a trie */
+    sv_array trie;
+
+    /* everything else */
+    bstrlist *others;
+} fnmatch_compiled;
+
+fnmatch_compiled fnmatch_compiled_open(const bstrlist *patterns);
+bool fnmatch_compiled_any(const fnmatch_compiled *self, const char *s);
+bool fnmatch_compiled_anyunder(const fnmatch_compiled *self, const char *dir);
+void fnmatch_compiled_close(fnmatch_compiled *self);
+
 check_result sv_2darray_foreach(
     sv_2darray *self, sv_2darray_iter_cb cb, void *context);
 
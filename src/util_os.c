@@ -14,7 +14,17 @@ GNU General Public License for more details.
 
 #include "util_os.h"
 
+/* set once os_thread_set_background has been called on this thread, so that
+threads it starts for the same work can be given the same priority */
+static _Thread_local bool os_thread_background;
+bool os_thread_is_background(void)
+{
+    return os_thread_background;
+}
+
 #if __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <utime.h>
 
@@ -148,6 +158,137 @@ void os_perftimer_close(unused_ptr(os_perftimer))
     /* no allocations, nothing needs to be done. */
 }
 
+/* initialize mutex */
+void os_mutex_init(os_mutex *self)
+{
+    pthread_mutexattr_t attr;
+    check_fatal(pthread_mutexattr_init(&attr) == 0, "pthread_mutexattr_init");
+    check_fatal(
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE) == 0,
+        "pthread_mutexattr_settype");
+    check_fatal(pthread_mutex_init(self, &attr) == 0, "pthread_mutex_init");
+    (void)pthread_mutexattr_destroy(&attr);
+}
+
+/* free mutex */
+void os_mutex_close(os_mutex *self)
+{
+    (void)pthread_mutex_destroy(self);
+}
+
+/* acquire mutex */
+void os_mutex_lock(os_mutex *self)
+{
+    check_fatal(pthread_mutex_lock(self) == 0, "pthread_mutex_lock");
+}
+
+/* release mutex */
+void os_mutex_unlock(os_mutex *self)
+{
+    check_fatal(pthread_mutex_unlock(self) == 0, "pthread_mutex_unlock");
+}
+
+/* initialize condition variable */
+void os_cond_init(os_cond *self)
+{
+    check_fatal(pthread_cond_init(self, NULL) == 0, "pthread_cond_init");
+}
+
+/* free condition variable */
+void os_cond_close(os_cond *self)
+{
+    (void)pthread_cond_destroy(self);
+}
+
+/* release mutex, wait until signaled, then re-acquire mutex */
+void os_cond_wait(os_cond *self, os_mutex *mutex)
+{
+    check_fatal(pthread_cond_wait(self, mutex) == 0, "pthread_cond_wait");
+}
+
+/* wake all waiters */
+void os_cond_broadcast(os_cond *self)
+{
+    check_fatal(pthread_cond_broadcast(self) == 0, "pthread_cond_broadcast");
+}
+
+static void *os_thread_entry(void *arg)
+{
+    os_thread *self = (os_thread *)arg;
+    self->fn(self->arg);
+    return NULL;
+}
+
+/* start a thread running fn(arg) */
+check_result os_thread_start(os_thread *self, void (*fn)(void *), void *arg)
+{
+    sv_result currenterr = {};
+    self->fn = fn;
+    self->arg = arg;
+    int ret = pthread_create(&self->handle, NULL, &os_thread_entry, self);
+    check_b(ret == 0, "pthread_create failed %d", ret);
+    self->started = true;
+
+cleanup:
+    return currenterr;
+}
+
+/* wait for thread to exit */
+void os_thread_join(os_thread *self)
+{
+    if (self->started)
+    {
+        (void)pthread_join(self->handle, NULL);
+        self->started = false;
+    }
+}
+
+/* give the calling thread the idle i/o class, so that its disk requests
+are only served when no other process wants the disk, and the lowest cpu
+priority. on linux both apply to the thread, not the whole process. */
+void os_thread_set_background(void)
+{
+    const int ioprio_who_process = 1, ioprio_class_idle = 3;
+    const int ioprio_class_shift = 13;
+    int ret = 0;
+    log_errno_to(ret, cast64s32s(syscall(SYS_ioprio_set, ioprio_who_process,
+                          0, ioprio_class_idle << ioprio_class_shift)));
+    log_errno_to(ret,
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), 19));
+    os_thread_background = true;
+}
+
+/* number of processors online */
+uint32_t os_cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32_t)n : 1;
+}
+
+/* milliseconds from an arbitrary start, never goes backwards */
+uint64_t os_clock_monotonic_ms(void)
+{
+    struct timespec ts = {};
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return cast64s64u(ts.tv_sec) * 1000 + cast64s64u(ts.tv_nsec) / 1000000;
+}
+
+/* microseconds from an arbitrary start, for timing short spans of work */
+uint64_t os_clock_monotonic_us(void)
+{
+    struct timespec ts = {};
+    (void)clock_gettime(CLOCK_MONOTONIC, &ts);
+    return cast64s64u(ts.tv_sec) * 1000000 + cast64s64u(ts.tv_nsec) / 1000;
+}
+
+/* microseconds of cpu time used by the calling thread */
+uint64_t os_thread_cpu_us(void)
+{
+    struct timespec ts = {};
+    (void)clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return cast64s64u(ts.tv_sec) * 1000000 + cast64s64u(ts.tv_nsec) / 1000;
+}
+
 const bool islinux = true;
 
 #elif _WIN32
@@ -291,12 +432,205 @@ void os_perftimer_close(os_perftimer *timer)
     unused(timer);
 }
 
+/* initialize mutex */
+void os_mutex_init(os_mutex *self)
+{
+    InitializeCriticalSection(self);
+}
+
+/* free mutex */
+void os_mutex_close(os_mutex *self)
+{
+    DeleteCriticalSection(self);
+}
+
+/* acquire mutex */
+void os_mutex_lock(os_mutex *self)
+{
+    EnterCriticalSection(self);
+}
+
+/* release mutex */
+void os_mutex_unlock(os_mutex *self)
+{
+    LeaveCriticalSection(self);
+}
+
+/* initialize condition variable */
+void os_cond_init(os_cond *self)
+{
+    InitializeConditionVariable(self);
+}
+
+/* free condition variable */
+void os_cond_close(os_cond *self)
+{
+    /* no allocations, nothing needs to be done. */
+    unused(self);
+}
+
+/* release mutex, wait until signaled, then re-acquire mutex */
+void os_cond_wait(os_cond *self, os_mutex *mutex)
+{
+    check_fatal(SleepConditionVariableCS(self, mutex, INFINITE),
+        "SleepConditionVariableCS lasterr=%lu", GetLastError());
+}
+
+/* wake all waiters */
+void os_cond_broadcast(os_cond *self)
+{
+    WakeAllConditionVariable(self);
+}
+
+static DWORD WINAPI os_thread_entry(LPVOID arg)
+{
+    os_thread *self = (os_thread *)arg;
+    self->fn(self->arg);
+    return 0;
+}
+
+/* start a thread running fn(arg) */
+check_result os_thread_start(os_thread *self, void (*fn)(void *), void *arg)
+{
+    sv_result currenterr = {};
+    self->fn = fn;
+    self->arg = arg;
+    self->handle = CreateThread(NULL, 0, &os_thread_entry, self, 0, NULL);
+    check_b(self->handle, "CreateThread failed lasterr=%lu", GetLastError());
+    self->started = true;
+
+cleanup:
+    return currenterr;
+}
+
+/* wait for thread to exit */
+void os_thread_join(os_thread *self)
+{
+    if (self->started)
+    {
+        (void)WaitForSingleObject(self->handle, INFINITE);
+        CloseHandle(self->handle);
+        self->started = false;
+    }
+}
+
+/* background mode lowers both the thread's cpu priority and its i/o
+priority */
+void os_thread_set_background(void)
+{
+    log_b(SetThreadPriority(GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN),
+        "SetThreadPriority lasterr=%lu", GetLastError());
+    os_thread_background = true;
+}
+
+/* number of processors online */
+uint32_t os_cpu_count(void)
+{
+    SYSTEM_INFO info = {};
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? info.dwNumberOfProcessors : 1;
+}
+
+/* milliseconds from an arbitrary start, never goes backwards */
+uint64_t os_clock_monotonic_ms(void)
+{
+    return GetTickCount64();
+}
+
+/* microseconds from an arbitrary start, for timing short spans of work */
+uint64_t os_clock_monotonic_us(void)
+{
+    LARGE_INTEGER counter = {}, frequency = {};
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000 +
+        (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000 /
+        (uint64_t)frequency.QuadPart;
+}
+
+/* microseconds of cpu time used by the calling thread */
+uint64_t os_thread_cpu_us(void)
+{
+    FILETIME created = {}, exited = {}, kernel = {}, user = {};
+    if (!GetThreadTimes(
+            GetCurrentThread(), &created, &exited, &kernel, &user))
+    {
+        return 0;
+    }
+
+    uint64_t total = (((uint64_t)kernel.dwHighDateTime) << 32) |
+        kernel.dwLowDateTime;
+    total += (((uint64_t)user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return total / 10;
+}
+
 const bool islinux = false;
 
 #else
 #error "platform not yet supported"
 #endif
 
+/* a rate of 0 means no limit */
+void os_throttle_init(os_throttle *self, uint64_t bytespersecond)
+{
+    set_self_zero();
+    os_mutex_init(&self->mutex);
+    self->bytespersecond = bytespersecond;
+    self->tokens = cast64u64s(bytespersecond);
+    self->lastms = os_clock_monotonic_ms();
+}
+
+void os_throttle_close(os_throttle *self)
+{
+    if (self)
+    {
+        os_mutex_close(&self->mutex);
+        set_self_zero();
+    }
+}
+
+/* wait until the bytes can be read or written without going over the rate */
+void os_throttle_take(os_throttle *self, uint64_t bytes)
+{
+    if (!self || !self->bytespersecond || !bytes)
+    {
+        return;
+    }
+
+    os_mutex_lock(&self->mutex);
+    uint64_t now = os_clock_monotonic_ms();
+    uint64_t elapsed = now - self->lastms;
+    int64_t rate = cast64u64s(self->bytespersecond);
+
+    /* the time spent sleeping off a charge bigger than the rate must pay it
+    back in full, so only the balance is capped, not the time. */
+    int64_t earned = cast64u64s((elapsed / 1000) * self->bytespersecond +
+        (elapsed % 1000) * self->bytespersecond / 1000);
+    self->tokens = MIN(rate, self->tokens + earned);
+    self->tokens -= cast64u64s(bytes);
+    self->lastms = now;
+    int64_t debt = -self->tokens;
+    os_mutex_unlock(&self->mutex);
+    if (debt > 0)
+    {
+        os_sleep(cast64u32u(MIN(cast64s64u(debt * 1000 / rate), UINT32_MAX)));
+    }
+}
+
+/* the throttle used by i/o deep inside hashing and archiving, so that it
+doesn't have to be passed through every call. set it before starting threads
+that use it, and clear it after they have exited. */
+static os_throttle *p_os_throttle = NULL;
+void os_throttle_register_active(os_throttle *self)
+{
+    p_os_throttle = self;
+}
+
+void os_throttle_take_active(uint64_t bytes)
+{
+    os_throttle_take(p_os_throttle, bytes);
+}
+
 /* return true if path is a file */
 bool os_file_exists_basic(const char *filepath)
 {
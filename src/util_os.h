@@ -46,6 +46,54 @@ double os_perftimer_read(const os_perftimer *timer);
 void os_perftimer_close(os_perftimer *timer);
 extern const bool islinux;
 
+/* minimal threads, used by the backup worker pool. mutexes are recursive. */
+typedef struct os_thread
+{
+    void (*fn)(void *);
+    void *arg;
+#if __linux__
+    pthread_t handle;
+#else
+    HANDLE handle;
+#endif
+    bool started;
+} os_thread;
+
+void os_mutex_init(os_mutex *self);
+void os_mutex_close(os_mutex *self);
+void os_mutex_lock(os_mutex *self);
+void os_mutex_unlock(os_mutex *self);
+void os_cond_init(os_cond *self);
+void os_cond_close(os_cond *self);
+void os_cond_wait(os_cond *self, os_mutex *mutex);
+void os_cond_broadcast(os_cond *self);
+check_result os_thread_start(os_thread *self, void (*fn)(void *), void *arg);
+void os_thread_join(os_thread *self);
+void os_thread_set_background(void);
+bool os_thread_is_background(void);
+uint32_t os_cpu_count(void);
+uint64_t os_clock_monotonic_ms(void);
+uint64_t os_clock_monotonic_us(void);
+uint64_t os_thread_cpu_us(void);
+
+/* a token bucket shared by threads, capping how many bytes per second are
+read and written. it holds up to a second's worth, so a pause can only be
+made up for with a short burst. a caller that takes more than is left goes
+into debt, and sleeps until the debt it created has been paid off. */
+typedef struct os_throttle
+{
+    os_mutex mutex;
+    uint64_t bytespersecond;
+    int64_t tokens;
+    uint64_t lastms;
+} os_throttle;
+
+void os_throttle_init(os_throttle *self, uint64_t bytespersecond);
+void os_throttle_close(os_throttle *self);
+void os_throttle_take(os_throttle *self, uint64_t bytes);
+void os_throttle_register_active(os_throttle *self);
+void os_throttle_take_active(uint64_t bytes);
+
 void sv_file_close(sv_file *self);
 check_result sv_file_open_basic(
     sv_file *self, const char *path, const char *mode);